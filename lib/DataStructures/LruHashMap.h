@@ -0,0 +1,287 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fixed-capacity map which evicts the least recently used entry when full.
+ *
+ * Entries live in a slab allocated up front, linked into an intrusive
+ * doubly-linked list in recency order.  Lookups go through an open-addressed
+ * (linear probing) table of slab indexes sized to stay at most half full, so
+ * get() and put() don't depend on how many entries there are.
+ *
+ * Hash is a functor giving a uint32_t for a key.  Keys are compared with ==,
+ * so keys which hash the same are still told apart.
+ *
+ * Doesn't depend on Arduino so it can be tested on the host.
+ */
+template <typename K, typename V, typename Hash>
+class LruHashMap {
+public:
+  typedef uint16_t Index;
+  static const Index NONE = 0xFFFF;
+  static const size_t MAX_CAPACITY = NONE - 1;
+
+  struct Entry {
+    K key;
+    V value;
+  };
+
+  explicit LruHashMap(size_t capacity)
+    : maxSize(capacity < MAX_CAPACITY ? capacity : static_cast<size_t>(MAX_CAPACITY))
+    , count(0)
+    , used(0)
+    , head(NONE)
+    , tail(NONE)
+    , freeList(NONE)
+    , tableBits(1)
+  {
+    while ((static_cast<size_t>(1) << tableBits) < maxSize * 2) {
+      ++tableBits;
+    }
+
+    nodes = new Node[maxSize > 0 ? maxSize : 1];
+    table = new Index[tableSize()];
+
+    for (size_t i = 0; i < tableSize(); i++) {
+      table[i] = NONE;
+    }
+  }
+
+  ~LruHashMap() {
+    delete[] nodes;
+    delete[] table;
+  }
+
+  LruHashMap(const LruHashMap&) = delete;
+  LruHashMap& operator=(const LruHashMap&) = delete;
+
+  // Value for the key, or NULL.  Marks the entry most recently used.
+  V* get(const K& key) {
+    const Index ix = find(key, hash(key));
+
+    if (ix == NONE) {
+      return NULL;
+    }
+
+    moveToFront(ix);
+    return &nodes[ix].entry.value;
+  }
+
+  // Same as get() without changing the recency order
+  V* peek(const K& key) {
+    const Index ix = find(key, hash(key));
+    return ix == NONE ? NULL : &nodes[ix].entry.value;
+  }
+
+  // Stores the value and marks it most recently used.  Evicts the least
+  // recently used entry if the key is new and the map is full.
+  V* put(const K& key, const V& value) {
+    const uint32_t h = hash(key);
+    Index ix = find(key, h);
+
+    if (ix != NONE) {
+      nodes[ix].entry.value = value;
+      moveToFront(ix);
+      return &nodes[ix].entry.value;
+    }
+
+    if (maxSize == 0) {
+      return NULL;
+    }
+
+    if (count == maxSize) {
+      ix = tail;
+      eraseFromTable(ix);
+      unlink(ix);
+      --count;
+    } else if (freeList != NONE) {
+      ix = freeList;
+      freeList = nodes[ix].next;
+    } else {
+      ix = used++;
+    }
+
+    Node& node = nodes[ix];
+    node.entry.key = key;
+    node.entry.value = value;
+    node.hash = h;
+
+    insertIntoTable(ix);
+    linkFront(ix);
+    ++count;
+
+    return &node.entry.value;
+  }
+
+  bool remove(const K& key) {
+    const Index ix = find(key, hash(key));
+
+    if (ix == NONE) {
+      return false;
+    }
+
+    eraseFromTable(ix);
+    unlink(ix);
+    nodes[ix].next = freeList;
+    freeList = ix;
+    --count;
+
+    return true;
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  size_t capacity() const {
+    return maxSize;
+  }
+
+  bool isFull() const {
+    return count >= maxSize;
+  }
+
+  // Iteration from most to least recently used:
+  //
+  //   for (Index i = first(); i != NONE; i = next(i)) { at(i) ... }
+  Index first() const {
+    return head;
+  }
+
+  Index last() const {
+    return tail;
+  }
+
+  Index next(Index ix) const {
+    return nodes[ix].next;
+  }
+
+  Entry& at(Index ix) {
+    return nodes[ix].entry;
+  }
+
+  const Entry& at(Index ix) const {
+    return nodes[ix].entry;
+  }
+
+private:
+  struct Node {
+    Entry entry;
+    uint32_t hash;
+    Index prev;
+    Index next;
+  };
+
+  const size_t maxSize;
+  size_t count;
+  // Slab nodes handed out so far.  Nodes after this have never been used.
+  Index used;
+  Index head;
+  Index tail;
+  // Removed nodes, linked through next
+  Index freeList;
+
+  size_t tableBits;
+  Node* nodes;
+  Index* table;
+
+  static uint32_t hash(const K& key) {
+    return Hash()(key);
+  }
+
+  size_t tableSize() const {
+    return static_cast<size_t>(1) << tableBits;
+  }
+
+  // Fibonacci hashing spreads ids which only differ in their low bits
+  size_t homeSlot(uint32_t h) const {
+    return static_cast<uint32_t>(h * 2654435769u) >> (32 - tableBits);
+  }
+
+  Index find(const K& key, uint32_t h) {
+    const size_t mask = tableSize() - 1;
+
+    for (size_t slot = homeSlot(h); table[slot] != NONE; slot = (slot + 1) & mask) {
+      Node& node = nodes[table[slot]];
+
+      if (node.hash == h && node.entry.key == key) {
+        return table[slot];
+      }
+    }
+
+    return NONE;
+  }
+
+  void insertIntoTable(Index ix) {
+    const size_t mask = tableSize() - 1;
+    size_t slot = homeSlot(nodes[ix].hash);
+
+    while (table[slot] != NONE) {
+      slot = (slot + 1) & mask;
+    }
+
+    table[slot] = ix;
+  }
+
+  // Backward shift deletion, so lookups never need tombstones
+  void eraseFromTable(Index ix) {
+    const size_t mask = tableSize() - 1;
+    size_t hole = homeSlot(nodes[ix].hash);
+
+    while (table[hole] != ix) {
+      hole = (hole + 1) & mask;
+    }
+
+    for (size_t slot = (hole + 1) & mask; table[slot] != NONE; slot = (slot + 1) & mask) {
+      const size_t home = homeSlot(nodes[table[slot]].hash);
+
+      // Move the entry back if the hole is between its home slot and here
+      if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+        table[hole] = table[slot];
+        hole = slot;
+      }
+    }
+
+    table[hole] = NONE;
+  }
+
+  void unlink(Index ix) {
+    Node& node = nodes[ix];
+
+    if (node.prev != NONE) {
+      nodes[node.prev].next = node.next;
+    } else {
+      head = node.next;
+    }
+
+    if (node.next != NONE) {
+      nodes[node.next].prev = node.prev;
+    } else {
+      tail = node.prev;
+    }
+  }
+
+  void linkFront(Index ix) {
+    Node& node = nodes[ix];
+
+    node.prev = NONE;
+    node.next = head;
+
+    if (head != NONE) {
+      nodes[head].prev = ix;
+    } else {
+      tail = ix;
+    }
+
+    head = ix;
+  }
+
+  void moveToFront(Index ix) {
+    if (ix != head) {
+      unlink(ix);
+      linkFront(ix);
+    }
+  }
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+/**
+ * Publishes a value written by one task so others can read consistent copies
+ * of it without locking.  The writer never waits.  A reader retries if the
+ * value changed while it was copying it.
+ *
+ * The value is stored as atomic words, so a torn read is detected rather than
+ * being undefined behaviour.  T must be trivially copyable.
+ *
+ * Doesn't depend on Arduino so it can be tested on the host.
+ */
+template <typename T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value, "SeqLock values must be trivially copyable");
+
+public:
+  SeqLock()
+    : sequence(0)
+  {
+    for (size_t i = 0; i < NUM_WORDS; i++) {
+      words[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Writer side
+  void write(const T& value) {
+    const uint32_t seq = sequence.load(std::memory_order_relaxed);
+
+    // Odd while the words are being written
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    for (size_t i = 0; i < NUM_WORDS; i++) {
+      uint32_t word = 0;
+      memcpy(&word, bytes + i * sizeof(uint32_t), wordLength(i));
+      words[i].store(word, std::memory_order_relaxed);
+    }
+
+    sequence.store(seq + 2, std::memory_order_release);
+  }
+
+  /*
+   * Reader side.  Returns false if a consistent copy couldn't be made within
+   * the given number of attempts, e.g. because the writer was preempted part
+   * way through.  value is unspecified in that case.
+   */
+  bool read(T& value, size_t maxAttempts = 16) const {
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(&value);
+
+    for (size_t attempt = 0; attempt < maxAttempts; attempt++) {
+      const uint32_t before = sequence.load(std::memory_order_acquire);
+
+      if (before & 1) {
+        continue;
+      }
+
+      for (size_t i = 0; i < NUM_WORDS; i++) {
+        const uint32_t word = words[i].load(std::memory_order_relaxed);
+        memcpy(bytes + i * sizeof(uint32_t), &word, wordLength(i));
+      }
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      if (sequence.load(std::memory_order_relaxed) == before) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Number of times the value was written
+  uint32_t version() const {
+    return sequence.load(std::memory_order_acquire) / 2;
+  }
+
+private:
+  static const size_t NUM_WORDS = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+  std::atomic<uint32_t> sequence;
+  std::atomic<uint32_t> words[NUM_WORDS];
+
+  static size_t wordLength(size_t i) {
+    const size_t remaining = sizeof(T) - i * sizeof(uint32_t);
+    return remaining < sizeof(uint32_t) ? remaining : sizeof(uint32_t);
+  }
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * Fixed-capacity, lock-free queue for passing items from one task to another.
+ * Only one task may push and only one other task may pop.  Neither side ever
+ * blocks or touches the heap; push() fails when the queue is full.
+ *
+ * Doesn't depend on Arduino so it can be tested on the host.
+ */
+template <typename T, size_t CAPACITY>
+class SpscQueue {
+  static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+public:
+  SpscQueue()
+    : head(0)
+    , tail(0)
+  { }
+
+  // Producer side
+  bool push(const T& item) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+
+    if (t - head.load(std::memory_order_acquire) == CAPACITY) {
+      return false;
+    }
+
+    items[t & (CAPACITY - 1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // Consumer side
+  bool pop(T& item) {
+    const size_t h = head.load(std::memory_order_relaxed);
+
+    if (h == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    item = items[h & (CAPACITY - 1)];
+    head.store(h + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // Consumer side.  The oldest item, or nullptr if empty.  Stays valid until
+  // it's popped.
+  T* peek() {
+    const size_t h = head.load(std::memory_order_relaxed);
+
+    if (h == tail.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+
+    return &items[h & (CAPACITY - 1)];
+  }
+
+  // Consumer side.  Discards the oldest item.
+  bool pop() {
+    const size_t h = head.load(std::memory_order_relaxed);
+
+    if (h == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    head.store(h + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // Exact when called from either side, otherwise a snapshot
+  size_t size() const {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+  }
+
+  bool isEmpty() const {
+    return size() == 0;
+  }
+
+  static size_t capacity() {
+    return CAPACITY;
+  }
+
+private:
+  T items[CAPACITY];
+
+  // Free-running counts of items popped and pushed.  Only the consumer writes
+  // head and only the producer writes tail.
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+};
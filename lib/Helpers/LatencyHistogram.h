@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Log-linear histogram of latencies in microseconds, for percentiles without
+ * keeping samples around.  Values under 16 get their own bucket, larger ones
+ * are bucketed with 4 buckets per power of two, so a percentile is within 25%
+ * of the real value.
+ *
+ * Written by one task.  Others may read it, and may see a slightly stale
+ * snapshot.  Doesn't depend on Arduino so it can be tested on the host.
+ */
+class LatencyHistogram {
+public:
+  static const size_t NUM_BUCKETS = 128;
+
+  LatencyHistogram() {
+    reset();
+  }
+
+  void add(uint32_t micros) {
+    ++buckets[bucketFor(micros)];
+    ++count;
+
+    if (micros > maxValue) {
+      maxValue = micros;
+    }
+  }
+
+  void reset() {
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+      buckets[i] = 0;
+    }
+    count = 0;
+    maxValue = 0;
+  }
+
+  uint32_t getCount() const {
+    return count;
+  }
+
+  uint32_t getMax() const {
+    return maxValue;
+  }
+
+  // Upper bound of the bucket holding the given percentile (0-100), or 0 if
+  // nothing was recorded
+  uint32_t percentile(uint8_t pct) const {
+    const uint32_t total = count;
+
+    if (total == 0) {
+      return 0;
+    }
+
+    // Rank of the sample we're after, rounding up so p100 is the last sample
+    const uint64_t rank = (static_cast<uint64_t>(total) * pct + 99) / 100;
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+      seen += buckets[i];
+
+      if (seen >= rank && seen > 0) {
+        const uint32_t upper = upperBound(i);
+        return upper < maxValue ? upper : maxValue;
+      }
+    }
+
+    return maxValue;
+  }
+
+  static size_t bucketFor(uint32_t value) {
+    if (value < 16) {
+      return value;
+    }
+
+    size_t exponent = 31 - __builtin_clz(value);
+    return 16 + (exponent - 4) * 4 + ((value >> (exponent - 2)) & 3);
+  }
+
+  // Largest value which goes in the bucket
+  static uint32_t upperBound(size_t bucket) {
+    if (bucket < 16) {
+      return bucket;
+    }
+
+    const size_t exponent = (bucket - 16) / 4 + 4;
+    const uint64_t step = 1ULL << (exponent - 2);
+    const uint64_t upper = (1ULL << exponent) + ((bucket - 16) % 4 + 1) * step - 1;
+
+    return upper > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(upper);
+  }
+
+private:
+  uint32_t buckets[NUM_BUCKETS];
+  uint32_t count;
+  uint32_t maxValue;
+};
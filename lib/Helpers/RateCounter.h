@@ -0,0 +1,53 @@
+#ifndef _RATE_COUNTER_H
+#define _RATE_COUNTER_H
+
+#include <Arduino.h>
+
+// Counts events and how many happened during the last full second.
+class RateCounter {
+public:
+  RateCounter()
+    : total(0)
+    , thisSecond(0)
+    , lastSecond(0)
+    , secondStart(0)
+  { }
+
+  void add(size_t n = 1) {
+    unsigned long now = millis();
+
+    if (now - secondStart >= 1000) {
+      // Nothing was counted in the last second if more than one has gone by
+      lastSecond = (now - secondStart < 2000) ? thisSecond : 0;
+      thisSecond = 0;
+      secondStart = now;
+    }
+
+    thisSecond += n;
+    total += n;
+  }
+
+  size_t getTotal() const {
+    return total;
+  }
+
+  size_t perSecond() const {
+    unsigned long elapsed = millis() - secondStart;
+
+    if (elapsed < 1000) {
+      return lastSecond;
+    } else if (elapsed < 2000) {
+      return thisSecond;
+    } else {
+      return 0;
+    }
+  }
+
+private:
+  size_t total;
+  size_t thisSecond;
+  size_t lastSecond;
+  unsigned long secondStart;
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include <ListenScheduler.h>
+
+ListenScheduler::ListenScheduler(size_t numConfigs)
+  : count(numConfigs < LISTEN_SCHEDULER_MAX_CONFIGS ? numConfigs : LISTEN_SCHEDULER_MAX_CONFIGS)
+{
+  for (size_t i = 0; i < count; i++) {
+    configs[i].allowed = true;
+    configs[i].listens = 0;
+    configs[i].hits = 0;
+    configs[i].hitRate = 0;
+    configs[i].credit = 0;
+  }
+}
+
+void ListenScheduler::setAllowedConfigs(uint32_t allowedConfigs) {
+  for (size_t i = 0; i < count; i++) {
+    configs[i].allowed = allowedConfigs == 0 || (allowedConfigs & (1UL << i)) != 0;
+    configs[i].credit = 0;
+  }
+}
+
+size_t ListenScheduler::next() {
+  const int32_t total = totalWeight();
+  size_t best = NONE;
+
+  for (size_t i = 0; i < count; i++) {
+    Config& config = configs[i];
+
+    if (!config.allowed) {
+      continue;
+    }
+
+    config.credit += weightOf(config);
+
+    if (best == NONE || config.credit > configs[best].credit) {
+      best = i;
+    }
+  }
+
+  if (best != NONE) {
+    configs[best].credit -= total;
+  }
+
+  return best;
+}
+
+void ListenScheduler::recordListen(size_t configIx, size_t packets) {
+  if (configIx >= count) {
+    return;
+  }
+
+  Config& config = configs[configIx];
+  const uint32_t target = packets > 0 ? RATE_SCALE : 0;
+
+  ++config.listens;
+  if (packets > 0) {
+    ++config.hits;
+  }
+
+  if (target > config.hitRate) {
+    config.hitRate += rateStep(target - config.hitRate);
+  } else {
+    config.hitRate -= rateStep(config.hitRate - target);
+  }
+}
+
+uint32_t ListenScheduler::rateStep(uint32_t distance) {
+  // Rounded, and at least 1 so the rate gets all the way to 0 or RATE_SCALE
+  // instead of stalling within 2^LISTEN_SCHEDULER_RATE_SHIFT of it
+  const uint32_t step = (distance + (1 << (LISTEN_SCHEDULER_RATE_SHIFT - 1))) >> LISTEN_SCHEDULER_RATE_SHIFT;
+
+  if (step == 0 && distance > 0) {
+    return 1;
+  }
+  return step;
+}
+
+size_t ListenScheduler::numConfigs() const {
+  return count;
+}
+
+ListenScheduler::ConfigStats ListenScheduler::stats(size_t configIx) const {
+  const Config& config = configs[configIx];
+  ConfigStats stats;
+
+  stats.allowed = config.allowed;
+  stats.listens = config.listens;
+  stats.hits = config.hits;
+  stats.hitRate = config.hitRate;
+  stats.weight = config.allowed ? weightOf(config) : 0;
+
+  return stats;
+}
+
+uint32_t ListenScheduler::totalWeight() const {
+  uint32_t total = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (configs[i].allowed) {
+      total += weightOf(configs[i]);
+    }
+  }
+
+  return total;
+}
+
+uint32_t ListenScheduler::weightOf(const Config& config) const {
+  // In units of 1/RATE_SCALE so low hit rates still count for something
+  return LISTEN_SCHEDULER_IDLE_WEIGHT * RATE_SCALE + config.hitRate * LISTEN_SCHEDULER_ACTIVE_WEIGHT;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Most radio configs the scheduler can track
+#ifndef LISTEN_SCHEDULER_MAX_CONFIGS
+#define LISTEN_SCHEDULER_MAX_CONFIGS 8
+#endif
+
+// Share of listens a config gets when nothing is heard on it.  Relative to
+// LISTEN_SCHEDULER_ACTIVE_WEIGHT.
+#ifndef LISTEN_SCHEDULER_IDLE_WEIGHT
+#define LISTEN_SCHEDULER_IDLE_WEIGHT 1
+#endif
+
+// Extra share a config gets when something is heard every time it's listened
+// on.  Scaled down with the hit rate.
+#ifndef LISTEN_SCHEDULER_ACTIVE_WEIGHT
+#define LISTEN_SCHEDULER_ACTIVE_WEIGHT 15
+#endif
+
+// How quickly the hit rate follows traffic.  Each listen moves it 1/2^n of
+// the way towards 0 or 1.
+#ifndef LISTEN_SCHEDULER_RATE_SHIFT
+#define LISTEN_SCHEDULER_RATE_SHIFT 4
+#endif
+
+/**
+ * Decides which radio config to listen on next.  Configs are referred to by
+ * their index in MiLightRadioConfig::ALL_CONFIGS.
+ *
+ * Each config has a hit rate: the fraction of recent listens on it which heard
+ * something.  Configs get a share of listens in proportion to
+ *
+ *    IDLE_WEIGHT + hitRate * ACTIVE_WEIGHT
+ *
+ * so configs in use are listened on most of the time, and idle ones are still
+ * checked now and then.  Listens are spread out with smooth weighted
+ * round-robin, so an idle config is never starved.
+ *
+ * Doesn't depend on Arduino so it can be tested on the host.
+ */
+class ListenScheduler {
+public:
+  static const size_t NONE = static_cast<size_t>(-1);
+
+  // Hit rates are fractions of RATE_SCALE
+  static const uint32_t RATE_SCALE = 1 << 12;
+
+  struct ConfigStats {
+    bool allowed;
+    size_t listens;
+    // Listens which heard at least one packet
+    size_t hits;
+    // Recent hit rate, as a fraction of RATE_SCALE
+    uint32_t hitRate;
+    uint32_t weight;
+  };
+
+  explicit ListenScheduler(size_t numConfigs);
+
+  // Bitmask of config indexes which may be listened on.  0 allows all of them.
+  void setAllowedConfigs(uint32_t allowedConfigs);
+
+  // Config to listen on next, or NONE if none are allowed
+  size_t next();
+
+  // Record the number of packets heard while listening on the config
+  void recordListen(size_t configIx, size_t packets);
+
+  size_t numConfigs() const;
+  ConfigStats stats(size_t configIx) const;
+  // Sum of the weights of allowed configs.  A config's share of listens is
+  // its weight over this.
+  uint32_t totalWeight() const;
+
+private:
+  struct Config {
+    bool allowed;
+    size_t listens;
+    size_t hits;
+    uint32_t hitRate;
+    // Smooth weighted round-robin credit
+    int32_t credit;
+  };
+
+  const size_t count;
+  Config configs[LISTEN_SCHEDULER_MAX_CONFIGS];
+
+  uint32_t weightOf(const Config& config) const;
+  // How far a hit rate moves towards its target in one listen
+  static uint32_t rateStep(uint32_t distance);
+};
@@ -30,6 +30,7 @@ MqttClient::MqttClient(Settings& settings, MiLightClient*& milightClient)
     milightClient(milightClient),
     settings(settings),
     lastConnectAttempt(0),
+    subscribedAt(0),
     connected(false)
 {
   String strDomain = settings.mqttServer();
@@ -161,6 +162,7 @@ void MqttClient::subscribe() {
 #endif
 
   mqttClient.subscribe(topic.c_str());
+  subscribedAt = millis();
 }
 
 void MqttClient::send(const char* topic, const char* message, const bool retain) {
@@ -269,8 +271,20 @@ void MqttClient::publishCallback(char* topic, byte* payload, int length) {
   MIHUB_PRINTF("MqttClient - device %04X, group %u\n", deviceId, groupId);
 #endif
 
+  // PubSubClient doesn't say which messages are retained.  Ones the broker
+  // replays when we subscribe are old news, so they wait for anything newer.
+  const bool replayed = millis() - subscribedAt < MQTT_RETAINED_REPLAY_WINDOW_MS;
+
+  if (replayed) {
+    milightClient->setPriority(PacketPriority::BACKGROUND);
+  }
+
   milightClient->prepare(config, deviceId, groupId);
   milightClient->update(obj);
+
+  if (replayed) {
+    milightClient->clearPriority();
+  }
 }
 
 String MqttClient::bindTopicString(const String& topicPattern, const BulbId& bulbId) {
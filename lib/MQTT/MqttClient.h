@@ -15,6 +15,12 @@
 #define MQTT_PACKET_CHUNK_SIZE 128
 #endif
 
+// Commands received within this long of subscribing are taken to be retained
+// messages replayed by the broker, and are sent in the background lane
+#ifndef MQTT_RETAINED_REPLAY_WINDOW_MS
+#define MQTT_RETAINED_REPLAY_WINDOW_MS 2000
+#endif
+
 #ifndef _MQTT_CLIENT_H
 #define _MQTT_CLIENT_H
 
@@ -71,6 +77,7 @@ private:
   Settings& settings;
   char* domain;
   unsigned long lastConnectAttempt;
+  unsigned long subscribedAt;
   OnConnectFn onConnectFn;
   bool connected;
 
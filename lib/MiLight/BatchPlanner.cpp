@@ -0,0 +1,65 @@
+#include <BatchPlanner.h>
+#include <MiLightRemoteConfig.h>
+
+std::vector<BatchTarget> BatchPlanner::plan(const std::vector<BulbId>& bulbIds, bool collapseGroups) {
+  std::vector<DeviceGroups> devices;
+
+  for (const BulbId& bulbId : bulbIds) {
+    // Group IDs which don't fit can't be collapsed, but still need sending
+    if (bulbId.groupId < 16) {
+      findDevice(devices, bulbId).requested |= (1 << bulbId.groupId);
+    }
+  }
+
+  std::vector<BatchTarget> targets;
+  targets.reserve(bulbIds.size());
+
+  for (const BulbId& bulbId : bulbIds) {
+    if (bulbId.groupId >= 16) {
+      targets.push_back({bulbId, 1});
+      continue;
+    }
+
+    DeviceGroups& device = findDevice(devices, bulbId);
+    const MiLightRemoteConfig* remote = MiLightRemoteConfig::fromType(bulbId.deviceType);
+    const size_t numGroups = remote != nullptr ? remote->numGroups : 0;
+    const uint16_t allGroups = ((1 << (numGroups + 1)) - 1) & ~1;
+
+    const bool toGroup0 = collapseGroups
+      && numGroups > 0
+      && ((device.requested & 1) || (device.requested & allGroups) == allGroups);
+
+    if (toGroup0) {
+      if (device.planned == 0) {
+        device.planned = device.requested;
+        targets.push_back({BulbId(bulbId.deviceId, 0, bulbId.deviceType), countGroups(device.requested)});
+      }
+    } else if (!(device.planned & (1 << bulbId.groupId))) {
+      device.planned |= (1 << bulbId.groupId);
+      targets.push_back({bulbId, 1});
+    }
+  }
+
+  return targets;
+}
+
+BatchPlanner::DeviceGroups& BatchPlanner::findDevice(std::vector<DeviceGroups>& devices, const BulbId& bulbId) {
+  for (DeviceGroups& device : devices) {
+    if (device.deviceId == bulbId.deviceId && device.deviceType == bulbId.deviceType) {
+      return device;
+    }
+  }
+
+  devices.push_back({bulbId.deviceId, bulbId.deviceType, 0, 0});
+  return devices.back();
+}
+
+size_t BatchPlanner::countGroups(uint16_t groups) {
+  size_t count = 0;
+
+  for (; groups != 0; groups &= groups - 1) {
+    ++count;
+  }
+
+  return count;
+}
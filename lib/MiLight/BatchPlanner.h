@@ -0,0 +1,35 @@
+#pragma once
+
+#include <BulbId.h>
+#include <vector>
+
+struct BatchTarget {
+  BulbId bulbId;
+  // Number of requested bulbs the target stands in for
+  size_t covers;
+};
+
+/**
+ * Works out which bulbs to send a batch to.  Duplicate bulbs are dropped.
+ *
+ * When collapsing, a device whose groups are all targeted (or whose group 0
+ * is) gets one group 0 target instead.  Every bulb paired with the device
+ * listens to group 0, so that reaches the same bulbs with a fraction of the
+ * packets.  GroupStateStore fans group 0 state out to the individual groups.
+ */
+class BatchPlanner {
+public:
+  static std::vector<BatchTarget> plan(const std::vector<BulbId>& bulbIds, bool collapseGroups);
+
+private:
+  struct DeviceGroups {
+    uint16_t deviceId;
+    MiLightRemoteType deviceType;
+    // Bit n is set if group n was requested
+    uint16_t requested;
+    uint16_t planned;
+  };
+
+  static DeviceGroups& findDevice(std::vector<DeviceGroups>& devices, const BulbId& bulbId);
+  static size_t countGroups(uint16_t groups);
+};
@@ -1,5 +1,4 @@
 #include <CctPacketFormatter.h>
-#include <MiLightCommands.h>
 
 static const uint8_t CCT_PROTOCOL_ID = 0x5A;
 
@@ -190,7 +189,7 @@ MiLightStatus CctPacketFormatter::cctCommandToStatus(uint8_t command) {
   }
 }
 
-BulbId CctPacketFormatter::parsePacket(const uint8_t* packet, JsonObject result) {
+BulbId CctPacketFormatter::parseDecodedPacket(const uint8_t* packet, ParsedPacket& result) {
   uint8_t command = packet[CCT_COMMAND_INDEX] & 0x7F;
 
   uint8_t onOffGroupId = cctCommandIdToGroup(command);
@@ -202,19 +201,19 @@ BulbId CctPacketFormatter::parsePacket(const uint8_t* packet, JsonObject result)
 
   // Night mode
   if (command & 0x10) {
-    result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::NIGHT_MODE;
+    result.setCommand(PacketCommand::NIGHT_MODE);
   } else if (onOffGroupId < 255) {
-    result[GroupStateFieldNames::STATE] = cctCommandToStatus(command) == ON ? "ON" : "OFF";
+    result.setState(cctCommandToStatus(command) == ON);
   } else if (command == CCT_BRIGHTNESS_DOWN) {
-    result[GroupStateFieldNames::COMMAND] = "brightness_down";
+    result.setCommand(PacketCommand::BRIGHTNESS_DOWN);
   } else if (command == CCT_BRIGHTNESS_UP) {
-    result[GroupStateFieldNames::COMMAND] = "brightness_up";
+    result.setCommand(PacketCommand::BRIGHTNESS_UP);
   } else if (command == CCT_TEMPERATURE_DOWN) {
-    result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::TEMPERATURE_DOWN;
+    result.setCommand(PacketCommand::TEMPERATURE_DOWN);
   } else if (command == CCT_TEMPERATURE_UP) {
-    result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::TEMPERATURE_UP;
+    result.setCommand(PacketCommand::TEMPERATURE_UP);
   } else {
-    result["button_id"] = command;
+    result.setButtonId(command);
   }
 
   return bulbId;
@@ -47,7 +47,7 @@ void FUT020PacketFormatter::updateStatus(MiLightStatus status, uint8_t groupId)
   command(static_cast<uint8_t>(FUT020Command::ON_OFF), 0);
 }
 
-BulbId FUT020PacketFormatter::parsePacket(const uint8_t* packet, JsonObject result) {
+BulbId FUT020PacketFormatter::parseDecodedPacket(const uint8_t* packet, ParsedPacket& result) {
   FUT020Command command = static_cast<FUT020Command>(packet[FUT02xPacketFormatter::FUT02X_COMMAND_INDEX] & 0x0F);
 
   BulbId bulbId(
@@ -58,29 +58,29 @@ BulbId FUT020PacketFormatter::parsePacket(const uint8_t* packet, JsonObject resu
 
   switch (command) {
     case FUT020Command::ON_OFF:
-      result[F("state")] = F("ON");
+      result.setState(true);
       break;
 
     case FUT020Command::BRIGHTNESS_DOWN:
-      result[F("command")] = F("brightness_down");
+      result.setCommand(PacketCommand::BRIGHTNESS_DOWN);
       break;
 
     case FUT020Command::BRIGHTNESS_UP:
-      result[F("command")] = F("brightness_up");
+      result.setCommand(PacketCommand::BRIGHTNESS_UP);
       break;
 
     case FUT020Command::MODE_SWITCH:
-      result[F("command")] = F("next_mode");
+      result.setCommand(PacketCommand::NEXT_MODE);
       break;
 
     case FUT020Command::COLOR_WHITE_TOGGLE:
-      result[F("command")] = F("color_white_toggle");
+      result.setCommand(PacketCommand::COLOR_WHITE_TOGGLE);
       break;
 
     case FUT020Command::COLOR:
       uint16_t remappedColor = Units::rescale<uint16_t, uint16_t>(packet[FUT02xPacketFormatter::FUT02X_ARGUMENT_INDEX], 360.0, 255.0);
       remappedColor = (remappedColor + 113) % 360;
-      result[GroupStateFieldNames::HUE] = remappedColor;
+      result.setHue(remappedColor);
       break;
   }
 
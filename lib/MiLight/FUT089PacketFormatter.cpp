@@ -1,7 +1,5 @@
 #include <FUT089PacketFormatter.h>
-#include <V2RFEncoding.h>
 #include <Units.h>
-#include <MiLightCommands.h>
 
 void FUT089PacketFormatter::modeSpeedDown() {
   command(FUT089_ON, FUT089_MODE_SPEED_DOWN);
@@ -92,64 +90,60 @@ void FUT089PacketFormatter::enableNightMode() {
   command(FUT089_ON | 0x80, arg);
 }
 
-BulbId FUT089PacketFormatter::parsePacket(const uint8_t *packet, JsonObject result) {
+BulbId FUT089PacketFormatter::parseDecodedPacket(const uint8_t *packet, ParsedPacket& result) {
   if (stateStore == NULL) {
     Serial.println(F("ERROR: stateStore not set.  Prepare was not called!  **THIS IS A BUG**"));
     BulbId fakeId(0, 0, REMOTE_TYPE_FUT089);
     return fakeId;
   }
 
-  uint8_t packetCopy[V2_PACKET_LEN];
-  memcpy(packetCopy, packet, V2_PACKET_LEN);
-  V2RFEncoding::decodeV2Packet(packetCopy);
-
   BulbId bulbId(
-    (packetCopy[2] << 8) | packetCopy[3],
-    packetCopy[7],
+    (packet[2] << 8) | packet[3],
+    packet[7],
     REMOTE_TYPE_FUT089
   );
 
-  uint8_t command = (packetCopy[V2_COMMAND_INDEX] & 0x7F);
-  uint8_t arg = packetCopy[V2_ARGUMENT_INDEX];
+  uint8_t command = (packet[V2_COMMAND_INDEX] & 0x7F);
+  uint8_t arg = packet[V2_ARGUMENT_INDEX];
 
   if (command == FUT089_ON) {
-    if ((packetCopy[V2_COMMAND_INDEX] & 0x80) == 0x80) {
-      result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::NIGHT_MODE;
+    if ((packet[V2_COMMAND_INDEX] & 0x80) == 0x80) {
+      result.setCommand(PacketCommand::NIGHT_MODE);
     } else if (arg == FUT089_MODE_SPEED_DOWN) {
-      result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::MODE_SPEED_DOWN;
+      result.setCommand(PacketCommand::MODE_SPEED_DOWN);
     } else if (arg == FUT089_MODE_SPEED_UP) {
-      result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::MODE_SPEED_UP;
+      result.setCommand(PacketCommand::MODE_SPEED_UP);
     } else if (arg == FUT089_WHITE_MODE) {
-      result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::SET_WHITE;
+      result.setCommand(PacketCommand::SET_WHITE);
     } else if (arg <= 8) { // Group is not reliably encoded in group byte. Extract from arg byte
-      result[GroupStateFieldNames::STATE] = "ON";
+      result.setState(true);
       bulbId.groupId = arg;
     } else if (arg >= 9 && arg <= 17) {
-      result[GroupStateFieldNames::STATE] = "OFF";
+      result.setState(false);
       bulbId.groupId = arg-9;
     }
   } else if (command == FUT089_COLOR) {
     uint8_t rescaledColor = (arg - FUT089_COLOR_OFFSET) % 0x100;
     uint16_t hue = Units::rescale<uint16_t, uint16_t>(rescaledColor, 360, 255.0);
-    result[GroupStateFieldNames::HUE] = hue;
+    result.setHue(hue);
   } else if (command == FUT089_BRIGHTNESS) {
     uint8_t level = constrain(arg, 0, 100);
-    result[GroupStateFieldNames::BRIGHTNESS] = Units::rescale<uint8_t, uint8_t>(level, 255, 100);
+    result.setBrightness(Units::rescale<uint8_t, uint8_t>(level, 255, 100));
   // saturation == kelvin. arg ranges are the same, so can't distinguish
   // without using state
   } else if (command == FUT089_SATURATION) {
     const GroupState* state = stateStore->get(bulbId);
 
     if (state != NULL && state->getBulbMode() == BULB_MODE_COLOR) {
-      result[GroupStateFieldNames::SATURATION] = 100 - constrain(arg, 0, 100);
+      result.setSaturation(100 - constrain(arg, 0, 100));
     } else {
-      result[GroupStateFieldNames::COLOR_TEMP] = Units::whiteValToMireds(100 - arg, 100);
+      result.setColorTemp(Units::whiteValToMireds(100 - arg, 100));
     }
   } else if (command == FUT089_MODE) {
-    result[GroupStateFieldNames::MODE] = arg;
+    result.setMode(arg);
   } else {
-    result["button_id"] = command;
-    result["argument"] = arg;
+    result.setButtonId(command);
+    result.setArgument(arg);
   }
 
   return bulbId;
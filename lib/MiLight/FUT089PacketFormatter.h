@@ -39,7 +39,7 @@ public:
   virtual void modeSpeedUp();
   virtual void updateMode(uint8_t mode);
 
-  virtual BulbId parsePacket(const uint8_t* packet, JsonObject result);
+  virtual BulbId parseDecodedPacket(const uint8_t* packet, ParsedPacket& result);
 };
 
 #endif
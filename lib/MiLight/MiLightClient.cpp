@@ -6,6 +6,7 @@
 #include <TokenIterator.h>
 #include <ParsedColor.h>
 #include <MiLightCommands.h>
+#include <BatchPlanner.h>
 #include <functional>
 #if defined(ARDUINO_ARCH_ESP32)
   #ifdef printf_P
@@ -25,7 +26,7 @@ using namespace std::placeholders;
 
 static const uint8_t STATUS_UNDEFINED = 255;
 
-const char* MiLightClient::FIELD_ORDERINGS[] = {
+const char* MiLightClient::FIELD_ORDERINGS[MiLightClient::NUM_FIELD_ORDERINGS] = {
   // These are handled manually
   // GroupStateFieldNames::STATE,
   // GroupStateFieldNames::STATUS,
@@ -45,7 +46,7 @@ const char* MiLightClient::FIELD_ORDERINGS[] = {
   GroupStateFieldNames::COMMANDS
 };
 
-const std::map<const char*, std::function<void(MiLightClient*, JsonVariant)>, MiLightClient::cmp_str> MiLightClient::FIELD_SETTERS = {
+const std::map<const char*, MiLightClient::FieldSetter, MiLightClient::cmp_str> MiLightClient::FIELD_SETTERS = {
   {
     GroupStateFieldNames::STATUS,
     [](MiLightClient* client, JsonVariant val) {
@@ -90,6 +91,14 @@ MiLightClient::MiLightClient(
   , packetSender(packetSender)
   , transitions(transitions)
   , repeatsOverride(0)
+  , priority(PacketPriority::INTERACTIVE)
+  , elisionActive(false)
+  , elidedPackets(0)
+  , lastUpdateElidedPackets(0)
+  , lastUpdateDroppedPackets(0)
+  , queuedPackets(0)
+  , collapsedTargets(0)
+  , collapsedPackets(0)
 { }
 
 void MiLightClient::setHeld(bool held) {
@@ -123,7 +132,7 @@ void MiLightClient::updateColorRaw(const uint8_t color) {
   Serial.printf_P(PSTR("MiLightClient::updateColorRaw: Change color to %d\n"), color);
 #endif
   currentRemote->packetFormatter->updateColorRaw(color);
-  flushPacket();
+  flushPacket(PacketCommandClass::HUE);
 }
 
 void MiLightClient::updateHue(const uint16_t hue) {
@@ -131,7 +140,7 @@ void MiLightClient::updateHue(const uint16_t hue) {
   Serial.printf_P(PSTR("MiLightClient::updateHue: Change hue to %d\n"), hue);
 #endif
   currentRemote->packetFormatter->updateHue(hue);
-  flushPacket();
+  flushPacket(PacketCommandClass::HUE);
 }
 
 void MiLightClient::updateBrightness(const uint8_t brightness) {
@@ -139,7 +148,7 @@ void MiLightClient::updateBrightness(const uint8_t brightness) {
   Serial.printf_P(PSTR("MiLightClient::updateBrightness: Change brightness to %d\n"), brightness);
 #endif
   currentRemote->packetFormatter->updateBrightness(brightness);
-  flushPacket();
+  flushPacket(PacketCommandClass::BRIGHTNESS);
 }
 
 void MiLightClient::updateMode(uint8_t mode) {
@@ -147,7 +156,7 @@ void MiLightClient::updateMode(uint8_t mode) {
   Serial.printf_P(PSTR("MiLightClient::updateMode: Change mode to %d\n"), mode);
 #endif
   currentRemote->packetFormatter->updateMode(mode);
-  flushPacket();
+  flushPacket(PacketCommandClass::MODE);
 }
 
 void MiLightClient::nextMode() {
@@ -186,7 +195,7 @@ void MiLightClient::updateStatus(MiLightStatus status, uint8_t groupId) {
   Serial.printf_P(PSTR("MiLightClient::updateStatus: Status %s, groupId %d\n"), status == MiLightStatus::OFF ? "OFF" : "ON", groupId);
 #endif
   currentRemote->packetFormatter->updateStatus(status, groupId);
-  flushPacket();
+  flushPacket(PacketCommandClass::NONE, true);
 }
 
 void MiLightClient::updateStatus(MiLightStatus status) {
@@ -194,7 +203,7 @@ void MiLightClient::updateStatus(MiLightStatus status) {
   Serial.printf_P(PSTR("MiLightClient::updateStatus: Status %s\n"), status == MiLightStatus::OFF ? "OFF" : "ON");
 #endif
   currentRemote->packetFormatter->updateStatus(status);
-  flushPacket();
+  flushPacket(PacketCommandClass::NONE, true);
 }
 
 void MiLightClient::updateSaturation(const uint8_t value) {
@@ -202,7 +211,7 @@ void MiLightClient::updateSaturation(const uint8_t value) {
   Serial.printf_P(PSTR("MiLightClient::updateSaturation: Saturation %d\n"), value);
 #endif
   currentRemote->packetFormatter->updateSaturation(value);
-  flushPacket();
+  flushPacket(PacketCommandClass::SATURATION);
 }
 
 void MiLightClient::updateColorWhite() {
@@ -210,7 +219,7 @@ void MiLightClient::updateColorWhite() {
   Serial.println(F("MiLightClient::updateColorWhite: Color white"));
 #endif
   currentRemote->packetFormatter->updateColorWhite();
-  flushPacket();
+  flushPacket(PacketCommandClass::NONE, true);
 }
 
 void MiLightClient::enableNightMode() {
@@ -274,7 +283,7 @@ void MiLightClient::updateTemperature(const uint8_t temperature) {
   Serial.printf_P(PSTR("MiLightClient::updateTemperature: Set temperature to %d\n"), temperature);
 #endif
   currentRemote->packetFormatter->updateTemperature(temperature);
-  flushPacket();
+  flushPacket(PacketCommandClass::KELVIN);
 }
 
 void MiLightClient::command(uint8_t command, uint8_t arg) {
@@ -314,31 +323,120 @@ void MiLightClient::updateColor(JsonVariant json) {
 }
 
 void MiLightClient::update(JsonObject request) {
+  ParsedUpdate update;
+  parseUpdate(request, update);
+  lastUpdateElidedPackets = 0;
+
   if (this->updateBeginHandler) {
     this->updateBeginHandler();
   }
 
-  const JsonVariant status = this->extractStatus(request);
-  const uint8_t parsedStatus = this->parseStatus(status);
+  applyUpdate(update);
+
+  if (this->updateEndHandler) {
+    this->updateEndHandler();
+  }
+}
+
+uint16_t MiLightClient::updateBatch(const std::vector<BulbId>& bulbIds, JsonObject request) {
+  ParsedUpdate update;
+  parseUpdate(request, update);
+  lastUpdateElidedPackets = 0;
+
+  if (this->updateBeginHandler) {
+    this->updateBeginHandler();
+  }
+
+  // Transitions start from the state of each group, which group 0 doesn't have
+  const std::vector<BatchTarget> targets = BatchPlanner::plan(bulbIds, update.transition == 0);
+  const uint16_t batchId = packetSender.beginBatch();
+
+  for (const BatchTarget& target : targets) {
+    const BulbId& bulbId = target.bulbId;
+    const MiLightRemoteConfig* config = MiLightRemoteConfig::fromType(bulbId.deviceType);
+
+    if (config != nullptr) {
+      const size_t queuedBefore = queuedPackets;
+
+      prepare(config, bulbId.deviceId, bulbId.groupId);
+      applyUpdate(update);
+
+      // Each group would have needed the same packets
+      collapsedTargets += target.covers - 1;
+      collapsedPackets += (queuedPackets - queuedBefore) * (target.covers - 1);
+    }
+  }
+
+  lastUpdateDroppedPackets = packetSender.endBatch();
+
+  if (this->updateEndHandler) {
+    this->updateEndHandler();
+  }
+
+  return batchId;
+}
+
+void MiLightClient::parseUpdate(JsonObject request, ParsedUpdate& update) {
+  update.force = request[RequestKeys::FORCE].as<bool>();
+  update.status = this->extractStatus(request);
+  update.parsedStatus = this->parseStatus(update.status);
+
   const JsonVariant jsonTransition = request[RequestKeys::TRANSITION];
-  float transition = 0;
+  update.transition = 0;
 
   if (!jsonTransition.isNull()) {
     if (jsonTransition.is<float>()) {
-      transition = jsonTransition.as<float>();
+      update.transition = jsonTransition.as<float>();
     } else if (jsonTransition.is<size_t>()) {
-      transition = jsonTransition.as<size_t>();
+      update.transition = jsonTransition.as<size_t>();
     } else {
       Serial.println(F("MiLightClient - WARN: unsupported transition type.  Must be float or int."));
     }
   }
 
-  JsonVariant brightness = request[GroupStateFieldNames::BRIGHTNESS];
-  JsonVariant level = request[GroupStateFieldNames::LEVEL];
-  const bool isBrightnessDefined = !brightness.isNull() || !level.isNull();
+  update.brightness = request[GroupStateFieldNames::BRIGHTNESS];
+  update.level = request[GroupStateFieldNames::LEVEL];
+  update.isBrightnessDefined = !update.brightness.isNull() || !update.level.isNull();
+
+  update.numFields = 0;
+  for (const char* fieldName : FIELD_ORDERINGS) {
+    if (request.containsKey(fieldName)) {
+      auto handler = FIELD_SETTERS.find(fieldName);
+
+      if (handler != FIELD_SETTERS.end()) {
+        update.fieldNames[update.numFields] = fieldName;
+        update.setters[update.numFields] = &handler->second;
+        update.values[update.numFields] = request[fieldName];
+        ++update.numFields;
+      }
+    }
+  }
+
+  if (request.containsKey("button_id") && request.containsKey("argument")) {
+    update.buttonId = request["button_id"];
+    update.argument = request["argument"];
+  }
+}
+
+void MiLightClient::applyUpdate(const ParsedUpdate& update) {
+  const BulbId bulbId = currentRemote->packetFormatter->currentBulbId();
+
+  // State can only be trusted if nothing for the device is still on its way
+  // out.  Group 0 state doesn't reflect changes made to individual groups.
+  elisionActive = settings.elideRedundantCommands
+    && !update.force
+    && currentState != nullptr
+    && bulbId.groupId != 0
+    && !packetSender.hasPendingPackets(bulbId);
+
+  if (elisionActive) {
+    elisionState = *currentState;
+  }
+
+  const float transition = update.transition;
 
   // Always turn on first
-  if (parsedStatus == ON) {
+  if (update.parsedStatus == ON) {
     if (transition == 0) {
       this->updateStatus(ON);
     }
@@ -354,60 +452,51 @@ void MiLightClient::update(JsonObject request) {
       // If a brightness is defined, we'll want to transition to that.  Status
       // transitions only ramp up/down to the max/min.  Otherwise, just turn the bulb on
       // and let field transitions handle the rest.
-      if (!isBrightnessDefined) {
-        handleTransition(GroupStateField::STATUS, status, transition, 0);
+      if (!update.isBrightnessDefined) {
+        handleTransition(GroupStateField::STATUS, update.status, transition, 0);
       } else {
         this->updateStatus(ON);
 
-        if (! brightness.isNull()) {
-          handleTransition(GroupStateField::BRIGHTNESS, brightness, transition, 0);
-        } else if (! level.isNull()) {
-          handleTransition(GroupStateField::LEVEL, level, transition, 0);
+        if (! update.brightness.isNull()) {
+          handleTransition(GroupStateField::BRIGHTNESS, update.brightness, transition, 0);
+        } else if (! update.level.isNull()) {
+          handleTransition(GroupStateField::LEVEL, update.level, transition, 0);
         }
       }
     }
   }
 
-  for (const char* fieldName : FIELD_ORDERINGS) {
-    if (request.containsKey(fieldName)) {
-      auto handler = FIELD_SETTERS.find(fieldName);
-      JsonVariant value = request[fieldName];
+  for (size_t i = 0; i < update.numFields; ++i) {
+    // No transition -- set field directly
+    if (transition == 0) {
+      (*update.setters[i])(this, update.values[i]);
+    } else {
+      GroupStateField field = GroupStateFieldHelpers::getFieldByName(update.fieldNames[i]);
 
-      if (handler != FIELD_SETTERS.end()) {
-        // No transition -- set field directly
-        if (transition == 0) {
-          handler->second(this, value);
-        } else {
-          GroupStateField field = GroupStateFieldHelpers::getFieldByName(fieldName);
-
-          if (   !GroupStateFieldHelpers::isBrightnessField(field)  // If field isn't brightness
-               || parsedStatus == STATUS_UNDEFINED                  // or if there was not a status field
-               || currentState->isOn()                              // or if bulb was already on
-          ) {
-            handleTransition(field, value, transition);
-          }
-        }
+      if (   !GroupStateFieldHelpers::isBrightnessField(field)  // If field isn't brightness
+           || update.parsedStatus == STATUS_UNDEFINED           // or if there was not a status field
+           || currentState->isOn()                              // or if bulb was already on
+      ) {
+        handleTransition(field, update.values[i], transition);
       }
     }
   }
 
   // Raw packet command/args
-  if (request.containsKey("button_id") && request.containsKey("argument")) {
-    this->command(request["button_id"], request["argument"]);
+  if (!update.buttonId.isNull()) {
+    this->command(update.buttonId.as<uint8_t>(), update.argument.as<uint8_t>());
   }
 
   // Always turn off last
-  if (parsedStatus == OFF) {
+  if (update.parsedStatus == OFF) {
     if (transition == 0) {
       this->updateStatus(OFF);
     } else {
-      handleTransition(GroupStateField::STATUS, status, transition);
+      handleTransition(GroupStateField::STATUS, update.status, transition);
     }
   }
 
-  if (this->updateEndHandler) {
-    this->updateEndHandler();
-  }
+  elisionActive = false;
 }
 
 void MiLightClient::handleCommands(JsonArray commands) {
@@ -663,16 +752,96 @@ void MiLightClient::clearRepeatsOverride() {
   this->repeatsOverride = PacketSender::DEFAULT_PACKET_SENDS_VALUE;
 }
 
-void MiLightClient::flushPacket() {
-  PacketStream& stream = currentRemote->packetFormatter->buildPackets();
+void MiLightClient::setPriority(PacketPriority priority) {
+  this->priority = priority;
+}
+
+void MiLightClient::clearPriority() {
+  this->priority = PacketPriority::INTERACTIVE;
+}
+
+void MiLightClient::flushPacket(const PacketCommandClass commandClass, const bool absolute) {
+  PacketFormatter* formatter = currentRemote->packetFormatter;
+  PacketStream& stream = formatter->buildPackets();
+  const BulbId bulbId = formatter->currentBulbId();
+
+  // Multi-packet commands (e.g., automatic mode switching) and step commands depend
+  // on every packet being sent, so they can't be superseded.
+  const bool singleAbsolutePacket = stream.numPackets == 1 && !formatter->hasRelativeCommands();
+  const PacketCommandClass effectiveClass = singleAbsolutePacket
+    ? commandClass
+    : PacketCommandClass::NONE;
+  const bool elidable = elisionActive
+    && singleAbsolutePacket
+    && (commandClass != PacketCommandClass::NONE || absolute);
 
   while (stream.hasNext()) {
-    packetSender.enqueue(stream.next(), currentRemote, repeatsOverride);
+    uint8_t* packet = stream.next();
+
+    if (elidable && !applyToElisionState(packet)) {
+      ++elidedPackets;
+      ++lastUpdateElidedPackets;
+      continue;
+    }
+
+    packetSender.enqueue(packet, currentRemote, repeatsOverride, bulbId, effectiveClass, priority);
+    ++queuedPackets;
+  }
+
+  // Don't know what state will be after anything else, so stop skipping
+  if (!elidable) {
+    elisionActive = false;
   }
 
   currentRemote->packetFormatter->reset();
 }
 
+bool MiLightClient::applyToElisionState(const uint8_t* packet) {
+  // Parse the packet rather than comparing requested values, so values are
+  // quantized exactly as the protocol does it
+  ParsedPacket result;
+  BulbId parsedBulbId = currentRemote->packetFormatter->parsePacket(packet, result);
+
+  // e.g. a status command for a different group
+  if (!(parsedBulbId == currentRemote->packetFormatter->currentBulbId())) {
+    elisionActive = false;
+    return true;
+  }
+
+  const GroupState updates(&elisionState, result);
+  GroupState next = elisionState;
+  next.patch(updates);
+
+  // Fields other than status aren't applied to state while a bulb is off, so
+  // only trust that they're redundant when it's known to be on
+  const bool redundant = next.isEqualIgnoreDirty(elisionState)
+    && elisionState.isSetState()
+    && (updates.isSetState() || elisionState.isOn());
+
+  elisionState = next;
+  return !redundant;
+}
+
+size_t MiLightClient::getElidedPacketCount() const {
+  return elidedPackets;
+}
+
+size_t MiLightClient::getLastUpdateElidedPacketCount() const {
+  return lastUpdateElidedPackets;
+}
+
+size_t MiLightClient::getLastUpdateDroppedPacketCount() const {
+  return lastUpdateDroppedPackets;
+}
+
+size_t MiLightClient::getCollapsedTargetCount() const {
+  return collapsedTargets;
+}
+
+size_t MiLightClient::getCollapsedPacketCount() const {
+  return collapsedPackets;
+}
+
 void MiLightClient::onUpdateBegin(EventHandler handler) {
   this->updateBeginHandler = handler;
 }
@@ -19,6 +19,8 @@
 
 namespace RequestKeys {
   static const char TRANSITION[] = "transition";
+  // Send every field, even if state says it wouldn't change anything
+  static const char FORCE[] = "force";
 };
 
 namespace TransitionParams {
@@ -90,6 +92,14 @@ public:
   void updateSaturation(const uint8_t saturation);
 
   void update(JsonObject object);
+
+  // Applies one update to each of the given bulbs.  The request is only parsed
+  // once, and the packets are sent as a single batch (see
+  // PacketSender::beginBatch()) so the bulbs switch together.  Devices with
+  // every group targeted are sent one group 0 command (see BatchPlanner).
+  // Returns the id of the batch.
+  uint16_t updateBatch(const std::vector<BulbId>& bulbIds, JsonObject object);
+
   void handleCommand(JsonVariant command);
   void handleCommands(JsonArray commands);
   bool handleTransition(JsonObject args, JsonDocument& responseObj);
@@ -110,17 +120,64 @@ public:
   // Clear the repeats override so that the default is used
   void clearRepeatsOverride();
 
+  // Call to change the priority lane packets are queued in.  Clear with clearPriority
+  void setPriority(PacketPriority priority);
+
+  // Clear the priority so that packets are queued as interactive commands
+  void clearPriority();
+
   uint8_t parseStatus(JsonVariant object);
   JsonVariant extractStatus(JsonObject object);
 
+  // Packets skipped by update() because they wouldn't have changed anything.
+  // See Settings::elideRedundantCommands.
+  size_t getElidedPacketCount() const;
+  size_t getLastUpdateElidedPacketCount() const;
+
+  // Packets from the last updateBatch() which were dropped because the sender
+  // couldn't keep up.  See PacketSender::endBatch().
+  size_t getLastUpdateDroppedPacketCount() const;
+
+  // Bulbs updateBatch() reached through group 0 instead of individually, and
+  // the packets that saved
+  size_t getCollapsedTargetCount() const;
+  size_t getCollapsedPacketCount() const;
+
 protected:
   struct cmp_str {
     bool operator()(char const *a, char const *b) const {
         return std::strcmp(a, b) < 0;
     }
   };
-  static const std::map<const char*, std::function<void(MiLightClient*, JsonVariant)>, cmp_str> FIELD_SETTERS;
-  static const char* FIELD_ORDERINGS[];
+  typedef std::function<void(MiLightClient*, JsonVariant)> FieldSetter;
+  static const std::map<const char*, FieldSetter, cmp_str> FIELD_SETTERS;
+  static const size_t NUM_FIELD_ORDERINGS = 12;
+  static const char* FIELD_ORDERINGS[NUM_FIELD_ORDERINGS];
+
+  // An update() request, parsed so that it can be applied to any bulb
+  struct ParsedUpdate {
+    JsonVariant status;
+    uint8_t parsedStatus;
+    float transition;
+    JsonVariant brightness;
+    JsonVariant level;
+    bool isBrightnessDefined;
+    bool force;
+
+    // Fields present in the request, in FIELD_ORDERINGS order
+    size_t numFields;
+    const char* fieldNames[NUM_FIELD_ORDERINGS];
+    const FieldSetter* setters[NUM_FIELD_ORDERINGS];
+    JsonVariant values[NUM_FIELD_ORDERINGS];
+
+    // Raw packet command/args
+    JsonVariant buttonId;
+    JsonVariant argument;
+  };
+
+  void parseUpdate(JsonObject request, ParsedUpdate& update);
+  // Applies the update to the prepared bulb
+  void applyUpdate(const ParsedUpdate& update);
 
   RadioSwitchboard& radioSwitchboard;
   std::vector<std::shared_ptr<MiLightRadio>> radios;
@@ -139,7 +196,35 @@ protected:
   // If set, override the number of packet repeats used.
   size_t repeatsOverride;
 
-  void flushPacket();
+  // Priority lane packets are queued in.
+  PacketPriority priority;
+
+  // Set during update() while packets may be skipped.  elisionState is what
+  // state would be after the packets sent so far.
+  bool elisionActive;
+  GroupState elisionState;
+  size_t elidedPackets;
+  size_t lastUpdateElidedPackets;
+  size_t lastUpdateDroppedPackets;
+
+  // Packets passed to the sender
+  size_t queuedPackets;
+  size_t collapsedTargets;
+  size_t collapsedPackets;
+
+  // Applies the packet to elisionState.  Returns false if it wouldn't change
+  // anything.
+  bool applyToElisionState(const uint8_t* packet);
+
+  // commandClass allows a pending packet with the same absolute value command to be
+  // superseded.  Only applied when the command fits in a single packet.
+  //
+  // Packets with a command class, or marked as absolute (status, white mode),
+  // may be skipped during update() when they wouldn't change state.
+  void flushPacket(
+    const PacketCommandClass commandClass = PacketCommandClass::NONE,
+    const bool absolute = false
+  );
 };
 
 #endif
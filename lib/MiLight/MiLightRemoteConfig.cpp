@@ -30,16 +30,77 @@ const MiLightRemoteConfig* MiLightRemoteConfig::fromType(MiLightRemoteType type)
   return ALL_REMOTES[type];
 }
 
+namespace {
+  static const size_t MAX_REMOTES_PER_CONFIG = 4;
+
+  // Remotes which can be heard with a radio config.  Remotes sending V2
+  // packets share radio configs, and are told apart by the protocol ID in the
+  // decoded packet.  Others are checked with canHandle.
+  struct V2Remote {
+    uint8_t protocolId;
+    const MiLightRemoteConfig* remote;
+  };
+
+  struct ReceiveRoute {
+    // Formatter to decode V2 packets for the config with, or NULL
+    const PacketFormatter* v2Decoder;
+    size_t v2PacketLength;
+    // Only a few remotes share a config, so these are scanned
+    size_t numV2;
+    V2Remote v2Remotes[MAX_REMOTES_PER_CONFIG];
+
+    size_t numOthers;
+    const MiLightRemoteConfig* others[MAX_REMOTES_PER_CONFIG];
+  };
+
+  const ReceiveRoute* buildReceiveRoutes() {
+    static ReceiveRoute routes[MiLightRadioConfig::NUM_CONFIGS];
+
+    for (size_t i = 0; i < MiLightRemoteConfig::NUM_REMOTES; i++) {
+      const MiLightRemoteConfig* remote = MiLightRemoteConfig::ALL_REMOTES[i];
+      ReceiveRoute& route = routes[&remote->radioConfig - MiLightRadioConfig::ALL_CONFIGS];
+      const int16_t protocolId = remote->packetFormatter->getProtocolId();
+
+      if (protocolId >= 0 && route.numV2 < MAX_REMOTES_PER_CONFIG) {
+        route.v2Decoder = remote->packetFormatter;
+        route.v2PacketLength = remote->packetFormatter->getPacketLength();
+        route.v2Remotes[route.numV2].protocolId = protocolId;
+        route.v2Remotes[route.numV2].remote = remote;
+        ++route.numV2;
+      } else if (route.numOthers < MAX_REMOTES_PER_CONFIG) {
+        route.others[route.numOthers++] = remote;
+      }
+    }
+
+    return routes;
+  }
+}
+
 const MiLightRemoteConfig* MiLightRemoteConfig::fromReceivedPacket(
   const MiLightRadioConfig& radioConfig,
   const uint8_t* packet,
-  const size_t len
+  const size_t len,
+  uint8_t* decoded
 ) {
-  for (size_t i = 0; i < MiLightRemoteConfig::NUM_REMOTES; i++) {
-    const MiLightRemoteConfig* config = MiLightRemoteConfig::ALL_REMOTES[i];
-    if (&config->radioConfig == &radioConfig
-      && config->packetFormatter->canHandle(packet, len)) {
-      return config;
+  static const ReceiveRoute* routes = buildReceiveRoutes();
+  const ReceiveRoute& route = routes[&radioConfig - MiLightRadioConfig::ALL_CONFIGS];
+
+  if (route.v2Decoder != NULL && len == route.v2PacketLength) {
+    route.v2Decoder->decodePacket(packet, decoded);
+
+    for (size_t i = 0; i < route.numV2; i++) {
+      if (route.v2Remotes[i].protocolId == decoded[V2_PROTOCOL_ID_INDEX]) {
+        return route.v2Remotes[i].remote;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < route.numOthers; i++) {
+    const MiLightRemoteConfig* remote = route.others[i];
+
+    if (remote->packetFormatter->canHandle(packet, len)) {
+      remote->packetFormatter->decodePacket(packet, decoded);
+      return remote;
     }
   }
 
@@ -36,7 +36,15 @@ public:
 
   static const MiLightRemoteConfig* fromType(MiLightRemoteType type);
   static const MiLightRemoteConfig* fromType(const String& type);
-  static const MiLightRemoteConfig* fromReceivedPacket(const MiLightRadioConfig& radioConfig, const uint8_t* packet, const size_t len);
+  // Remote a packet heard with the radio config came from, or NULL.  The
+  // packet is decoded into decoded (see PacketFormatter::decodePacket), which
+  // must have room for MILIGHT_MAX_PACKET_LENGTH bytes.
+  static const MiLightRemoteConfig* fromReceivedPacket(
+    const MiLightRadioConfig& radioConfig,
+    const uint8_t* packet,
+    const size_t len,
+    uint8_t* decoded
+  );
 
   static const size_t NUM_REMOTES;
   static const MiLightRemoteConfig* ALL_REMOTES[];
@@ -1,4 +1,6 @@
 #include <PacketFormatter.h>
+#include <MiLightRadioConfig.h>
+#include <MiLightCommands.h>
 
 static uint8_t* PACKET_BUFFER = new uint8_t[PACKET_FORMATTER_BUFFER_SIZE];
 
@@ -24,7 +26,8 @@ PacketFormatter::PacketFormatter(const MiLightRemoteType deviceType, const size_
     packetLength(packetLength),
     numPackets(0),
     currentPacket(NULL),
-    held(false)
+    held(false),
+    relativeCommands(false)
 {
   packetStream.packetLength = packetLength;
 }
@@ -80,10 +83,92 @@ void PacketFormatter::enableNightMode() { }
 void PacketFormatter::updateTemperature(uint8_t value) { }
 void PacketFormatter::updateSaturation(uint8_t value) { }
 
+BulbId PacketFormatter::parsePacket(const uint8_t *packet, ParsedPacket& result) {
+  uint8_t decoded[MILIGHT_MAX_PACKET_LENGTH];
+  decodePacket(packet, decoded);
+
+  return parseDecodedPacket(decoded, result);
+}
+
 BulbId PacketFormatter::parsePacket(const uint8_t *packet, JsonObject result) {
+  ParsedPacket parsed;
+  BulbId bulbId = parsePacket(packet, parsed);
+
+  toJson(parsed, result);
+  return bulbId;
+}
+
+BulbId PacketFormatter::parseDecodedPacket(const uint8_t *packet, ParsedPacket& result) {
   return DEFAULT_BULB_ID;
 }
 
+BulbId PacketFormatter::parseDecodedPacket(const uint8_t *packet, JsonObject result) {
+  ParsedPacket parsed;
+  BulbId bulbId = parseDecodedPacket(packet, parsed);
+
+  toJson(parsed, result);
+  return bulbId;
+}
+
+void PacketFormatter::toJson(const ParsedPacket& packet, JsonObject result) {
+  if (packet.has(ParsedPacket::STATE)) {
+    result[GroupStateFieldNames::STATE] = packet.on ? "ON" : "OFF";
+  }
+  if (packet.has(ParsedPacket::BRIGHTNESS)) {
+    result[GroupStateFieldNames::BRIGHTNESS] = packet.brightness;
+  }
+  if (packet.has(ParsedPacket::HUE)) {
+    result[GroupStateFieldNames::HUE] = packet.hue;
+  }
+  if (packet.has(ParsedPacket::SATURATION)) {
+    result[GroupStateFieldNames::SATURATION] = packet.saturation;
+  }
+  if (packet.has(ParsedPacket::MODE)) {
+    result[GroupStateFieldNames::MODE] = packet.mode;
+  }
+  if (packet.has(ParsedPacket::COLOR_TEMP)) {
+    result[GroupStateFieldNames::COLOR_TEMP] = packet.colorTemp;
+  }
+  if (packet.has(ParsedPacket::COMMAND)) {
+    result[GroupStateFieldNames::COMMAND] = commandName(packet.command);
+  }
+  if (packet.has(ParsedPacket::BUTTON_ID)) {
+    result["button_id"] = packet.buttonId;
+  }
+  if (packet.has(ParsedPacket::ARGUMENT)) {
+    result["argument"] = packet.argument;
+  }
+}
+
+const char* PacketFormatter::commandName(PacketCommand command) {
+  switch (command) {
+    case PacketCommand::NIGHT_MODE:
+      return MiLightCommandNames::NIGHT_MODE;
+    case PacketCommand::SET_WHITE:
+      return MiLightCommandNames::SET_WHITE;
+    case PacketCommand::BRIGHTNESS_UP:
+      return "brightness_up";
+    case PacketCommand::BRIGHTNESS_DOWN:
+      return "brightness_down";
+    case PacketCommand::TEMPERATURE_UP:
+      return MiLightCommandNames::TEMPERATURE_UP;
+    case PacketCommand::TEMPERATURE_DOWN:
+      return MiLightCommandNames::TEMPERATURE_DOWN;
+    case PacketCommand::MODE_SPEED_UP:
+      return MiLightCommandNames::MODE_SPEED_UP;
+    case PacketCommand::MODE_SPEED_DOWN:
+      return MiLightCommandNames::MODE_SPEED_DOWN;
+    case PacketCommand::NEXT_MODE:
+      return MiLightCommandNames::NEXT_MODE;
+    case PacketCommand::PREVIOUS_MODE:
+      return MiLightCommandNames::PREVIOUS_MODE;
+    case PacketCommand::COLOR_WHITE_TOGGLE:
+      return "color_white_toggle";
+    default:
+      return "";
+  }
+}
+
 void PacketFormatter::pair() {
   for (size_t i = 0; i < 5; i++) {
     updateStatus(ON);
@@ -109,6 +194,8 @@ void PacketFormatter::valueByStepFunction(StepFunction increase, StepFunction de
   StepFunction fn;
   size_t numCommands = 0;
 
+  relativeCommands = true;
+
   // If current value is not known, drive down to minimum value.  Then we can assume that we
   // know the state (it'll be 0).
   if (knownValue == -1) {
@@ -144,6 +231,7 @@ void PacketFormatter::reset() {
   this->numPackets = 0;
   this->currentPacket = PACKET_BUFFER;
   this->held = false;
+  this->relativeCommands = false;
 }
 
 void PacketFormatter::pushPacket() {
@@ -183,6 +271,18 @@ size_t PacketFormatter::getPacketLength() const {
   return packetLength;
 }
 
+void PacketFormatter::decodePacket(const uint8_t* packet, uint8_t* decoded) const {
+  memcpy(decoded, packet, packetLength);
+}
+
+int16_t PacketFormatter::getProtocolId() const {
+  return -1;
+}
+
+bool PacketFormatter::hasRelativeCommands() const {
+  return relativeCommands;
+}
+
 BulbId PacketFormatter::currentBulbId() const {
   return BulbId(deviceId, groupId, deviceType);
 }
\ No newline at end of file
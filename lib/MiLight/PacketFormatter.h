@@ -4,6 +4,7 @@
 #include <MiLightRemoteType.h>
 #include <ArduinoJson.h>
 #include <GroupState.h>
+#include <ParsedPacket.h>
 #include <GroupStateStore.h>
 #include <Settings.h>
 
@@ -83,13 +84,34 @@ public:
   virtual void prepare(uint16_t deviceId, uint8_t groupId);
   virtual void format(uint8_t const* packet, char* buffer);
 
-  virtual BulbId parsePacket(const uint8_t* packet, JsonObject result);
+  // Decodes the packet and parses it.  See parseDecodedPacket.
+  BulbId parsePacket(const uint8_t* packet, ParsedPacket& result);
+  BulbId parsePacket(const uint8_t* packet, JsonObject result);
+  // Parses a packet which has already been through decodePacket
+  virtual BulbId parseDecodedPacket(const uint8_t* packet, ParsedPacket& result);
+  BulbId parseDecodedPacket(const uint8_t* packet, JsonObject result);
+
+  // Writes the fields set in a parsed packet as JSON, e.g. for MQTT
+  static void toJson(const ParsedPacket& packet, JsonObject result);
+  static const char* commandName(PacketCommand command);
   virtual BulbId currentBulbId() const;
 
+  // Copies a received packet to decoded, undoing any over-the-air encoding.
+  // decoded must have room for getPacketLength() bytes.
+  virtual void decodePacket(const uint8_t* packet, uint8_t* decoded) const;
+
+  // Protocol ID in decoded V2 packets, or -1 for formatters which don't use
+  // V2 packets
+  virtual int16_t getProtocolId() const;
+
   static void formatV1Packet(uint8_t const* packet, char* buffer);
 
   size_t getPacketLength() const;
 
+  // True if the packets built since the last reset() step a value up or down
+  // rather than setting it outright.
+  bool hasRelativeCommands() const;
+
 protected:
   const MiLightRemoteType deviceType;
   size_t packetLength;
@@ -99,6 +121,7 @@ protected:
   uint16_t deviceId;
   uint8_t groupId;
   uint8_t sequenceNum;
+  bool relativeCommands;
   PacketStream packetStream;
   GroupStateStore* stateStore = NULL;
   const Settings* settings = NULL;
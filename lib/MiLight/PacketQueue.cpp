@@ -1,42 +1,200 @@
 #include <PacketQueue.h>
 
 PacketQueue::PacketQueue()
-  : droppedPackets(0)
-{ }
+  : head(0)
+  , count(0)
+  , droppedPackets(0)
+  , mergedPackets(0)
+  , enqueuedPackets(0)
+  , dequeuedPackets(0)
+{
+  lastEvicted.batchId = 0;
+}
+
+PacketQueue::PushResult PacketQueue::push(
+  const uint8_t* packet,
+  const MiLightRemoteConfig* remoteConfig,
+  const size_t repeatsOverride,
+  const BulbId& bulbId,
+  const PacketCommandClass commandClass,
+  const uint32_t enqueuedAtMicros
+) {
+  QueuedPacket* qp = findSupersededPacket(bulbId, commandClass);
+  PushResult result = PushResult::QUEUED;
+
+  if (qp != nullptr) {
+    ++mergedPackets;
+    result = PushResult::MERGED;
+  } else {
+    const bool full = count == MILIGHT_MAX_QUEUED_PACKETS;
+    qp = allocatePacket();
+
+    if (qp == nullptr) {
+      return PushResult::DROPPED;
+    } else if (full) {
+      result = PushResult::REPLACED;
+    }
+
+    qp->bulbId = bulbId;
+    qp->commandClass = commandClass;
+    qp->enqueuedAt = millis();
+    qp->enqueuedAtMicros = enqueuedAtMicros;
+    qp->batchId = 0;
+    qp->checkedOut = false;
+    qp->repeatsRemaining = 0;
+    qp->repeatsSent = 0;
+  }
 
-void PacketQueue::push(const uint8_t* packet, const MiLightRemoteConfig* remoteConfig, const size_t repeatsOverride) {
-  std::shared_ptr<QueuedPacket> qp = checkoutPacket();
   memcpy(qp->packet, packet, remoteConfig->packetFormatter->getPacketLength());
   qp->remoteConfig = remoteConfig;
   qp->repeatsOverride = repeatsOverride;
+  qp->encodedLength = 0;
+
+  return result;
 }
 
 bool PacketQueue::isEmpty() const {
-  return queue.size() == 0;
+  return count == 0;
 }
 
 size_t PacketQueue::getDroppedPacketCount() const {
   return droppedPackets;
 }
 
-std::shared_ptr<QueuedPacket> PacketQueue::pop() {
-  return queue.shift();
+size_t PacketQueue::getMergedPacketCount() const {
+  return mergedPackets;
+}
+
+size_t PacketQueue::getEnqueuedPacketCount() const {
+  return enqueuedPackets;
+}
+
+size_t PacketQueue::getDequeuedPacketCount() const {
+  return dequeuedPackets;
+}
+
+QueuedPacket& PacketQueue::front() {
+  return packets[head];
+}
+
+QueuedPacket& PacketQueue::at(const size_t index) {
+  return packets[slot(index)];
+}
+
+QueuedPacket& PacketQueue::checkout(const size_t index) {
+  QueuedPacket& packet = packets[slot(index)];
+  packet.checkedOut = true;
+  return packet;
+}
+
+void PacketQueue::pop() {
+  remove(0);
+}
+
+void PacketQueue::remove(const size_t index) {
+  if (index >= count) {
+    return;
+  }
+
+  if (index == 0) {
+    packets[head].checkedOut = false;
+    head = slot(1);
+  } else {
+    for (size_t i = index; i < count - 1; ++i) {
+      packets[slot(i)] = packets[slot(i + 1)];
+    }
+  }
+
+  --count;
+  ++dequeuedPackets;
 }
 
-std::shared_ptr<QueuedPacket> PacketQueue::checkoutPacket() {
-  if (queue.size() == MILIGHT_MAX_QUEUED_PACKETS) {
+QueuedPacket* PacketQueue::allocatePacket() {
+  if (count == MILIGHT_MAX_QUEUED_PACKETS) {
     ++droppedPackets;
-    return queue.getLast();
+
+    // Never clobber a packet that's part way through being sent
+    if (! packets[slot(count - 1)].checkedOut) {
+      return evict(count - 1);
+    }
+
+    for (size_t i = 0; i < count - 1; ++i) {
+      if (! packets[slot(i)].checkedOut) {
+        return evict(i);
+      }
+    }
+
+    return nullptr;
   } else {
-    std::shared_ptr<QueuedPacket> packet = std::make_shared<QueuedPacket>();
-    queue.add(packet);
-    return packet;
+    QueuedPacket& packet = packets[slot(count)];
+    ++count;
+    ++enqueuedPackets;
+    return &packet;
+  }
+}
+
+QueuedPacket* PacketQueue::evict(const size_t index) {
+  lastEvicted.bulbId = packets[slot(index)].bulbId;
+  lastEvicted.batchId = packets[slot(index)].batchId;
+
+  for (size_t i = index; i < count - 1; ++i) {
+    packets[slot(i)] = packets[slot(i + 1)];
+  }
+
+  return &packets[slot(count - 1)];
+}
+
+const PacketQueue::EvictedPacket& PacketQueue::evicted() const {
+  return lastEvicted;
+}
+
+size_t PacketQueue::slot(const size_t index) const {
+  return (head + index) % MILIGHT_MAX_QUEUED_PACKETS;
+}
+
+// Walk backwards from the newest packet looking for one this packet can replace.
+// Packets for other devices can be skipped over.  Anything else for the same device
+// (including other groups, because of group 0) ends the search unless reordering the
+// two commands can't change the outcome.
+QueuedPacket* PacketQueue::findSupersededPacket(const BulbId& bulbId, const PacketCommandClass commandClass) {
+  if (commandClass == PacketCommandClass::NONE) {
+    return nullptr;
   }
+
+  for (size_t i = count; i > 0; --i) {
+    QueuedPacket& candidate = packets[slot(i - 1)];
+
+    if (candidate.bulbId.deviceId != bulbId.deviceId || candidate.bulbId.deviceType != bulbId.deviceType) {
+      continue;
+    }
+
+    if (candidate.checkedOut || candidate.bulbId.groupId != bulbId.groupId) {
+      return nullptr;
+    }
+
+    if (candidate.commandClass == commandClass) {
+      return &candidate;
+    }
+
+    if (! isCommutative(bulbId.deviceType, candidate.commandClass, commandClass)) {
+      return nullptr;
+    }
+  }
+
+  return nullptr;
 }
 
-void PacketQueue::checkinPacket(std::shared_ptr<QueuedPacket> packet) {
+bool PacketQueue::isCommutative(const MiLightRemoteType deviceType, const PacketCommandClass a, const PacketCommandClass b) {
+  // FUT089 shares one command byte between saturation and color temperature, so
+  // a saturation packet also changes white mode state.
+  if (deviceType == REMOTE_TYPE_FUT089) {
+    return false;
+  }
+
+  return (a == PacketCommandClass::HUE || a == PacketCommandClass::SATURATION)
+    && (b == PacketCommandClass::HUE || b == PacketCommandClass::SATURATION);
 }
 
 size_t PacketQueue::size() const {
-  return queue.size();
-}
\ No newline at end of file
+  return count;
+}
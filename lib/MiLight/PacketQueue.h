@@ -1,36 +1,138 @@
 #pragma once
 
-#include <memory>
-
-#include <CircularBuffer.h>
 #include <MiLightRadioConfig.h>
 #include <MiLightRemoteConfig.h>
+#include <BulbId.h>
 
 #ifndef MILIGHT_MAX_QUEUED_PACKETS
 #define MILIGHT_MAX_QUEUED_PACKETS 20
 #endif
 
+// The newest packet is overwritten when the queue is full.  If the sender has it
+// checked out, the oldest packet which isn't is dropped instead.  Need at least two
+// slots for that to be possible.
+static_assert(MILIGHT_MAX_QUEUED_PACKETS >= 2, "MILIGHT_MAX_QUEUED_PACKETS must be at least 2");
+
+// The logical command a packet carries.  A pending packet may be superseded by a newer
+// one for the same bulb and the same class.  Anything which isn't an absolute value
+// (status, pairing, increment/decrement steps, ...) is NONE and is never merged.
+enum class PacketCommandClass : uint8_t {
+  NONE,
+  BRIGHTNESS,
+  HUE,
+  KELVIN,
+  SATURATION,
+  MODE
+};
+
 struct QueuedPacket {
   uint8_t packet[MILIGHT_MAX_PACKET_LENGTH];
   const MiLightRemoteConfig* remoteConfig;
   size_t repeatsOverride;
+  BulbId bulbId;
+  PacketCommandClass commandClass;
+
+  // On-air frame, encoded once for all repeats.  encodedLength is 0 until the
+  // packet is encoded, or if the radio doesn't support it.  Only valid for the
+  // radio module it was encoded for.
+  uint8_t encodedPacket[MILIGHT_MAX_ENCODED_PACKET_LENGTH];
+  size_t encodedLength;
+  size_t encodedModule;
+
+  // millis() when the packet was first queued.  Kept when the packet is superseded.
+  unsigned long enqueuedAt;
+  // micros() when the command was issued, for command-to-air latency
+  uint32_t enqueuedAtMicros;
+  // Batch the packet was queued as part of, or 0.  See PacketSender::beginBatch().
+  uint16_t batchId;
+
+  // Set once the sender starts transmitting this packet.  Checked out packets are
+  // never superseded or overwritten.
+  bool checkedOut;
+  size_t repeatsRemaining;
+  size_t repeatsSent;
 };
 
+/**
+ * Fixed-capacity ring of queued packets.  All slots are allocated up front, so
+ * pushing and popping never touch the heap.
+ *
+ * Packets are borrowed with checkout() and stay valid until a packet is
+ * removed.  Removing a packet from the middle shifts the ones behind it
+ * forward, so indexes are only stable until then.
+ *
+ * When a packet carries a command class, it replaces the most recent pending
+ * packet for the same bulb with the same class in place (keeping its position
+ * in the queue) rather than being appended.
+ */
 class PacketQueue {
 public:
+  enum class PushResult : uint8_t {
+    QUEUED,
+    // Superseded a pending packet
+    MERGED,
+    // Queue was full, another packet was dropped to make room.  See evicted().
+    REPLACED,
+    // Queue was full and every packet was checked out, the packet was discarded
+    DROPPED
+  };
+
+  // The packet dropped by the last push() which returned REPLACED
+  struct EvictedPacket {
+    BulbId bulbId;
+    uint16_t batchId;
+  };
+
   PacketQueue();
 
-  void push(const uint8_t* packet, const MiLightRemoteConfig* remoteConfig, const size_t repeatsOverride);
-  std::shared_ptr<QueuedPacket> pop();
+  PushResult push(
+    const uint8_t* packet,
+    const MiLightRemoteConfig* remoteConfig,
+    const size_t repeatsOverride,
+    const BulbId& bulbId = DEFAULT_BULB_ID,
+    const PacketCommandClass commandClass = PacketCommandClass::NONE,
+    const uint32_t enqueuedAtMicros = micros()
+  );
+  QueuedPacket& front();
+  // index 0 is the oldest packet
+  QueuedPacket& at(const size_t index);
+  QueuedPacket& checkout(const size_t index = 0);
+  void remove(const size_t index);
+  void pop();
   bool isEmpty() const;
   size_t size() const;
+
+  const EvictedPacket& evicted() const;
+
+  // Number of packets which were dropped to make room, or were discarded,
+  // because the queue was full
   size_t getDroppedPacketCount() const;
+  // Number of packets which superseded a pending one instead of being queued
+  size_t getMergedPacketCount() const;
+  // Packets which took up a new slot.  Merged and overwriting packets aren't
+  // counted, so enqueued == dequeued + size() always holds.
+  size_t getEnqueuedPacketCount() const;
+  size_t getDequeuedPacketCount() const;
 
 private:
+  QueuedPacket packets[MILIGHT_MAX_QUEUED_PACKETS];
+  size_t head;
+  size_t count;
+
   size_t droppedPackets;
+  size_t mergedPackets;
+  size_t enqueuedPackets;
+  size_t dequeuedPackets;
+  EvictedPacket lastEvicted;
 
-  std::shared_ptr<QueuedPacket> checkoutPacket();
-  void checkinPacket(std::shared_ptr<QueuedPacket> packet);
+  QueuedPacket* allocatePacket();
+  // Drops the packet at index without counting it as dequeued and returns the
+  // slot at the back of the queue, which is free
+  QueuedPacket* evict(const size_t index);
+  size_t slot(const size_t index) const;
+  QueuedPacket* findSupersededPacket(const BulbId& bulbId, const PacketCommandClass commandClass);
 
-  LinkedList<std::shared_ptr<QueuedPacket>> queue;
-};
\ No newline at end of file
+  // Hue and saturation are both color mode commands, so their relative order
+  // doesn't matter (except on remotes where they overlap with other commands).
+  static bool isCommutative(const MiLightRemoteType deviceType, const PacketCommandClass a, const PacketCommandClass b);
+};
@@ -1,103 +1,750 @@
 #include <PacketSender.h>
 #include <MiLightRadioConfig.h>
 
+const uint8_t PacketSender::LANE_WEIGHTS[PacketSender::NUM_PRIORITIES] = { 8, 2, 1 };
+
+unsigned long PacketLaneStats::averageWaitMillis() const {
+  return sentPackets == 0 ? 0 : totalWaitMillis / sentPackets;
+}
+
+unsigned long PacketLaneStats::averageFirstSendMillis() const {
+  return firstSendPackets == 0 ? 0 : totalFirstSendMillis / firstSendPackets;
+}
+
 PacketSender::PacketSender(
   RadioSwitchboard& radioSwitchboard,
   Settings& settings,
   PacketSentHandler packetSentHandler
 ) : radioSwitchboard(radioSwitchboard)
-  , settings(settings)
-  , currentPacket(nullptr)
-  , packetRepeatsRemaining(0)
+  , packetRepeats(settings.packetRepeats)
+  , packetRepeatsPerLoop(settings.packetRepeatsPerLoop)
+  , packetInFlightWindow(settings.packetInFlightWindow)
+  , packetSendBudgetMicros(settings.packetSendBudgetMicros)
+  , async(false)
+  , inboxDrops(0)
+  , inboxWaitTimedOut(false)
+  , unroutableDrops(0)
+  , lastBatchId(0)
+  , currentBatchId(0)
+  , currentBatchStartMicros(0)
+  , currentBatchDrops(0)
+  , openBatchId(0)
+  , openBatchSince(0)
+  , budgetOverrunCount(0)
+  , cyclesPerRepeat(0)
+  , writeFailureCount(0)
   , packetSentHandler(packetSentHandler)
-  , lastSend(0)
-  , currentResendCount(settings.packetRepeats)
-  , throttleMultiplier(
+  , promotedPacketCount(0)
+  , repeatThrottle(
+      settings.packetRepeats,
+      settings.packetRepeatMinimum,
+      settings.packetRepeatThrottleThreshold,
       std::ceil(
         (settings.packetRepeatThrottleSensitivity / 1000.0) * settings.packetRepeats
       )
     )
-{ }
+{
+  for (size_t i = 0; i < NUM_PRIORITIES; ++i) {
+    laneCredits[i] = LANE_WEIGHTS[i];
+    laneCursors[i] = 0;
+    headBypasses[i] = 0;
+    sentPackets[i] = 0;
+    maxWaitMillis[i] = 0;
+    totalWaitMillis[i] = 0;
+    firstSendPackets[i] = 0;
+    maxFirstSendMillis[i] = 0;
+    totalFirstSendMillis[i] = 0;
+  }
+
+  for (size_t i = 0; i < MILIGHT_PENDING_DEVICE_SLOTS; ++i) {
+    pendingDevices[i] = 0;
+  }
 
-void PacketSender::enqueue(uint8_t* packet, const MiLightRemoteConfig* remoteConfig, const size_t repeatsOverride) {
+  for (size_t i = 0; i < MILIGHT_MAX_TRACKED_BATCHES; ++i) {
+    trackedBatches[i].id = 0;
+  }
+
+  lastBatchStats.id = 0;
+  lastBatchStats.packets = 0;
+  lastBatchStats.toAirMicros = 0;
+  lastBatchStats.completeMicros = 0;
+}
+
+void PacketSender::enqueue(
+  uint8_t* packet,
+  const MiLightRemoteConfig* remoteConfig,
+  const size_t repeatsOverride,
+  const BulbId& bulbId,
+  const PacketCommandClass commandClass,
+  const PacketPriority priority
+) {
 #ifdef DEBUG_PRINTF
-  Serial.println("Enqueuing packet");
+  Serial.printf_P(PSTR("Enqueuing packet (priority %d)\n"), static_cast<uint8_t>(priority));
 #endif
-  size_t repeats = repeatsOverride == DEFAULT_PACKET_SENDS_VALUE
-    ? this->currentResendCount
-    : repeatsOverride;
+  PendingPacket pending;
+  memcpy(pending.packet, packet, remoteConfig->packetFormatter->getPacketLength());
+  pending.remoteConfig = remoteConfig;
+  pending.repeatsOverride = repeatsOverride;
+  pending.bulbId = bulbId;
+  pending.commandClass = commandClass;
+  pending.priority = priority;
+  // Latency for a batch counts from when it was started
+  pending.enqueuedAtMicros = currentBatchId != 0 ? currentBatchStartMicros : micros();
+  pending.batchId = currentBatchId;
+
+  ++pendingDevices[pendingSlot(bulbId)];
+
+  // Packets left in the inbox from when it was async go first to keep commands
+  // in order
+  if (!async && inbox.isEmpty()) {
+    // Batch packets mustn't overwrite queued ones, so make room for them
+    if (currentBatchId != 0 && isLaneFull(priority)) {
+      spillLane(priority);
+    }
+
+    queuePacket(pending);
+    return;
+  }
+
+  // Batches which don't fit in their lane wait in the inbox.  Anything after
+  // them has to wait too.
+  if (!pushToInbox(pending)) {
+    Serial.println(F("WARNING: packet inbox full, dropping packet"));
+    ++inboxDrops;
+    releasePending(bulbId);
+
+    if (currentBatchId != 0) {
+      ++currentBatchDrops;
+    }
+  }
+}
+
+bool PacketSender::pushToInbox(const PendingPacket& pending) {
+  // The sender drains the inbox every loop, so it's only full while a burst of
+  // commands arrives.  Give it a chance to catch up before dropping anything,
+  // unless it already failed to.
+  unsigned long start = millis();
+  while (!inbox.push(pending)) {
+    if (!async) {
+      return false;
+    }
+    if (inboxWaitTimedOut || millis() - start >= MILIGHT_PACKET_INBOX_WAIT_MS) {
+      inboxWaitTimedOut = true;
+      return false;
+    }
+    delay(1);
+  }
+
+  inboxWaitTimedOut = false;
+  return true;
+}
+
+void PacketSender::spillLane(const PacketPriority priority) {
+  const size_t lane = static_cast<size_t>(priority);
+
+  // Each call sends at least one repeat or drops what can't be sent, so this
+  // finishes
+  while (isLaneFull(priority)) {
+    sendBatch(lane);
+  }
+}
+
+bool PacketSender::isLaneFull(const PacketPriority priority) const {
+  return queues[static_cast<size_t>(priority)].size() == MILIGHT_MAX_QUEUED_PACKETS;
+}
+
+uint16_t PacketSender::beginBatch() {
+  if (++lastBatchId == 0) {
+    ++lastBatchId;
+  }
+
+  currentBatchId = lastBatchId;
+  currentBatchStartMicros = micros();
+  currentBatchDrops = 0;
+
+  return currentBatchId;
+}
+
+size_t PacketSender::endBatch() {
+  if (currentBatchId == 0) {
+    return 0;
+  }
+
+  // Follows the batch's packets through the inbox so the sender knows when
+  // it has all of them
+  PendingPacket marker = PendingPacket();
+  marker.remoteConfig = nullptr;
+  marker.batchId = currentBatchId;
+  currentBatchId = 0;
+
+  if (!async && inbox.isEmpty()) {
+    queuePacket(marker);
+  } else if (!pushToInbox(marker)) {
+    Serial.println(F("WARNING: packet inbox full, batch may be delayed"));
+  }
+
+  return currentBatchDrops;
+}
+
+void PacketSender::queuePacket(const PendingPacket& pending) {
+  if (pending.remoteConfig == nullptr) {
+    sealBatch(pending.batchId);
+    return;
+  }
+
+  promotePackets(pending.bulbId, pending.priority);
+
+  queueInLane(pending);
+}
+
+void PacketSender::queueInLane(const PendingPacket& pending) {
+  size_t repeats = pending.repeatsOverride == DEFAULT_PACKET_SENDS_VALUE
+    ? repeatThrottle.repeatsFor(throttleKey(pending.bulbId))
+    : pending.repeatsOverride;
+
+  PacketQueue& queue = queues[static_cast<size_t>(pending.priority)];
+
+  PacketQueue::PushResult result = queue.push(
+    pending.packet,
+    pending.remoteConfig,
+    repeats,
+    pending.bulbId,
+    pending.commandClass,
+    pending.enqueuedAtMicros
+  );
+
+  // Packets which will never be sent aren't pending anymore
+  switch (result) {
+    case PacketQueue::PushResult::MERGED:
+    case PacketQueue::PushResult::DROPPED:
+      releasePending(pending.bulbId);
+      break;
+
+    case PacketQueue::PushResult::REPLACED:
+      releasePending(queue.evicted().bulbId);
+      batchPacketRemoved(queue.evicted().batchId, false);
+      break;
+
+    default:
+      break;
+  }
+
+  // The packet just queued is the newest
+  if (result == PacketQueue::PushResult::QUEUED || result == PacketQueue::PushResult::REPLACED) {
+    queue.at(queue.size() - 1).batchId = pending.batchId;
+    batchPacketQueued(pending.batchId, pending.enqueuedAtMicros);
+  }
+}
+
+void PacketSender::promotePackets(const BulbId& bulbId, const PacketPriority priority) {
+  while (true) {
+    // Oldest packet for the bulb in any lower lane.  Each lane is in the order
+    // it was queued, so only its first match needs looking at.
+    PacketQueue* from = nullptr;
+    size_t fromIx = 0;
+
+    for (size_t lane = static_cast<size_t>(priority) + 1; lane < NUM_PRIORITIES; ++lane) {
+      PacketQueue& queue = queues[lane];
+
+      for (size_t i = 0; i < queue.size(); ++i) {
+        const QueuedPacket& packet = queue.at(i);
+
+        // Group 0 overlaps every group on the device.  Packets already going
+        // out have reached the bulbs, and their repeats are ignored.
+        const bool sameBulb = packet.bulbId.deviceId == bulbId.deviceId
+          && packet.bulbId.deviceType == bulbId.deviceType
+          && (packet.bulbId.groupId == bulbId.groupId || packet.bulbId.groupId == 0 || bulbId.groupId == 0);
+
+        if (!sameBulb || packet.checkedOut) {
+          continue;
+        }
+
+        if (from == nullptr
+          || static_cast<int32_t>(packet.enqueuedAtMicros - from->at(fromIx).enqueuedAtMicros) < 0) {
+          from = &queue;
+          fromIx = i;
+        }
+        break;
+      }
+    }
+
+    if (from == nullptr) {
+      return;
+    }
+
+    QueuedPacket& packet = from->at(fromIx);
+    PendingPacket promoted;
+    memcpy(promoted.packet, packet.packet, packet.remoteConfig->packetFormatter->getPacketLength());
+    promoted.remoteConfig = packet.remoteConfig;
+    promoted.repeatsOverride = packet.repeatsOverride;
+    promoted.bulbId = packet.bulbId;
+    promoted.commandClass = packet.commandClass;
+    promoted.priority = priority;
+    promoted.enqueuedAtMicros = packet.enqueuedAtMicros;
+    promoted.batchId = packet.batchId;
+
+    // Queued again before it's removed so its batch isn't settled in between
+    queueInLane(promoted);
+    batchPacketRemoved(packet.batchId, false);
+    from->remove(fromIx);
+    ++promotedPacketCount;
+  }
+}
+
+PacketSender::TrackedBatch* PacketSender::findTrackedBatch(uint16_t batchId, bool create, uint32_t startMicros) {
+  if (batchId == 0) {
+    return nullptr;
+  }
+
+  TrackedBatch* free = nullptr;
+  TrackedBatch* oldest = nullptr;
+  const uint32_t now = micros();
+
+  for (size_t i = 0; i < MILIGHT_MAX_TRACKED_BATCHES; ++i) {
+    TrackedBatch& batch = trackedBatches[i];
+
+    if (batch.id == batchId) {
+      return &batch;
+    } else if (batch.id == 0) {
+      free = &batch;
+    } else if (oldest == nullptr || now - batch.startMicros > now - oldest->startMicros) {
+      oldest = &batch;
+    }
+  }
+
+  if (!create) {
+    return nullptr;
+  }
+
+  TrackedBatch* batch = free != nullptr ? free : oldest;
+  batch->id = batchId;
+  batch->startMicros = startMicros;
+  batch->packets = 0;
+  batch->queued = 0;
+  batch->unsent = 0;
+  batch->sealed = false;
+  batch->airborne = false;
+  batch->toAirMicros = 0;
+
+  return batch;
+}
+
+void PacketSender::batchPacketQueued(uint16_t batchId, uint32_t startMicros) {
+  TrackedBatch* batch = findTrackedBatch(batchId, true, startMicros);
+
+  if (batch == nullptr) {
+    return;
+  }
+
+  ++batch->packets;
+  ++batch->queued;
+  ++batch->unsent;
+
+  if (!batch->sealed && openBatchId != batchId) {
+    openBatchId = batchId;
+    openBatchSince = millis();
+  }
+}
+
+void PacketSender::batchPacketRemoved(uint16_t batchId, bool sent) {
+  TrackedBatch* batch = findTrackedBatch(batchId, false);
+
+  if (batch == nullptr) {
+    return;
+  }
+
+  --batch->queued;
+
+  // Dropped before it went out
+  if (!sent) {
+    --batch->packets;
+    --batch->unsent;
+  }
+
+  settleBatch(*batch);
+}
+
+void PacketSender::batchPacketFirstSent(uint16_t batchId) {
+  TrackedBatch* batch = findTrackedBatch(batchId, false);
+
+  if (batch != nullptr) {
+    --batch->unsent;
+    settleBatch(*batch);
+  }
+}
+
+void PacketSender::sealBatch(uint16_t batchId) {
+  if (openBatchId == batchId) {
+    openBatchId = 0;
+  }
+
+  // Nothing was queued if it isn't tracked yet, e.g. every packet was elided
+  TrackedBatch* batch = findTrackedBatch(batchId, false);
+
+  if (batch != nullptr) {
+    batch->sealed = true;
+    settleBatch(*batch);
+  }
+}
+
+void PacketSender::settleBatch(TrackedBatch& batch) {
+  if (!batch.sealed) {
+    return;
+  }
+
+  const uint32_t elapsed = micros() - batch.startMicros;
+
+  if (!batch.airborne && batch.unsent == 0 && batch.packets > 0) {
+    batch.airborne = true;
+    batch.toAirMicros = elapsed;
+    batchToAir.add(elapsed);
+  }
+
+  if (batch.queued == 0) {
+    if (batch.packets > 0) {
+      batchComplete.add(elapsed);
+
+      lastBatchStats.id = batch.id;
+      lastBatchStats.packets = batch.packets;
+      lastBatchStats.toAirMicros = batch.toAirMicros;
+      lastBatchStats.completeMicros = elapsed;
+    }
+
+    batch.id = 0;
+  }
+}
+
+const LatencyHistogram& PacketSender::batchToAirLatency() const {
+  return batchToAir;
+}
+
+const LatencyHistogram& PacketSender::batchCompleteLatency() const {
+  return batchComplete;
+}
+
+PacketBatchStats PacketSender::lastBatch() const {
+  return lastBatchStats;
+}
+
+void PacketSender::dispatchSentPackets() {
+  SentPacket sent;
+
+  while (outbox.pop(sent)) {
+    notifySent(sent.packet, *sent.remoteConfig, sent.batchId);
+    releasePending(sent.bulbId);
+  }
+}
+
+void PacketSender::notifySent(const uint8_t* packet, const MiLightRemoteConfig& remoteConfig, uint16_t batchId) {
+  if (packetSentHandler == nullptr) {
+    return;
+  }
+
+  uint8_t decoded[MILIGHT_MAX_PACKET_LENGTH];
+  remoteConfig.packetFormatter->decodePacket(packet, decoded);
 
-  queue.push(packet, remoteConfig, repeats);
+  packetSentHandler(decoded, remoteConfig, batchId);
+}
+
+bool PacketSender::hasPendingPackets(const BulbId& bulbId) const {
+  return pendingDevices[pendingSlot(bulbId)] > 0;
+}
+
+size_t PacketSender::pendingSlot(const BulbId& bulbId) {
+  return (bulbId.deviceId ^ (static_cast<size_t>(bulbId.deviceType) * 31)) % MILIGHT_PENDING_DEVICE_SLOTS;
+}
+
+void PacketSender::releasePending(const BulbId& bulbId) {
+  --pendingDevices[pendingSlot(bulbId)];
+}
+
+void PacketSender::setAsync(bool async) {
+  this->async = async;
+}
+
+bool PacketSender::isAsync() const {
+  return async;
 }
 
 void PacketSender::loop() {
-  // Switch to the next packet if we're done with the current one
-  if (packetRepeatsRemaining == 0 && !queue.isEmpty()) {
-    nextPacket();
+  // Drained even when not async, in case packets were left over from when it
+  // was.  Batch packets wait in the inbox for room in their lane.
+  bool batchBlocked = false;
+  PendingPacket* pending;
+  while ((pending = inbox.peek()) != nullptr) {
+    if (pending->batchId != 0 && pending->remoteConfig != nullptr && isLaneFull(pending->priority)) {
+      batchBlocked = true;
+      break;
+    }
+
+    queuePacket(*pending);
+    inbox.pop();
+  }
+
+  // Give the rest of a batch the chance to be enqueued so it all goes out
+  // together.  Only waits for so long in case the end of it was dropped.
+  if (openBatchId != 0 && !batchBlocked) {
+    if (millis() - openBatchSince < MILIGHT_BATCH_SEAL_TIMEOUT_MS) {
+      return;
+    }
+    openBatchId = 0;
+  }
+
+  int lane = nextLane();
+
+  if (lane < 0) {
+    return;
   }
 
-  // If there's a packet we're handling, deal with it
-  if (currentPacket != nullptr && packetRepeatsRemaining > 0) {
-    handleCurrentPacket();
+  --laneCredits[lane];
+  sendBatch(lane);
+}
+
+int PacketSender::nextLane() {
+  bool anyQueued = false;
+
+  for (size_t i = 0; i < NUM_PRIORITIES; ++i) {
+    if (!queues[i].isEmpty()) {
+      if (laneCredits[i] > 0) {
+        return i;
+      }
+      anyQueued = true;
+    }
+  }
+
+  if (!anyQueued) {
+    return -1;
+  }
+
+  // Every lane with something to send has used up its share.  Start a new round.
+  int lane = -1;
+  for (size_t i = 0; i < NUM_PRIORITIES; ++i) {
+    laneCredits[i] = LANE_WEIGHTS[i];
+
+    if (lane < 0 && !queues[i].isEmpty()) {
+      lane = i;
+    }
   }
+
+  return lane;
 }
 
 bool PacketSender::isSending() {
-  return packetRepeatsRemaining > 0 || !queue.isEmpty();
+  if (!inbox.isEmpty()) {
+    return true;
+  }
+
+  for (size_t i = 0; i < NUM_PRIORITIES; ++i) {
+    if (!queues[i].isEmpty()) {
+      return true;
+    }
+  }
+  return false;
 }
 
-void PacketSender::nextPacket() {
-#ifdef DEBUG_PRINTF
-  Serial.printf("Switching to next packet, %d packets in queue\n", queue.size());
-#endif
-  currentPacket = queue.pop();
+const MiLightRadioConfig* PacketSender::chooseRadioConfig(size_t lane) {
+  PacketQueue& queue = queues[lane];
+  const MiLightRadioConfig* headConfig = &queue.front().remoteConfig->radioConfig;
 
-  if (currentPacket->repeatsOverride > 0) {
-    packetRepeatsRemaining = currentPacket->repeatsOverride;
-  } else {
-    packetRepeatsRemaining = settings.packetRepeats;
+  if (!queue.front().checkedOut && headBypasses[lane] < MILIGHT_MAX_HEAD_BYPASSES) {
+    const size_t lookahead = std::min(queue.size(), static_cast<size_t>(MILIGHT_RADIO_BATCH_LOOKAHEAD));
+
+    // Packets for different radio configs are for different device types, so
+    // sending them out of order is safe.  Finish packets which are part way
+    // through being sent first, even if the radio has been reconfigured since.
+    for (size_t i = 1; i < lookahead; ++i) {
+      const MiLightRadioConfig* config = &queue.at(i).remoteConfig->radioConfig;
+
+      if (queue.at(i).checkedOut && config != headConfig) {
+        ++headBypasses[lane];
+        return config;
+      }
+    }
+
+    for (size_t i = 1; i < lookahead && !radioSwitchboard.isConfigured(headConfig); ++i) {
+      const MiLightRadioConfig* config = &queue.at(i).remoteConfig->radioConfig;
+
+      if (radioSwitchboard.isConfigured(config)) {
+        ++headBypasses[lane];
+        return config;
+      }
+    }
   }
 
-  // Adjust resend count according to throttling rules
-  updateResendCount();
+  headBypasses[lane] = 0;
+  return headConfig;
 }
 
-void PacketSender::handleCurrentPacket() {
-  // Always switch radio.  could've been listening in another context
-  radioSwitchboard.switchRadio(currentPacket->remoteConfig);
+size_t PacketSender::fillWindow(size_t lane, const MiLightRadioConfig* radioConfig, size_t* window) {
+  PacketQueue& queue = queues[lane];
+  size_t maxSize = std::max(
+    static_cast<size_t>(1),
+    std::min(packetInFlightWindow, static_cast<size_t>(MILIGHT_MAX_IN_FLIGHT_PACKETS))
+  );
+  size_t size = 0;
+  uint16_t windowBatchId = 0;
 
-  size_t numToSend = std::min(packetRepeatsRemaining, settings.packetRepeatsPerLoop);
-  sendRepeats(numToSend);
-  packetRepeatsRemaining -= numToSend;
+  for (size_t i = 0; i < queue.size() && size < maxSize; ++i) {
+    QueuedPacket& packet = queue.at(i);
 
-  // If we're done sending this packet, fire the sent packet callback
-  if (packetRepeatsRemaining == 0 && packetSentHandler != nullptr) {
-    packetSentHandler(currentPacket->packet, *currentPacket->remoteConfig);
+    if (&packet.remoteConfig->radioConfig != radioConfig) {
+      continue;
+    }
+
+    // A batch gets the largest window to itself so its bulbs switch together
+    if (size == 0) {
+      windowBatchId = packet.batchId;
+      if (windowBatchId != 0) {
+        maxSize = MILIGHT_MAX_IN_FLIGHT_PACKETS;
+      }
+    } else if (windowBatchId != 0 && packet.batchId != windowBatchId) {
+      continue;
+    }
+
+    bool olderPacketForDevice = false;
+    for (size_t j = 0; j < i && !olderPacketForDevice; ++j) {
+      const BulbId& other = queue.at(j).bulbId;
+      olderPacketForDevice = other.deviceId == packet.bulbId.deviceId
+        && other.deviceType == packet.bulbId.deviceType;
+    }
+
+    if (!olderPacketForDevice) {
+      window[size++] = i;
+    }
   }
-}
 
-size_t PacketSender::queueLength() const {
-  return queue.size();
+  return size;
 }
 
-size_t PacketSender::droppedPackets() const {
-  return queue.getDroppedPacketCount();
+void PacketSender::startPacket(QueuedPacket& packet) {
+  packet.checkedOut = true;
+
+  if (packet.repeatsOverride > 0) {
+    packet.repeatsRemaining = packet.repeatsOverride;
+  } else {
+    packet.repeatsRemaining = packetRepeats;
+  }
+
+  // Adjust resend count according to throttling rules
+  repeatThrottle.recordSend(throttleKey(packet.bulbId), millis());
 }
 
-void PacketSender::sendRepeats(size_t num) {
-  size_t len = currentPacket->remoteConfig->packetFormatter->getPacketLength();
+void PacketSender::sendBatch(size_t lane) {
+  PacketQueue& queue = queues[lane];
+  size_t window[MILIGHT_MAX_IN_FLIGHT_PACKETS];
+  const MiLightRadioConfig* radioConfig = chooseRadioConfig(lane);
+  const size_t windowSize = fillWindow(lane, radioConfig, window);
 
-#ifdef DEBUG_PRINTF
-  Serial.printf_P(PSTR("Sending packet (%d repeats): \n"), num);
-  for (size_t i = 0; i < len; i++) {
-    Serial.printf_P(PSTR("%02X "), currentPacket->packet[i]);
+  // When there's a time budget, it covers everything including the radio switch
+  const bool timeBudgeted = packetSendBudgetMicros > 0;
+  const uint64_t budgetCycles = static_cast<uint64_t>(packetSendBudgetMicros) * ESP.getCpuFreqMHz();
+  const uint32_t batchStart = ESP.getCycleCount();
+
+  // Always switch radio.  could've been listening in another context.  Everything
+  // in the window shares a radio config.
+  const MiLightRemoteConfig* remoteConfig = queue.at(window[0]).remoteConfig;
+  const bool reconfiguring = !radioSwitchboard.isConfigured(radioConfig);
+
+  if (radioSwitchboard.switchRadio(remoteConfig) == nullptr) {
+    dropUnroutable(lane, window, windowSize);
+    return;
+  }
+
+  if (reconfiguring) {
+    radioSwitchCounter.add();
+  }
+
+  for (size_t i = 0; i < windowSize; ++i) {
+    QueuedPacket& packet = queue.at(window[i]);
+    if (!packet.checkedOut) {
+      startPacket(packet);
+    }
+  }
+
+  // Packets part way through being sent may have been encoded for another module
+  const size_t module = radioSwitchboard.transmitModule();
+  for (size_t i = 0; i < windowSize; ++i) {
+    QueuedPacket& packet = queue.at(window[i]);
+    if (packet.encodedLength == 0 || packet.encodedModule != module) {
+      packet.encodedLength = radioSwitchboard.encode(
+        packet.packet,
+        packet.remoteConfig->packetFormatter->getPacketLength(),
+        packet.encodedPacket
+      );
+      packet.encodedModule = module;
+    }
   }
-  Serial.println();
+
+  size_t repeatsLeft = timeBudgeted ? SIZE_MAX : packetRepeatsPerLoop;
+  size_t repeatsSent = 0;
+  size_t cursor = laneCursors[lane] % windowSize;
+  size_t idleSteps = 0;
+
+#ifdef DEBUG_PRINTF
+  Serial.printf_P(PSTR("Sending batch from %d packets in lane %d\n"), windowSize, lane);
   int iStart = millis();
 #endif
 
-  for (size_t i = 0; i < num; ++i) {
-    radioSwitchboard.write(currentPacket->packet, len);
+  // Send one repeat from each packet in turn so that every bulb in the window
+  // reacts at about the same time
+  while (repeatsLeft > 0 && idleSteps < windowSize) {
+    QueuedPacket& packet = queue.at(window[cursor]);
+
+    if (packet.repeatsRemaining == 0) {
+      cursor = (cursor + 1) % windowSize;
+      ++idleSteps;
+      continue;
+    }
+
+    // Always send at least one repeat so the queue makes progress
+    if (timeBudgeted
+      && repeatsSent > 0
+      && static_cast<uint64_t>(ESP.getCycleCount() - batchStart) + cyclesPerRepeat > budgetCycles) {
+      break;
+    }
+
+    cursor = (cursor + 1) % windowSize;
+
+    if (packet.repeatsSent == 0) {
+      unsigned long latency = millis() - packet.enqueuedAt;
+      ++firstSendPackets[lane];
+      totalFirstSendMillis[lane] += latency;
+      maxFirstSendMillis[lane] = std::max(maxFirstSendMillis[lane], latency);
+      commandToAir.add(micros() - packet.enqueuedAtMicros);
+      batchPacketFirstSent(packet.batchId);
+    }
+
+    // Fall back to having the radio frame the packet if the encoded one is refused
+    if (packet.encodedLength > 0 && !radioSwitchboard.writeEncoded(packet.encodedPacket, packet.encodedLength)) {
+      ++writeFailureCount;
+      packet.encodedLength = 0;
+    }
+
+    if (packet.encodedLength == 0
+      && !radioSwitchboard.write(packet.packet, packet.remoteConfig->packetFormatter->getPacketLength())) {
+      ++writeFailureCount;
+    }
+    --packet.repeatsRemaining;
+    ++packet.repeatsSent;
+    --repeatsLeft;
+    ++repeatsSent;
+    idleSteps = 0;
+  }
+
+  laneCursors[lane] = cursor;
+  repeatCounter.add(repeatsSent);
+
+  if (timeBudgeted) {
+    const uint32_t elapsed = ESP.getCycleCount() - batchStart;
+
+    if (elapsed > budgetCycles) {
+      ++budgetOverrunCount;
+    }
+
+    if (repeatsSent > 0) {
+      const uint32_t sample = elapsed / repeatsSent;
+      cyclesPerRepeat = cyclesPerRepeat == 0 ? sample : (cyclesPerRepeat * 3 + sample) / 4;
+    }
   }
 
 #ifdef DEBUG_PRINTF
@@ -105,21 +752,166 @@ void PacketSender::sendRepeats(size_t num) {
   Serial.print("Elapsed: ");
   Serial.println(iElapsed);
 #endif
+
+  for (size_t i = 0; i < windowSize; ++i) {
+    QueuedPacket& packet = queue.at(window[i]);
+    if (packet.repeatsRemaining == 0) {
+      finishPacket(lane, packet);
+    }
+  }
+
+  // Back to front so the indexes of the packets still to be removed don't shift
+  for (size_t i = windowSize; i > 0; --i) {
+    if (queue.at(window[i - 1]).repeatsRemaining == 0) {
+      queue.remove(window[i - 1]);
+    }
+  }
+}
+
+void PacketSender::dropUnroutable(size_t lane, const size_t* window, size_t windowSize) {
+  PacketQueue& queue = queues[lane];
+
+  Serial.println(F("WARNING: no radio module can send packets for this remote type, dropping them"));
+
+  // Back to front so the indexes of the packets still to be removed don't shift
+  for (size_t i = windowSize; i > 0; --i) {
+    QueuedPacket& packet = queue.at(window[i - 1]);
+
+    batchPacketRemoved(packet.batchId, false);
+    releasePending(packet.bulbId);
+    queue.remove(window[i - 1]);
+    ++unroutableDrops;
+  }
+}
+
+size_t PacketSender::radioSwitches() const {
+  return radioSwitchCounter.getTotal();
+}
+
+size_t PacketSender::radioSwitchesPerSecond() const {
+  return radioSwitchCounter.perSecond();
+}
+
+size_t PacketSender::repeatsPerSecond() const {
+  return repeatCounter.perSecond();
+}
+
+size_t PacketSender::budgetOverruns() const {
+  return budgetOverrunCount;
+}
+
+size_t PacketSender::writeFailures() const {
+  return writeFailureCount;
+}
+
+const LatencyHistogram& PacketSender::commandToAirLatency() const {
+  return commandToAir;
 }
 
-void PacketSender::updateResendCount() {
-  unsigned long now = millis();
-  long millisSinceLastSend = now - lastSend;
-  long x = (millisSinceLastSend - settings.packetRepeatThrottleThreshold);
-  long delta = x * throttleMultiplier;
-  int signedResends = static_cast<int>(this->currentResendCount) + delta;
+void PacketSender::finishPacket(size_t lane, QueuedPacket& packet) {
+  unsigned long waited = millis() - packet.enqueuedAt;
+  ++sentPackets[lane];
+  totalWaitMillis[lane] += waited;
+  maxWaitMillis[lane] = std::max(maxWaitMillis[lane], waited);
+  batchPacketRemoved(packet.batchId, true);
 
-  if (signedResends < static_cast<int>(settings.packetRepeatMinimum)) {
-    signedResends = settings.packetRepeatMinimum;
-  } else if (signedResends > static_cast<int>(settings.packetRepeats)) {
-    signedResends = settings.packetRepeats;
+  if (!async) {
+    notifySent(packet.packet, *packet.remoteConfig, packet.batchId);
+    releasePending(packet.bulbId);
+    return;
   }
 
-  this->currentResendCount = signedResends;
-  this->lastSend = now;
-}
\ No newline at end of file
+  SentPacket sent;
+  memcpy(sent.packet, packet.packet, packet.remoteConfig->packetFormatter->getPacketLength());
+  sent.remoteConfig = packet.remoteConfig;
+  sent.bulbId = packet.bulbId;
+  sent.batchId = packet.batchId;
+
+  // The handler won't be called, so state won't be updated.  Better than
+  // stalling the radio.
+  if (!outbox.push(sent)) {
+    Serial.println(F("WARNING: sent packet outbox full, state not updated"));
+    releasePending(packet.bulbId);
+  }
+}
+
+size_t PacketSender::queueLength() const {
+  size_t total = inbox.size();
+  for (size_t i = 0; i < NUM_PRIORITIES; ++i) {
+    total += queues[i].size();
+  }
+  return total;
+}
+
+size_t PacketSender::queueLength(const PacketPriority priority) const {
+  return queues[static_cast<size_t>(priority)].size();
+}
+
+PacketLaneStats PacketSender::laneStats(const PacketPriority priority) const {
+  const size_t lane = static_cast<size_t>(priority);
+
+  PacketLaneStats stats;
+  stats.queueLength = queues[lane].size();
+  stats.sentPackets = sentPackets[lane];
+  stats.maxWaitMillis = maxWaitMillis[lane];
+  stats.totalWaitMillis = totalWaitMillis[lane];
+  stats.firstSendPackets = firstSendPackets[lane];
+  stats.maxFirstSendMillis = maxFirstSendMillis[lane];
+  stats.totalFirstSendMillis = totalFirstSendMillis[lane];
+
+  return stats;
+}
+
+size_t PacketSender::droppedPackets() const {
+  size_t total = inboxDrops + unroutableDrops;
+  for (size_t i = 0; i < NUM_PRIORITIES; ++i) {
+    total += queues[i].getDroppedPacketCount();
+  }
+  return total;
+}
+
+size_t PacketSender::mergedPackets() const {
+  size_t total = 0;
+  for (size_t i = 0; i < NUM_PRIORITIES; ++i) {
+    total += queues[i].getMergedPacketCount();
+  }
+  return total;
+}
+
+size_t PacketSender::promotedPackets() const {
+  return promotedPacketCount;
+}
+
+size_t PacketSender::enqueuedPackets() const {
+  size_t total = 0;
+  for (size_t i = 0; i < NUM_PRIORITIES; ++i) {
+    total += queues[i].getEnqueuedPacketCount();
+  }
+  return total;
+}
+
+size_t PacketSender::dequeuedPackets() const {
+  size_t total = 0;
+  for (size_t i = 0; i < NUM_PRIORITIES; ++i) {
+    total += queues[i].getDequeuedPacketCount();
+  }
+  return total;
+}
+
+const RepeatThrottle& PacketSender::repeatThrottling() const {
+  return repeatThrottle;
+}
+
+uint32_t PacketSender::throttleKey(const BulbId& bulbId) {
+  return (static_cast<uint32_t>(bulbId.deviceType) << 24)
+    | (static_cast<uint32_t>(bulbId.groupId) << 16)
+    | bulbId.deviceId;
+}
+
+BulbId PacketSender::throttleKeyToBulbId(uint32_t key) {
+  return BulbId(
+    key & 0xFFFF,
+    (key >> 16) & 0xFF,
+    static_cast<MiLightRemoteType>(key >> 24)
+  );
+}
@@ -4,11 +4,114 @@
 #include <MiLightRemoteConfig.h>
 #include <PacketQueue.h>
 #include <RadioSwitchboard.h>
+#include <RateCounter.h>
+#include <LatencyHistogram.h>
+#include <SpscQueue.h>
+#include <atomic>
+#include <RepeatThrottle.h>
+
+// Upper bound for Settings::packetInFlightWindow
+#ifndef MILIGHT_MAX_IN_FLIGHT_PACKETS
+#define MILIGHT_MAX_IN_FLIGHT_PACKETS 8
+#endif
+
+// Number of packets from the front of a lane which are considered when looking
+// for one that can go out without reconfiguring the radio
+#ifndef MILIGHT_RADIO_BATCH_LOOKAHEAD
+#define MILIGHT_RADIO_BATCH_LOOKAHEAD 8
+#endif
+
+// Number of batches the oldest packet in a lane can be held back for while
+// packets using the current radio config are sent first
+#ifndef MILIGHT_MAX_HEAD_BYPASSES
+#define MILIGHT_MAX_HEAD_BYPASSES 8
+#endif
+
+// Packets enqueued from another task wait here until the sender picks them up.
+// Must be a power of two.
+#ifndef MILIGHT_PACKET_INBOX_SIZE
+#define MILIGHT_PACKET_INBOX_SIZE 32
+#endif
+
+// Sent packets waiting for the sent packet handler to be called from the task
+// which enqueues.  Must be a power of two.
+#ifndef MILIGHT_PACKET_OUTBOX_SIZE
+#define MILIGHT_PACKET_OUTBOX_SIZE 32
+#endif
+
+// Number of counters used to track which devices have packets pending
+#ifndef MILIGHT_PENDING_DEVICE_SLOTS
+#define MILIGHT_PENDING_DEVICE_SLOTS 32
+#endif
+
+// How long enqueue() waits for room in a full inbox before dropping the packet.
+// Once it's given up, packets are dropped without waiting until there's room
+// again, so a stuck sender only holds up the caller once.
+#ifndef MILIGHT_PACKET_INBOX_WAIT_MS
+#define MILIGHT_PACKET_INBOX_WAIT_MS 100
+#endif
+
+// Batches tracked at once for latency stats.  Stats for the oldest are given up
+// if more are in the queue at the same time.
+#ifndef MILIGHT_MAX_TRACKED_BATCHES
+#define MILIGHT_MAX_TRACKED_BATCHES 4
+#endif
+
+// How long sending is held back waiting for the rest of a batch to be enqueued
+#ifndef MILIGHT_BATCH_SEAL_TIMEOUT_MS
+#define MILIGHT_BATCH_SEAL_TIMEOUT_MS 50
+#endif
+
+// Lanes are served highest priority first.  Lower lanes are still given a share
+// of the radio (see PacketSender::LANE_WEIGHTS) so they can't be starved.
+enum class PacketPriority : uint8_t {
+  // Commands from a user (MQTT, HTTP, UDP, ...)
+  INTERACTIVE = 0,
+  // Steps generated by running transitions
+  TRANSITION = 1,
+  // Anything which can wait, e.g. retained commands replayed by the MQTT
+  // broker after (re)connecting
+  BACKGROUND = 2
+};
+
+struct PacketLaneStats {
+  size_t queueLength;
+  size_t sentPackets;
+  // Time between a packet being queued and its last repeat going out
+  unsigned long maxWaitMillis;
+  unsigned long totalWaitMillis;
+
+  // Time between a packet being queued and its first repeat going out
+  size_t firstSendPackets;
+  unsigned long maxFirstSendMillis;
+  unsigned long totalFirstSendMillis;
+
+  unsigned long averageWaitMillis() const;
+  unsigned long averageFirstSendMillis() const;
+};
+
+struct PacketBatchStats {
+  uint16_t id;
+  size_t packets;
+  // Time between beginBatch() and the first repeat of every packet in the
+  // batch having gone out
+  uint32_t toAirMicros;
+  // Time between beginBatch() and the last repeat going out
+  uint32_t completeMicros;
+};
 
 class PacketSender {
 public:
-  typedef std::function<void(uint8_t* packet, const MiLightRemoteConfig& config)> PacketSentHandler;
+  // Called with packets after they're sent, decoded (see
+  // PacketFormatter::decodePacket).  batchId is the batch the packet was part
+  // of (see beginBatch()), or 0.
+  typedef std::function<void(uint8_t* packet, const MiLightRemoteConfig& config, uint16_t batchId)> PacketSentHandler;
   static const size_t DEFAULT_PACKET_SENDS_VALUE = 0;
+  static const size_t NUM_PRIORITIES = 3;
+
+  // Number of batches of repeats each lane may send per scheduling round, indexed
+  // by PacketPriority
+  static const uint8_t LANE_WEIGHTS[NUM_PRIORITIES];
 
   PacketSender(
     RadioSwitchboard& radioSwitchboard,
@@ -16,59 +119,283 @@ public:
     PacketSentHandler packetSentHandler
   );
 
-  void enqueue(uint8_t* packet, const MiLightRemoteConfig* remoteConfig, const size_t repeatsOverride = 0);
+  // Packets with a command class other than NONE supersede a pending packet for
+  // the same bulb and command class in the same lane.  See PacketQueue.
+  void enqueue(
+    uint8_t* packet,
+    const MiLightRemoteConfig* remoteConfig,
+    const size_t repeatsOverride = 0,
+    const BulbId& bulbId = DEFAULT_BULB_ID,
+    const PacketCommandClass commandClass = PacketCommandClass::NONE,
+    const PacketPriority priority = PacketPriority::INTERACTIVE
+  );
   void loop();
 
+  /*
+   * When async, enqueue() and loop() may be called from different tasks (one
+   * each).  Enqueued packets are passed through a lock-free queue and picked up
+   * at the start of the next loop().  The sent packet handler is called from
+   * dispatchSentPackets() instead of loop().  Stats are only approximate when
+   * read from a task other than the one calling loop().
+   */
+  void setAsync(bool async);
+  bool isAsync() const;
+
+  // When async, call the sent packet handler for packets which have gone out.
+  // Call from the task which enqueues.
+  void dispatchSentPackets();
+
+  /*
+   * True if a packet for the device (any group) has been enqueued and its sent
+   * packet handler hasn't been called yet, meaning state for the device may be
+   * about to change.  Devices share counters, so this can be true when
+   * nothing is pending, but never the other way around.
+   */
+  bool hasPendingPackets(const BulbId& bulbId) const;
+
+  /*
+   * Packets enqueued between beginBatch() and endBatch() are scheduled as one
+   * unit.  Nothing is sent until the whole batch is queued (or it doesn't fit
+   * in its lane), and batch packets are interleaved with each other rather than
+   * with whatever else is queued, using the largest in-flight window available.
+   * When not async, a batch bigger than its lane is sent as it's queued to make
+   * room, so its first packets go out before its last are queued.
+   *
+   * Call both from the task which enqueues.  beginBatch() returns the id of the
+   * batch, endBatch() the number of its packets dropped because the inbox
+   * stayed full.
+   */
+  uint16_t beginBatch();
+  size_t endBatch();
+
+  // Time between beginBatch() and the first repeat of every packet in a batch
+  // going out, and the last repeat going out
+  const LatencyHistogram& batchToAirLatency() const;
+  const LatencyHistogram& batchCompleteLatency() const;
+  // The most recently completed batch
+  PacketBatchStats lastBatch() const;
+
   // Return true if there are queued packets
   bool isSending();
 
   // Return the number of queued packets
   size_t queueLength() const;
+  size_t queueLength(const PacketPriority priority) const;
+  PacketLaneStats laneStats(const PacketPriority priority) const;
+
   size_t droppedPackets() const;
+  size_t mergedPackets() const;
+  // Packets moved to a higher lane to stay ahead of a newer command for the
+  // same bulb
+  size_t promotedPackets() const;
+
+  // Lifetime counters for the queue.  Used to verify packets flow through
+  // without being lost.
+  size_t enqueuedPackets() const;
+  size_t dequeuedPackets() const;
+
+  // Number of times sending a batch required the radio to be reconfigured
+  size_t radioSwitches() const;
+  // Radio switches during the last full second
+  size_t radioSwitchesPerSecond() const;
+
+  // Repeats sent during the last full second
+  size_t repeatsPerSecond() const;
+  // Number of loop() calls which took longer than Settings::packetSendBudgetMicros
+  size_t budgetOverruns() const;
+  // Repeats the radio refused to send
+  size_t writeFailures() const;
+
+  // Time between enqueue() and the first repeat of the packet going out, across
+  // all lanes
+  const LatencyHistogram& commandToAirLatency() const;
+
+  // Bulbs recently sent to, and how many repeats their next packet gets
+  const RepeatThrottle& repeatThrottling() const;
+
+  // Keys in repeatThrottling() for each bulb
+  static uint32_t throttleKey(const BulbId& bulbId);
+  static BulbId throttleKeyToBulbId(uint32_t key);
 
 private:
+  struct PendingPacket {
+    uint8_t packet[MILIGHT_MAX_PACKET_LENGTH];
+    const MiLightRemoteConfig* remoteConfig;
+    size_t repeatsOverride;
+    BulbId bulbId;
+    PacketCommandClass commandClass;
+    PacketPriority priority;
+    uint32_t enqueuedAtMicros;
+    // Marks the end of the batch when remoteConfig is null
+    uint16_t batchId;
+  };
+
+  struct TrackedBatch {
+    uint16_t id;
+    uint32_t startMicros;
+    size_t packets;
+    // Packets still in a lane
+    size_t queued;
+    // Packets whose first repeat hasn't gone out
+    size_t unsent;
+    bool sealed;
+    // Set once every packet's first repeat has gone out
+    bool airborne;
+    uint32_t toAirMicros;
+  };
+
+  struct SentPacket {
+    uint8_t packet[MILIGHT_MAX_PACKET_LENGTH];
+    const MiLightRemoteConfig* remoteConfig;
+    BulbId bulbId;
+    uint16_t batchId;
+  };
+
   RadioSwitchboard& radioSwitchboard;
-  Settings& settings;
+  // Copied from settings so they can change while the radio task runs.  A new
+  // PacketSender is made to apply them.
+  const size_t packetRepeats;
+  const size_t packetRepeatsPerLoop;
+  const size_t packetInFlightWindow;
+  const uint32_t packetSendBudgetMicros;
   GroupStateStore* stateStore;
-  PacketQueue queue;
+  PacketQueue queues[NUM_PRIORITIES];
+
+  bool async;
+  SpscQueue<PendingPacket, MILIGHT_PACKET_INBOX_SIZE> inbox;
+  // Packets dropped because the inbox stayed full
+  size_t inboxDrops;
+  // Set when waiting for room in the inbox timed out, until there's room again
+  bool inboxWaitTimedOut;
+  // Packets dropped because no radio module can send them
+  size_t unroutableDrops;
+  SpscQueue<SentPacket, MILIGHT_PACKET_OUTBOX_SIZE> outbox;
+
+  // Packets enqueued and not yet handled, counted per device (hashed).
+  // Incremented by the enqueuing task, decremented by either.
+  std::atomic<uint16_t> pendingDevices[MILIGHT_PENDING_DEVICE_SLOTS];
+
+  // Batch being enqueued.  Only touched by the enqueuing task.
+  uint16_t lastBatchId;
+  uint16_t currentBatchId;
+  uint32_t currentBatchStartMicros;
+  size_t currentBatchDrops;
+
+  // Batch which has packets queued but hasn't been sealed yet, and when its
+  // first packet was queued.  Sending waits for it.
+  uint16_t openBatchId;
+  unsigned long openBatchSince;
+
+  TrackedBatch trackedBatches[MILIGHT_MAX_TRACKED_BATCHES];
+  LatencyHistogram batchToAir;
+  LatencyHistogram batchComplete;
+  PacketBatchStats lastBatchStats;
+
+  static size_t pendingSlot(const BulbId& bulbId);
+  void releasePending(const BulbId& bulbId);
+  // Calls packetSentHandler with the decoded packet
+  void notifySent(const uint8_t* packet, const MiLightRemoteConfig& remoteConfig, uint16_t batchId);
+
+  // Batches each lane has left in the current scheduling round
+  uint8_t laneCredits[NUM_PRIORITIES];
+
+  // Position in the in-flight window the next repeat for each lane is sent from
+  size_t laneCursors[NUM_PRIORITIES];
 
-  // The current packet we're sending and the number of repeats left
-  std::shared_ptr<QueuedPacket> currentPacket;
-  size_t packetRepeatsRemaining;
+  // Batches sent from each lane in a row without including its oldest packet
+  uint8_t headBypasses[NUM_PRIORITIES];
+
+  RateCounter radioSwitchCounter;
+  RateCounter repeatCounter;
+
+  // Used when sending is limited by time rather than number of repeats.
+  // Cycles per repeat is a moving average, used to predict whether another
+  // repeat fits in what's left of the budget.
+  size_t budgetOverrunCount;
+  uint32_t cyclesPerRepeat;
+  size_t writeFailureCount;
+
+  LatencyHistogram commandToAir;
+
+  size_t sentPackets[NUM_PRIORITIES];
+  unsigned long maxWaitMillis[NUM_PRIORITIES];
+  unsigned long totalWaitMillis[NUM_PRIORITIES];
+  size_t firstSendPackets[NUM_PRIORITIES];
+  unsigned long maxFirstSendMillis[NUM_PRIORITIES];
+  unsigned long totalFirstSendMillis[NUM_PRIORITIES];
 
   // Handler called after packets are sent.  Will not be called multiple times
   // per repeat.
   PacketSentHandler packetSentHandler;
 
-  // Send a batch of repeats for the current packet
-  void handleCurrentPacket();
+  // Put a packet in its lane
+  void queuePacket(const PendingPacket& pending);
+  void queueInLane(const PendingPacket& pending);
+
+  // Moves pending packets in lower lanes which affect the bulb to the given
+  // lane, oldest first, so they can't go out after a newer command
+  void promotePackets(const BulbId& bulbId, const PacketPriority priority);
+  size_t promotedPacketCount;
+
+  // Hand a packet to the sending task.  Waits for room in the inbox for a while.
+  bool pushToInbox(const PendingPacket& pending);
+  // Send from a full lane until there's room in it.  Only when not async.
+  void spillLane(const PacketPriority priority);
+
+  bool isLaneFull(const PacketPriority priority) const;
+
+  // Batch latency tracking.  Returns null if the batch isn't tracked (and
+  // create is false, or there's no room).
+  TrackedBatch* findTrackedBatch(uint16_t batchId, bool create, uint32_t startMicros = 0);
+  void sealBatch(uint16_t batchId);
+  void batchPacketQueued(uint16_t batchId, uint32_t startMicros);
+  void batchPacketRemoved(uint16_t batchId, bool sent);
+  void batchPacketFirstSent(uint16_t batchId);
+  // Record stats if the batch is sealed and has made it out
+  void settleBatch(TrackedBatch& batch);
 
-  // Switch to the next packet in the queue
-  void nextPacket();
+  // Pick the lane to send the next batch from, or -1 if all are empty
+  int nextLane();
 
-  // Send repeats of the current packet N times
-  void sendRepeats(size_t num);
+  // Send a batch of repeats from the packets in flight in the given lane
+  void sendBatch(size_t lane);
+
+  // Drop the packets in the window without calling the sent packet handler,
+  // when no radio module can send them
+  void dropUnroutable(size_t lane, const size_t* window, size_t windowSize);
+
+  /*
+   * Picks the radio config the next batch from the given lane is sent with.
+   * Packets part way through being sent are finished first.  Otherwise sticks
+   * with radio configs which are already set up while there's a packet for one
+   * near the front of the lane, so packets for different radios are grouped
+   * together.  The oldest packet is only held back for a bounded number of
+   * batches.
+   */
+  const MiLightRadioConfig* chooseRadioConfig(size_t lane);
+
+  /*
+   * Finds the packets in the given lane whose repeats may be interleaved and
+   * writes their queue indexes to window.  These are the oldest packets which
+   * use the given radio config, at most one per device.  Packets for a device
+   * with an older packet still queued are left out, so commands for a device
+   * always go out in order.
+   */
+  size_t fillWindow(size_t lane, const MiLightRadioConfig* radioConfig, size_t* window);
 
-  // Used to track auto repeat limiting
-  unsigned long lastSend;
-  uint8_t currentResendCount;
+  // Set up repeats for a packet the first time it's put in flight
+  void startPacket(QueuedPacket& packet);
 
-  // This will be pre-computed, but is simply:
-  //
-  //    (sensitivity / 1000.0) * R
-  //
-  // Where R is the base number of repeats.
-  size_t throttleMultiplier;
+  // Record stats and fire the sent packet callback
+  void finishPacket(size_t lane, QueuedPacket& packet);
 
   /*
-   * Calculates the number of resend packets based on when the last packet
-   * was sent using this function:
+   * Auto repeat limiting, tracked per bulb.  See RepeatThrottle.  The
+   * multiplier is pre-computed, but is simply:
    *
-   *    lastRepeatsValue + (millisSinceLastSend - THRESHOLD) * throttleMultiplier
+   *    (sensitivity / 1000.0) * R
    *
-   * When the last send was more recent than THRESHOLD, the number of repeats
-   * will be decreased to a minimum of zero.  When less recent, it will be
-   * increased up to a maximum of the default resend count.
+   * Where R is the base number of repeats.
    */
-  void updateResendCount();
-};
\ No newline at end of file
+  RepeatThrottle repeatThrottle;
+};
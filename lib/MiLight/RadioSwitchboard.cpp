@@ -1,14 +1,47 @@
 #include <RadioSwitchboard.h>
 
 RadioSwitchboard::RadioSwitchboard(
-  std::shared_ptr<MiLightRadioFactory> radioFactory,
+  const std::vector<std::shared_ptr<MiLightRadioFactory>>& radioFactories,
   GroupStateStore* stateStore,
   Settings& settings
-) {
-  for (size_t i = 0; i < MiLightRadioConfig::NUM_CONFIGS; i++) {
-    std::shared_ptr<MiLightRadio> radio = radioFactory->create(MiLightRadioConfig::ALL_CONFIGS[i]);
-    radio->begin();
-    radios.push_back(radio);
+) : factories(radioFactories)
+  , txModule(RadioRouter::NONE)
+  , rxModule(RadioRouter::NONE)
+  , receivedPackets(0)
+  , ringOverflows(0)
+  , maxIrqLatencyMicros(0)
+{
+  for (size_t m = 0; m < factories.size(); m++) {
+    std::vector<std::shared_ptr<MiLightRadio>> moduleRadios;
+
+    for (size_t i = 0; i < MiLightRadioConfig::NUM_CONFIGS; i++) {
+      std::shared_ptr<MiLightRadio> radio = factories[m]->create(MiLightRadioConfig::ALL_CONFIGS[i]);
+      radio->begin();
+      moduleRadios.push_back(radio);
+    }
+
+    RadioModuleSpec spec;
+    spec.role = factories[m]->getRole();
+    spec.pinnedConfigs = 0;
+
+    const std::vector<MiLightRemoteType>& remoteTypes = factories[m]->getRemoteTypes();
+    for (size_t i = 0; i < remoteTypes.size(); i++) {
+      const MiLightRemoteConfig* remote = MiLightRemoteConfig::fromType(remoteTypes[i]);
+
+      if (remote != NULL) {
+        spec.pinnedConfigs |= 1UL << configIndex(&remote->radioConfig);
+      }
+    }
+
+    radios.push_back(moduleRadios);
+    router.addModule(spec);
+
+    const int8_t irqPin = factories[m]->getIrqPin();
+    if (irqPin >= 0) {
+      irqs.emplace_back(new RadioIrq(irqPin, factories[m]->isIrqActiveLow()));
+    } else {
+      irqs.emplace_back(nullptr);
+    }
   }
 
   for (size_t i = 0; i < MiLightRemoteConfig::NUM_REMOTES; i++) {
@@ -17,7 +50,18 @@ RadioSwitchboard::RadioSwitchboard(
 }
 
 size_t RadioSwitchboard::getNumRadios() const {
-  return radios.size();
+  return MiLightRadioConfig::NUM_CONFIGS;
+}
+
+bool RadioSwitchboard::isConfigured(const MiLightRadioConfig* config) const {
+  const size_t configIx = configIndex(config);
+  const size_t module = router.transmitterFor(configIx);
+
+  return module != RadioRouter::NONE && router.tunedConfig(module) == configIx;
+}
+
+bool RadioSwitchboard::hasDedicatedReceiver() const {
+  return router.hasDedicatedReceiver();
 }
 
 std::shared_ptr<MiLightRadio> RadioSwitchboard::switchRadio(size_t radioIx) {
@@ -25,50 +69,209 @@ std::shared_ptr<MiLightRadio> RadioSwitchboard::switchRadio(size_t radioIx) {
     return NULL;
   }
 
-  if (this->currentRadio != radios[radioIx]) {
-    this->currentRadio = radios[radioIx];
-    this->currentRadio->configure();
+  rxModule = router.receiver();
+
+  if (rxModule == RadioRouter::NONE) {
+    return NULL;
   }
 
-  return this->currentRadio;
+  return tune(rxModule, radioIx);
 }
 
 std::shared_ptr<MiLightRadio> RadioSwitchboard::switchRadio(const MiLightRemoteConfig* remote) {
-  std::shared_ptr<MiLightRadio> radio = NULL;
+  txModule = router.transmitterFor(configIndex(&remote->radioConfig));
+
+  if (txModule == RadioRouter::NONE) {
+    return NULL;
+  }
+
+  return tune(txModule, configIndex(&remote->radioConfig));
+}
+
+std::shared_ptr<MiLightRadio> RadioSwitchboard::tune(size_t module, size_t configIx) {
+  std::shared_ptr<MiLightRadio> radio = radios[module][configIx];
+
+  if (router.tune(module, configIx)) {
+    radio->configure();
 
-  for (size_t i = 0; i < radios.size(); i++) {
-    if (&this->radios[i]->config() == &remote->radioConfig) {
-      radio = switchRadio(i);
-      break;
+    // Anything left was heard with the old config
+    if (module == rxModule) {
+      clearReceivedFrames();
     }
   }
 
   return radio;
 }
 
-void RadioSwitchboard::write(uint8_t* packet, size_t len) {
-  if (this->currentRadio == nullptr) {
-    return;
+std::shared_ptr<MiLightRadio> RadioSwitchboard::currentRadio(size_t module) const {
+  if (module == RadioRouter::NONE) {
+    return nullptr;
   }
 
-  this->currentRadio->write(packet, len);
+  size_t configIx = router.tunedConfig(module);
+  if (configIx == RadioRouter::NONE) {
+    return nullptr;
+  }
+
+  return radios[module][configIx];
+}
+
+size_t RadioSwitchboard::configIndex(const MiLightRadioConfig* config) {
+  return config - MiLightRadioConfig::ALL_CONFIGS;
+}
+
+bool RadioSwitchboard::write(uint8_t* packet, size_t len) {
+  std::shared_ptr<MiLightRadio> radio = currentRadio(txModule);
+
+  if (radio == nullptr) {
+    return false;
+  }
+
+  return radio->write(packet, len) >= 0;
+}
+
+size_t RadioSwitchboard::encode(const uint8_t* packet, size_t length, uint8_t* encoded) {
+  std::shared_ptr<MiLightRadio> radio = currentRadio(txModule);
+
+  if (radio == nullptr) {
+    return 0;
+  }
+
+  return radio->encode(packet, length, encoded);
+}
+
+bool RadioSwitchboard::writeEncoded(const uint8_t* encoded, size_t length) {
+  std::shared_ptr<MiLightRadio> radio = currentRadio(txModule);
+
+  if (radio == nullptr) {
+    return false;
+  }
+
+  return radio->writeEncoded(encoded, length) >= 0;
+}
+
+size_t RadioSwitchboard::transmitModule() const {
+  return txModule;
 }
 
 size_t RadioSwitchboard::read(uint8_t* packet) {
-  if (currentRadio == nullptr) {
+  ReceivedFrame* frame = receivedFrames.peek();
+
+  if (frame != nullptr) {
+    memcpy(packet, frame->packet, frame->length);
+    const size_t length = frame->length;
+
+    receivedFrames.pop();
+    ++receivedPackets;
+
+    return length;
+  }
+
+  std::shared_ptr<MiLightRadio> radio = currentRadio(rxModule);
+
+  if (radio == nullptr) {
     return 0;
   }
 
-  size_t length;
-  currentRadio->read(packet, length);
+  size_t length = MILIGHT_MAX_PACKET_LENGTH;
+  radio->read(packet, length);
+  ++receivedPackets;
 
   return length;
 }
 
 bool RadioSwitchboard::available() {
-  if (currentRadio == nullptr) {
+  if (!receivedFrames.isEmpty()) {
+    return true;
+  }
+
+  std::shared_ptr<MiLightRadio> radio = currentRadio(rxModule);
+
+  if (radio == nullptr) {
     return false;
   }
 
-  return currentRadio->available();
-}
\ No newline at end of file
+  RadioIrq* irq = irqFor(rxModule);
+
+  if (irq == nullptr) {
+    return radio->available();
+  }
+
+  // Sending takes the module out of RX mode
+  radio->startListening();
+
+  uint32_t firedAtMicros;
+  if (!irq->take(firedAtMicros)) {
+    return false;
+  }
+
+  drain(*radio, firedAtMicros);
+
+  return !receivedFrames.isEmpty();
+}
+
+void RadioSwitchboard::drain(MiLightRadio& radio, uint32_t firedAtMicros) {
+  bool drained = false;
+
+  while (radio.available()) {
+    ReceivedFrame frame;
+    frame.length = MILIGHT_MAX_PACKET_LENGTH;
+    radio.read(frame.packet, frame.length);
+
+    if (!receivedFrames.push(frame)) {
+      ++ringOverflows;
+    }
+    drained = true;
+  }
+
+  if (drained) {
+    const uint32_t latency = micros() - firedAtMicros;
+
+    if (latency > maxIrqLatencyMicros) {
+      maxIrqLatencyMicros = latency;
+    }
+  }
+}
+
+void RadioSwitchboard::clearReceivedFrames() {
+  while (receivedFrames.pop()) { }
+}
+
+RadioIrq* RadioSwitchboard::irqFor(size_t module) const {
+  if (module == RadioRouter::NONE) {
+    return nullptr;
+  }
+
+  return irqs[module].get();
+}
+
+bool RadioSwitchboard::isInterruptDriven() const {
+  return irqFor(rxModule) != nullptr;
+}
+
+RadioReceiveStats RadioSwitchboard::receiveStats() const {
+  RadioReceiveStats stats;
+
+  stats.interruptDriven = isInterruptDriven();
+  stats.interrupts = 0;
+  stats.packets = receivedPackets;
+  stats.duplicates = 0;
+  stats.radioResets = 0;
+  stats.radioOverflows = 0;
+  stats.ringOverflows = ringOverflows;
+  stats.maxIrqLatencyMicros = maxIrqLatencyMicros;
+
+  for (size_t m = 0; m < radios.size(); m++) {
+    if (irqs[m] != nullptr) {
+      stats.interrupts += irqs[m]->getCount();
+    }
+
+    for (const std::shared_ptr<MiLightRadio>& radio : radios[m]) {
+      stats.radioOverflows += radio->droppedFrames();
+      stats.duplicates += radio->dupesReceived();
+      stats.radioResets += radio->rxResets();
+    }
+  }
+
+  return stats;
+}
@@ -4,24 +4,114 @@
 #include <MiLightRemoteConfig.h>
 #include <MiLightRadioConfig.h>
 #include <MiLightRadioFactory.h>
+#include <RadioRouter.h>
+#include <RadioIrq.h>
+#include <SpscQueue.h>
+#include <memory>
 
+// Packets drained from an interrupt-driven module, waiting to be read.  Must be
+// a power of two.
+#ifndef MILIGHT_RADIO_RX_RING_SIZE
+#define MILIGHT_RADIO_RX_RING_SIZE 8
+#endif
+
+struct RadioReceiveStats {
+  // Listening module has an IRQ pin
+  bool interruptDriven;
+  // Times the IRQ lines fired
+  size_t interrupts;
+  size_t packets;
+  // Repeats of packets which were heard and ignored.  Together with packets,
+  // shows how many repeats of each button press are being caught.
+  size_t duplicates;
+  // Times a module was fully reset while receiving
+  size_t radioResets;
+  // Frames the modules may have dropped because they weren't read in time
+  size_t radioOverflows;
+  // Frames dropped because the receive ring was full
+  size_t ringOverflows;
+  // Longest time between an interrupt and its packets being drained
+  uint32_t maxIrqLatencyMicros;
+};
+
+/**
+ * Owns the radio modules and routes packets to them.  With a single module it
+ * does everything, and is reconfigured whenever the radio config changes.
+ * With several, one can be dedicated to listening and others to sending,
+ * optionally pinned to particular radio configs.  See RadioRouter.
+ *
+ * Modules with an IRQ pin aren't polled.  available() only touches the module
+ * once its IRQ has fired, and then drains everything it received into a small
+ * ring which read() takes from.
+ */
 class RadioSwitchboard {
 public:
   RadioSwitchboard(
-    std::shared_ptr<MiLightRadioFactory> radioFactory,
+    const std::vector<std::shared_ptr<MiLightRadioFactory>>& radioFactories,
     GroupStateStore* stateStore,
     Settings& settings
   );
 
+  // Set up the module which sends packets for the remote
   std::shared_ptr<MiLightRadio> switchRadio(const MiLightRemoteConfig* remote);
+  // Set up the listening module for the radio config at this index
   std::shared_ptr<MiLightRadio> switchRadio(size_t index);
   size_t getNumRadios() const;
 
+  // True if packets for the config can be sent without reconfiguring a module
+  bool isConfigured(const MiLightRadioConfig* config) const;
+
+  // True if listening never gets in the way of sending
+  bool hasDedicatedReceiver() const;
+
   bool available();
-  void write(uint8_t* packet, size_t length);
+  // Returns false if there's no module to send with, or it failed
+  bool write(uint8_t* packet, size_t length);
   size_t read(uint8_t* packet);
 
+  // True if the listening module signals received packets with an IRQ
+  bool isInterruptDriven() const;
+  RadioReceiveStats receiveStats() const;
+
+  // See MiLightRadio::encode.  Encodes for the current radio.  Frames are
+  // specific to the module they were encoded for.
+  size_t encode(const uint8_t* packet, size_t length, uint8_t* encoded);
+  bool writeEncoded(const uint8_t* encoded, size_t length);
+
+  // Module the last switchRadio(const MiLightRemoteConfig*) picked, or
+  // RadioRouter::NONE
+  size_t transmitModule() const;
+
 private:
-  std::vector<std::shared_ptr<MiLightRadio>> radios;
-  std::shared_ptr<MiLightRadio> currentRadio;
+  std::vector<std::shared_ptr<MiLightRadioFactory>> factories;
+
+  // Indexed by module, then radio config
+  std::vector<std::vector<std::shared_ptr<MiLightRadio>>> radios;
+  RadioRouter router;
+
+  // Indexed by module.  Null for modules without an IRQ pin.
+  std::vector<std::unique_ptr<RadioIrq>> irqs;
+
+  struct ReceivedFrame {
+    uint8_t packet[MILIGHT_MAX_PACKET_LENGTH];
+    size_t length;
+  };
+  SpscQueue<ReceivedFrame, MILIGHT_RADIO_RX_RING_SIZE> receivedFrames;
+
+  size_t txModule;
+  size_t rxModule;
+
+  size_t receivedPackets;
+  size_t ringOverflows;
+  uint32_t maxIrqLatencyMicros;
+
+  RadioIrq* irqFor(size_t module) const;
+  // Reads everything the module has into receivedFrames
+  void drain(MiLightRadio& radio, uint32_t firedAtMicros);
+  void clearReceivedFrames();
+
+  std::shared_ptr<MiLightRadio> tune(size_t module, size_t configIx);
+  std::shared_ptr<MiLightRadio> currentRadio(size_t module) const;
+
+  static size_t configIndex(const MiLightRadioConfig* config);
 };
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include <RadioTask.h>
+
+#include <algorithm>
+
+RadioTask::RadioTask(
+  RadioSwitchboard& radioSwitchboard,
+  PacketSender& packetSender,
+  Settings& settings,
+  PacketHandler packetHandler
+) : radioSwitchboard(radioSwitchboard)
+  , packetSender(packetSender)
+  , taskCore(settings.radioTaskCore)
+  , listenRepeats(settings.listenRepeats)
+  , packetHandler(packetHandler)
+  , droppedEventCount(0)
+  , scheduler(radioSwitchboard.getNumRadios())
+  , dedup(MILIGHT_RECEIVE_DEDUP_WINDOW_MS)
+  , lastStatsPublish(0)
+  , running(false)
+  , stopRequested(false)
+#ifdef MIHUB_ESP32
+  , taskHandle(nullptr)
+#endif
+{
+  uint32_t allowedConfigs = 0;
+
+  for (size_t i = 0; i < settings.listenRemoteTypes.size(); i++) {
+    const MiLightRemoteConfig* remote = MiLightRemoteConfig::fromType(settings.listenRemoteTypes[i]);
+
+    if (remote != NULL) {
+      allowedConfigs |= 1UL << (&remote->radioConfig - MiLightRadioConfig::ALL_CONFIGS);
+    }
+  }
+
+  scheduler.setAllowedConfigs(allowedConfigs);
+  publishStats();
+}
+
+RadioTask::~RadioTask() {
+  end();
+}
+
+void RadioTask::begin() {
+#ifdef MIHUB_ESP32
+  if (running || taskCore < 0 || taskCore >= portNUM_PROCESSORS) {
+    return;
+  }
+
+  stopRequested = false;
+  running = true;
+  packetSender.setAsync(true);
+
+  BaseType_t result = xTaskCreatePinnedToCore(
+    taskMain,
+    "radio",
+    MILIGHT_RADIO_TASK_STACK_SIZE,
+    this,
+    MILIGHT_RADIO_TASK_PRIORITY,
+    &taskHandle,
+    taskCore
+  );
+
+  if (result != pdPASS) {
+    Serial.println(F("ERROR: couldn't start radio task.  Using main loop instead."));
+    running = false;
+    packetSender.setAsync(false);
+    return;
+  }
+
+  Serial.printf("Radio task started on core %d\n", taskCore);
+#endif
+}
+
+void RadioTask::end() {
+  if (!running) {
+    return;
+  }
+
+  stopRequested = true;
+  while (running) {
+    delay(1);
+  }
+
+  packetSender.setAsync(false);
+
+  // Anything the task sent or heard on its way out
+  dispatchEvents();
+  packetSender.dispatchSentPackets();
+}
+
+bool RadioTask::isRunning() const {
+  return running;
+}
+
+int8_t RadioTask::core() const {
+  return taskCore;
+}
+
+bool RadioTask::stats(RadioTaskStats& stats) const {
+  return publishedStats.read(stats);
+}
+
+void RadioTask::publishStats() {
+  RadioTaskStats& stats = nextStats;
+
+  stats.takenAt = millis();
+  stats.queueLength = packetSender.queueLength();
+  stats.droppedPackets = packetSender.droppedPackets();
+  stats.mergedPackets = packetSender.mergedPackets();
+  stats.promotedPackets = packetSender.promotedPackets();
+  stats.radioSwitches = packetSender.radioSwitches();
+  stats.radioSwitchesPerSecond = packetSender.radioSwitchesPerSecond();
+  stats.repeatsPerSecond = packetSender.repeatsPerSecond();
+  stats.budgetOverruns = packetSender.budgetOverruns();
+  stats.writeFailures = packetSender.writeFailures();
+  stats.lastBatch = packetSender.lastBatch();
+
+  for (size_t i = 0; i < PacketSender::NUM_PRIORITIES; i++) {
+    stats.lanes[i] = packetSender.laneStats(static_cast<PacketPriority>(i));
+  }
+
+  const RepeatThrottle& throttle = packetSender.repeatThrottling();
+  stats.throttleEntries = std::min(throttle.size(), static_cast<size_t>(REPEAT_THROTTLE_MAX_ENTRIES));
+  for (size_t i = 0; i < stats.throttleEntries; i++) {
+    stats.throttle[i] = throttle.at(i);
+  }
+
+  stats.droppedEvents = droppedEventCount;
+  stats.receivedPackets = dedup.getPacketCount();
+  stats.receivedDuplicates = dedup.getDuplicateCount();
+
+  stats.listenConfigs = std::min(scheduler.numConfigs(), static_cast<size_t>(LISTEN_SCHEDULER_MAX_CONFIGS));
+  stats.listenTotalWeight = scheduler.totalWeight();
+  for (size_t i = 0; i < stats.listenConfigs; i++) {
+    stats.listen[i] = scheduler.stats(i);
+  }
+
+  publishedStats.write(stats);
+  lastStatsPublish = stats.takenAt;
+}
+
+void RadioTask::loop() {
+  if (!running) {
+    radioLoop();
+  }
+
+  dispatchEvents();
+  packetSender.dispatchSentPackets();
+}
+
+bool RadioTask::isDuplicate(const uint8_t* packet, const MiLightRemoteConfig& config) {
+  const size_t length = config.packetFormatter->getPacketLength();
+  return dedup.isDuplicate(ReceiveDedup::keyFor(config.type, packet, length), millis());
+}
+
+void RadioTask::onPacketReceived(uint8_t* packet, const MiLightRemoteConfig& config) {
+  if (!running) {
+    packetHandler(packet, config);
+    return;
+  }
+
+  RadioEvent event;
+  memcpy(event.packet, packet, config.packetFormatter->getPacketLength());
+  event.remoteConfig = &config;
+
+  if (!events.push(event)) {
+    ++droppedEventCount;
+  }
+}
+
+void RadioTask::dispatchEvents() {
+  RadioEvent event;
+
+  while (events.pop(event)) {
+    packetHandler(event.packet, *event.remoteConfig);
+  }
+}
+
+void RadioTask::radioLoop() {
+  listen();
+  packetSender.loop();
+
+  if (millis() - lastStatsPublish >= MILIGHT_RADIO_STATS_INTERVAL_MS) {
+    publishStats();
+  }
+}
+
+void RadioTask::listen() {
+  // Do not handle listens while there are packets enqueued to be sent
+  // Doing so causes the radio module to need to be reinitialized inbetween
+  // repeats, which slows things down.  Not a problem with a module dedicated
+  // to listening.
+  if (! listenRepeats || (packetSender.isSending() && !radioSwitchboard.hasDedicatedReceiver())) {
+    return;
+  }
+
+  const size_t configIx = scheduler.next();
+
+  if (configIx == ListenScheduler::NONE) {
+    return;
+  }
+
+  std::shared_ptr<MiLightRadio> radio = radioSwitchboard.switchRadio(configIx);
+
+  if (radio == nullptr) {
+    return;
+  }
+
+  size_t heard = 0;
+
+  // An interrupt-driven module is only read once it has something, so there's
+  // no point asking repeatedly.  Take whatever it has.
+  const bool interruptDriven = radioSwitchboard.isInterruptDriven();
+
+  for (size_t i = 0; interruptDriven || i < listenRepeats; i++) {
+    if (!radioSwitchboard.available()) {
+      if (interruptDriven) {
+        break;
+      }
+      continue;
+    }
+
+    uint8_t readPacket[MILIGHT_MAX_PACKET_LENGTH];
+    uint8_t decodedPacket[MILIGHT_MAX_PACKET_LENGTH];
+    size_t packetLen = radioSwitchboard.read(readPacket);
+
+    const MiLightRemoteConfig* remoteConfig = MiLightRemoteConfig::fromReceivedPacket(
+      radio->config(),
+      readPacket,
+      packetLen,
+      decodedPacket
+    );
+
+    if (remoteConfig == NULL) {
+      // This can happen under normal circumstances, so not an error condition
+#ifdef DEBUG_PRINTF
+      Serial.println(F("WARNING: Couldn't find remote for received packet"));
+#endif
+      continue;
+    }
+
+    ++heard;
+
+    if (isDuplicate(decodedPacket, *remoteConfig)) {
+      continue;
+    }
+
+    // update state to reflect this packet
+    onPacketReceived(decodedPacket, *remoteConfig);
+  }
+
+  scheduler.recordListen(configIx, heard);
+}
+
+#ifdef MIHUB_ESP32
+void RadioTask::taskMain(void* arg) {
+  RadioTask* task = static_cast<RadioTask*>(arg);
+  TickType_t busySince = xTaskGetTickCount();
+
+  while (!task->stopRequested) {
+    task->radioLoop();
+
+    // Sleep while there's nothing to send.  Otherwise keep going, but block
+    // now and then so lower priority tasks on this core get to run.
+    if (!task->packetSender.isSending()
+      || (xTaskGetTickCount() - busySince) >= pdMS_TO_TICKS(MILIGHT_RADIO_TASK_MAX_BUSY_MS)) {
+      vTaskDelay(1);
+      busySince = xTaskGetTickCount();
+    }
+  }
+
+  task->running = false;
+  vTaskDelete(NULL);
+}
+#endif
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <PacketSender.h>
+#include <RadioSwitchboard.h>
+#include <SpscQueue.h>
+#include <ListenScheduler.h>
+#include <ReceiveDedup.h>
+#include <Settings.h>
+#include <SeqLock.h>
+#include <atomic>
+
+#ifdef MIHUB_ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+// Received packets waiting to be handled by the main loop.  Must be a power of
+// two.
+#ifndef MILIGHT_RADIO_EVENT_QUEUE_SIZE
+#define MILIGHT_RADIO_EVENT_QUEUE_SIZE 32
+#endif
+
+// Repeats of a received packet heard within this long of the last one are
+// dropped.  Remotes send each button press as a burst of repeats.
+#ifndef MILIGHT_RECEIVE_DEDUP_WINDOW_MS
+#define MILIGHT_RECEIVE_DEDUP_WINDOW_MS 500
+#endif
+
+#ifndef MILIGHT_RADIO_TASK_STACK_SIZE
+#define MILIGHT_RADIO_TASK_STACK_SIZE 4096
+#endif
+
+// Above the Arduino loop task (1) so radio timing doesn't depend on it, and
+// below the WiFi and TCP/IP tasks, which share core 0 with it by default
+#ifndef MILIGHT_RADIO_TASK_PRIORITY
+#define MILIGHT_RADIO_TASK_PRIORITY 2
+#endif
+
+// Longest the radio task runs without blocking while it's busy sending, so the
+// idle task on its core can feed the watchdog
+#ifndef MILIGHT_RADIO_TASK_MAX_BUSY_MS
+#define MILIGHT_RADIO_TASK_MAX_BUSY_MS 20
+#endif
+
+// How often the radio task publishes its stats for other tasks
+#ifndef MILIGHT_RADIO_STATS_INTERVAL_MS
+#define MILIGHT_RADIO_STATS_INTERVAL_MS 250
+#endif
+
+// Copy of the sender and listener stats, taken by whichever task does the
+// radio work.  See RadioTask::stats().
+struct RadioTaskStats {
+  unsigned long takenAt;
+
+  size_t queueLength;
+  size_t droppedPackets;
+  size_t mergedPackets;
+  size_t promotedPackets;
+  size_t radioSwitches;
+  size_t radioSwitchesPerSecond;
+  size_t repeatsPerSecond;
+  size_t budgetOverruns;
+  size_t writeFailures;
+  PacketBatchStats lastBatch;
+  PacketLaneStats lanes[PacketSender::NUM_PRIORITIES];
+
+  size_t throttleEntries;
+  RepeatThrottle::Entry throttle[REPEAT_THROTTLE_MAX_ENTRIES];
+
+  size_t droppedEvents;
+  size_t receivedPackets;
+  size_t receivedDuplicates;
+
+  size_t listenConfigs;
+  uint32_t listenTotalWeight;
+  ListenScheduler::ConfigStats listen[LISTEN_SCHEDULER_MAX_CONFIGS];
+};
+
+/**
+ * Runs the radio: sends queued packets and listens for remotes.
+ *
+ * On the ESP32 this happens in a FreeRTOS task pinned to
+ * Settings::radioTaskCore, so radio timing isn't held up by HTTP, MQTT or file
+ * system writes in the main loop.  Packets go through PacketSender's inbox and
+ * outbox.  Packets which were heard are handed back through another lock-free
+ * queue.  Handlers for both are called from loop() on the main task, so they
+ * can safely touch state, MQTT and so on.
+ *
+ * Elsewhere, or with a core of -1, the radio work is done in loop().
+ */
+class RadioTask {
+public:
+  // Called from the main loop with packets heard from remotes
+  typedef std::function<void(uint8_t* packet, const MiLightRemoteConfig& config)> PacketHandler;
+
+  RadioTask(
+    RadioSwitchboard& radioSwitchboard,
+    PacketSender& packetSender,
+    Settings& settings,
+    PacketHandler packetHandler
+  );
+  ~RadioTask();
+
+  void begin();
+  // Stops the task, waiting for it to finish what it's doing
+  void end();
+
+  // Called from the main loop
+  void loop();
+
+  bool isRunning() const;
+  // Core the task runs on, as configured when it was created
+  int8_t core() const;
+
+  /*
+   * Latest stats published by the radio work, at most
+   * MILIGHT_RADIO_STATS_INTERVAL_MS old.  Safe to call from any task.  Returns
+   * false if a consistent copy couldn't be taken, e.g. while they're being
+   * published.
+   */
+  bool stats(RadioTaskStats& stats) const;
+
+private:
+  struct RadioEvent {
+    uint8_t packet[MILIGHT_MAX_PACKET_LENGTH];
+    const MiLightRemoteConfig* remoteConfig;
+  };
+
+  RadioSwitchboard& radioSwitchboard;
+  PacketSender& packetSender;
+
+  // Copied so settings can change while the task runs.  Takes a restart of
+  // the task to apply.
+  const int8_t taskCore;
+  const uint8_t listenRepeats;
+  // Called for received packets, once they're decoded
+  PacketHandler packetHandler;
+
+  SpscQueue<RadioEvent, MILIGHT_RADIO_EVENT_QUEUE_SIZE> events;
+  size_t droppedEventCount;
+  // Decides which radio config is listened on.  Indexed like
+  // MiLightRadioConfig::ALL_CONFIGS.
+  ListenScheduler scheduler;
+  // Drops repeats of received packets heard on any radio config
+  ReceiveDedup dedup;
+
+  // Written by the radio work only.  nextStats is filled in before being
+  // published so it isn't built on the task's stack.
+  SeqLock<RadioTaskStats> publishedStats;
+  RadioTaskStats nextStats;
+  unsigned long lastStatsPublish;
+
+  std::atomic<bool> running;
+  std::atomic<bool> stopRequested;
+
+#ifdef MIHUB_ESP32
+  TaskHandle_t taskHandle;
+  static void taskMain(void* arg);
+#endif
+
+  // One iteration of sending and listening
+  void radioLoop();
+
+  // Take and publish stats.  Only called by whichever task does the radio work.
+  void publishStats();
+
+  // Listen for packets on the radio config the scheduler picks
+  void listen();
+
+  // True if the decoded packet is a repeat of one which was already handled
+  bool isDuplicate(const uint8_t* packet, const MiLightRemoteConfig& config);
+  void onPacketReceived(uint8_t* packet, const MiLightRemoteConfig& config);
+  void dispatchEvents();
+};
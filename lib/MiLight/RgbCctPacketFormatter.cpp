@@ -1,7 +1,5 @@
 #include <RgbCctPacketFormatter.h>
-#include <V2RFEncoding.h>
 #include <Units.h>
-#include <MiLightCommands.h>
 
 void RgbCctPacketFormatter::modeSpeedDown() {
   command(RGB_CCT_ON, RGB_CCT_MODE_SPEED_DOWN);
@@ -107,52 +105,48 @@ void RgbCctPacketFormatter::enableNightMode() {
   command(RGB_CCT_ON | 0x80, arg);
 }
 
-BulbId RgbCctPacketFormatter::parsePacket(const uint8_t *packet, JsonObject result) {
-  uint8_t packetCopy[V2_PACKET_LEN];
-  memcpy(packetCopy, packet, V2_PACKET_LEN);
-  V2RFEncoding::decodeV2Packet(packetCopy);
-
+BulbId RgbCctPacketFormatter::parseDecodedPacket(const uint8_t *packet, ParsedPacket& result) {
   BulbId bulbId(
-    (packetCopy[2] << 8) | packetCopy[3],
-    packetCopy[7],
+    (packet[2] << 8) | packet[3],
+    packet[7],
     REMOTE_TYPE_RGB_CCT
   );
 
-  uint8_t command = (packetCopy[V2_COMMAND_INDEX] & 0x7F);
-  uint8_t arg = packetCopy[V2_ARGUMENT_INDEX];
+  uint8_t command = (packet[V2_COMMAND_INDEX] & 0x7F);
+  uint8_t arg = packet[V2_ARGUMENT_INDEX];
 
   if (command == RGB_CCT_ON) {
-    if ((packetCopy[V2_COMMAND_INDEX] & 0x80) == 0x80) {
-      result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::NIGHT_MODE;
+    if ((packet[V2_COMMAND_INDEX] & 0x80) == 0x80) {
+      result.setCommand(PacketCommand::NIGHT_MODE);
     } else if (arg == RGB_CCT_MODE_SPEED_DOWN) {
-      result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::MODE_SPEED_DOWN;
+      result.setCommand(PacketCommand::MODE_SPEED_DOWN);
     } else if (arg == RGB_CCT_MODE_SPEED_UP) {
-      result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::MODE_SPEED_UP;
+      result.setCommand(PacketCommand::MODE_SPEED_UP);
     } else if (arg < 5) { // Group is not reliably encoded in group byte. Extract from arg byte
-      result[GroupStateFieldNames::STATE] = "ON";
+      result.setState(true);
       bulbId.groupId = arg;
     } else {
-      result[GroupStateFieldNames::STATE] = "OFF";
+      result.setState(false);
       bulbId.groupId = arg-5;
     }
   } else if (command == RGB_CCT_COLOR) {
     uint8_t rescaledColor = (arg - RGB_CCT_COLOR_OFFSET) % 0x100;
     uint16_t hue = Units::rescale<uint16_t, uint16_t>(rescaledColor, 360, 255.0);
-    result[GroupStateFieldNames::HUE] = hue;
+    result.setHue(hue);
   } else if (command == RGB_CCT_KELVIN) {
     uint8_t temperature = V2PacketFormatter::fromv2scale(arg, RGB_CCT_KELVIN_REMOTE_END, 2);
-    result[GroupStateFieldNames::COLOR_TEMP] = Units::whiteValToMireds(temperature, 100);
+    result.setColorTemp(Units::whiteValToMireds(temperature, 100));
   // brightness == saturation
   } else if (command == RGB_CCT_BRIGHTNESS && arg >= (RGB_CCT_BRIGHTNESS_OFFSET - 15)) {
     uint8_t level = constrain(arg - RGB_CCT_BRIGHTNESS_OFFSET, 0, 100);
-    result[GroupStateFieldNames::BRIGHTNESS] = Units::rescale<uint8_t, uint8_t>(level, 255, 100);
+    result.setBrightness(Units::rescale<uint8_t, uint8_t>(level, 255, 100));
   } else if (command == RGB_CCT_SATURATION) {
-    result[GroupStateFieldNames::SATURATION] = constrain(arg - RGB_CCT_SATURATION_OFFSET, 0, 100);
+    result.setSaturation(constrain(arg - RGB_CCT_SATURATION_OFFSET, 0, 100));
   } else if (command == RGB_CCT_MODE) {
-    result[GroupStateFieldNames::MODE] = arg;
+    result.setMode(arg);
   } else {
-    result["button_id"] = command;
-    result["argument"] = arg;
+    result.setButtonId(command);
+    result.setArgument(arg);
   }
 
   return bulbId;
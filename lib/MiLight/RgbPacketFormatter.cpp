@@ -1,6 +1,5 @@
 #include <RgbPacketFormatter.h>
 #include <Units.h>
-#include <MiLightCommands.h>
 
 void RgbPacketFormatter::initializePacket(uint8_t *packet) {
   size_t packetPtr = 0;
@@ -84,7 +83,7 @@ void RgbPacketFormatter::previousMode() {
   command(RGB_MODE_DOWN, 0);
 }
 
-BulbId RgbPacketFormatter::parsePacket(const uint8_t* packet, JsonObject result) {
+BulbId RgbPacketFormatter::parseDecodedPacket(const uint8_t* packet, ParsedPacket& result) {
   uint8_t command = packet[RGB_COMMAND_INDEX] & 0x7F;
 
   BulbId bulbId(
@@ -94,27 +93,27 @@ BulbId RgbPacketFormatter::parsePacket(const uint8_t* packet, JsonObject result)
   );
 
   if (command == RGB_ON) {
-    result[GroupStateFieldNames::STATE] = "ON";
+    result.setState(true);
   } else if (command == RGB_OFF) {
-    result[GroupStateFieldNames::STATE] = "OFF";
+    result.setState(false);
   } else if (command == 0) {
     uint16_t remappedColor = Units::rescale<uint16_t, uint16_t>(packet[RGB_COLOR_INDEX], 360.0, 255.0);
     remappedColor = (remappedColor + 320) % 360;
-    result[GroupStateFieldNames::HUE] = remappedColor;
+    result.setHue(remappedColor);
   } else if (command == RGB_MODE_DOWN) {
-    result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::PREVIOUS_MODE;
+    result.setCommand(PacketCommand::PREVIOUS_MODE);
   } else if (command == RGB_MODE_UP) {
-    result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::NEXT_MODE;
+    result.setCommand(PacketCommand::NEXT_MODE);
   } else if (command == RGB_SPEED_DOWN) {
-    result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::MODE_SPEED_DOWN;
+    result.setCommand(PacketCommand::MODE_SPEED_DOWN);
   } else if (command == RGB_SPEED_UP) {
-    result[GroupStateFieldNames::COMMAND] = MiLightCommandNames::MODE_SPEED_UP;
+    result.setCommand(PacketCommand::MODE_SPEED_UP);
   } else if (command == RGB_BRIGHTNESS_DOWN) {
-    result[GroupStateFieldNames::COMMAND] = "brightness_down";
+    result.setCommand(PacketCommand::BRIGHTNESS_DOWN);
   } else if (command == RGB_BRIGHTNESS_UP) {
-    result[GroupStateFieldNames::COMMAND] = "brightness_up";
+    result.setCommand(PacketCommand::BRIGHTNESS_UP);
   } else {
-    result["button_id"] = command;
+    result.setButtonId(command);
   }
 
   return bulbId;
@@ -76,6 +76,15 @@ void V2PacketFormatter::finalizePacket(uint8_t* packet) {
   V2RFEncoding::encodeV2Packet(packet);
 }
 
+void V2PacketFormatter::decodePacket(const uint8_t* packet, uint8_t* decoded) const {
+  memcpy(decoded, packet, V2_PACKET_LEN);
+  V2RFEncoding::decodeV2Packet(decoded);
+}
+
+int16_t V2PacketFormatter::getProtocolId() const {
+  return protocolId;
+}
+
 void V2PacketFormatter::format(uint8_t const* packet, char* buffer) {
   buffer += sprintf_P(buffer, PSTR("Raw packet: "));
   for (size_t i = 0; i < packetLength; i++) {
@@ -26,6 +26,8 @@ public:
   virtual void unpair();
 
   virtual void finalizePacket(uint8_t* packet);
+  virtual void decodePacket(const uint8_t* packet, uint8_t* decoded) const;
+  virtual int16_t getProtocolId() const;
 
   uint8_t groupCommandArg(MiLightStatus status, uint8_t groupId);
 
@@ -0,0 +1,33 @@
+#include <DeviceStates.h>
+
+DeviceStates::DeviceStates()
+  : numGroups(0)
+{ }
+
+DeviceStates::DeviceStates(const MiLightRemoteType deviceType, const size_t numGroups)
+  : numGroups(numGroups < MAX_GROUPS ? numGroups : MAX_GROUPS)
+{
+  for (size_t i = 0; i <= MAX_GROUPS; i++) {
+    groups[i] = GroupState::defaultState(deviceType);
+  }
+}
+
+BulbId DeviceStates::keyFor(const BulbId& id) {
+  return BulbId(id.deviceId, 0, id.deviceType);
+}
+
+bool DeviceStates::isDirty() const {
+  for (size_t i = 0; i <= numGroups; i++) {
+    if (groups[i].isDirty()) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void DeviceStates::clearDirty() {
+  for (size_t i = 0; i <= MAX_GROUPS; i++) {
+    groups[i].clearDirty();
+  }
+}
@@ -0,0 +1,30 @@
+#include <GroupState.h>
+
+#ifndef _DEVICE_STATES_H
+#define _DEVICE_STATES_H
+
+/**
+ * States for every group of a device (device ID and type), group 0 included.
+ * GroupStateStore caches and saves them as one block, so a change to group 0
+ * is applied to the other groups in place.
+ */
+struct DeviceStates {
+  // Most groups a remote type has (FUT089)
+  static const size_t MAX_GROUPS = 8;
+
+  // Groups other than 0 that the device type has
+  uint8_t numGroups;
+  GroupState groups[MAX_GROUPS + 1];
+
+  DeviceStates();
+  // Default states for the device type
+  DeviceStates(const MiLightRemoteType deviceType, const size_t numGroups);
+
+  // The BulbId a device's block is kept under: the one for its group 0
+  static BulbId keyFor(const BulbId& id);
+
+  bool isDirty() const;
+  void clearDirty();
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include <FileStateLogStorage.h>
+#ifdef ESP32
+  #include <SPIFFS.h>
+#endif
+#include "ProjectFS.h"
+
+FileStateLogStorage::FileStateLogStorage(const char* path, const char* rewritePath)
+  : path(path)
+  , rewritePath(rewritePath)
+{ }
+
+FileStateLogStorage::~FileStateLogStorage() {
+  if (file) {
+    file.close();
+  }
+  if (rewriteFile) {
+    rewriteFile.close();
+  }
+}
+
+size_t FileStateLogStorage::size() {
+  return open() ? file.size() : 0;
+}
+
+bool FileStateLogStorage::read(size_t offset, uint8_t* buffer, size_t length) {
+  return open()
+    && file.seek(offset)
+    && file.read(buffer, length) == length;
+}
+
+bool FileStateLogStorage::append(const uint8_t* data, size_t length) {
+  if (!open()) {
+    return false;
+  }
+
+  // Writes always go to the end in append mode, but switching from reading to
+  // writing needs a seek
+  file.seek(file.size());
+  const bool written = file.write(data, length) == length;
+  file.flush();
+
+  return written;
+}
+
+bool FileStateLogStorage::beginRewrite() {
+  rewriteFile = ProjectFS.open(rewritePath, "w");
+  return static_cast<bool>(rewriteFile);
+}
+
+bool FileStateLogStorage::appendRewrite(const uint8_t* data, size_t length) {
+  return rewriteFile.write(data, length) == length;
+}
+
+bool FileStateLogStorage::commitRewrite() {
+  rewriteFile.close();
+  file.close();
+
+  // If this is cut short, open() finishes it
+  ProjectFS.remove(path);
+  const bool renamed = ProjectFS.rename(rewritePath, path);
+
+  return renamed && open();
+}
+
+bool FileStateLogStorage::open() {
+  if (file) {
+    return true;
+  }
+
+  if (ProjectFS.exists(rewritePath)) {
+    if (ProjectFS.exists(path)) {
+      // Compaction didn't finish writing the new log.  The old one is intact.
+      ProjectFS.remove(rewritePath);
+    } else {
+      // The old log was removed, so the new one is complete
+      ProjectFS.rename(rewritePath, path);
+    }
+  }
+
+  file = ProjectFS.open(path, "a+");
+
+  if (!file) {
+    Serial.print(F("Failed to open state log "));
+    Serial.println(path);
+  }
+
+  return static_cast<bool>(file);
+}
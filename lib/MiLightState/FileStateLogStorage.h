@@ -0,0 +1,34 @@
+#include <FS.h>
+#include <StateLog.h>
+
+#ifndef _FILE_STATE_LOG_STORAGE_H
+#define _FILE_STATE_LOG_STORAGE_H
+
+/**
+ * Keeps a StateLog in a file.  The file is kept open so that appending a
+ * record doesn't pay for opening it.  Compaction writes a second file and
+ * renames it over the first.
+ */
+class FileStateLogStorage : public StateLogStorage {
+public:
+  FileStateLogStorage(const char* path, const char* rewritePath);
+  ~FileStateLogStorage();
+
+  virtual size_t size() override;
+  virtual bool read(size_t offset, uint8_t* buffer, size_t length) override;
+  virtual bool append(const uint8_t* data, size_t length) override;
+
+  virtual bool beginRewrite() override;
+  virtual bool appendRewrite(const uint8_t* data, size_t length) override;
+  virtual bool commitRewrite() override;
+
+private:
+  const char* path;
+  const char* rewritePath;
+  File file;
+  File rewriteFile;
+
+  bool open();
+};
+
+#endif
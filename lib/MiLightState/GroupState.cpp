@@ -137,6 +137,18 @@ GroupState::GroupState(const GroupState* previousState, JsonObject jsonState)
   patch(jsonState);
 }
 
+GroupState::GroupState(const GroupState* previousState, const ParsedPacket& packet)
+  : previousState(previousState)
+{
+  initFields();
+
+  if (previousState != NULL) {
+    this->scratchpad = previousState->scratchpad;
+  }
+
+  patch(packet);
+}
+
 bool GroupState::operator==(const GroupState& other) const {
   return memcmp(state.rawData, other.state.rawData, DATA_LONGS * sizeof(uint32_t)) == 0;
 }
@@ -628,6 +640,17 @@ void GroupState::dump(Stream& stream) const {
   }
 }
 
+void GroupState::load(const uint8_t* buffer) {
+  static_assert(DUMP_SIZE == sizeof(StateData::rawData), "DUMP_SIZE should match the packed state");
+
+  memcpy(state.rawData, buffer, DUMP_SIZE);
+  clearDirty();
+}
+
+void GroupState::dump(uint8_t* buffer) const {
+  memcpy(buffer, state.rawData, DUMP_SIZE);
+}
+
 bool GroupState::applyIncrementCommand(GroupStateField field, IncrementDirection dir) {
   if (field != GroupStateField::KELVIN && field != GroupStateField::BRIGHTNESS) {
     Serial.print(F("WARNING: tried to apply increment for unsupported field: "));
@@ -790,6 +813,76 @@ bool GroupState::patch(JsonObject state) {
   return changes;
 }
 
+bool GroupState::patch(const ParsedPacket& packet) {
+  bool changes = false;
+
+  if (packet.has(ParsedPacket::STATE)) {
+    changes |= setState(packet.on ? ON : OFF);
+  }
+
+  if (isOn() && packet.has(ParsedPacket::BRIGHTNESS)) {
+    changes |= setBrightness(Units::rescale(packet.brightness, 100, 255));
+  }
+  if (isOn() && packet.has(ParsedPacket::HUE)) {
+    changes |= setHue(packet.hue);
+    changes |= setBulbMode(BULB_MODE_COLOR);
+  }
+  if (isOn() && packet.has(ParsedPacket::SATURATION)) {
+    changes |= setSaturation(packet.saturation);
+  }
+  if (isOn() && packet.has(ParsedPacket::MODE)) {
+    changes |= setMode(packet.mode);
+    changes |= setBulbMode(BULB_MODE_SCENE);
+  }
+  if (isOn() && packet.has(ParsedPacket::COLOR_TEMP)) {
+    changes |= setMireds(packet.colorTemp);
+    changes |= setBulbMode(BULB_MODE_WHITE);
+  }
+
+  if (packet.has(ParsedPacket::COMMAND)) {
+    switch (packet.command) {
+      case PacketCommand::SET_WHITE:
+        if (isOn()) {
+          changes |= setBulbMode(BULB_MODE_WHITE);
+        }
+        break;
+      case PacketCommand::NIGHT_MODE:
+        changes |= setBulbMode(BULB_MODE_NIGHT);
+        break;
+      case PacketCommand::BRIGHTNESS_UP:
+      case PacketCommand::BRIGHTNESS_DOWN:
+        if (isOn()) {
+          changes |= applyIncrementCommand(
+            GroupStateField::BRIGHTNESS,
+            packet.command == PacketCommand::BRIGHTNESS_UP ? IncrementDirection::INCREASE : IncrementDirection::DECREASE
+          );
+        }
+        break;
+      case PacketCommand::TEMPERATURE_UP:
+      case PacketCommand::TEMPERATURE_DOWN:
+        if (isOn()) {
+          changes |= applyIncrementCommand(
+            GroupStateField::KELVIN,
+            packet.command == PacketCommand::TEMPERATURE_UP ? IncrementDirection::INCREASE : IncrementDirection::DECREASE
+          );
+          changes |= setBulbMode(BULB_MODE_WHITE);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  if (changes) {
+    debugState("GroupState::patch: State changed");
+  }
+  else {
+    debugState("GroupState::patch: State not changed");
+  }
+
+  return changes;
+}
+
 void GroupState::applyColor(JsonObject state) const {
   ParsedColor color = getColor();
   applyColor(state, color.r, color.g, color.b);
@@ -7,6 +7,7 @@
 #include <ArduinoJson.h>
 #include <BulbId.h>
 #include <ParsedColor.h>
+#include <ParsedPacket.h>
 #include <vector>
 
 #ifndef _GROUP_STATE_H
@@ -38,6 +39,7 @@ public:
   // Convenience constructor that patches transient state from a previous GroupState,
   // and defaults with JSON state
   GroupState(const GroupState* previousState, JsonObject jsonState);
+  GroupState(const GroupState* previousState, const ParsedPacket& packet);
 
   void initFields();
 
@@ -120,6 +122,10 @@ public:
   // true if there were any changes.
   bool patch(JsonObject state);
 
+  // Patches this state with a packet parsed by a PacketFormatter.  Same as
+  // patching with the packet's JSON, without building it.
+  bool patch(const ParsedPacket& packet);
+
   // It's a little weird to need to pass in a BulbId here.  The purpose is to
   // support fields like DEVICE_ID, which aren't otherweise available to the
   // state in this class.  The alternative is to have every GroupState object
@@ -152,6 +158,11 @@ public:
   void load(Stream& stream);
   void dump(Stream& stream) const;
 
+  // Same as load/dump, with a buffer of DUMP_SIZE bytes
+  static const size_t DUMP_SIZE = 8;
+  void load(const uint8_t* buffer);
+  void dump(uint8_t* buffer) const;
+
   void debugState(char const *debugMessage) const;
 
   static const GroupState& defaultState(MiLightRemoteType remoteType);
@@ -1,34 +1,39 @@
 #include <GroupState.h>
-#include <LinkedList.h>
+#include <DeviceStates.h>
+#include <LruHashMap.h>
 
 #ifndef _GROUP_STATE_CACHE_H
 #define _GROUP_STATE_CACHE_H
 
-struct GroupCacheNode {
-  GroupCacheNode() {}
-  GroupCacheNode(const BulbId& id, const GroupState& state)
-    : id(id), state(state) { }
-
-  BulbId id;
-  GroupState state;
+struct BulbIdHash {
+  uint32_t operator()(const BulbId& id) const {
+    return id.getCompactId();
+  }
 };
 
+/**
+ * States for the most recently used devices, one block per device with all
+ * of its groups (see DeviceStates).  Lookups are hashed on the device's
+ * compact ID, so they don't slow down as the cache fills up.
+ */
 class GroupStateCache {
 public:
+  // Keyed by DeviceStates::keyFor
+  typedef LruHashMap<BulbId, DeviceStates, BulbIdHash> StateMap;
+
   GroupStateCache(const size_t maxSize);
-  ~GroupStateCache();
 
-  GroupState* get(const BulbId& id);
-  GroupState* set(const BulbId& id, const GroupState& state);
+  // The group ID is ignored.  Any BulbId for the device finds its block.
+  DeviceStates* get(const BulbId& id);
+  DeviceStates* set(const BulbId& id, const DeviceStates& states);
   BulbId getLru();
   bool isFull() const;
-  ListNode<GroupCacheNode*>* getHead();
 
-private:
-  LinkedList<GroupCacheNode*> cache;
-  const size_t maxSize;
+  // Cached devices, iterable from most to least recently used
+  StateMap& getStates();
 
-  GroupState* getInternal(const BulbId& id);
+private:
+  StateMap cache;
 };
 
 #endif
@@ -4,45 +4,241 @@
   #include <SPIFFS.h>
 #endif
 #include "ProjectFS.h"
+#include <vector>
 
 #ifdef ESP8266
+    static const char LOG_PATH[] = "group_states.log";
+    static const char LOG_REWRITE_PATH[] = "group_states.tmp";
+    static const char FILE_DIRECTORY[] = "group_states";
     static const char FILE_PREFIX[] = "group_states/";
 #elif ESP32
+    static const char LOG_PATH[] = "/group_states.log";
+    static const char LOG_REWRITE_PATH[] = "/group_states.tmp";
+    static const char FILE_DIRECTORY[] = "/group_states";
     static const char FILE_PREFIX[] = "/group_states/";
 #endif
 
-void GroupStatePersistence::get(const BulbId &id, GroupState& state) {
-  char path[30];
-  memset(path, 0, 30);
-  buildFilename(id, path);
+GroupStatePersistence::GroupStatePersistence()
+  : storage(LOG_PATH, LOG_REWRITE_PATH)
+  , log(storage)
+  , loaded(false)
+  , stats()
+{ }
 
-  if (ProjectFS.exists(path)) {
-    File f = ProjectFS.open(path, "r");
-    state.load(f);
-    f.close();
+void GroupStatePersistence::get(const BulbId &id, DeviceStates& states) {
+  static_assert(MAX_RECORD_LENGTH <= STATE_LOG_MAX_RECORD_LENGTH, "Device records should fit in the log");
+
+  uint8_t record[MAX_RECORD_LENGTH];
+  const BulbId key = DeviceStates::keyFor(id);
+
+  load();
+
+  const size_t length = log.get(deviceKey(key), record, sizeof(record));
+
+  if (length == 0) {
+    getLegacyRecords(key, states);
+    return;
   }
+
+  loadRecord(key, record, length, states);
 }
 
-void GroupStatePersistence::set(const BulbId &id, const GroupState& state) {
-  char path[30];
-  memset(path, 0, 30);
-  buildFilename(id, path);
+bool GroupStatePersistence::set(const BulbId &id, const DeviceStates& states) {
+  uint8_t record[MAX_RECORD_LENGTH];
+  uint8_t saved[MAX_RECORD_LENGTH];
+  const BulbId key = DeviceStates::keyFor(id);
+
+  load();
+
+  const size_t length = dumpRecord(key, states, record);
+  const uint32_t recordKey = deviceKey(key);
+
+  if (log.get(recordKey, saved, sizeof(saved)) == length
+    && memcmp(record, saved, length) == 0) {
+    ++stats.skippedWrites;
+    return true;
+  }
 
-  File f = ProjectFS.open(path, "w");
-  state.dump(f);
-  f.close();
+  const unsigned long start = micros();
+  const bool written = log.set(recordKey, record, length);
+  const unsigned long elapsed = micros() - start;
+
+  ++stats.writes;
+  stats.totalWriteMicros += elapsed;
+  if (elapsed > stats.maxWriteMicros) {
+    stats.maxWriteMicros = elapsed;
+  }
+
+  if (written) {
+    clearLegacyRecords(key);
+  }
+
+  return written;
 }
 
 void GroupStatePersistence::clear(const BulbId &id) {
-  char path[30];
-  buildFilename(id, path);
+  const BulbId key = DeviceStates::keyFor(id);
 
-  if (ProjectFS.exists(path)) {
-    ProjectFS.remove(path);
+  load();
+  log.clear(deviceKey(key));
+  clearLegacyRecords(key);
+}
+
+uint32_t GroupStatePersistence::deviceKey(const BulbId& id) {
+  return id.deviceId | DEVICE_KEY_TAG | (static_cast<uint32_t>(id.deviceType) << 24);
+}
+
+size_t GroupStatePersistence::dumpRecord(const BulbId& id, const DeviceStates& states, uint8_t* record) {
+  const size_t count = states.numGroups + 1;
+
+  record[0] = id.deviceId & 0xFF;
+  record[1] = id.deviceId >> 8;
+  record[2] = count;
+
+  // Dirty flags aren't part of what's saved, so they don't make otherwise
+  // unchanged states look different
+  for (size_t i = 0; i < count; i++) {
+    GroupState clean(states.groups[i]);
+    clean.clearDirty();
+    clean.clearMqttDirty();
+    clean.dump(record + RECORD_HEADER_LENGTH + i * GroupState::DUMP_SIZE);
+  }
+
+  return RECORD_HEADER_LENGTH + count * GroupState::DUMP_SIZE;
+}
+
+bool GroupStatePersistence::loadRecord(const BulbId& id, const uint8_t* record, size_t length, DeviceStates& states) {
+  if (length < RECORD_HEADER_LENGTH
+    || (record[0] | (record[1] << 8)) != id.deviceId) {
+    return false;
+  }
+
+  size_t count = record[2];
+  if (count > static_cast<size_t>(states.numGroups) + 1) {
+    count = states.numGroups + 1;
+  }
+  if (length < RECORD_HEADER_LENGTH + count * GroupState::DUMP_SIZE) {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    states.groups[i].load(record + RECORD_HEADER_LENGTH + i * GroupState::DUMP_SIZE);
+  }
+
+  return true;
+}
+
+// Records saved under compact IDs: either a device record under group 0's
+// ID, or one record per group
+void GroupStatePersistence::getLegacyRecords(const BulbId& key, DeviceStates& states) {
+  uint8_t record[MAX_RECORD_LENGTH];
+  BulbId groupId(key);
+
+  const size_t length = log.get(groupId.getCompactId(), record, sizeof(record));
+
+  // Compact IDs only have the low byte of the device ID, so this can be
+  // another device's record
+  if (length > GroupState::DUMP_SIZE) {
+    loadRecord(key, record, length, states);
+    return;
+  }
+
+  for (size_t i = 0; i <= states.numGroups; i++) {
+    groupId.groupId = i;
+
+    if (log.get(groupId.getCompactId(), record, GroupState::DUMP_SIZE) == GroupState::DUMP_SIZE) {
+      states.groups[i].load(record);
+    }
+  }
+}
+
+void GroupStatePersistence::clearLegacyRecords(const BulbId& key) {
+  uint8_t record[MAX_RECORD_LENGTH];
+  BulbId groupId(key);
+
+  // Another device's record can be under the same compact ID
+  const size_t length = log.get(groupId.getCompactId(), record, sizeof(record));
+  if (length == GroupState::DUMP_SIZE
+    || (length > GroupState::DUMP_SIZE && (record[0] | (record[1] << 8)) == key.deviceId)) {
+    log.clear(groupId.getCompactId());
+  }
+
+  for (size_t i = 1; i <= DeviceStates::MAX_GROUPS; i++) {
+    groupId.groupId = i;
+    log.clear(groupId.getCompactId());
   }
 }
 
-char* GroupStatePersistence::buildFilename(const BulbId &id, char *buffer) {
-  uint32_t compactId = id.getCompactId();
-  return buffer + sprintf(buffer, "%s%x", FILE_PREFIX, compactId);
+void GroupStatePersistence::compactIfNeeded() {
+  load();
+  log.compactIfNeeded();
+}
+
+const GroupStatePersistence::Stats& GroupStatePersistence::getStats() {
+  load();
+  return stats;
+}
+
+const StateLog::Stats& GroupStatePersistence::getLogStats() {
+  load();
+  return log.getStats();
+}
+
+// Deferred until first use, because the file system isn't mounted when the
+// store is constructed
+void GroupStatePersistence::load() {
+  if (loaded) {
+    return;
+  }
+  loaded = true;
+
+  const unsigned long start = millis();
+
+  log.begin();
+  migrateFiles();
+
+  stats.indexBuildMillis = millis() - start;
+}
+
+void GroupStatePersistence::migrateFiles() {
+  File directory = ProjectFS.open(FILE_DIRECTORY);
+
+  if (!directory || !directory.isDirectory()) {
+    return;
+  }
+
+  std::vector<String> migrated;
+  uint8_t data[GroupState::DUMP_SIZE];
+
+  for (File f = directory.openNextFile(); f; f = directory.openNextFile()) {
+    // Older cores give the full path, newer ones just the file name
+    const char* name = strrchr(f.name(), '/');
+    name = name == NULL ? f.name() : name + 1;
+
+    char* end;
+    const uint32_t compactId = strtoul(name, &end, 16);
+
+    if (*end == 0 && f.read(data, sizeof(data)) == sizeof(data)) {
+      // States in the log are newer than any file.  They're group records,
+      // which are read until the device's record is saved.
+      if (!log.contains(compactId)) {
+        log.set(compactId, data, sizeof(data));
+      }
+
+      migrated.push_back(String(FILE_PREFIX) + name);
+    }
+
+    f.close();
+  }
+  directory.close();
+
+  for (const String& path : migrated) {
+    ProjectFS.remove(path);
+  }
+
+  stats.migratedFiles += migrated.size();
+
+  if (!migrated.empty()) {
+    Serial.printf("Moved %u saved group states into %s\n", static_cast<unsigned>(migrated.size()), LOG_PATH);
+  }
 }
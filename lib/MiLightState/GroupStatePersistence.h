@@ -1,18 +1,77 @@
 #include <GroupState.h>
+#include <DeviceStates.h>
+#include <StateLog.h>
+#include <FileStateLogStorage.h>
 
 #ifndef _GROUP_STATE_PERSISTENCE_H
 #define _GROUP_STATE_PERSISTENCE_H
 
+/**
+ * Saves device states in a single append-only log (see StateLog), one record
+ * per device with all of its groups.  Records are keyed by deviceKey().
+ *
+ * Older versions keyed device records by the compact ID of the device's group
+ * 0, before that saved one record per group, and before that one file per
+ * group.  Files are moved into the log the first time it's loaded.  Older
+ * records are read until the device's first record under its new key is
+ * saved, and then cleared.
+ */
 class GroupStatePersistence {
 public:
-  void get(const BulbId& id, GroupState& state);
-  void set(const BulbId& id, const GroupState& state);
+  struct Stats {
+    // Time taken to load the log and build its index
+    unsigned long indexBuildMillis;
+    size_t migratedFiles;
+    size_t writes;
+    // States which were already saved as they are
+    size_t skippedWrites;
+    unsigned long totalWriteMicros;
+    unsigned long maxWriteMicros;
+  };
+
+  GroupStatePersistence();
+
+  // Device record: device ID (2 bytes, little endian), the number of states
+  // that follow, then the states of groups 0, 1, ...
+  static const size_t RECORD_HEADER_LENGTH = 3;
+  static const size_t MAX_RECORD_LENGTH = RECORD_HEADER_LENGTH + (DeviceStates::MAX_GROUPS + 1) * GroupState::DUMP_SIZE;
+
+  // Device ID in the low 16 bits, then DEVICE_KEY_TAG, then the device type.
+  // Compact IDs only keep the low byte of the device ID, and always have 0
+  // where the tag goes, so the two never collide.
+  static const uint32_t DEVICE_KEY_TAG = 0xD5 << 16;
+  static uint32_t deviceKey(const BulbId& id);
+
+  // The group ID is ignored.  States that haven't been saved are left as
+  // they are.
+  void get(const BulbId& id, DeviceStates& states);
+  // Returns false if the states couldn't be saved.  Nothing is written if
+  // the saved states are the same.
+  bool set(const BulbId& id, const DeviceStates& states);
 
   void clear(const BulbId& id);
 
+  // Encodes states as a device record.  Returns its length.
+  static size_t dumpRecord(const BulbId& id, const DeviceStates& states, uint8_t* record);
+  // Returns false if the record isn't for the device
+  static bool loadRecord(const BulbId& id, const uint8_t* record, size_t length, DeviceStates& states);
+
+  // Rewrites the log if enough of it is superseded states
+  void compactIfNeeded();
+
+  const Stats& getStats();
+  const StateLog::Stats& getLogStats();
+
 private:
+  FileStateLogStorage storage;
+  StateLog log;
+  bool loaded;
+  Stats stats;
 
-  static char* buildFilename(const BulbId& id, char* buffer);
+  void load();
+  void migrateFiles();
+  void getLegacyRecords(const BulbId& key, DeviceStates& states);
+  void clearLegacyRecords(const BulbId& key);
 };
 
 #endif
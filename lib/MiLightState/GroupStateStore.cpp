@@ -1,38 +1,55 @@
 #include <GroupStateStore.h>
 #include <MiLightRemoteConfig.h>
 
-GroupStateStore::GroupStateStore(const size_t maxSize, const size_t flushRate)
-  : cache(GroupStateCache(maxSize)),
+GroupStateStore::GroupStateStore(
+  const size_t maxSize,
+  const size_t flushRate,
+  const size_t flushMaxBytes,
+  const size_t flushBudgetMillis
+) : cache(maxSize),
+    dirtyIds(maxSize),
     flushRate(flushRate),
-    lastFlush(0)
+    flushMaxBytes(flushMaxBytes),
+    flushBudgetMillis(flushBudgetMillis),
+    lastFlush(0),
+    compactionDue(false)
 { }
 
-GroupState* GroupStateStore::get(const BulbId& id) {
-  GroupState* state = cache.get(id);
+DeviceStates* GroupStateStore::getDevice(const BulbId& id) {
+  DeviceStates* states = cache.get(id);
 
-  if (state == NULL) {
+  if (states == NULL) {
 #if STATE_DEBUG
     printf(
-      "Couldn't fetch state for 0x%04X / %d / %s in the cache, getting it from persistence\n",
+      "Couldn't fetch states for 0x%04X / %s in the cache, getting them from persistence\n",
       id.deviceId,
-      id.groupId,
       MiLightRemoteConfig::fromType(id.deviceType)->name.c_str()
     );
 #endif
-    trackEviction();
-    GroupState loadedState = GroupState::defaultState(id.deviceType);
-
     const MiLightRemoteConfig* remoteConfig = MiLightRemoteConfig::fromType(id.deviceType);
 
     if (remoteConfig == NULL) {
       return NULL;
     }
 
-    persistence.get(id, loadedState);
-    state = cache.set(id, loadedState);
+    trackEviction();
+    DeviceStates loadedStates(id.deviceType, remoteConfig->numGroups);
+
+    persistence.get(id, loadedStates);
+    states = cache.set(id, loadedStates);
   }
 
-  return state;
+  return states;
+}
+
+GroupState* GroupStateStore::get(const BulbId& id) {
+  DeviceStates* states = getDevice(id);
+
+  if (states == NULL || id.groupId > DeviceStates::MAX_GROUPS) {
+    return NULL;
+  }
+
+  return &states->groups[id.groupId];
 }
 
 GroupState* GroupStateStore::get(const uint16_t deviceId, const uint8_t groupId, const MiLightRemoteType deviceType) {
@@ -48,34 +65,35 @@ GroupState* GroupStateStore::get(const uint16_t deviceId, const uint8_t groupId,
 //   respond to group 0.  When state for an individual (i.e., != 0) group is changed, the state for
 //   group 0 becomes out of sync and should be cleared.
 //
-// * If id.groupId == 0, will iterate across all groups and individually save each group (recursively)
+// * If id.groupId == 0, the state is patched onto every group as well.
+//
+// All groups of a device are in one cache entry, so none of this can evict anything.
 //
 GroupState* GroupStateStore::set(const BulbId &id, const GroupState& state) {
-  BulbId otherId(id);
-  GroupState* storedState = get(id);
+  DeviceStates* states = getDevice(id);
+
+  if (states == NULL || id.groupId > DeviceStates::MAX_GROUPS) {
+    return NULL;
+  }
+
+  GroupState* storedState = &states->groups[id.groupId];
   storedState->patch(state);
 
   if (id.groupId == 0) {
-    const MiLightRemoteConfig* remote = MiLightRemoteConfig::fromType(id.deviceType);
-
 #ifdef STATE_DEBUG
-    Serial.printf_P(PSTR("Fanning out group 0 state for device ID 0x%04X (%d groups in total)\n"), id.deviceId, remote->numGroups);
+    Serial.printf_P(PSTR("Fanning out group 0 state for device ID 0x%04X (%d groups in total)\n"), id.deviceId, states->numGroups);
     state.debugState("group 0 state = ");
 #endif
 
-    for (size_t i = 1; i <= remote->numGroups; i++) {
-      otherId.groupId = i;
-
-      GroupState* individualState = get(otherId);
-      individualState->patch(state);
+    for (size_t i = 1; i <= states->numGroups; i++) {
+      states->groups[i].patch(state);
     }
   } else {
-    otherId.groupId = 0;
-    GroupState* group0State = get(otherId);
-
-    group0State->clearNonMatchingFields(state);
+    states->groups[0].clearNonMatchingFields(state);
   }
 
+  markDirty(id);
+
   return storedState;
 }
 
@@ -90,61 +108,205 @@ void GroupStateStore::clear(const BulbId& bulbId) {
   if (state != NULL) {
     state->initFields();
     state->patch(GroupState::defaultState(bulbId.deviceType));
+    markDirty(bulbId);
   }
 }
 
 void GroupStateStore::trackEviction() {
   if (cache.isFull()) {
     evictedIds.add(cache.getLru());
+    dirtyIds.remove(evictedIds.getLast());
 
 #ifdef STATE_DEBUG
     BulbId bulbId = evictedIds.getLast();
     printf(
-      "Evicting from cache: 0x%04X / %d / %s\n",
+      "Evicting from cache: 0x%04X / %s\n",
       bulbId.deviceId,
-      bulbId.groupId,
       MiLightRemoteConfig::fromType(bulbId.deviceType)->name.c_str()
     );
 #endif
   }
 }
 
+void GroupStateStore::markDirty(const BulbId& id) {
+  const BulbId key = DeviceStates::keyFor(id);
+
+  // Keeps the time of the first change, so a device that keeps changing
+  // (e.g. in a transition) still gets flushed
+  if (dirtyIds.peek(key) == NULL) {
+    dirtyIds.put(key, millis());
+  }
+}
+
 bool GroupStateStore::flush() {
-  ListNode<GroupCacheNode*>* curr = cache.getHead();
+  return flushBatch(0, 0, 0);
+}
+
+bool GroupStateStore::flushBatch(const unsigned long minDirtyMillis, const size_t maxBytes, const size_t budgetMillis) {
+  const bool budgeted = maxBytes > 0 || budgetMillis > 0;
+
+  // A rewrite isn't split up, so budgeted flushes give it a batch of its own
+  if (compactionDue && budgeted) {
+    compactionDue = false;
+    persistence.compactIfNeeded();
+    return false;
+  }
+
+  const unsigned long start = millis();
+  const StateLog::Stats& logStats = persistence.getLogStats();
+  const size_t startBytes = logStats.bytesWritten;
   bool anythingFlushed = false;
+  bool overBudget = false;
+
+  // Always does at least one thing, so small budgets still make progress
+  auto checkBudget = [&]() {
+    overBudget = (maxBytes > 0 && logStats.bytesWritten - startBytes >= maxBytes)
+      || (budgetMillis > 0 && millis() - start >= budgetMillis);
+  };
 
-  while (curr != NULL && curr->data->state.isDirty() && !anythingFlushed) {
-    persistence.set(curr->data->id, curr->data->state);
-    curr->data->state.clearDirty();
+  // Clears go first, so they can't remove anything written below.  A device
+  // that's been loaded back into the cache since it was evicted keeps its
+  // saved states.
+  while (evictedIds.size() > 0 && !overBudget) {
+    BulbId bulbId = evictedIds.shift();
 
+    if (cache.getStates().peek(bulbId) == NULL) {
+      persistence.clear(bulbId);
+      anythingFlushed = true;
+      checkBudget();
+    }
+  }
+
+  while (dirtyIds.size() > 0 && !overBudget) {
+    const DirtyMap::Entry& oldest = dirtyIds.at(dirtyIds.last());
+
+    if (millis() - oldest.value < minDirtyMillis) {
+      break;
+    }
+
+    const BulbId bulbId = oldest.key;
+    DeviceStates* states = cache.getStates().peek(bulbId);
+
+    if (states != NULL) {
 #ifdef STATE_DEBUG
-    BulbId bulbId = curr->data->id;
-    printf(
-      "Flushing dirty state for 0x%04X / %d / %s\n",
-      bulbId.deviceId,
-      bulbId.groupId,
-      MiLightRemoteConfig::fromType(bulbId.deviceType)->name.c_str()
-    );
+      printf(
+        "Flushing dirty states for 0x%04X / %s\n",
+        bulbId.deviceId,
+        MiLightRemoteConfig::fromType(bulbId.deviceType)->name.c_str()
+      );
 #endif
 
-    curr = curr->next;
-    anythingFlushed = true;
+      // Leave it dirty and try again after another flush interval
+      if (!persistence.set(bulbId, *states)) {
+        dirtyIds.remove(bulbId);
+        dirtyIds.put(bulbId, millis());
+        break;
+      }
+
+      states->clearDirty();
+      anythingFlushed = true;
+    }
+
+    dirtyIds.remove(bulbId);
+    checkBudget();
   }
 
-  while (evictedIds.size() > 0 && !anythingFlushed) {
-    persistence.clear(evictedIds.shift());
-    anythingFlushed = true;
+  if (anythingFlushed) {
+    compactionDue = true;
+  }
+
+  if (compactionDue && !budgeted) {
+    compactionDue = false;
+    persistence.compactIfNeeded();
   }
 
   return anythingFlushed;
 }
 
+// Waiting until the oldest dirty device has been dirty for the flush rate lets
+// changes to a scene's worth of bulbs go out in one batch.  A batch cut short
+// by its budget carries on in the next loop, since what's left is still due.
+// So does compaction after a batch.
 void GroupStateStore::limitedFlush() {
-  unsigned long now = millis();
+  const unsigned long now = millis();
+  const bool dirtyDue = getDirtyCount() > 0 && getOldestDirtyMillis() >= flushRate;
+  const bool clearsDue = evictedIds.size() > 0 && now - lastFlush >= flushRate;
+
+  if (compactionDue || dirtyDue || clearsDue) {
+    flushBatch(flushRate, flushMaxBytes, flushBudgetMillis);
+    lastFlush = now;
+  }
+}
+
+size_t GroupStateStore::getDirtyCount() const {
+  return dirtyIds.size();
+}
+
+unsigned long GroupStateStore::getOldestDirtyMillis() const {
+  if (dirtyIds.size() == 0) {
+    return 0;
+  }
+
+  return millis() - dirtyIds.at(dirtyIds.last()).value;
+}
+
+// Full device ID and type, which is all a device's key needs
+static uint32_t retainedKey(const BulbId& key) {
+  return key.deviceId | (static_cast<uint32_t>(key.deviceType) << 16);
+}
+
+void GroupStateStore::retain(RetainedStates& retained) {
+  static_assert(
+    GroupStatePersistence::MAX_RECORD_LENGTH <= RETAINED_STATES_MAX_RECORD_LENGTH,
+    "Device records should fit in retained memory"
+  );
 
-  if ((lastFlush + flushRate) < now) {
-    if (flush()) {
-      lastFlush = now;
+  GroupStateCache::StateMap& states = cache.getStates();
+  uint8_t record[GroupStatePersistence::MAX_RECORD_LENGTH];
+
+  retained.clear();
+
+  for (GroupStateCache::StateMap::Index i = states.first(); i != GroupStateCache::StateMap::NONE; i = states.next(i)) {
+    const BulbId& key = states.at(i).key;
+    const size_t length = GroupStatePersistence::dumpRecord(key, states.at(i).value, record);
+
+    if (!retained.add(retainedKey(key), record, length, dirtyIds.peek(key) != NULL)) {
+      break;
     }
   }
+
+  retained.seal();
+}
+
+size_t GroupStateStore::restore(const RetainedStates& retained) {
+  size_t restored = 0;
+
+  // Least recently used first, so the cache ends up in the same order
+  for (size_t i = retained.count; i > 0 && !cache.isFull(); i--) {
+    const RetainedStates::Slot& slot = retained.slots[i - 1];
+    const BulbId key(slot.key & 0xFFFF, 0, static_cast<MiLightRemoteType>(slot.key >> 16));
+    const MiLightRemoteConfig* remoteConfig = MiLightRemoteConfig::fromType(key.deviceType);
+
+    if (remoteConfig == NULL) {
+      continue;
+    }
+
+    DeviceStates states(key.deviceType, remoteConfig->numGroups);
+
+    if (!GroupStatePersistence::loadRecord(key, slot.data, slot.length, states)) {
+      continue;
+    }
+
+    cache.set(key, states);
+    if (slot.dirty) {
+      markDirty(key);
+    }
+    ++restored;
+  }
+
+  return restored;
+}
+
+GroupStatePersistence& GroupStateStore::getPersistence() {
+  return persistence;
 }
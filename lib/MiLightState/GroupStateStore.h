@@ -1,13 +1,29 @@
 #include <GroupState.h>
 #include <GroupStateCache.h>
 #include <GroupStatePersistence.h>
+#include <RetainedStates.h>
+#include <LinkedList.h>
 
 #ifndef _GROUP_STATE_STORE_H
 #define _GROUP_STATE_STORE_H
 
+/**
+ * Group states, cached and saved one device at a time (see DeviceStates).
+ */
 class GroupStateStore {
 public:
-  GroupStateStore(const size_t maxSize, const size_t flushRate);
+  /*
+   * maxSize is the number of devices cached.
+   *
+   * Devices are flushed once they've been dirty for flushRate milliseconds,
+   * at most flushMaxBytes and flushBudgetMillis at a time (0 for no limit).
+   */
+  GroupStateStore(
+    const size_t maxSize,
+    const size_t flushRate,
+    const size_t flushMaxBytes = 0,
+    const size_t flushBudgetMillis = 0
+  );
 
   /*
    * Returns the state for the given BulbId.  If accessing state for a valid device
@@ -35,19 +51,52 @@ public:
   bool flush();
 
   /*
-   * Flushes at most one dirty state to persistent storage.  Rate limit
-   * specified by Settings.
+   * Flushes a batch of dirty devices, oldest first, once the oldest has
+   * waited for the flush rate.  Rate and batch limits specified by Settings.
+   * The log is compacted in a call of its own, since a rewrite can take as
+   * long as a whole batch.
    */
   void limitedFlush();
 
+  // Dirty devices waiting to be flushed, and how long the oldest has waited
+  size_t getDirtyCount() const;
+  unsigned long getOldestDirtyMillis() const;
+
+  /*
+   * Copies the most recently used devices into memory that survives a
+   * restart.  Devices waiting to be flushed stay dirty when restored.
+   */
+  void retain(RetainedStates& retained);
+
+  /*
+   * Puts devices saved by retain() back in the cache without reading flash.
+   * Returns how many were restored.
+   */
+  size_t restore(const RetainedStates& retained);
+
+  GroupStatePersistence& getPersistence();
+
 private:
+  // Time each dirty device was first changed since it was last flushed.
+  // Only ever holds cached devices, so it never needs to evict.
+  typedef LruHashMap<BulbId, unsigned long, BulbIdHash> DirtyMap;
+
   GroupStateCache cache;
   GroupStatePersistence persistence;
+  DirtyMap dirtyIds;
   LinkedList<BulbId> evictedIds;
   const size_t flushRate;
+  const size_t flushMaxBytes;
+  const size_t flushBudgetMillis;
   unsigned long lastFlush;
+  // Set when states were flushed since the log was last checked for
+  // compaction
+  bool compactionDue;
 
+  DeviceStates* getDevice(const BulbId& id);
   void trackEviction();
+  void markDirty(const BulbId& id);
+  bool flushBatch(const unsigned long minDirtyMillis, const size_t maxBytes, const size_t budgetMillis);
 };
 
 #endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Bytes added to a payload when it's framed: 2 for the CRC
+#define PL1167_FRAME_OVERHEAD 2
+
+// Define to bit-reverse buffers a 32-bit word at a time rather than with the
+// lookup table.  Which is faster depends on the CPU; see the native benchmark.
+// #define PL1167_CODEC_WORD_REVERSAL
+
+/**
+ * Framing used by the PL1167 on air, for radios which don't do it in hardware
+ * (the nRF24 pretends to be a PL1167, the LT8900 is one).
+ *
+ * Doesn't depend on Arduino so it can be tested and benchmarked on the host.
+ */
+class PL1167Codec {
+public:
+  // CRC-16 with reflected polynomial 0x8408, initial value 0
+  static uint16_t crc(const uint8_t* data, size_t length);
+
+  // Reverse the bits of a given byte
+  static uint8_t reverseBits(uint8_t byte);
+
+  // Reverse the bits of every byte in a buffer.  in and out may be the same.
+  static void reverseBytes(const uint8_t* in, uint8_t* out, size_t length);
+
+  // Same as reverseBytes, but handles four bytes at a time with shifts and masks
+  static void reverseBytesWordwise(const uint8_t* in, uint8_t* out, size_t length);
+
+  /**
+   * Writes the on-air frame for the payload to out: every byte bit-reversed,
+   * followed by the CRC (LSB first, also bit-reversed).  out must have room
+   * for length + PL1167_FRAME_OVERHEAD bytes.  Returns the frame length.
+   */
+  static size_t encode(const uint8_t* data, size_t length, uint8_t* out);
+
+  /**
+   * Reverse of encode.  Writes the payload to out, which may be the same as
+   * frame.  Returns the payload length, or -1 if the frame is too short or
+   * the CRC doesn't match.
+   */
+  static int decode(const uint8_t* frame, size_t length, uint8_t* out);
+
+private:
+  static const uint16_t CRC_TABLE[256];
+  static const uint8_t REVERSE_TABLE[256];
+};
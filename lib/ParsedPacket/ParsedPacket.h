@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+
+// Commands a remote can send which aren't a value for a single field
+enum class PacketCommand : uint8_t {
+  NONE,
+  NIGHT_MODE,
+  SET_WHITE,
+  BRIGHTNESS_UP,
+  BRIGHTNESS_DOWN,
+  TEMPERATURE_UP,
+  TEMPERATURE_DOWN,
+  MODE_SPEED_UP,
+  MODE_SPEED_DOWN,
+  NEXT_MODE,
+  PREVIOUS_MODE,
+  COLOR_WHITE_TOGGLE
+};
+
+/**
+ * What a packet from a remote asks for, as parsed by a PacketFormatter.  Only
+ * the fields in the mask are meaningful.
+ *
+ * Received packets are applied to GroupState straight from this.  JSON is only
+ * built for consumers that need it (see PacketFormatter::toJson).
+ *
+ * Doesn't depend on Arduino so it can be used on the host.
+ */
+struct ParsedPacket {
+  enum Field : uint16_t {
+    STATE      = 1 << 0,
+    BRIGHTNESS = 1 << 1,
+    HUE        = 1 << 2,
+    SATURATION = 1 << 3,
+    MODE       = 1 << 4,
+    COLOR_TEMP = 1 << 5,
+    COMMAND    = 1 << 6,
+    BUTTON_ID  = 1 << 7,
+    ARGUMENT   = 1 << 8
+  };
+
+  uint16_t fields;
+
+  bool on;
+  // 0-255, as formatters store it.  GroupState rescales it to 0-100.
+  uint8_t brightness;
+  // Degrees, 0-359
+  uint16_t hue;
+  // 0-100
+  uint8_t saturation;
+  uint8_t mode;
+  // Mireds
+  uint16_t colorTemp;
+  PacketCommand command;
+
+  // Raw command and argument for packets that couldn't be parsed further
+  uint8_t buttonId;
+  uint8_t argument;
+
+  ParsedPacket()
+    : fields(0)
+    , on(false)
+    , brightness(0)
+    , hue(0)
+    , saturation(0)
+    , mode(0)
+    , colorTemp(0)
+    , command(PacketCommand::NONE)
+    , buttonId(0)
+    , argument(0)
+  { }
+
+  inline bool has(Field field) const {
+    return (fields & field) != 0;
+  }
+
+  inline bool hasCommand(PacketCommand command) const {
+    return has(COMMAND) && this->command == command;
+  }
+
+  inline void setState(bool on) {
+    this->on = on;
+    fields |= STATE;
+  }
+
+  inline void setBrightness(uint8_t brightness) {
+    this->brightness = brightness;
+    fields |= BRIGHTNESS;
+  }
+
+  inline void setHue(uint16_t hue) {
+    this->hue = hue;
+    fields |= HUE;
+  }
+
+  inline void setSaturation(uint8_t saturation) {
+    this->saturation = saturation;
+    fields |= SATURATION;
+  }
+
+  inline void setMode(uint8_t mode) {
+    this->mode = mode;
+    fields |= MODE;
+  }
+
+  inline void setColorTemp(uint16_t colorTemp) {
+    this->colorTemp = colorTemp;
+    fields |= COLOR_TEMP;
+  }
+
+  inline void setCommand(PacketCommand command) {
+    this->command = command;
+    fields |= COMMAND;
+  }
+
+  inline void setButtonId(uint8_t buttonId) {
+    this->buttonId = buttonId;
+    fields |= BUTTON_ID;
+  }
+
+  inline void setArgument(uint8_t argument) {
+    this->argument = argument;
+    fields |= ARGUMENT;
+  }
+};
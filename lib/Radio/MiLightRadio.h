@@ -22,6 +22,36 @@ class MiLightRadio {
     virtual int configure() = 0;
     virtual const MiLightRadioConfig& config() = 0;
 
+    // Radios which frame packets in software can encode a packet once and send
+    // the result repeatedly with writeEncoded.  Returns the encoded length, or 0
+    // if the radio doesn't support this, in which case use write.
+    virtual size_t encode(const uint8_t frame[], size_t frame_length, uint8_t encoded[]) {
+      return 0;
+    }
+
+    virtual int writeEncoded(const uint8_t encoded[], size_t encoded_length) {
+      return -1;
+    }
+
+    // Makes sure the radio is receiving, so that it will raise its IRQ line when
+    // a packet arrives.  Should be cheap when it already is.
+    virtual void startListening() { }
+
+    // Frames the radio may have dropped because they weren't read in time
+    virtual size_t droppedFrames() {
+      return 0;
+    }
+
+    // Repeats of a packet which were received and ignored
+    virtual int dupesReceived() {
+      return 0;
+    }
+
+    // Times the radio had to be fully reset while receiving
+    virtual size_t rxResets() {
+      return 0;
+    }
+
 };
 
 
@@ -8,6 +8,9 @@
 
 #define MILIGHT_MAX_PACKET_LENGTH 9
 
+// Packet, plus a length byte and CRC, as it's sent by radios which do their own framing
+#define MILIGHT_MAX_ENCODED_PACKET_LENGTH (MILIGHT_MAX_PACKET_LENGTH + 3)
+
 class MiLightRadioConfig {
 public:
   static const size_t NUM_CHANNELS = 3;
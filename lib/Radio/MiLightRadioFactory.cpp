@@ -1,24 +1,83 @@
 #include <MiLightRadioFactory.h>
 
-std::shared_ptr<MiLightRadioFactory> MiLightRadioFactory::fromSettings(const Settings& settings) {
-  switch (settings.radioInterfaceType) {
+std::vector<std::shared_ptr<MiLightRadioFactory>> MiLightRadioFactory::fromSettings(const Settings& settings) {
+  std::vector<std::shared_ptr<MiLightRadioFactory>> factories;
+
+  if (settings.radioModules.empty()) {
+    std::shared_ptr<MiLightRadioFactory> factory = create(
+      settings.radioInterfaceType,
+      settings.cePin,
+      settings.csnPin,
+      settings.resetPin,
+      settings
+    );
+
+    if (factory != NULL) {
+      factory->irqPin = settings.irqPin;
+      factories.push_back(factory);
+    }
+
+    return factories;
+  }
+
+  for (size_t i = 0; i < settings.radioModules.size(); i++) {
+    const RadioModuleConfig& module = settings.radioModules[i];
+    std::shared_ptr<MiLightRadioFactory> factory = create(
+      module.type,
+      module.cePin,
+      module.csnPin,
+      module.resetPin,
+      settings
+    );
+
+    if (factory != NULL) {
+      factory->role = module.role;
+      factory->remoteTypes = module.remoteTypes;
+      factory->irqPin = module.irqPin;
+      factories.push_back(factory);
+    }
+  }
+
+  return factories;
+}
+
+std::shared_ptr<MiLightRadioFactory> MiLightRadioFactory::create(
+  RadioInterfaceType type,
+  uint8_t cePin,
+  uint8_t csnPin,
+  uint8_t resetPin,
+  const Settings& settings
+) {
+  switch (type) {
     case nRF24:
       return std::make_shared<NRF24Factory>(
-        settings.csnPin,
-        settings.cePin,
+        csnPin,
+        cePin,
         settings.rf24PowerLevel,
         settings.rf24Channels,
         settings.rf24ListenChannel
       );
 
     case LT8900:
-      return std::make_shared<LT8900Factory>(settings.csnPin, settings.resetPin, settings.cePin);
+      return std::make_shared<LT8900Factory>(csnPin, resetPin, cePin);
 
     default:
       return NULL;
   }
 }
 
+RadioRole MiLightRadioFactory::getRole() const {
+  return role;
+}
+
+const std::vector<MiLightRemoteType>& MiLightRadioFactory::getRemoteTypes() const {
+  return remoteTypes;
+}
+
+int8_t MiLightRadioFactory::getIrqPin() const {
+  return irqPin;
+}
+
 NRF24Factory::NRF24Factory(
   uint8_t csnPin,
   uint8_t cePin,
@@ -37,6 +96,10 @@ std::shared_ptr<MiLightRadio> NRF24Factory::create(const MiLightRadioConfig &con
   return std::make_shared<NRF24MiLightRadio>(rf24, config, channels, listenChannel);
 }
 
+bool NRF24Factory::isIrqActiveLow() const {
+  return true;
+}
+
 LT8900Factory::LT8900Factory(uint8_t csPin, uint8_t resetPin, uint8_t pktFlag)
   : _csPin(csPin),
     _resetPin(resetPin),
@@ -46,3 +109,8 @@ LT8900Factory::LT8900Factory(uint8_t csPin, uint8_t resetPin, uint8_t pktFlag)
 std::shared_ptr<MiLightRadio> LT8900Factory::create(const MiLightRadioConfig& config) {
   return std::make_shared<LT8900MiLightRadio>(_csPin, _resetPin, _pktFlag, config);
 }
+
+bool LT8900Factory::isIrqActiveLow() const {
+  // PKT_FLAG goes high
+  return false;
+}
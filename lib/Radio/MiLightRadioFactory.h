@@ -7,6 +7,7 @@
 #include <RF24PowerLevel.h>
 #include <RF24Channel.h>
 #include <Settings.h>
+#include <RadioRole.h>
 #include <vector>
 #include <memory>
 
@@ -19,7 +20,31 @@ public:
   virtual ~MiLightRadioFactory() { };
   virtual std::shared_ptr<MiLightRadio> create(const MiLightRadioConfig& config) = 0;
 
-  static std::shared_ptr<MiLightRadioFactory> fromSettings(const Settings& settings);
+  // One factory per physical radio module
+  static std::vector<std::shared_ptr<MiLightRadioFactory>> fromSettings(const Settings& settings);
+
+  RadioRole getRole() const;
+  // Remote types the module is dedicated to sending.  Empty for any.
+  const std::vector<MiLightRemoteType>& getRemoteTypes() const;
+
+  // Pin the module signals received packets on, or -1 if it should be polled
+  int8_t getIrqPin() const;
+  // Level the pin is driven to while the module has something to report
+  virtual bool isIrqActiveLow() const = 0;
+
+protected:
+
+  RadioRole role = RadioRole::BOTH;
+  std::vector<MiLightRemoteType> remoteTypes;
+  int8_t irqPin = -1;
+
+  static std::shared_ptr<MiLightRadioFactory> create(
+    RadioInterfaceType type,
+    uint8_t cePin,
+    uint8_t csnPin,
+    uint8_t resetPin,
+    const Settings& settings
+  );
 
 };
 
@@ -35,11 +60,13 @@ public:
   );
 
   virtual std::shared_ptr<MiLightRadio> create(const MiLightRadioConfig& config);
+  virtual bool isIrqActiveLow() const;
 
 protected:
 
   RF24 rf24;
-  const std::vector<RF24Channel>& channels;
+  // Copied so settings can change while the radios are in use
+  const std::vector<RF24Channel> channels;
   const RF24Channel listenChannel;
 
 };
@@ -50,6 +77,7 @@ public:
   LT8900Factory(uint8_t csPin, uint8_t resetPin, uint8_t pktFlag);
 
   virtual std::shared_ptr<MiLightRadio> create(const MiLightRadioConfig& config);
+  virtual bool isIrqActiveLow() const;
 
 protected:
 
@@ -2,6 +2,7 @@
 
 #include <PL1167_nRF24.h>
 #include <NRF24MiLightRadio.h>
+#include <PL1167Codec.h>
 
 #define PACKET_ID(packet, packet_length) ( (packet[1] << 8) | packet[packet_length - 1] )
 
@@ -86,6 +87,22 @@ bool NRF24MiLightRadio::available() {
   return _waiting;
 }
 
+void NRF24MiLightRadio::startListening() {
+  _pl1167.startListening(_config.channels[listenChannelIx]);
+}
+
+size_t NRF24MiLightRadio::droppedFrames() {
+  return _pl1167.rxOverflows();
+}
+
+size_t NRF24MiLightRadio::rxResets() {
+  return _pl1167.rxResets();
+}
+
+int NRF24MiLightRadio::dupesReceived() {
+  return _dupes_received;
+}
+
 int NRF24MiLightRadio::read(uint8_t frame[], size_t &frame_length)
 {
   if (!_waiting) {
@@ -123,12 +140,31 @@ int NRF24MiLightRadio::write(uint8_t frame[], size_t frame_length) {
 }
 
 int NRF24MiLightRadio::resend() {
+  // The frame is the same on every channel, so only encode it once
+  uint8_t encoded[MILIGHT_MAX_ENCODED_PACKET_LENGTH];
+  size_t encoded_length = PL1167Codec::encode(_out_packet, _out_packet[0] + 1, encoded);
+
+  return writeEncoded(encoded, encoded_length);
+}
+
+size_t NRF24MiLightRadio::encode(const uint8_t frame[], size_t frame_length, uint8_t encoded[]) {
+  if (frame_length > sizeof(_out_packet) - 1) {
+    return 0;
+  }
+
+  uint8_t packet[sizeof(_out_packet)];
+  packet[0] = frame_length;
+  memcpy(packet + 1, frame, frame_length);
+
+  return PL1167Codec::encode(packet, frame_length + 1, encoded);
+}
+
+int NRF24MiLightRadio::writeEncoded(const uint8_t encoded[], size_t encoded_length) {
   for (std::vector<RF24Channel>::const_iterator it = channels.begin(); it != channels.end(); ++it) {
     size_t channelIx = static_cast<uint8_t>(*it);
     uint8_t channel = _config.channels[channelIx];
 
-    _pl1167.writeFIFO(_out_packet, _out_packet[0] + 1);
-    _pl1167.transmit(channel);
+    _pl1167.transmitFrame(channel, encoded, encoded_length);
   }
 
   return 0;
@@ -32,6 +32,11 @@ class NRF24MiLightRadio : public MiLightRadio {
     int write(uint8_t frame[], size_t frame_length);
     int resend();
     int configure();
+    size_t encode(const uint8_t frame[], size_t frame_length, uint8_t encoded[]);
+    int writeEncoded(const uint8_t encoded[], size_t encoded_length);
+    void startListening();
+    size_t droppedFrames();
+    size_t rxResets();
     const MiLightRadioConfig& config();
 
   private:
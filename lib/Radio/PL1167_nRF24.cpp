@@ -11,10 +11,8 @@
  */
 
 #include "PL1167_nRF24.h"
-#include <RadioUtils.h>
 #include <MiLightRadioConfig.h>
-
-static uint16_t calc_crc(uint8_t *data, size_t data_length);
+#include <PL1167Codec.h>
 
 PL1167_nRF24::PL1167_nRF24(RF24 &radio)
   : _radio(radio)
@@ -25,6 +23,9 @@ int PL1167_nRF24::open() {
   _radio.setAutoAck(false);
   _radio.setDataRate(RF24_1MBPS);
   _radio.disableCRC();
+  // Only raise IRQ for received packets
+  _radio.maskIRQ(true, true, false);
+  _listening = false;
 
   _syncwordLength = MiLightRadioConfig::SYNCWORD_LENGTH;
   _radio.setAddressWidth(_syncwordLength);
@@ -53,6 +54,7 @@ int PL1167_nRF24::recalc_parameters() {
   }
 
   _receive_length = packet_length;
+  _listening = false;
 
   _radio.setChannel(2 + _channel);
   _radio.setPayloadSize( packet_length );
@@ -71,7 +73,7 @@ int PL1167_nRF24::setMaxPacketLength(uint8_t maxPacketLength) {
   return recalc_parameters();
 }
 
-int PL1167_nRF24::receive(uint8_t channel) {
+int PL1167_nRF24::startListening(uint8_t channel) {
   if (channel != _channel) {
     _channel = channel;
     int retval = recalc_parameters();
@@ -80,8 +82,32 @@ int PL1167_nRF24::receive(uint8_t channel) {
     }
   }
 
-  _radio.startListening();
+  if (!_listening) {
+    _radio.startListening();
+    _listening = true;
+  }
+
+  return 0;
+}
+
+size_t PL1167_nRF24::rxOverflows() const {
+  return _rxOverflows;
+}
+
+size_t PL1167_nRF24::rxResets() const {
+  return _rxResets;
+}
+
+int PL1167_nRF24::receive(uint8_t channel) {
+  int retval = startListening(channel);
+  if (retval < 0) {
+    return retval;
+  }
+
   if (_radio.available()) {
+    if (_radio.rxFifoFull()) {
+      ++_rxOverflows;
+    }
 #ifdef DEBUG_PRINTF
   printf("Radio is available\n");
 #endif
@@ -126,6 +152,13 @@ int PL1167_nRF24::writeFIFO(const uint8_t data[], size_t data_length)
 }
 
 int PL1167_nRF24::transmit(uint8_t channel) {
+  uint8_t tmp[sizeof(_packet) + PL1167_FRAME_OVERHEAD];
+  size_t length = PL1167Codec::encode(_packet, _packet_length, tmp);
+
+  return transmitFrame(channel, tmp, length);
+}
+
+int PL1167_nRF24::transmitFrame(uint8_t channel, const uint8_t frame[], size_t frame_length) {
   if (channel != _channel) {
     _channel = channel;
     int retval = recalc_parameters();
@@ -135,26 +168,14 @@ int PL1167_nRF24::transmit(uint8_t channel) {
     yield();
   }
 
-  _radio.stopListening();
-  uint8_t tmp[sizeof(_packet)];
-  int outp=0;
-
-  uint16_t crc = calc_crc(_packet, _packet_length);
-
-  // +1 for packet length
-  // +2 for crc
-  // = 3
-  for (int inp = 0; inp < _packet_length + 3; inp++) {
-    if (inp < _packet_length) {
-      tmp[outp++] = reverseBits(_packet[inp]);}
-    else if (inp < _packet_length + 2) {
-      tmp[outp++] = reverseBits((crc >> ( (inp - _packet_length) * 8)) & 0xff);
-    }
-  }
+  // Anything received is stale once we start transmitting
+  _received = false;
 
+  _radio.stopListening();
+  _listening = false;
   yield();
 
-  _radio.write(tmp, outp);
+  _radio.write(frame, frame_length);
   return 0;
 }
 
@@ -175,9 +196,6 @@ int PL1167_nRF24::internal_receive() {
 
   _radio.read(tmp, _receive_length);
 
-  // HACK HACK HACK: Reset radio
-  open();
-
 // Currently, the syncword width is set to 5 in order to include the
 // PL1167 trailer.  The trailer is 4 bits, which pushes packet data
 // out of byte-alignment.
@@ -200,35 +218,23 @@ int PL1167_nRF24::internal_receive() {
 //     buffer = (buffer << 8) | currentByte;
 //   }
 
-  for (int inp = 0; inp < _receive_length; inp++) {
-    tmp[outp++] = reverseBits(tmp[inp]);
-  }
-
 #ifdef DEBUG_PRINTF
-  Serial.printf_P(PSTR("Packet received (%d bytes): "), outp);
-  for (int i = 0; i < outp; i++) {
+  Serial.printf_P(PSTR("Packet received (%d bytes) RAW: "), _receive_length);
+  for (int i = 0; i < _receive_length; i++) {
     Serial.printf_P(PSTR("%02X "), tmp[i]);
   }
   Serial.print(F("\n"));
 #endif
 
-  if (outp < 2) {
-#ifdef DEBUG_PRINTF
-    Serial.println(F("Failed CRC: outp < 2"));
-#endif
-    return 0;
-  }
-
-  uint16_t crc = calc_crc(tmp, outp - 2);
-  uint16_t recvCrc = (tmp[outp - 1] << 8) | tmp[outp - 2];
+  outp = PL1167Codec::decode(tmp, _receive_length, tmp);
+  rearm(outp >= 0);
 
-  if ( crc != recvCrc ) {
+  if (outp < 0) {
 #ifdef DEBUG_PRINTF
-    Serial.printf_P(PSTR("Failed CRC: expected %04X, got %04X\n"), crc, recvCrc);
+    Serial.println(F("Failed CRC"));
 #endif
     return 0;
   }
-  outp -= 2;
 
   memcpy(_packet, tmp, outp);
 
@@ -242,20 +248,21 @@ int PL1167_nRF24::internal_receive() {
   return outp;
 }
 
-#define CRC_POLY 0x8408
-
-static uint16_t calc_crc(uint8_t *data, size_t data_length) {
-  uint16_t state = 0;
-  for (size_t i = 0; i < data_length; i++) {
-    uint8_t byte = data[i];
-    for (int j = 0; j < 8; j++) {
-      if ((byte ^ state) & 0x01) {
-        state = (state >> 1) ^ CRC_POLY;
-      } else {
-        state = state >> 1;
-      }
-      byte = byte >> 1;
-    }
+void PL1167_nRF24::rearm(bool frameValid) {
+  _failedFrames = frameValid ? 0 : _failedFrames + 1;
+
+  // Clearing RX_DR is enough to be ready for the next repeat.  Frames still in
+  // the FIFO are read next, since available() checks the FIFO rather than the
+  // flag.  They may be other bulbs' commands, so they're kept.
+  bool txOk, txFail, rxReady;
+  _radio.whatHappened(txOk, txFail, rxReady);
+
+  // If nothing but garbage is coming in, the radio may be in a bad state.
+  // Drop whatever it has queued and start over.
+  if (_failedFrames >= PL1167_MAX_FAILED_FRAMES) {
+    ++_rxResets;
+    _failedFrames = 0;
+    _radio.flush_rx();
+    open();
   }
-  return state;
-}
\ No newline at end of file
+}
@@ -13,6 +13,12 @@
 
 // #define DEBUG_PRINTF
 
+// Frames in a row which can fail their CRC before the radio is fully reset,
+// in case it has got into a bad state
+#ifndef PL1167_MAX_FAILED_FRAMES
+#define PL1167_MAX_FAILED_FRAMES 8
+#endif
+
 #ifndef PL1167_NRF24_H_
 #define PL1167_NRF24_H_
 
@@ -26,9 +32,21 @@ class PL1167_nRF24 {
 
     int writeFIFO(const uint8_t data[], size_t data_length);
     int transmit(uint8_t channel);
+
+    // Send a frame which has already been encoded with PL1167Codec::encode
+    int transmitFrame(uint8_t channel, const uint8_t frame[], size_t frame_length);
     int receive(uint8_t channel);
     int readFIFO(uint8_t data[], size_t &data_length);
 
+    // Puts the radio in RX mode on the channel.  Does nothing if it already is.
+    int startListening(uint8_t channel);
+
+    // Times the RX FIFO was found full, meaning frames may have been dropped
+    size_t rxOverflows() const;
+
+    // Times the radio was fully reset after receiving, rather than re-armed
+    size_t rxResets() const;
+
   private:
     RF24 &_radio;
 
@@ -46,10 +64,18 @@ class PL1167_nRF24 {
     uint8_t _preamble = 0;
     uint8_t _packet[32];
     bool _received = false;
+    bool _listening = false;
+    size_t _rxOverflows = 0;
+    size_t _rxResets = 0;
+    size_t _failedFrames = 0;
 
     int recalc_parameters();
     int internal_receive();
 
+    // Gets ready for the next frame after one was read.  Falls back on a full
+    // reset if frames keep failing their CRC.
+    void rearm(bool frameValid);
+
 };
 
 
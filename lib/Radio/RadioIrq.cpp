@@ -0,0 +1,48 @@
+#include <RadioIrq.h>
+
+RadioIrq::RadioIrq(uint8_t pin, bool activeLow)
+  : pin(pin)
+  , activeLow(activeLow)
+  , count(0)
+  , firedAtMicros(0)
+  , takenCount(0)
+{
+  pinMode(pin, activeLow ? INPUT_PULLUP : INPUT);
+  attachInterruptArg(digitalPinToInterrupt(pin), handleInterrupt, this, activeLow ? FALLING : RISING);
+}
+
+RadioIrq::~RadioIrq() {
+  detachInterrupt(digitalPinToInterrupt(pin));
+}
+
+void IRAM_ATTR RadioIrq::handleInterrupt(void* arg) {
+  RadioIrq* irq = static_cast<RadioIrq*>(arg);
+
+  if (irq->count == irq->takenCount) {
+    irq->firedAtMicros = micros();
+  }
+  ++irq->count;
+}
+
+bool RadioIrq::take(uint32_t& firedAtMicros) {
+  const uint32_t seen = count;
+
+  if (seen != takenCount) {
+    firedAtMicros = this->firedAtMicros;
+    takenCount = seen;
+    return true;
+  }
+
+  // The line stays asserted until the radio is read, so an edge can't be
+  // missed for good
+  if (digitalRead(pin) == (activeLow ? LOW : HIGH)) {
+    firedAtMicros = micros();
+    return true;
+  }
+
+  return false;
+}
+
+size_t RadioIrq::getCount() const {
+  return count;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * Interrupt line from a radio module: the nRF24's IRQ, or the LT8900's
+ * PKT_FLAG.  The ISR only records that the line fired and when.  The radio is
+ * read from task context once take() says there's something to read.
+ */
+class RadioIrq {
+public:
+  RadioIrq(uint8_t pin, bool activeLow);
+  ~RadioIrq();
+
+  // True if the line fired since the last call, or is still asserted.
+  // firedAtMicros is set to when it first fired.
+  bool take(uint32_t& firedAtMicros);
+
+  // Number of times the line has fired
+  size_t getCount() const;
+
+private:
+  const uint8_t pin;
+  const bool activeLow;
+
+  // Written by the ISR
+  volatile uint32_t count;
+  volatile uint32_t firedAtMicros;
+
+  uint32_t takenCount;
+
+  static void IRAM_ATTR handleInterrupt(void* arg);
+};
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// What a radio module is used for.  See RadioRouter.
+enum class RadioRole : uint8_t {
+  // Sends and listens.  The only option with a single radio module.
+  BOTH = 0,
+  // Only listens, so remote presses are heard while other modules are sending
+  RX = 1,
+  // Only sends
+  TX = 2
+};
@@ -0,0 +1,111 @@
+#include <RadioRouter.h>
+
+const size_t RadioRouter::NONE;
+
+bool RadioModuleSpec::canTransmit() const {
+  return role != RadioRole::RX;
+}
+
+bool RadioModuleSpec::canReceive() const {
+  return role != RadioRole::TX;
+}
+
+bool RadioModuleSpec::isPinned() const {
+  return pinnedConfigs != 0;
+}
+
+bool RadioModuleSpec::isPinnedTo(size_t configIx) const {
+  return configIx < 32 && (pinnedConfigs & (1UL << configIx)) != 0;
+}
+
+void RadioRouter::addModule(const RadioModuleSpec& spec) {
+  specs.push_back(spec);
+  tunedConfigs.push_back(NONE);
+  tunedAt.push_back(0);
+}
+
+size_t RadioRouter::numModules() const {
+  return specs.size();
+}
+
+const RadioModuleSpec& RadioRouter::spec(size_t module) const {
+  return specs[module];
+}
+
+size_t RadioRouter::transmitterFor(size_t configIx) const {
+  size_t leastRecentTxOnly = NONE;
+  size_t tunedShared = NONE;
+  size_t firstShared = NONE;
+
+  for (size_t i = 0; i < specs.size(); ++i) {
+    const RadioModuleSpec& spec = specs[i];
+
+    if (! spec.canTransmit()) {
+      continue;
+    }
+
+    if (spec.isPinned()) {
+      if (spec.isPinnedTo(configIx)) {
+        return i;
+      }
+      continue;
+    }
+
+    if (spec.role == RadioRole::TX) {
+      if (tunedConfigs[i] == configIx) {
+        return i;
+      }
+
+      if (leastRecentTxOnly == NONE || tunedAt[i] < tunedAt[leastRecentTxOnly]) {
+        leastRecentTxOnly = i;
+      }
+    } else {
+      if (tunedConfigs[i] == configIx && tunedShared == NONE) {
+        tunedShared = i;
+      }
+
+      if (firstShared == NONE) {
+        firstShared = i;
+      }
+    }
+  }
+
+  if (leastRecentTxOnly != NONE) {
+    return leastRecentTxOnly;
+  }
+
+  return tunedShared != NONE ? tunedShared : firstShared;
+}
+
+size_t RadioRouter::receiver() const {
+  size_t firstShared = NONE;
+
+  for (size_t i = 0; i < specs.size(); ++i) {
+    if (specs[i].role == RadioRole::RX) {
+      return i;
+    } else if (specs[i].role == RadioRole::BOTH && firstShared == NONE) {
+      firstShared = i;
+    }
+  }
+
+  return firstShared;
+}
+
+bool RadioRouter::hasDedicatedReceiver() const {
+  size_t module = receiver();
+  return module != NONE && specs[module].role == RadioRole::RX;
+}
+
+bool RadioRouter::tune(size_t module, size_t configIx) {
+  if (tunedConfigs[module] == configIx) {
+    return false;
+  }
+
+  tunedConfigs[module] = configIx;
+  tunedAt[module] = ++retunes;
+  return true;
+}
+
+size_t RadioRouter::tunedConfig(size_t module) const {
+  return tunedConfigs[module];
+}
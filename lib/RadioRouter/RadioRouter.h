@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <RadioRole.h>
+
+struct RadioModuleSpec {
+  RadioRole role;
+
+  // Bitmask of the radio config indexes a TX module is dedicated to.  A pinned
+  // module stays configured for its config(s), and doesn't send anything else.
+  // 0 means any config.
+  uint32_t pinnedConfigs;
+
+  bool canTransmit() const;
+  bool canReceive() const;
+  bool isPinned() const;
+  bool isPinnedTo(size_t configIx) const;
+};
+
+/**
+ * Decides which radio module a packet is sent or received with, and keeps
+ * track of which radio config each module is tuned to.  Radio configs are
+ * referred to by their index in MiLightRadioConfig::ALL_CONFIGS.
+ *
+ * Doesn't depend on Arduino so the routing can be tested on the host.
+ */
+class RadioRouter {
+public:
+  static const size_t NONE = static_cast<size_t>(-1);
+
+  void addModule(const RadioModuleSpec& spec);
+  size_t numModules() const;
+  const RadioModuleSpec& spec(size_t module) const;
+
+  /*
+   * Module to send packets for the given config with, or NONE if no module
+   * can.  In order of preference:
+   *
+   *   1. A module pinned to the config
+   *   2. A TX only module which isn't pinned and is already tuned to the config
+   *   3. The TX only module which isn't pinned and was retuned least recently,
+   *      so that traffic for different configs is spread over all of them
+   *   4. A module which also listens, one already tuned to the config first
+   */
+  size_t transmitterFor(size_t configIx) const;
+
+  // Module to listen with, or NONE if there isn't one.  RX only modules are
+  // preferred.
+  size_t receiver() const;
+
+  // True if the receiver is never used to send, so it can keep listening
+  // while packets are being sent.
+  bool hasDedicatedReceiver() const;
+
+  // Record that the module is tuned to the config.  Returns true if it was
+  // tuned to something else, meaning the module needs to be reconfigured.
+  bool tune(size_t module, size_t configIx);
+
+  // Config the module is tuned to, or NONE
+  size_t tunedConfig(size_t module) const;
+
+private:
+  std::vector<RadioModuleSpec> specs;
+  std::vector<size_t> tunedConfigs;
+
+  // When each module was last retuned, in number of retunes.  0 if never.
+  std::vector<uint32_t> tunedAt;
+  uint32_t retunes = 0;
+};
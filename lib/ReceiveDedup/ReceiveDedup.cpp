@@ -0,0 +1,58 @@
+#include <ReceiveDedup.h>
+
+ReceiveDedup::ReceiveDedup(unsigned long window)
+  : window(window)
+  , count(0)
+  , packets(0)
+  , duplicates(0)
+{ }
+
+bool ReceiveDedup::isDuplicate(uint32_t key, unsigned long now) {
+  ++packets;
+
+  Entry* oldest = nullptr;
+
+  for (size_t i = 0; i < count; ++i) {
+    Entry& entry = entries[i];
+
+    if (entry.key == key) {
+      const bool duplicate = (now - entry.lastSeen) < window;
+      entry.lastSeen = now;
+
+      if (duplicate) {
+        ++duplicates;
+      }
+      return duplicate;
+    }
+
+    if (oldest == nullptr || (now - entry.lastSeen) > (now - oldest->lastSeen)) {
+      oldest = &entry;
+    }
+  }
+
+  Entry* entry = count < RECEIVE_DEDUP_MAX_ENTRIES ? &entries[count++] : oldest;
+  entry->key = key;
+  entry->lastSeen = now;
+
+  return false;
+}
+
+uint32_t ReceiveDedup::keyFor(uint8_t remoteType, const uint8_t* packet, size_t length) {
+  // FNV-1a
+  uint32_t hash = 2166136261UL;
+
+  hash = (hash ^ remoteType) * 16777619UL;
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ packet[i]) * 16777619UL;
+  }
+
+  return hash;
+}
+
+size_t ReceiveDedup::getPacketCount() const {
+  return packets;
+}
+
+size_t ReceiveDedup::getDuplicateCount() const {
+  return duplicates;
+}
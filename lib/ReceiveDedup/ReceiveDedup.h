@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Number of recently heard packets remembered.  The one heard longest ago is
+// forgotten to make room.
+#ifndef RECEIVE_DEDUP_MAX_ENTRIES
+#define RECEIVE_DEDUP_MAX_ENTRIES 16
+#endif
+
+/**
+ * Drops repeats of received packets.  Remotes send each button press many
+ * times, and the repeats can be heard interleaved with other remotes or again
+ * after switching radio configs, so comparing against the last packet isn't
+ * enough.
+ *
+ * Packets are identified by a key computed from their decoded contents (see
+ * keyFor()).  A packet is a duplicate if the same key was seen less than the
+ * window ago.  Each repeat restarts the window, so a long burst is still
+ * recognized.
+ *
+ * Doesn't depend on Arduino so it can be tested on the host.
+ */
+class ReceiveDedup {
+public:
+  explicit ReceiveDedup(unsigned long window);
+
+  // Returns true if the key was seen within the window.  Records it either way.
+  bool isDuplicate(uint32_t key, unsigned long now);
+
+  // Key for a decoded packet from the given remote type.  Covers device ID,
+  // group, command, argument and sequence number.
+  static uint32_t keyFor(uint8_t remoteType, const uint8_t* packet, size_t length);
+
+  size_t getPacketCount() const;
+  size_t getDuplicateCount() const;
+
+private:
+  struct Entry {
+    uint32_t key;
+    unsigned long lastSeen;
+  };
+
+  const unsigned long window;
+  Entry entries[RECEIVE_DEDUP_MAX_ENTRIES];
+  size_t count;
+
+  size_t packets;
+  size_t duplicates;
+};
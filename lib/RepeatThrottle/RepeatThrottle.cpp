@@ -0,0 +1,87 @@
+#include <RepeatThrottle.h>
+
+RepeatThrottle::RepeatThrottle(size_t maxRepeats, size_t minRepeats, unsigned long threshold, size_t multiplier)
+  : maxRepeats(maxRepeats)
+  , minRepeats(minRepeats < maxRepeats ? minRepeats : maxRepeats)
+  , threshold(threshold)
+  , multiplier(multiplier)
+  , count(0)
+  , useCounter(0)
+  , evictions(0)
+{ }
+
+size_t RepeatThrottle::repeatsFor(uint32_t key) const {
+  const Entry* entry = find(key);
+  return entry == nullptr ? maxRepeats : entry->repeats;
+}
+
+size_t RepeatThrottle::recordSend(uint32_t key, unsigned long now) {
+  Entry* entry = findOrAdd(key, now);
+
+  // 64 bits so a long gap times the multiplier can't overflow
+  int64_t sinceLastSend = static_cast<unsigned long>(now - entry->lastSend);
+  int64_t repeats = static_cast<int64_t>(entry->repeats)
+    + (sinceLastSend - static_cast<int64_t>(threshold)) * static_cast<int64_t>(multiplier);
+
+  if (repeats < static_cast<int64_t>(minRepeats)) {
+    repeats = minRepeats;
+  } else if (repeats > static_cast<int64_t>(maxRepeats)) {
+    repeats = maxRepeats;
+  }
+
+  entry->repeats = static_cast<size_t>(repeats);
+  entry->lastSend = now;
+  entry->lastUsed = ++useCounter;
+
+  return entry->repeats;
+}
+
+size_t RepeatThrottle::size() const {
+  return count;
+}
+
+const RepeatThrottle::Entry& RepeatThrottle::at(size_t index) const {
+  return entries[index];
+}
+
+size_t RepeatThrottle::getEvictionCount() const {
+  return evictions;
+}
+
+const RepeatThrottle::Entry* RepeatThrottle::find(uint32_t key) const {
+  for (size_t i = 0; i < count; ++i) {
+    if (entries[i].key == key) {
+      return &entries[i];
+    }
+  }
+  return nullptr;
+}
+
+RepeatThrottle::Entry* RepeatThrottle::findOrAdd(uint32_t key, unsigned long now) {
+  Entry* entry = const_cast<Entry*>(find(key));
+
+  if (entry != nullptr) {
+    return entry;
+  }
+
+  if (count < REPEAT_THROTTLE_MAX_ENTRIES) {
+    entry = &entries[count++];
+  } else {
+    // Evict the least recently used.  Compared relative to the counter so
+    // wrapping around doesn't matter.
+    entry = &entries[0];
+    for (size_t i = 1; i < count; ++i) {
+      if (useCounter - entries[i].lastUsed > useCounter - entry->lastUsed) {
+        entry = &entries[i];
+      }
+    }
+    ++evictions;
+  }
+
+  // A new key has been quiet for as long as we know, so it gets full repeats
+  entry->key = key;
+  entry->repeats = maxRepeats;
+  entry->lastSend = now - threshold;
+
+  return entry;
+}
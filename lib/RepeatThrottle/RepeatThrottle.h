@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Number of bulbs whose repeat throttling is tracked.  The least recently sent
+// to is forgotten to make room, and goes back to full repeats.
+#ifndef REPEAT_THROTTLE_MAX_ENTRIES
+#define REPEAT_THROTTLE_MAX_ENTRIES 16
+#endif
+
+/**
+ * Lowers the number of times packets are repeated while commands arrive in
+ * quick succession, and raises it back as they slow down.  Tracked separately
+ * per key (one per bulb), so a burst of commands to one bulb doesn't cost
+ * repeats for commands to another.
+ *
+ * The count for a key is updated each time a packet for it starts going out:
+ *
+ *    repeats + (millisSinceLastSend - threshold) * multiplier
+ *
+ * clamped between the minimum and maximum.  Keys not seen before start at the
+ * maximum.
+ *
+ * Doesn't depend on Arduino so it can be tested on the host.
+ */
+class RepeatThrottle {
+public:
+  struct Entry {
+    uint32_t key;
+    size_t repeats;
+    unsigned long lastSend;
+    // Value of useCounter when the entry was last sent to.  Lowest is evicted.
+    uint32_t lastUsed;
+  };
+
+  RepeatThrottle(size_t maxRepeats, size_t minRepeats, unsigned long threshold, size_t multiplier);
+
+  // Repeats the next packet for the key should be sent with
+  size_t repeatsFor(uint32_t key) const;
+
+  // Update the count for the key now that a packet for it is being sent.
+  // Returns the new count.
+  size_t recordSend(uint32_t key, unsigned long now);
+
+  // Tracked keys, in no particular order
+  size_t size() const;
+  const Entry& at(size_t index) const;
+
+  // Number of keys forgotten because the table was full
+  size_t getEvictionCount() const;
+
+private:
+  const size_t maxRepeats;
+  const size_t minRepeats;
+  const unsigned long threshold;
+  const size_t multiplier;
+
+  Entry entries[REPEAT_THROTTLE_MAX_ENTRIES];
+  size_t count;
+  uint32_t useCounter;
+  size_t evictions;
+
+  const Entry* find(uint32_t key) const;
+  Entry* findOrAdd(uint32_t key, unsigned long now);
+};
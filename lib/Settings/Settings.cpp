@@ -67,6 +67,47 @@ void Settings::updateGatewayConfigs(JsonArray arr) {
   }
 }
 
+void Settings::updateRadioModules(JsonArray arr) {
+  radioModules.clear();
+
+  for (size_t i = 0; i < arr.size(); i++) {
+    JsonObject params = arr[i];
+
+    if (params.isNull() || !params.containsKey(FPSTR(SettingsKeys::CSN_PIN))) {
+      Serial.print(F("Settings - skipped parsing radio module settings for element #"));
+      Serial.println(i);
+      continue;
+    }
+
+    RadioModuleConfig module;
+    module.type = typeFromString(params[FPSTR(SettingsKeys::RADIO_INTERFACE_TYPE)] | "nRF24");
+
+    // LT8900 modules don't have a CE pin
+    if (module.type == nRF24 && !params.containsKey(FPSTR(SettingsKeys::CE_PIN))) {
+      Serial.print(F("Settings - skipped nRF24 radio module without a ce_pin, element #"));
+      Serial.println(i);
+      continue;
+    }
+
+    module.cePin = params[FPSTR(SettingsKeys::CE_PIN)] | 0;
+    module.csnPin = params[FPSTR(SettingsKeys::CSN_PIN)];
+    module.resetPin = params[FPSTR(SettingsKeys::RESET_PIN)] | 0;
+    module.irqPin = params[FPSTR(SettingsKeys::IRQ_PIN)] | -1;
+    module.role = roleFromString(params[FPSTR(SettingsKeys::RADIO_ROLE)] | "both");
+
+    JsonArray remoteTypes = params[FPSTR(SettingsKeys::RADIO_REMOTE_TYPES)];
+    for (size_t j = 0; j < remoteTypes.size(); j++) {
+      MiLightRemoteType type = MiLightRemoteTypeHelpers::remoteTypeFromString(remoteTypes[j].as<String>());
+
+      if (type != REMOTE_TYPE_UNKNOWN) {
+        module.remoteTypes.push_back(type);
+      }
+    }
+
+    radioModules.push_back(module);
+  }
+}
+
 void Settings::patch(JsonObject parsedSettings) {
   if (parsedSettings.isNull()) {
     Serial.println(F("Skipping patching loaded settings.  Parsed settings was null."));
@@ -78,6 +119,7 @@ void Settings::patch(JsonObject parsedSettings) {
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::CE_PIN), cePin);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::CSN_PIN), csnPin);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::RESET_PIN), resetPin);
+  this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::IRQ_PIN), irqPin);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::LED_PIN), ledPin);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::PACKET_REPEATS), packetRepeats);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::HTTP_REPEAT_FACTOR), httpRepeatFactor);
@@ -93,6 +135,8 @@ void Settings::patch(JsonObject parsedSettings) {
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::DISCOVERY_PORT), discoveryPort);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::LISTEN_REPEATS), listenRepeats);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::STATE_FLUSH_INTERVAL), stateFlushInterval);
+  this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::STATE_FLUSH_MAX_BYTES), stateFlushMaxBytes);
+  this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::STATE_FLUSH_BUDGET_MILLIS), stateFlushBudgetMillis);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::MQTT_STATE_RATE_LIMIT), mqttStateRateLimit);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::MQTT_DEBOUNCE_DELAY), mqttDebounceDelay);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::MQTT_RETAIN), mqttRetain);
@@ -106,6 +150,11 @@ void Settings::patch(JsonObject parsedSettings) {
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::WIFI_STATIC_IP_GATEWAY), wifiStaticIPGateway);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::WIFI_STATIC_IP_NETMASK), wifiStaticIPNetmask);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::PACKET_REPEATS_PER_LOOP), packetRepeatsPerLoop);
+  this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::PACKET_IN_FLIGHT_WINDOW), packetInFlightWindow);
+  this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::PACKET_SEND_BUDGET_MICROS), packetSendBudgetMicros);
+  packetSendBudgetMicros = std::min(packetSendBudgetMicros, static_cast<uint32_t>(MAXIMUM_PACKET_SEND_BUDGET_MICROS));
+  this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::RADIO_TASK_CORE), radioTaskCore);
+  this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::ELIDE_REDUNDANT_COMMANDS), elideRedundantCommands);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::HOME_ASSISTANT_DISCOVERY_PREFIX), homeAssistantDiscoveryPrefix);
   this->setIfPresent(parsedSettings, FPSTR(SettingsKeys::DEFAULT_TRANSITION_PERIOD), defaultTransitionPeriod);
 
@@ -154,10 +203,26 @@ void Settings::patch(JsonObject parsedSettings) {
     JsonArray arr = parsedSettings[FPSTR(SettingsKeys::GATEWAY_CONFIGS)];
     updateGatewayConfigs(arr);
   }
+  if (parsedSettings.containsKey(FPSTR(SettingsKeys::RADIO_MODULES))) {
+    JsonArray arr = parsedSettings[FPSTR(SettingsKeys::RADIO_MODULES)];
+    updateRadioModules(arr);
+  }
   if (parsedSettings.containsKey(FPSTR(SettingsKeys::GROUP_STATE_FIELDS))) {
     JsonArray arr = parsedSettings[FPSTR(SettingsKeys::GROUP_STATE_FIELDS)];
     groupStateFields = JsonHelpers::jsonArrToVector<GroupStateField, const char*>(arr, GroupStateFieldHelpers::getFieldByName);
   }
+  if (parsedSettings.containsKey(FPSTR(SettingsKeys::LISTEN_REMOTE_TYPES))) {
+    JsonArray arr = parsedSettings[FPSTR(SettingsKeys::LISTEN_REMOTE_TYPES)];
+    listenRemoteTypes.clear();
+
+    for (size_t i = 0; i < arr.size(); i++) {
+      MiLightRemoteType type = MiLightRemoteTypeHelpers::remoteTypeFromString(arr[i].as<String>());
+
+      if (type != REMOTE_TYPE_UNKNOWN) {
+        listenRemoteTypes.push_back(type);
+      }
+    }
+  }
 
   // this key will only be present in old settings files, but for backwards
   // compatability, parse it if it's present.
@@ -317,6 +382,7 @@ void Settings::serialize(Print& stream, const bool prettyPrint) const {
   root[FPSTR(SettingsKeys::CE_PIN)] = this->cePin;
   root[FPSTR(SettingsKeys::CSN_PIN)] = this->csnPin;
   root[FPSTR(SettingsKeys::RESET_PIN)] = this->resetPin;
+  root[FPSTR(SettingsKeys::IRQ_PIN)] = this->irqPin;
   root[FPSTR(SettingsKeys::LED_PIN)] = this->ledPin;
   root[FPSTR(SettingsKeys::RADIO_INTERFACE_TYPE)] = typeToString(this->radioInterfaceType);
   root[FPSTR(SettingsKeys::PACKET_REPEATS)] = this->packetRepeats;
@@ -333,6 +399,8 @@ void Settings::serialize(Print& stream, const bool prettyPrint) const {
   root[FPSTR(SettingsKeys::DISCOVERY_PORT)] = this->discoveryPort;
   root[FPSTR(SettingsKeys::LISTEN_REPEATS)] = this->listenRepeats;
   root[FPSTR(SettingsKeys::STATE_FLUSH_INTERVAL)] = this->stateFlushInterval;
+  root[FPSTR(SettingsKeys::STATE_FLUSH_MAX_BYTES)] = this->stateFlushMaxBytes;
+  root[FPSTR(SettingsKeys::STATE_FLUSH_BUDGET_MILLIS)] = this->stateFlushBudgetMillis;
   root[FPSTR(SettingsKeys::MQTT_STATE_RATE_LIMIT)] = this->mqttStateRateLimit;
   root[FPSTR(SettingsKeys::MQTT_DEBOUNCE_DELAY)] = this->mqttDebounceDelay;
   root[FPSTR(SettingsKeys::MQTT_RETAIN)] = this->mqttRetain;
@@ -352,6 +420,10 @@ void Settings::serialize(Print& stream, const bool prettyPrint) const {
   root[FPSTR(SettingsKeys::WIFI_STATIC_IP_GATEWAY)] = this->wifiStaticIPGateway;
   root[FPSTR(SettingsKeys::WIFI_STATIC_IP_NETMASK)] = this->wifiStaticIPNetmask;
   root[FPSTR(SettingsKeys::PACKET_REPEATS_PER_LOOP)] = this->packetRepeatsPerLoop;
+  root[FPSTR(SettingsKeys::PACKET_IN_FLIGHT_WINDOW)] = this->packetInFlightWindow;
+  root[FPSTR(SettingsKeys::PACKET_SEND_BUDGET_MICROS)] = this->packetSendBudgetMicros;
+  root[FPSTR(SettingsKeys::RADIO_TASK_CORE)] = this->radioTaskCore;
+  root[FPSTR(SettingsKeys::ELIDE_REDUNDANT_COMMANDS)] = this->elideRedundantCommands;
   root[FPSTR(SettingsKeys::HOME_ASSISTANT_DISCOVERY_PREFIX)] = this->homeAssistantDiscoveryPrefix;
   root[FPSTR(SettingsKeys::WIFI_MODE)] = wifiModeToString(this->wifiMode);
   root[FPSTR(SettingsKeys::DEFAULT_TRANSITION_PERIOD)] = this->defaultTransitionPeriod;
@@ -370,9 +442,32 @@ void Settings::serialize(Print& stream, const bool prettyPrint) const {
     elmt.add(this->gatewayConfigs[i]->protocolVersion);
   }
 
+  JsonArray radioModulesArr = root.createNestedArray(FPSTR(SettingsKeys::RADIO_MODULES));
+  for (size_t i = 0; i < this->radioModules.size(); i++) {
+    const RadioModuleConfig& module = this->radioModules[i];
+    JsonObject elmt = radioModulesArr.createNestedObject();
+
+    elmt[FPSTR(SettingsKeys::RADIO_INTERFACE_TYPE)] = typeToString(module.type);
+    elmt[FPSTR(SettingsKeys::CE_PIN)] = module.cePin;
+    elmt[FPSTR(SettingsKeys::CSN_PIN)] = module.csnPin;
+    elmt[FPSTR(SettingsKeys::RESET_PIN)] = module.resetPin;
+    elmt[FPSTR(SettingsKeys::IRQ_PIN)] = module.irqPin;
+    elmt[FPSTR(SettingsKeys::RADIO_ROLE)] = roleToString(module.role);
+
+    JsonArray remoteTypes = elmt.createNestedArray(FPSTR(SettingsKeys::RADIO_REMOTE_TYPES));
+    for (size_t j = 0; j < module.remoteTypes.size(); j++) {
+      remoteTypes.add(MiLightRemoteTypeHelpers::remoteTypeToString(module.remoteTypes[j]));
+    }
+  }
+
   JsonArray groupStateFieldArr = root.createNestedArray(FPSTR(SettingsKeys::GROUP_STATE_FIELDS));
   JsonHelpers::vectorToJsonArr<GroupStateField, const char*>(groupStateFieldArr, groupStateFields, GroupStateFieldHelpers::getFieldName);
 
+  JsonArray listenRemoteTypeArr = root.createNestedArray(FPSTR(SettingsKeys::LISTEN_REMOTE_TYPES));
+  for (size_t i = 0; i < listenRemoteTypes.size(); i++) {
+    listenRemoteTypeArr.add(MiLightRemoteTypeHelpers::remoteTypeToString(listenRemoteTypes[i]));
+  }
+
   if (prettyPrint) {
     serializeJsonPretty(root, stream);
   } else {
@@ -419,6 +514,30 @@ String Settings::typeToString(RadioInterfaceType type) {
   }
 }
 
+RadioRole Settings::roleFromString(const String& s) {
+  if (s.equalsIgnoreCase("rx")) {
+    return RadioRole::RX;
+  } else if (s.equalsIgnoreCase("tx")) {
+    return RadioRole::TX;
+  } else {
+    return RadioRole::BOTH;
+  }
+}
+
+String Settings::roleToString(RadioRole role) {
+  switch (role) {
+    case RadioRole::RX:
+      return "rx";
+
+    case RadioRole::TX:
+      return "tx";
+
+    case RadioRole::BOTH:
+    default:
+      return "both";
+  }
+}
+
 WifiMode Settings::wifiModeFromString(const String& mode) {
   if (mode.equalsIgnoreCase("b")) {
     return WifiMode::B;
@@ -10,6 +10,7 @@
 
 #include <MiLightRemoteType.h>
 #include <BulbId.h>
+#include <RadioRole.h>
 
 #include <vector>
 #include <memory>
@@ -43,8 +44,28 @@
   #define CSN_DEFAULT_PIN 5
 #endif
 
-#ifndef MILIGHT_MAX_STATE_ITEMS
-#define MILIGHT_MAX_STATE_ITEMS 100
+// Devices whose states are cached, each with all of its groups.  Slots are
+// allocated up front at about 190 bytes per device on the ESP32: 164 for its
+// cache node (9 GroupStates of 16 bytes), 20 for its dirty map node, and hash
+// table slots for both.
+//
+// This used to be MILIGHT_MAX_STATE_ITEMS groups at about 60 bytes each.
+// Dividing that by the groups a typical remote has (4) keeps the default
+// within the old budget: 25 devices is about 5 KB, where 100 groups was about
+// 6 KB.
+#define MILIGHT_TYPICAL_GROUPS_PER_DEVICE 4
+
+#ifdef MILIGHT_MAX_STATE_ITEMS
+  #ifndef MILIGHT_MAX_STATE_DEVICES
+    #warning "MILIGHT_MAX_STATE_ITEMS is deprecated, use MILIGHT_MAX_STATE_DEVICES.  Caching one device per 4 items."
+    #define MILIGHT_MAX_STATE_DEVICES ((MILIGHT_MAX_STATE_ITEMS + MILIGHT_TYPICAL_GROUPS_PER_DEVICE - 1) / MILIGHT_TYPICAL_GROUPS_PER_DEVICE)
+  #else
+    #warning "MILIGHT_MAX_STATE_ITEMS is ignored because MILIGHT_MAX_STATE_DEVICES is set"
+  #endif
+#endif
+
+#ifndef MILIGHT_MAX_STATE_DEVICES
+#define MILIGHT_MAX_STATE_DEVICES (100 / MILIGHT_TYPICAL_GROUPS_PER_DEVICE)
 #endif
 
 #ifndef MILIGHT_MAX_STALE_MQTT_GROUPS
@@ -63,6 +84,9 @@
 #define MILIGHT_REPO_WEB_PATH "/data/web/index.html"
 
 #define MINIMUM_RESTART_PERIOD 1
+// Longest packet_send_budget_us accepted.  A loop() taking longer than this
+// would hold up everything else anyway.
+#define MAXIMUM_PACKET_SEND_BUDGET_MICROS 100000
 #define DEFAULT_MQTT_PORT 1883
 #define MAX_IP_ADDR_LEN 15
 
@@ -92,6 +116,19 @@ struct GatewayConfig {
   const uint8_t protocolVersion;
 };
 
+// An extra radio module.  See Settings::radioModules.
+struct RadioModuleConfig {
+  RadioInterfaceType type;
+  uint8_t cePin;
+  uint8_t csnPin;
+  uint8_t resetPin;
+  // Pin wired to the module's IRQ (nRF24) or PKT_FLAG (LT8900), or -1 to poll
+  int8_t irqPin;
+  RadioRole role;
+  // Remote types a TX module is dedicated to.  Empty for any.
+  std::vector<MiLightRemoteType> remoteTypes;
+};
+
 // all keys that appear in JSON
 namespace SettingsKeys {
   static const char ADMIN_USERNAME[] PROGMEM = "admin_username";
@@ -99,6 +136,9 @@ namespace SettingsKeys {
   static const char CE_PIN[] PROGMEM = "ce_pin";
   static const char CSN_PIN[] PROGMEM = "csn_pin";
   static const char RESET_PIN[] PROGMEM = "reset_pin";
+  static const char IRQ_PIN[] PROGMEM = "irq_pin";
+  static const char RADIO_ROLE[] PROGMEM = "role";
+  static const char RADIO_REMOTE_TYPES[] PROGMEM = "remote_types";
   static const char LED_PIN[] PROGMEM = "led_pin";
   static const char PACKET_REPEATS[] PROGMEM = "packet_repeats";
   static const char HTTP_REPEAT_FACTOR[] PROGMEM = "http_repeat_factor";
@@ -113,7 +153,10 @@ namespace SettingsKeys {
   static const char SIMPLE_MQTT_CLIENT_STATUS[] PROGMEM = "simple_mqtt_client_status";
   static const char DISCOVERY_PORT[] PROGMEM = "discovery_port";
   static const char LISTEN_REPEATS[] PROGMEM = "listen_repeats";
+  static const char LISTEN_REMOTE_TYPES[] PROGMEM = "listen_remote_types";
   static const char STATE_FLUSH_INTERVAL[] PROGMEM = "state_flush_interval";
+  static const char STATE_FLUSH_MAX_BYTES[] PROGMEM = "state_flush_max_bytes";
+  static const char STATE_FLUSH_BUDGET_MILLIS[] PROGMEM = "state_flush_budget_ms";
   static const char MQTT_STATE_RATE_LIMIT[] PROGMEM = "mqtt_state_rate_limit";
   static const char MQTT_DEBOUNCE_DELAY[] PROGMEM = "mqtt_debounce_delay";
   static const char MQTT_RETAIN[] PROGMEM = "mqtt_retain";
@@ -127,6 +170,10 @@ namespace SettingsKeys {
   static const char WIFI_STATIC_IP_GATEWAY[] PROGMEM = "wifi_static_ip_gateway";
   static const char WIFI_STATIC_IP_NETMASK[] PROGMEM = "wifi_static_ip_netmask";
   static const char PACKET_REPEATS_PER_LOOP[] PROGMEM = "packet_repeats_per_loop";
+  static const char PACKET_IN_FLIGHT_WINDOW[] PROGMEM = "packet_in_flight_window";
+  static const char PACKET_SEND_BUDGET_MICROS[] PROGMEM = "packet_send_budget_us";
+  static const char RADIO_TASK_CORE[] PROGMEM = "radio_task_core";
+  static const char ELIDE_REDUNDANT_COMMANDS[] PROGMEM = "elide_redundant_commands";
   static const char HOME_ASSISTANT_DISCOVERY_PREFIX[] PROGMEM = "home_assistant_discovery_prefix";
   static const char DEFAULT_TRANSITION_PERIOD[] PROGMEM = "default_transition_period";
   static const char WIFI_MODE[] PROGMEM = "wifi_mode";
@@ -140,6 +187,7 @@ namespace SettingsKeys {
   static const char RADIO_INTERFACE_TYPE[] PROGMEM = "radio_interface_type";
   static const char DEVICE_IDS[] PROGMEM = "device_ids";
   static const char GATEWAY_CONFIGS[] PROGMEM = "gateway_configs";
+  static const char RADIO_MODULES[] PROGMEM = "radio_modules";
   static const char GROUP_STATE_FIELDS[] PROGMEM = "group_state_fields";
   static const char GROUP_ID_ALIASES[] PROGMEM = "group_id_aliases";
 }
@@ -154,6 +202,7 @@ public:
     cePin(4),
     csnPin(CSN_DEFAULT_PIN),
     resetPin(0),
+    irqPin(-1),
     ledPin(-2),
     radioInterfaceType(nRF24),
     packetRepeats(50),
@@ -165,6 +214,8 @@ public:
     mqttClientStatusTopic("milight/client_status"),
     simpleMqttClientStatus(true),
     stateFlushInterval(10000),
+    stateFlushMaxBytes(1024),
+    stateFlushBudgetMillis(50),
     mqttStateRateLimit(500),
     mqttDebounceDelay(500),
     mqttRetain(true),
@@ -183,6 +234,10 @@ public:
     groupStateFields(DEFAULT_GROUP_STATE_FIELDS),
     rf24ListenChannel(RF24Channel::RF24_LOW),
     packetRepeatsPerLoop(10),
+    packetInFlightWindow(4),
+    packetSendBudgetMicros(0),
+    radioTaskCore(0),
+    elideRedundantCommands(false),
     homeAssistantDiscoveryPrefix("homeassistant/"),
     wifiMode(WifiMode::G),
     defaultTransitionPeriod(500),
@@ -204,12 +259,15 @@ public:
 
   static RadioInterfaceType typeFromString(const String& s);
   static String typeToString(RadioInterfaceType type);
+  static RadioRole roleFromString(const String& s);
+  static String roleToString(RadioRole role);
   static std::vector<RF24Channel> defaultListenChannels();
 
   void save();
   void serialize(Print& stream, const bool prettyPrint = false) const;
   void updateDeviceIds(JsonArray arr);
   void updateGatewayConfigs(JsonArray arr);
+  void updateRadioModules(JsonArray arr);
   void patch(JsonObject obj);
   String mqttServer();
   uint16_t mqttPort();
@@ -223,6 +281,9 @@ public:
   uint8_t cePin;
   uint8_t csnPin;
   uint8_t resetPin;
+  // Radio interrupt pin for the module set up from cePin, csnPin and resetPin.
+  // -1 polls the radio instead.
+  int8_t irqPin;
   int8_t ledPin;
   RadioInterfaceType radioInterfaceType;
   size_t packetRepeats;
@@ -238,6 +299,10 @@ public:
   String mqttClientStatusTopic;
   bool simpleMqttClientStatus;
   size_t stateFlushInterval;
+  // Limits on how much a single flush of dirty states can write, and for how
+  // long.  0 means no limit.
+  size_t stateFlushMaxBytes;
+  size_t stateFlushBudgetMillis;
   size_t mqttStateRateLimit;
   size_t mqttDebounceDelay;
   bool mqttRetain;
@@ -255,12 +320,28 @@ public:
   std::vector<uint16_t> deviceIds;
   std::vector<RF24Channel> rf24Channels;
   std::vector<GroupStateField> groupStateFields;
+  // Only listen for these remote types.  Empty for all.
+  std::vector<MiLightRemoteType> listenRemoteTypes;
   std::vector<std::shared_ptr<GatewayConfig>> gatewayConfigs;
+  // When empty, there's a single radio module described by radioInterfaceType,
+  // cePin, csnPin and resetPin which does everything.
+  std::vector<RadioModuleConfig> radioModules;
   RF24Channel rf24ListenChannel;
   String wifiStaticIP;
   String wifiStaticIPNetmask;
   String wifiStaticIPGateway;
   size_t packetRepeatsPerLoop;
+  // Number of packets for different devices whose repeats are interleaved
+  size_t packetInFlightWindow;
+  // If non-zero, send as many repeats per loop as fit in this many microseconds
+  // instead of packetRepeatsPerLoop
+  uint32_t packetSendBudgetMicros;
+  // Core the radio task is pinned to (ESP32 only).  -1 does radio work in the
+  // main loop instead.
+  int8_t radioTaskCore;
+  // Skip packets for fields which state says already have the requested value.
+  // Requests can bypass this with "force": true.
+  bool elideRedundantCommands;
   std::map<String, GroupAlias> groupIdAliases;
   std::map<uint32_t, BulbId> deletedGroupIdAliases;
   String homeAssistantDiscoveryPrefix;
@@ -0,0 +1,279 @@
+#include <StateLog.h>
+
+#include <algorithm>
+#include <string.h>
+
+StateLog::StateLog(StateLogStorage& storage)
+  : storage(storage)
+  , stats()
+  , tornTail(false)
+{ }
+
+void StateLog::begin() {
+  uint8_t record[HEADER_LENGTH + STATE_LOG_MAX_RECORD_LENGTH];
+  const size_t size = storage.size();
+  size_t offset = 0;
+
+  index.clear();
+  stats = Stats();
+  tornTail = false;
+
+  while (offset + HEADER_LENGTH <= size) {
+    uint32_t id;
+    uint16_t length;
+    uint16_t recordCheck;
+
+    if (!storage.read(offset, record, HEADER_LENGTH)) {
+      break;
+    }
+    readHeader(record, id, length, recordCheck);
+
+    if (length > STATE_LOG_MAX_RECORD_LENGTH
+      || offset + HEADER_LENGTH + length > size
+      || !storage.read(offset + HEADER_LENGTH, record + HEADER_LENGTH, length)
+      || check(id, record + HEADER_LENGTH, length) != recordCheck) {
+      break;
+    }
+
+    if (length == 0) {
+      remove(id);
+    } else {
+      put(id, offset, length);
+    }
+
+    offset += HEADER_LENGTH + length;
+  }
+
+  stats.logBytes = offset;
+  stats.discardedBytes = size - offset;
+
+  // New records would be appended after the bad one and lost on the next load
+  if (stats.discardedBytes > 0) {
+    tornTail = true;
+    compact();
+  }
+}
+
+size_t StateLog::get(uint32_t id, uint8_t* buffer, size_t maxLength) {
+  const IndexEntry* entry = find(id);
+
+  if (entry == NULL || entry->length > maxLength) {
+    return 0;
+  }
+
+  uint8_t header[HEADER_LENGTH];
+  uint32_t recordId;
+  uint16_t length;
+  uint16_t recordCheck;
+
+  if (!storage.read(entry->offset, header, HEADER_LENGTH)
+    || !storage.read(entry->offset + HEADER_LENGTH, buffer, entry->length)) {
+    return 0;
+  }
+  readHeader(header, recordId, length, recordCheck);
+
+  // Guards against the index and the log disagreeing about where records are
+  if (recordId != entry->id
+    || length != entry->length
+    || check(recordId, buffer, length) != recordCheck) {
+    return 0;
+  }
+
+  return entry->length;
+}
+
+bool StateLog::contains(uint32_t id) const {
+  return find(id) != NULL;
+}
+
+bool StateLog::set(uint32_t id, const uint8_t* data, size_t length) {
+  if (length == 0 || length > STATE_LOG_MAX_RECORD_LENGTH || !readyToAppend()) {
+    return false;
+  }
+
+  const uint32_t offset = stats.logBytes;
+
+  if (!append(id, data, length)) {
+    return false;
+  }
+
+  put(id, offset, length);
+  return true;
+}
+
+bool StateLog::clear(uint32_t id) {
+  if (find(id) == NULL || !readyToAppend()) {
+    return false;
+  }
+
+  if (!append(id, NULL, 0)) {
+    return false;
+  }
+
+  remove(id);
+  return true;
+}
+
+bool StateLog::compact() {
+  uint8_t record[HEADER_LENGTH + STATE_LOG_MAX_RECORD_LENGTH];
+  std::vector<uint32_t> offsets;
+  uint32_t offset = 0;
+
+  offsets.reserve(index.size());
+
+  if (!storage.beginRewrite()) {
+    return false;
+  }
+
+  for (const IndexEntry& entry : index) {
+    const size_t recordLength = HEADER_LENGTH + entry.length;
+
+    if (!storage.read(entry.offset, record, recordLength)
+      || !storage.appendRewrite(record, recordLength)) {
+      return false;
+    }
+
+    offsets.push_back(offset);
+    offset += recordLength;
+  }
+
+  if (!storage.commitRewrite()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < index.size(); i++) {
+    index[i].offset = offsets[i];
+  }
+
+  stats.logBytes = offset;
+  stats.liveBytes = offset;
+  ++stats.compactions;
+  tornTail = false;
+
+  return true;
+}
+
+bool StateLog::compactIfNeeded() {
+  if (stats.logBytes >= STATE_LOG_COMPACT_MIN_BYTES
+    && stats.logBytes > stats.liveBytes * STATE_LOG_COMPACT_RATIO) {
+    return compact();
+  }
+
+  return false;
+}
+
+size_t StateLog::numIds() const {
+  return index.size();
+}
+
+uint32_t StateLog::idAt(size_t ix) const {
+  return index[ix].id;
+}
+
+const StateLog::Stats& StateLog::getStats() const {
+  return stats;
+}
+
+// FNV-1a, folded to 16 bits
+uint16_t StateLog::check(uint32_t id, const uint8_t* data, size_t length) {
+  uint32_t hash = 2166136261UL;
+
+  for (size_t i = 0; i < 4; i++) {
+    hash = (hash ^ ((id >> (8 * i)) & 0xFF)) * 16777619UL;
+  }
+  hash = (hash ^ (length & 0xFF)) * 16777619UL;
+  hash = (hash ^ (length >> 8)) * 16777619UL;
+
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ data[i]) * 16777619UL;
+  }
+
+  return (hash >> 16) ^ (hash & 0xFFFF);
+}
+
+bool StateLog::idLess(const IndexEntry& entry, uint32_t id) {
+  return entry.id < id;
+}
+
+StateLog::IndexEntry* StateLog::find(uint32_t id) {
+  auto it = std::lower_bound(index.begin(), index.end(), id, idLess);
+  return (it != index.end() && it->id == id) ? &*it : NULL;
+}
+
+const StateLog::IndexEntry* StateLog::find(uint32_t id) const {
+  auto it = std::lower_bound(index.begin(), index.end(), id, idLess);
+  return (it != index.end() && it->id == id) ? &*it : NULL;
+}
+
+void StateLog::put(uint32_t id, uint32_t offset, uint16_t length) {
+  auto it = std::lower_bound(index.begin(), index.end(), id, idLess);
+
+  if (it != index.end() && it->id == id) {
+    stats.liveBytes -= HEADER_LENGTH + it->length;
+    it->offset = offset;
+    it->length = length;
+  } else {
+    index.insert(it, IndexEntry{ id, offset, length });
+  }
+
+  stats.liveBytes += HEADER_LENGTH + length;
+  stats.records = index.size();
+}
+
+void StateLog::remove(uint32_t id) {
+  auto it = std::lower_bound(index.begin(), index.end(), id, idLess);
+
+  if (it != index.end() && it->id == id) {
+    stats.liveBytes -= HEADER_LENGTH + it->length;
+    index.erase(it);
+  }
+
+  stats.records = index.size();
+}
+
+bool StateLog::append(uint32_t id, const uint8_t* data, size_t length) {
+  uint8_t record[HEADER_LENGTH + STATE_LOG_MAX_RECORD_LENGTH];
+
+  writeHeader(record, id, length, check(id, data, length));
+  if (length > 0) {
+    memcpy(record + HEADER_LENGTH, data, length);
+  }
+
+  if (!storage.append(record, HEADER_LENGTH + length)) {
+    // Part of the record may have made it out.  Rewrite the log so later
+    // records don't end up after it.
+    tornTail = true;
+    compact();
+    return false;
+  }
+
+  stats.logBytes += HEADER_LENGTH + length;
+  stats.bytesWritten += HEADER_LENGTH + length;
+  ++stats.recordsWritten;
+
+  return true;
+}
+
+bool StateLog::readyToAppend() {
+  return !tornTail || compact();
+}
+
+// Little endian regardless of the platform, so logs can be read anywhere
+void StateLog::writeHeader(uint8_t* buffer, uint32_t id, uint16_t length, uint16_t check) {
+  for (size_t i = 0; i < 4; i++) {
+    buffer[i] = (id >> (8 * i)) & 0xFF;
+  }
+  buffer[4] = length & 0xFF;
+  buffer[5] = length >> 8;
+  buffer[6] = check & 0xFF;
+  buffer[7] = check >> 8;
+}
+
+void StateLog::readHeader(const uint8_t* buffer, uint32_t& id, uint16_t& length, uint16_t& check) {
+  id = 0;
+  for (size_t i = 0; i < 4; i++) {
+    id |= static_cast<uint32_t>(buffer[i]) << (8 * i);
+  }
+  length = buffer[4] | (buffer[5] << 8);
+  check = buffer[6] | (buffer[7] << 8);
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Largest payload a record can have
+#ifndef STATE_LOG_MAX_RECORD_LENGTH
+#define STATE_LOG_MAX_RECORD_LENGTH 128
+#endif
+
+// Compact once the log is this many times the size of the live records...
+#ifndef STATE_LOG_COMPACT_RATIO
+#define STATE_LOG_COMPACT_RATIO 2
+#endif
+
+// ...and at least this big, so small logs aren't rewritten over and over
+#ifndef STATE_LOG_COMPACT_MIN_BYTES
+#define STATE_LOG_COMPACT_MIN_BYTES 4096
+#endif
+
+/**
+ * Where a StateLog keeps its records, e.g. a file.
+ */
+class StateLogStorage {
+public:
+  virtual ~StateLogStorage() { }
+
+  virtual size_t size() = 0;
+  virtual bool read(size_t offset, uint8_t* buffer, size_t length) = 0;
+  virtual bool append(const uint8_t* data, size_t length) = 0;
+
+  // Compaction writes a new log next to the current one, which can still be
+  // read, and then replaces the current one with it.
+  virtual bool beginRewrite() = 0;
+  virtual bool appendRewrite(const uint8_t* data, size_t length) = 0;
+  virtual bool commitRewrite() = 0;
+};
+
+/**
+ * Append-only log of (id, payload) records.  Setting a value appends a record
+ * rather than rewriting anything, and the latest record for an id wins.  An
+ * index from id to the latest record is kept in RAM, rebuilt by begin().
+ *
+ * Records are an 8 byte header (id, payload length, check) followed by the
+ * payload.  A record with an empty payload clears the id.  A record which
+ * doesn't check out (e.g. a write cut short by a power cut) ends the log, and
+ * it's compacted so that new records aren't appended after it.  Until that
+ * compaction succeeds, set() and clear() retry it and fail if it fails again.
+ *
+ * Only one StateLog should use a storage at a time.
+ *
+ * Doesn't depend on Arduino so it can be tested on the host.
+ */
+class StateLog {
+public:
+  static const size_t HEADER_LENGTH = 8;
+
+  struct Stats {
+    // Ids with a value
+    size_t records;
+    size_t logBytes;
+    // Bytes taken by the latest record of each id
+    size_t liveBytes;
+    // Appended since begin(), not counting compaction
+    size_t recordsWritten;
+    size_t bytesWritten;
+    size_t compactions;
+    // Bytes dropped from the end of the log when it was loaded
+    size_t discardedBytes;
+  };
+
+  explicit StateLog(StateLogStorage& storage);
+
+  // Reads the log and builds the index
+  void begin();
+
+  // Copies the payload for id into buffer.  Returns its length, or 0 if id
+  // has no value, it's longer than maxLength or its record doesn't check out.
+  size_t get(uint32_t id, uint8_t* buffer, size_t maxLength);
+  bool contains(uint32_t id) const;
+
+  bool set(uint32_t id, const uint8_t* data, size_t length);
+  bool clear(uint32_t id);
+
+  // Rewrites the log with only the latest record for each id
+  bool compact();
+  // Compacts if enough of the log is superseded records.  See
+  // STATE_LOG_COMPACT_RATIO.
+  bool compactIfNeeded();
+
+  // Ids with a value, in ascending order
+  size_t numIds() const;
+  uint32_t idAt(size_t ix) const;
+
+  const Stats& getStats() const;
+
+  static uint16_t check(uint32_t id, const uint8_t* data, size_t length);
+
+private:
+  struct IndexEntry {
+    uint32_t id;
+    uint32_t offset;
+    uint16_t length;
+  };
+
+  StateLogStorage& storage;
+  // Sorted by id
+  std::vector<IndexEntry> index;
+  Stats stats;
+  // Set while the end of the log may hold part of a record.  Cleared by
+  // compaction.
+  bool tornTail;
+
+  static bool idLess(const IndexEntry& entry, uint32_t id);
+  IndexEntry* find(uint32_t id);
+  const IndexEntry* find(uint32_t id) const;
+  void put(uint32_t id, uint32_t offset, uint16_t length);
+  void remove(uint32_t id);
+  bool append(uint32_t id, const uint8_t* data, size_t length);
+  // Compacts first if the end of the log is torn.  False if it still is.
+  bool readyToAppend();
+
+  static void writeHeader(uint8_t* buffer, uint32_t id, uint16_t length, uint16_t check);
+  static void readHeader(const uint8_t* buffer, uint32_t& id, uint16_t& length, uint16_t& check);
+};
@@ -0,0 +1,62 @@
+#include <RetainedStates.h>
+
+#include <string.h>
+
+// Changes with the layout, so a firmware update doesn't read records it
+// doesn't understand
+static const uint32_t MAGIC = 0x4D4C5253UL ^ sizeof(RetainedStates);
+
+void RetainedStates::clear() {
+  magic = 0;
+  count = 0;
+}
+
+bool RetainedStates::add(uint32_t key, const uint8_t* data, size_t length, bool dirty) {
+  if (count >= RETAINED_STATES_MAX_DEVICES || length > RETAINED_STATES_MAX_RECORD_LENGTH) {
+    return false;
+  }
+
+  Slot& slot = slots[count++];
+
+  // Padding is included in the checksum
+  memset(&slot, 0, sizeof(slot));
+  slot.key = key;
+  slot.length = length;
+  slot.dirty = dirty;
+  memcpy(slot.data, data, length);
+
+  return true;
+}
+
+void RetainedStates::seal() {
+  magic = MAGIC;
+  check = checksum();
+}
+
+bool RetainedStates::isValid() const {
+  return magic == MAGIC
+    && count <= RETAINED_STATES_MAX_DEVICES
+    && check == checksum();
+}
+
+void RetainedStates::invalidate() {
+  magic = 0;
+}
+
+static uint32_t fnv1a(uint32_t hash, const void* data, size_t length) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * 16777619UL;
+  }
+
+  return hash;
+}
+
+// Covers the count and the slots in use
+uint32_t RetainedStates::checksum() const {
+  const size_t used = count <= RETAINED_STATES_MAX_DEVICES ? count : RETAINED_STATES_MAX_DEVICES;
+  uint32_t hash = fnv1a(2166136261UL, &count, sizeof(count));
+
+  return fnv1a(hash, slots, used * sizeof(Slot));
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Devices kept over a restart
+#ifndef RETAINED_STATES_MAX_DEVICES
+#define RETAINED_STATES_MAX_DEVICES 16
+#endif
+
+// Largest record a device can have
+#ifndef RETAINED_STATES_MAX_RECORD_LENGTH
+#define RETAINED_STATES_MAX_RECORD_LENGTH 80
+#endif
+
+/**
+ * Device state records kept in memory that survives a software restart (e.g.
+ * RTC_NOINIT_ATTR on ESP32), so the state cache can be filled again without
+ * reading flash.  Nothing initializes that memory, so it's only trusted when
+ * the magic number and checksum match.
+ *
+ * Plain data, so it can live in a section which isn't initialized.  Doesn't
+ * depend on Arduino so it can be tested on the host.
+ */
+struct RetainedStates {
+  struct Slot {
+    uint32_t key;
+    uint8_t length;
+    uint8_t dirty;
+    uint8_t data[RETAINED_STATES_MAX_RECORD_LENGTH];
+  };
+
+  uint32_t magic;
+  uint32_t count;
+  Slot slots[RETAINED_STATES_MAX_DEVICES];
+  uint32_t check;
+
+  // Starts saving a new set of records.  Invalid until seal() is called.
+  void clear();
+  // Returns false if it's full or the record is too long
+  bool add(uint32_t key, const uint8_t* data, size_t length, bool dirty);
+  void seal();
+
+  bool isValid() const;
+  // So records aren't restored twice
+  void invalidate();
+
+  uint32_t checksum() const;
+};
@@ -342,7 +342,7 @@ void MiLightHttpServer::handlePacketSent(
     unsigned char* /*packet*/,
     const MiLightRemoteConfig& /*remoteConfig*/,
     const BulbId& /*bulbId*/,
-    const ArduinoJson::JsonObject& /*result*/
+    const ParsedPacket& /*result*/
 ) {
   // Stub: rien à faire
 }
@@ -434,10 +434,115 @@ void MiLightHttpServer::handleGetGroupAlias(RequestContext& request) {
 }
 
 // --------- /gateways (batch PUT) ----------
+// Body is {"gateways": [...], "update": {...}}.  Each gateway is either an
+// alias or {"device_id", "device_type", "group_id"}.  The update is applied to
+// all of them as one batch.
 void MiLightHttpServer::handleBatchUpdateGroups(RequestContext& request) {
-  request.response.setCode(501);
-  request.response.json[F("ok")] = false;
-  request.response.json[F("error")] = F("handleBatchUpdateGroups not implemented");
+  JsonVariant body = request.getJsonBody().as<JsonVariant>();
+  const bool isList = body.is<JsonArray>();
+  std::vector<JsonObject> updates;
+  std::vector<std::vector<BulbId>> targets;
+
+  // One {gateways, update} object, or a list of them sent as separate batches
+  if (isList) {
+    for (JsonObject batch : body.as<JsonArray>()) {
+      updates.push_back(batch);
+    }
+  } else {
+    updates.push_back(body.as<JsonObject>());
+  }
+
+  // Check everything before sending anything
+  for (JsonObject batch : updates) {
+    JsonArray gateways = batch[F("gateways")];
+
+    if (gateways.isNull() || batch[F("update")].isNull()) {
+      request.response.setCode(400);
+      request.response.json[F("ok")] = false;
+      request.response.json[F("error")] = F("Must specify required keys: gateways, update");
+      return;
+    }
+
+    targets.emplace_back();
+    if (!parseBatchGateways(gateways, targets.back(), request)) {
+      return;
+    }
+  }
+
+  size_t droppedPackets = 0;
+  request.response.json[F("ok")] = true;
+  JsonArray results = isList ? request.response.json.createNestedArray(F("batches")) : JsonArray();
+
+  for (size_t i = 0; i < updates.size(); i++) {
+    JsonObject result = isList ? results.createNestedObject() : request.response.json.as<JsonObject>();
+
+    result[F("batch_id")] = milightClient->updateBatch(targets[i], updates[i][F("update")]);
+    result[F("gateways")] = targets[i].size();
+    result[F("elided_packets")] = milightClient->getLastUpdateElidedPacketCount();
+    droppedPackets += milightClient->getLastUpdateDroppedPacketCount();
+  }
+
+  if (droppedPackets > 0) {
+    request.response.setCode(503);
+    request.response.json[F("ok")] = false;
+    request.response.json[F("dropped_packets")] = droppedPackets;
+    request.response.json[F("error")] = String(F("Radio couldn't keep up, some packets were dropped.  At most "))
+      + (MILIGHT_MAX_QUEUED_PACKETS + MILIGHT_PACKET_INBOX_SIZE)
+      + F(" packets can wait to be sent at once.");
+    return;
+  }
+
+  request.response.setCode(200);
+}
+
+bool MiLightHttpServer::parseBatchGateways(JsonArray gateways, std::vector<BulbId>& bulbIds, RequestContext& request) {
+  bulbIds.reserve(gateways.size());
+
+  for (JsonVariant gateway : gateways) {
+    if (gateway.is<const char*>()) {
+      auto alias = settings.groupIdAliases.find(gateway.as<String>());
+
+      if (alias == settings.groupIdAliases.end()) {
+        request.response.setCode(404);
+        request.response.json[F("ok")] = false;
+        request.response.json[F("error")] = String(F("Unknown alias: ")) + gateway.as<String>();
+        return false;
+      }
+
+      bulbIds.push_back(alias->second.bulbId);
+    } else {
+      const MiLightRemoteConfig* config = MiLightRemoteConfig::fromType(
+        gateway[GroupStateFieldNames::DEVICE_TYPE].as<String>()
+      );
+
+      JsonVariant groupId = gateway[GroupStateFieldNames::GROUP_ID];
+
+      // A missing group_id would otherwise read as 0, i.e. every group on the
+      // remote
+      if (config == nullptr || gateway[GroupStateFieldNames::DEVICE_ID].isNull() || groupId.isNull()) {
+        request.response.setCode(400);
+        request.response.json[F("ok")] = false;
+        request.response.json[F("error")] = F("Gateways must be aliases or have device_id, device_type and group_id");
+        return false;
+      }
+
+      if (!groupId.is<uint8_t>() || groupId.as<uint8_t>() > config->numGroups) {
+        request.response.setCode(400);
+        request.response.json[F("ok")] = false;
+        request.response.json[F("error")] = String(F("group_id must be between 0 and ")) + config->numGroups
+          + F(" for ") + gateway[GroupStateFieldNames::DEVICE_TYPE].as<String>();
+        return false;
+      }
+
+      bulbIds.push_back(BulbId(
+        gateway[GroupStateFieldNames::DEVICE_ID].as<uint16_t>(),
+        groupId.as<uint8_t>(),
+        config->type
+      ));
+    }
+  }
+
+  return true;
 }
 
 // --------- /transitions/:id ----------
@@ -474,7 +579,11 @@ void MiLightHttpServer::handleSendRaw(RequestContext& request) {
 // --------- /about ----------
 void MiLightHttpServer::handleAbout(RequestContext& request) {
   request.response.setCode(200);
-  request.response.json[F("version")] = F("custom-esp32-build");
+  AboutHelper::generateAboutObject(request.response.json);
+
+  if (aboutHandler) {
+    aboutHandler(request.response.json);
+  }
 }
 
 // --------- /system (POST) ----------
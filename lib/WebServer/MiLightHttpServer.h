@@ -61,7 +61,7 @@ public:
   void onGroupDeleted(GroupDeletedHandler handler);
   void onAbout(AboutHandler handler);
   void on(const char* path, HTTPMethod method, THandlerFunction handler);
-  void handlePacketSent(uint8_t* packet, const MiLightRemoteConfig& config, const BulbId& bulbId, const JsonObject& result);
+  void handlePacketSent(uint8_t* packet, const MiLightRemoteConfig& config, const BulbId& bulbId, const ParsedPacket& result);
   WiFiClient client();
 
 protected:
@@ -92,6 +92,8 @@ protected:
   void handleGetGroupAlias(RequestContext& request);
   void _handleGetGroup(bool allowAsync, BulbId bulbId, RequestContext& request);
   void handleBatchUpdateGroups(RequestContext& request);
+  // Sets an error response and returns false if a gateway is invalid
+  bool parseBatchGateways(JsonArray gateways, std::vector<BulbId>& bulbIds, RequestContext& request);
 
   void handleDeleteGroup(RequestContext& request);
   void handleDeleteGroupAlias(RequestContext& request);
@@ -19,6 +19,7 @@
 #include <BulbStateUpdater.h>
 #include <RadioSwitchboard.h>
 #include <PacketSender.h>
+#include <RadioTask.h>
 #include <HomeAssistantDiscoveryClient.h>
 #include <TransitionController.h>
 #include <ProjectWifi.h>
@@ -32,6 +33,7 @@
  // #include <ESP32SSDP.h>
 
   #include <esp_wifi.h>
+  #include <esp_system.h>
   #include <SPIFFS.h>
   #include <ESPmDNS.h>
 #endif
@@ -54,17 +56,29 @@ Settings settings;
 MiLightClient* milightClient = NULL;
 RadioSwitchboard* radios = nullptr;
 PacketSender* packetSender = nullptr;
-std::shared_ptr<MiLightRadioFactory> radioFactory;
+RadioTask* radioTask = nullptr;
+std::vector<std::shared_ptr<MiLightRadioFactory>> radioFactories;
 MiLightHttpServer *httpServer = NULL;
 MqttClient* mqttClient = NULL;
 MiLightDiscoveryServer* discoveryServer = NULL;
-uint8_t currentRadioType = 0;
 
 // For tracking and managing group state
 GroupStateStore* stateStore = NULL;
 BulbStateUpdater* bulbStateUpdater = NULL;
 TransitionController transitions;
 
+#ifdef ESP32
+// Survives software restarts, so the state cache can be filled again without
+// reading flash
+static RTC_NOINIT_ATTR RetainedStates retainedStates;
+#endif
+
+// How the state cache started out after booting
+static const char* stateRestoreResult = "cold";
+static size_t restoredDevices = 0;
+static unsigned long stateRestoreMicros = 0;
+static unsigned long bootToReadyMillis = 0;
+
 std::vector<std::shared_ptr<MiLightUdpServer>> udpServers;
 
 /**
@@ -110,13 +124,11 @@ void initMilightUdpServers() {
  * Milight RF packet handler.
  *
  * Called both when a packet is sent locally, and when an intercepted packet
- * is read.
+ * is read.  The packet has already been decoded.
  */
-void onPacketSentHandler(uint8_t* packet, const MiLightRemoteConfig& config) {
-  StaticJsonDocument<200> buffer;
-  JsonObject result = buffer.to<JsonObject>();
-
-  BulbId bulbId = config.packetFormatter->parsePacket(packet, result);
+void onPacketSentHandler(uint8_t* packet, const MiLightRemoteConfig& config, uint16_t batchId) {
+  ParsedPacket result;
+  BulbId bulbId = config.packetFormatter->parseDecodedPacket(packet, result);
 
   // set LED mode for a packet movement
   ledStatus->oneshot(settings.ledModePacket, settings.ledModePacketCount);
@@ -143,57 +155,39 @@ void onPacketSentHandler(uint8_t* packet, const MiLightRemoteConfig& config) {
   }
 
   if (mqttClient) {
-    // Sends the state delta derived from the raw packet
+    // Sends the state delta derived from the raw packet.  This is the only
+    // place it's needed as JSON.
+    StaticJsonDocument<200> buffer;
+    PacketFormatter::toJson(result, buffer.to<JsonObject>());
+
     char output[200];
-    serializeJson(result, output);
+    serializeJson(buffer, output);
     mqttClient->sendUpdate(remoteConfig, bulbId.deviceId, bulbId.groupId, output);
 
     // Sends the entire state
     if (groupState != NULL) {
       bulbStateUpdater->enqueueUpdate(bulbId, *groupState);
     }
-  }
 
-  httpServer->handlePacketSent(packet, remoteConfig, bulbId, result);
-}
+    // Batches send whole devices group 0 commands in place of a command for
+    // each group (see BatchPlanner), so send the updates each group would have
+    // got.  Left out for other group 0 packets, e.g. from physical remotes, as
+    // it's a lot of MQTT traffic for a button press.
+    if (bulbId.groupId == 0 && batchId != 0) {
+      BulbId groupId(bulbId);
 
-/**
- * Listen for packets on one radio config.  Cycles through all configs as its
- * called.
- */
-void handleListen() {
-  // Do not handle listens while there are packets enqueued to be sent
-  // Doing so causes the radio module to need to be reinitialized inbetween
-  // repeats, which slows things down.
-  if (! settings.listenRepeats || packetSender->isSending()) {
-    return;
-  }
-
-  std::shared_ptr<MiLightRadio> radio = radios->switchRadio(currentRadioType++ % radios->getNumRadios());
-
-  for (size_t i = 0; i < settings.listenRepeats; i++) {
-    if (radios->available()) {
-      uint8_t readPacket[MILIGHT_MAX_PACKET_LENGTH];
-      size_t packetLen = radios->read(readPacket);
-
-      const MiLightRemoteConfig* remoteConfig = MiLightRemoteConfig::fromReceivedPacket(
-        radio->config(),
-        readPacket,
-        packetLen
-      );
+      for (size_t i = 1; i <= remoteConfig.numGroups; ++i) {
+        groupId.groupId = i;
+        GroupState* state = stateStore->get(groupId);
 
-      if (remoteConfig == NULL) {
-        // This can happen under normal circumstances, so not an error condition
-#ifdef DEBUG_PRINTF
-        Serial.println(F("WARNING: Couldn't find remote for received packet"));
-#endif
-        return;
+        if (state != NULL) {
+          bulbStateUpdater->enqueueUpdate(groupId, *state);
+        }
       }
-
-      // update state to reflect this packet
-      onPacketSentHandler(readPacket, *remoteConfig);
     }
   }
+
+  httpServer->handlePacketSent(packet, remoteConfig, bulbId, result);
 }
 
 /**
@@ -220,6 +214,11 @@ void onUpdateEnd() {
  * Apply what's in the Settings object.
  */
 void applySettings() {
+  // Stop the radio before tearing down anything it uses
+  if (radioTask) {
+    delete radioTask;
+    radioTask = nullptr;
+  }
   if (milightClient) {
     delete milightClient;
   }
@@ -242,16 +241,28 @@ void applySettings() {
 
   transitions.setDefaultPeriod(settings.defaultTransitionPeriod);
 
-  radioFactory = MiLightRadioFactory::fromSettings(settings);
+  radioFactories = MiLightRadioFactory::fromSettings(settings);
 
-  if (radioFactory == NULL) {
+  if (radioFactories.empty()) {
     Serial.println(F("ERROR: unable to construct radio factory"));
   }
 
-  stateStore = new GroupStateStore(MILIGHT_MAX_STATE_ITEMS, settings.stateFlushInterval);
+  stateStore = new GroupStateStore(
+    MILIGHT_MAX_STATE_DEVICES,
+    settings.stateFlushInterval,
+    settings.stateFlushMaxBytes,
+    settings.stateFlushBudgetMillis
+  );
 
-  radios = new RadioSwitchboard(radioFactory, stateStore, settings);
+  radios = new RadioSwitchboard(radioFactories, stateStore, settings);
   packetSender = new PacketSender(*radios, settings, onPacketSentHandler);
+  radioTask = new RadioTask(
+    *radios,
+    *packetSender,
+    settings,
+    [](uint8_t* packet, const MiLightRemoteConfig& config) { onPacketSentHandler(packet, config, 0); }
+  );
+  radioTask->begin();
 
   milightClient = new MiLightClient(
     *radios,
@@ -343,6 +354,14 @@ void wifiExtraSettingsChange() {
   ESP.restart();
 }
 
+void addLatencyStats(JsonObject json, const LatencyHistogram& latency) {
+  json[FPSTR("count")] = latency.getCount();
+  json[FPSTR("p50")] = latency.percentile(50);
+  json[FPSTR("p90")] = latency.percentile(90);
+  json[FPSTR("p99")] = latency.percentile(99);
+  json[FPSTR("max")] = latency.getMax();
+}
+
 void aboutHandler(JsonDocument& json) {
   JsonObject mqtt = json.createNestedObject(FPSTR("mqtt"));
   mqtt[FPSTR("configured")] = (mqttClient != nullptr);
@@ -351,6 +370,178 @@ void aboutHandler(JsonDocument& json) {
     mqtt[FPSTR("connected")] = mqttClient->isConnected();
     mqtt[FPSTR("status")] = mqttClient->getConnectionStatusString();
   }
+
+  // Counters owned by the radio task are read from its last published copy
+  RadioTaskStats radioStats;
+  const bool haveRadioStats = radioTask && radioTask->stats(radioStats);
+
+  if (packetSender) {
+    JsonObject sender = json.createNestedObject(FPSTR("packet_sender"));
+
+    if (haveRadioStats) {
+      sender[FPSTR("stats_age_ms")] = millis() - radioStats.takenAt;
+      sender[FPSTR("queue_length")] = radioStats.queueLength;
+      sender[FPSTR("dropped_packets")] = radioStats.droppedPackets;
+      sender[FPSTR("merged_packets")] = radioStats.mergedPackets;
+      sender[FPSTR("promoted_packets")] = radioStats.promotedPackets;
+      sender[FPSTR("radio_switches")] = radioStats.radioSwitches;
+      sender[FPSTR("radio_switches_per_second")] = radioStats.radioSwitchesPerSecond;
+      sender[FPSTR("repeats_per_second")] = radioStats.repeatsPerSecond;
+      sender[FPSTR("budget_overruns")] = radioStats.budgetOverruns;
+      sender[FPSTR("write_failures")] = radioStats.writeFailures;
+    }
+
+    addLatencyStats(sender.createNestedObject(FPSTR("command_to_air_us")), packetSender->commandToAirLatency());
+
+    // Commands sent to several bulbs at once, e.g. PUT /gateways
+    JsonObject batches = sender.createNestedObject(FPSTR("batches"));
+    addLatencyStats(batches.createNestedObject(FPSTR("to_air_us")), packetSender->batchToAirLatency());
+    addLatencyStats(batches.createNestedObject(FPSTR("complete_us")), packetSender->batchCompleteLatency());
+
+    if (haveRadioStats) {
+      const PacketBatchStats& lastBatch = radioStats.lastBatch;
+
+      if (lastBatch.id != 0) {
+        JsonObject last = batches.createNestedObject(FPSTR("last"));
+        last[FPSTR("id")] = lastBatch.id;
+        last[FPSTR("packets")] = lastBatch.packets;
+        last[FPSTR("to_air_us")] = lastBatch.toAirMicros;
+        last[FPSTR("complete_us")] = lastBatch.completeMicros;
+      }
+
+      // Repeats the next command to each recently used bulb will be sent with
+      const unsigned long now = millis();
+      JsonArray bulbs = sender.createNestedArray(FPSTR("repeat_throttle"));
+
+      for (size_t i = 0; i < radioStats.throttleEntries; i++) {
+        const RepeatThrottle::Entry& entry = radioStats.throttle[i];
+        const BulbId bulbId = PacketSender::throttleKeyToBulbId(entry.key);
+        JsonObject bulb = bulbs.createNestedObject();
+
+        bulb[FPSTR("device_id")] = bulbId.deviceId;
+        bulb[FPSTR("device_type")] = MiLightRemoteTypeHelpers::remoteTypeToString(bulbId.deviceType);
+        bulb[FPSTR("group_id")] = bulbId.groupId;
+        bulb[FPSTR("repeats")] = entry.repeats;
+        bulb[FPSTR("last_send_ms_ago")] = now - entry.lastSend;
+      }
+
+      static const char* laneNames[] = { "interactive", "transition", "background" };
+      JsonObject lanes = sender.createNestedObject(FPSTR("lanes"));
+
+      for (size_t i = 0; i < PacketSender::NUM_PRIORITIES; i++) {
+        const PacketLaneStats& stats = radioStats.lanes[i];
+        JsonObject lane = lanes.createNestedObject(laneNames[i]);
+
+        lane[FPSTR("queue_length")] = stats.queueLength;
+        lane[FPSTR("sent_packets")] = stats.sentPackets;
+        lane[FPSTR("avg_wait_ms")] = stats.averageWaitMillis();
+        lane[FPSTR("max_wait_ms")] = stats.maxWaitMillis;
+        lane[FPSTR("avg_first_send_ms")] = stats.averageFirstSendMillis();
+        lane[FPSTR("max_first_send_ms")] = stats.maxFirstSendMillis;
+      }
+    }
+  }
+
+  if (milightClient) {
+    JsonObject elision = json.createNestedObject(FPSTR("command_elision"));
+    elision[FPSTR("enabled")] = settings.elideRedundantCommands;
+    elision[FPSTR("elided_packets")] = milightClient->getElidedPacketCount();
+
+    // Batches sent to whole devices through group 0
+    JsonObject collapsing = json.createNestedObject(FPSTR("group_collapsing"));
+    collapsing[FPSTR("collapsed_targets")] = milightClient->getCollapsedTargetCount();
+    collapsing[FPSTR("packets_saved")] = milightClient->getCollapsedPacketCount();
+  }
+
+  if (radioTask) {
+    JsonObject radio = json.createNestedObject(FPSTR("radio_task"));
+    radio[FPSTR("running")] = radioTask->isRunning();
+    radio[FPSTR("core")] = radioTask->core();
+
+    if (haveRadioStats) {
+      radio[FPSTR("dropped_events")] = radioStats.droppedEvents;
+
+      // Repeats of received packets which were dropped
+      JsonObject dedupStats = radio.createNestedObject(FPSTR("receive_dedup"));
+      dedupStats[FPSTR("packets")] = radioStats.receivedPackets;
+      dedupStats[FPSTR("duplicates")] = radioStats.receivedDuplicates;
+      dedupStats[FPSTR("ratio")] = radioStats.receivedPackets > 0
+        ? static_cast<float>(radioStats.receivedDuplicates) / radioStats.receivedPackets
+        : 0;
+
+      // How listening is split between radio configs
+      const uint32_t totalWeight = radioStats.listenTotalWeight;
+      JsonArray listening = radio.createNestedArray(FPSTR("listen_configs"));
+
+      for (size_t i = 0; i < radioStats.listenConfigs; i++) {
+        const ListenScheduler::ConfigStats& stats = radioStats.listen[i];
+        JsonObject config = listening.createNestedObject();
+        JsonArray remoteTypes = config.createNestedArray(FPSTR("remote_types"));
+
+        for (size_t j = 0; j < MiLightRemoteConfig::NUM_REMOTES; j++) {
+          const MiLightRemoteConfig* remote = MiLightRemoteConfig::ALL_REMOTES[j];
+
+          if (&remote->radioConfig == &MiLightRadioConfig::ALL_CONFIGS[i]) {
+            remoteTypes.add(MiLightRemoteTypeHelpers::remoteTypeToString(remote->type));
+          }
+        }
+
+        config[FPSTR("allowed")] = stats.allowed;
+        config[FPSTR("listens")] = stats.listens;
+        config[FPSTR("hits")] = stats.hits;
+        config[FPSTR("hit_rate")] = static_cast<float>(stats.hitRate) / ListenScheduler::RATE_SCALE;
+        config[FPSTR("listen_share")] = totalWeight > 0 ? static_cast<float>(stats.weight) / totalWeight : 0;
+      }
+    }
+  }
+
+  if (radios) {
+    const RadioReceiveStats stats = radios->receiveStats();
+    JsonObject receive = json.createNestedObject(FPSTR("radio_receive"));
+
+    receive[FPSTR("mode")] = stats.interruptDriven ? F("irq") : F("poll");
+    receive[FPSTR("interrupts")] = stats.interrupts;
+    receive[FPSTR("packets")] = stats.packets;
+    receive[FPSTR("duplicate_frames")] = stats.duplicates;
+    // Roughly how many repeats of each button press are heard
+    receive[FPSTR("frames_per_packet")] = stats.packets > 0
+      ? static_cast<float>(stats.packets + stats.duplicates) / stats.packets
+      : 0;
+    receive[FPSTR("radio_resets")] = stats.radioResets;
+    receive[FPSTR("radio_overflows")] = stats.radioOverflows;
+    receive[FPSTR("ring_overflows")] = stats.ringOverflows;
+    receive[FPSTR("max_irq_latency_us")] = stats.maxIrqLatencyMicros;
+  }
+
+  if (stateStore) {
+    GroupStatePersistence& persistence = stateStore->getPersistence();
+    const GroupStatePersistence::Stats& stats = persistence.getStats();
+    const StateLog::Stats& logStats = persistence.getLogStats();
+    JsonObject states = json.createNestedObject(FPSTR("state_persistence"));
+
+    states[FPSTR("records")] = logStats.records;
+    states[FPSTR("log_bytes")] = logStats.logBytes;
+    states[FPSTR("live_bytes")] = logStats.liveBytes;
+    states[FPSTR("compactions")] = logStats.compactions;
+    states[FPSTR("discarded_bytes")] = logStats.discardedBytes;
+    states[FPSTR("index_build_ms")] = stats.indexBuildMillis;
+    states[FPSTR("migrated_files")] = stats.migratedFiles;
+    states[FPSTR("writes")] = stats.writes;
+    states[FPSTR("bytes_per_write")] = logStats.recordsWritten > 0
+      ? static_cast<float>(logStats.bytesWritten) / logStats.recordsWritten
+      : 0;
+    states[FPSTR("avg_write_us")] = stats.writes > 0 ? stats.totalWriteMicros / stats.writes : 0;
+    states[FPSTR("max_write_us")] = stats.maxWriteMicros;
+    states[FPSTR("skipped_writes")] = stats.skippedWrites;
+    states[FPSTR("dirty_states")] = stateStore->getDirtyCount();
+    states[FPSTR("oldest_dirty_ms")] = stateStore->getOldestDirtyMillis();
+  }
+
+  JsonObject retention = json.createNestedObject(FPSTR("state_retention"));
+  retention[FPSTR("result")] = stateRestoreResult;
+  retention[FPSTR("restored_devices")] = restoredDevices;
+  retention[FPSTR("restore_us")] = stateRestoreMicros;
+  retention[FPSTR("boot_to_ready_ms")] = bootToReadyMillis;
 }
 
 // Called when a group is deleted via the REST API.  Will publish an empty message to
@@ -366,6 +557,34 @@ void onGroupDeleted(const BulbId& id) {
   }
 }
 
+#ifdef ESP32
+// Runs in ESP.restart(), and the cache is restored by restoreStates() after it
+void retainStates() {
+  if (stateStore) {
+    stateStore->retain(retainedStates);
+  }
+}
+
+void restoreStates() {
+  const unsigned long start = micros();
+
+  if (esp_reset_reason() != ESP_RST_SW) {
+    stateRestoreResult = "cold";
+  } else if (!retainedStates.isValid()) {
+    stateRestoreResult = "invalid";
+  } else {
+    restoredDevices = stateStore->restore(retainedStates);
+    stateRestoreResult = "restored";
+  }
+
+  // Anything retained is stale once the store's been used, e.g. after a crash
+  retainedStates.invalidate();
+  stateRestoreMicros = micros() - start;
+
+  esp_register_shutdown_handler(retainStates);
+}
+#endif
+
 bool initialized = false;
 void postConnectSetup() {
   if (initialized) return;
@@ -398,8 +617,11 @@ void postConnectSetup() {
           const char* fieldName = GroupStateFieldHelpers::getFieldName(field);
           buffer[fieldName] = value;
 
+          // Keep transition steps from delaying commands which come in while fading
+          milightClient->setPriority(PacketPriority::TRANSITION);
           milightClient->prepare(bulbId.deviceType, bulbId.deviceId, bulbId.groupId);
           milightClient->update(buffer.as<JsonObject>());
+          milightClient->clearPriority();
       }
   );
 
@@ -411,7 +633,7 @@ void postConnectSetup() {
     Serial.printf_P(PSTR("Setup complete (version %s)\n"), QUOTE(MILIGHT_HUB_VERSION));
   #endif
 
-
+  bootToReadyMillis = millis();
 }
 
 void setup() {
@@ -434,6 +656,10 @@ void setup() {
   ESPMH_SETUP_WIFI(settings);
   applySettings();
 
+  #ifdef ESP32
+    restoreStates();
+  #endif
+
   // set up the LED status for wifi configuration
   ledStatus = new LEDStatus(settings.ledPin);
   ledStatus->continuous(settings.ledModeWifiConfig);
@@ -557,10 +783,8 @@ void loop() {
       discoveryServer->handleClient();
     }
 
-    handleListen();
-
     stateStore->limitedFlush();
-    packetSender->loop();
+    radioTask->loop();
 
     transitions.loop();
   }
@@ -6,10 +6,16 @@
 #include <GroupState.h>
 #include <GroupStateStore.h>
 #include <GroupStateCache.h>
+#include <DeviceStates.h>
 #include <GroupStatePersistence.h>
 
 #include <RgbCctPacketFormatter.h>
 #include <FUT091PacketFormatter.h>
+#include <MiLightRemoteConfig.h>
+#include <PacketQueue.h>
+#include <PacketSender.h>
+#include <RadioSwitchboard.h>
+#include <BatchPlanner.h>
 #include <Units.h>
 
 #include "unity.h"
@@ -103,6 +109,28 @@ void test_fut091_packet_formatter() {
   );
 }
 
+void test_receive_dispatch() {
+  const MiLightRadioConfig& radioConfig = MiLightRadioConfig::ALL_CONFIGS[2];
+  uint8_t decoded[MILIGHT_MAX_PACKET_LENGTH];
+
+  // Same radio config, told apart by protocol ID
+  uint8_t fut092Packet[] = {0x00, 0xDB, 0xE1, 0x24, 0x66, 0xCA, 0x54, 0x66, 0xD2};
+  const MiLightRemoteConfig* remote = MiLightRemoteConfig::fromReceivedPacket(radioConfig, fut092Packet, sizeof(fut092Packet), decoded);
+  TEST_ASSERT_TRUE_MESSAGE(remote == &FUT092Config, "Should dispatch to rgb_cct");
+  TEST_ASSERT_EQUAL_INT_MESSAGE(0x20, decoded[V2_PROTOCOL_ID_INDEX], "Should pass on the decoded packet");
+
+  StaticJsonDocument<200> doc;
+  BulbId bulbId = remote->packetFormatter->parseDecodedPacket(decoded, doc.to<JsonObject>());
+  TEST_ASSERT_TRUE_MESSAGE(bulbId == BulbId(1, 1, REMOTE_TYPE_RGB_CCT), "Decoded packet should parse");
+
+  uint8_t fut091Packet[] = {0x00, 0xDC, 0xE1, 0x24, 0x66, 0xCA, 0xBA, 0x66, 0xB5};
+  remote = MiLightRemoteConfig::fromReceivedPacket(radioConfig, fut091Packet, sizeof(fut091Packet), decoded);
+  TEST_ASSERT_TRUE_MESSAGE(remote == &FUT091Config, "Should dispatch to fut091");
+
+  remote = MiLightRemoteConfig::fromReceivedPacket(radioConfig, fut091Packet, 7, decoded);
+  TEST_ASSERT_TRUE_MESSAGE(remote == NULL, "Wrong length shouldn't match anything");
+}
+
 //================================================================================
 // Group State
 //================================================================================
@@ -147,77 +175,199 @@ void test_state_updates() {
   TEST_ASSERT_EQUAL(s.getBrightness(), 100);
 }
 
+void test_parsed_packet_patch() {
+  RgbCctPacketFormatter packetFormatter;
+  uint8_t packets[][9] = {
+    {0x00, 0xDB, 0xE1, 0x24, 0x64, 0x3C, 0x47, 0x66, 0x31}, // color_temp
+    {0x00, 0xDB, 0xE1, 0x24, 0x66, 0xCA, 0x54, 0x66, 0xD2}, // state
+  };
+
+  for (size_t i = 0; i < sizeof(packets) / sizeof(packets[0]); ++i) {
+    const GroupState previous = color();
+
+    ParsedPacket parsed;
+    packetFormatter.parsePacket(packets[i], parsed);
+    GroupState typed(&previous, parsed);
+
+    StaticJsonDocument<200> doc;
+    JsonObject json = doc.to<JsonObject>();
+    packetFormatter.parsePacket(packets[i], json);
+    GroupState fromJson(&previous, json);
+
+    TEST_ASSERT_TRUE_MESSAGE(typed.isEqualIgnoreDirty(fromJson), "Typed and JSON patches should match");
+  }
+}
+
+// Time per received packet to parse it and patch state, through JSON as
+// formatters used to and through ParsedPacket.  If publish is set the result
+// is also serialized, as for MQTT.
+static unsigned long nanosPerPacket(bool typed, bool publish) {
+  static const size_t ITERATIONS = 2000;
+  RgbCctPacketFormatter packetFormatter;
+  uint8_t packets[][9] = {
+    {0x00, 0xDB, 0xE1, 0x24, 0x64, 0x3C, 0x47, 0x66, 0x31}, // color_temp
+    {0x00, 0xDB, 0xE1, 0x24, 0x66, 0xCA, 0x54, 0x66, 0xD2}, // state
+  };
+  GroupState state = color();
+  char output[200];
+  size_t written = 0;
+
+  const unsigned long start = micros();
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    const uint8_t* packet = packets[i % 2];
+    StaticJsonDocument<200> doc;
+
+    if (typed) {
+      ParsedPacket parsed;
+      packetFormatter.parsePacket(packet, parsed);
+      state.patch(parsed);
+
+      if (publish) {
+        PacketFormatter::toJson(parsed, doc.to<JsonObject>());
+        written += serializeJson(doc, output);
+      }
+    } else {
+      JsonObject json = doc.to<JsonObject>();
+      packetFormatter.parsePacket(packet, json);
+      state.patch(json);
+
+      if (publish) {
+        written += serializeJson(doc, output);
+      }
+    }
+  }
+  const unsigned long elapsed = micros() - start;
+
+  TEST_ASSERT_TRUE(written > 0 || !publish);
+  return elapsed * 1000 / ITERATIONS;
+}
+
+void test_benchmark_parsed_packet() {
+  const unsigned long jsonNs = nanosPerPacket(false, false);
+  const unsigned long typedNs = nanosPerPacket(true, false);
+  const unsigned long jsonPublishNs = nanosPerPacket(false, true);
+  const unsigned long typedPublishNs = nanosPerPacket(true, true);
+
+  char message[160];
+  snprintf(message, sizeof(message), "Parse and patch per packet: %lu ns through JSON, %lu ns typed", jsonNs, typedNs);
+  TEST_MESSAGE(message);
+  snprintf(
+    message, sizeof(message),
+    "Parse, patch and serialize per packet: %lu ns through JSON, %lu ns typed", jsonPublishNs, typedPublishNs
+  );
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_TRUE_MESSAGE(typedNs < jsonNs, "Patching from the typed packet should be cheaper");
+}
+
 void test_cache() {
   BulbId id1(1, 1, REMOTE_TYPE_FUT089);
-  BulbId id2(1, 2, REMOTE_TYPE_FUT089);
+  BulbId id2(2, 1, REMOTE_TYPE_FUT089);
 
   GroupState s = color();
   s.clearDirty();
   s.clearMqttDirty();
 
+  DeviceStates states(REMOTE_TYPE_FUT089, 8);
+  states.groups[1] = s;
+
   GroupStateCache cache(1);
-  GroupState* storedState = cache.get(id2);
+  DeviceStates* storedStates = cache.get(id2);
 
-  TEST_ASSERT_NULL_MESSAGE(storedState, "Should not retrieve value which hasn't been stored");
+  TEST_ASSERT_NULL_MESSAGE(storedStates, "Should not retrieve value which hasn't been stored");
 
-  cache.set(id1, s);
-  storedState = cache.get(id1);
+  cache.set(id1, states);
+  storedStates = cache.get(id1);
 
-  TEST_ASSERT_NOT_NULL_MESSAGE(storedState, "Should retrieve a value");
-  TEST_ASSERT_TRUE_MESSAGE(s == *storedState, "State should be the same when retrieved");
+  TEST_ASSERT_NOT_NULL_MESSAGE(storedStates, "Should retrieve a value");
+  TEST_ASSERT_TRUE_MESSAGE(s == storedStates->groups[1], "State should be the same when retrieved");
+  TEST_ASSERT_TRUE_MESSAGE(storedStates == cache.get(BulbId(1, 5, REMOTE_TYPE_FUT089)), "Every group of a device should share its entry");
 
-  cache.set(id2, s);
-  storedState = cache.get(id2);
+  cache.set(id2, states);
+  storedStates = cache.get(id2);
 
-  TEST_ASSERT_NOT_NULL_MESSAGE(storedState, "Should retrieve a value");
-  TEST_ASSERT_TRUE_MESSAGE(s == *storedState, "State should be the same when retrieved");
+  TEST_ASSERT_NOT_NULL_MESSAGE(storedStates, "Should retrieve a value");
+  TEST_ASSERT_TRUE_MESSAGE(s == storedStates->groups[1], "State should be the same when retrieved");
 
-  storedState = cache.get(id1);
+  storedStates = cache.get(id1);
 
-  TEST_ASSERT_NULL_MESSAGE(storedState, "Should evict old entry from cache");
+  TEST_ASSERT_NULL_MESSAGE(storedStates, "Should evict old entry from cache");
 }
 
 void test_persistence() {
   BulbId id1(1, 1, REMOTE_TYPE_FUT089);
-  BulbId id2(1, 2, REMOTE_TYPE_FUT089);
+  BulbId id2(2, 1, REMOTE_TYPE_FUT089);
 
   GroupStatePersistence persistence;
 
   persistence.clear(id1);
   persistence.clear(id2);
 
-  GroupState storedState;
   GroupState s = color();
   s.clearDirty();
   s.clearMqttDirty();
 
   GroupState defaultState = GroupState::defaultState(REMOTE_TYPE_FUT089);
+  DeviceStates states(REMOTE_TYPE_FUT089, 8);
+  states.groups[1] = s;
+
+  DeviceStates storedStates(REMOTE_TYPE_FUT089, 8);
+  persistence.get(id1, storedStates);
+  TEST_ASSERT_TRUE_MESSAGE(storedStates.groups[1].isEqualIgnoreDirty(defaultState), "Should start with clean state");
+  persistence.get(id2, storedStates);
+  TEST_ASSERT_TRUE_MESSAGE(storedStates.groups[1].isEqualIgnoreDirty(defaultState), "Should start with clean state");
+
+  persistence.set(id1, states);
 
-  persistence.get(id1, storedState);
-  TEST_ASSERT_TRUE_MESSAGE(storedState.isEqualIgnoreDirty(defaultState), "Should start with clean state");
-  persistence.get(id2, storedState);
-  TEST_ASSERT_TRUE_MESSAGE(storedState.isEqualIgnoreDirty(defaultState), "Should start with clean state");
+  storedStates = DeviceStates(REMOTE_TYPE_FUT089, 8);
+  persistence.get(id2, storedStates);
+  TEST_ASSERT_TRUE_MESSAGE(storedStates.groups[1].isEqualIgnoreDirty(defaultState), "Should return default for state that hasn't been stored");
 
-  persistence.set(id1, s);
+  persistence.get(id1, storedStates);
+  TEST_ASSERT_TRUE_MESSAGE(storedStates.groups[1].isEqualIgnoreDirty(s), "Should retrieve state from flash without modification");
+  TEST_ASSERT_TRUE_MESSAGE(storedStates.groups[2].isEqualIgnoreDirty(defaultState), "Should retrieve the device's other groups");
 
-  persistence.get(id2, storedState);
-  TEST_ASSERT_TRUE_MESSAGE(storedState.isEqualIgnoreDirty(defaultState), "Should return default for state that hasn't been stored");
+  DeviceStates newStates = states;
+  newStates.groups[1].setBulbMode(BulbMode::BULB_MODE_WHITE);
+  newStates.groups[1].setBrightness(255);
+  persistence.set(id2, newStates);
+
+  persistence.get(id1, storedStates);
+
+  TEST_ASSERT_TRUE_MESSAGE(storedStates.groups[1].isEqualIgnoreDirty(s), "Should retrieve unmodified state");
+
+  persistence.get(id2, storedStates);
+
+  TEST_ASSERT_TRUE_MESSAGE(storedStates.groups[1].isEqualIgnoreDirty(newStates.groups[1]), "Should retrieve modified state");
+}
+
+// Compact IDs only keep the low byte of the device ID
+void test_persistence_full_device_id() {
+  BulbId id1(0x0101, 1, REMOTE_TYPE_FUT089);
+  BulbId id2(0x0201, 1, REMOTE_TYPE_FUT089);
+
+  GroupStatePersistence persistence;
 
-  persistence.get(id1, storedState);
-  TEST_ASSERT_TRUE_MESSAGE(storedState.isEqualIgnoreDirty(s), "Should retrieve state from flash without modification");
+  persistence.clear(id1);
+  persistence.clear(id2);
 
-  GroupState newState = s;
-  newState.setBulbMode(BulbMode::BULB_MODE_WHITE);
-  newState.setBrightness(255);
-  persistence.set(id2, newState);
+  TEST_ASSERT_NOT_EQUAL(GroupStatePersistence::deviceKey(id1), GroupStatePersistence::deviceKey(id2));
 
-  persistence.get(id1, storedState);
+  DeviceStates states1(REMOTE_TYPE_FUT089, 8);
+  DeviceStates states2(REMOTE_TYPE_FUT089, 8);
+  states1.groups[1] = color();
+  states2.groups[1] = color();
+  states2.groups[1].setBrightness(10);
 
-  TEST_ASSERT_TRUE_MESSAGE(storedState.isEqualIgnoreDirty(s), "Should retrieve unmodified state");
+  persistence.set(id1, states1);
+  persistence.set(id2, states2);
 
-  persistence.get(id2, storedState);
+  DeviceStates storedStates(REMOTE_TYPE_FUT089, 8);
+  persistence.get(id1, storedStates);
+  TEST_ASSERT_TRUE_MESSAGE(storedStates.groups[1].isEqualIgnoreDirty(states1.groups[1]), "Should keep devices with the same low byte apart");
 
-  TEST_ASSERT_TRUE_MESSAGE(storedState.isEqualIgnoreDirty(newState), "Should retrieve modified state");
+  persistence.get(id2, storedStates);
+  TEST_ASSERT_TRUE_MESSAGE(storedStates.groups[1].isEqualIgnoreDirty(states2.groups[1]), "Should keep devices with the same low byte apart");
 }
 
 void test_store() {
@@ -243,7 +393,7 @@ void test_store() {
   store.set(id1, initState);
   storedState = store.get(id1);
 
-  TEST_ASSERT_TRUE_MESSAGE(storedState->isEqualIgnoreDirty(initState), "Should return stored state.  Will not be cached because of internal group 0 lookups");
+  TEST_ASSERT_TRUE_MESSAGE(storedState->isEqualIgnoreDirty(initState), "Should return stored state");
 
   store.flush();
   storedState = store.get(id1);
@@ -263,7 +413,7 @@ void test_group_0() {
   BulbId id1(1, 1, REMOTE_TYPE_FUT089);
   BulbId id2(1, 2, REMOTE_TYPE_FUT089);
 
-  // cache 1 item, flush immediately
+  // flush immediately
   GroupStateStore store(10, 0);
   GroupStatePersistence persistence;
 
@@ -344,6 +494,671 @@ void test_group_0() {
   TEST_ASSERT_TRUE_MESSAGE(storedState.isEqualIgnoreDirty(rgbState), "Should persist group 0 for device type with no groups");
 }
 
+void test_group_0_in_place() {
+  BulbId group0Id(3, 0, REMOTE_TYPE_FUT089);
+
+  // One device cached, so fanning out can't evict anything
+  GroupStateStore store(1, 0);
+  store.getPersistence().clear(group0Id);
+
+  GroupState state;
+  state.setHue(100);
+
+  GroupState* group0State = store.set(group0Id, state);
+
+  for (uint8_t i = 1; i <= 8; i++) {
+    TEST_ASSERT_EQUAL_MESSAGE(100, store.get(BulbId(3, i, REMOTE_TYPE_FUT089))->getHue(), "Every group should be updated");
+  }
+  TEST_ASSERT_TRUE_MESSAGE(group0State == store.get(group0Id), "Group 0 should stay cached");
+  TEST_ASSERT_EQUAL_MESSAGE(1, store.getDirtyCount(), "The device should be dirty as a whole");
+}
+
+void test_store_batched_flush() {
+  // One device each
+  BulbId ids[] = {
+    BulbId(1, 0, REMOTE_TYPE_RGB),
+    BulbId(2, 0, REMOTE_TYPE_RGB),
+    BulbId(3, 0, REMOTE_TYPE_RGB),
+    BulbId(4, 0, REMOTE_TYPE_RGB)
+  };
+
+  // Flush immediately, two records per batch
+  const size_t recordBytes = StateLog::HEADER_LENGTH + GroupStatePersistence::RECORD_HEADER_LENGTH + GroupState::DUMP_SIZE;
+  GroupStateStore store(10, 0, 2 * recordBytes, 0);
+  GroupStatePersistence& persistence = store.getPersistence();
+
+  GroupState state = GroupState::defaultState(REMOTE_TYPE_RGB);
+  state.setHue(100);
+  state.setBrightness(100);
+
+  for (const BulbId& id : ids) {
+    persistence.clear(id);
+    store.set(id, state);
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(4, store.getDirtyCount(), "Every changed device should be dirty");
+
+  store.limitedFlush();
+  TEST_ASSERT_EQUAL_MESSAGE(2, store.getDirtyCount(), "Should stop once the batch is out of bytes");
+
+  store.limitedFlush();
+  TEST_ASSERT_EQUAL_MESSAGE(2, store.getDirtyCount(), "Should check for compaction in a batch of its own");
+
+  store.limitedFlush();
+  TEST_ASSERT_EQUAL_MESSAGE(0, store.getDirtyCount(), "Should carry on with the rest in the next batch");
+
+  for (const BulbId& id : ids) {
+    TEST_ASSERT_FALSE_MESSAGE(store.get(id)->isDirty(), "Should not be dirty after flushing");
+  }
+
+  // Changes back to what's saved aren't written
+  const size_t skippedWrites = persistence.getStats().skippedWrites;
+  const size_t bytesWritten = persistence.getLogStats().bytesWritten;
+
+  store.set(ids[0], state);
+  store.flush();
+
+  TEST_ASSERT_EQUAL_MESSAGE(skippedWrites + 1, persistence.getStats().skippedWrites, "Should skip a state that's already saved");
+  TEST_ASSERT_EQUAL_MESSAGE(bytesWritten, persistence.getLogStats().bytesWritten, "Should not append anything");
+}
+
+void test_store_retain_restore() {
+  BulbId id1(5, 2, REMOTE_TYPE_FUT089);
+  BulbId id2(6, 0, REMOTE_TYPE_RGB);
+
+  GroupState state1 = color();
+  GroupState state2 = GroupState::defaultState(REMOTE_TYPE_RGB);
+  state2.setHue(50);
+
+  RetainedStates retained;
+
+  {
+    GroupStateStore store(10, 0);
+    store.set(id1, state1);
+    store.set(id2, state2);
+    store.flush();
+
+    // Still waiting to be flushed when the restart happens
+    state2.setBrightness(20);
+    store.set(id2, state2);
+
+    store.retain(retained);
+  }
+
+  TEST_ASSERT_TRUE_MESSAGE(retained.isValid(), "Retained states should check out");
+
+  GroupStateStore store(10, 0);
+
+  TEST_ASSERT_EQUAL_MESSAGE(2, store.restore(retained), "Should restore both devices");
+  TEST_ASSERT_EQUAL_MESSAGE(1, store.getDirtyCount(), "Unflushed device should still be dirty");
+  TEST_ASSERT_TRUE_MESSAGE(store.get(id1)->isEqualIgnoreDirty(state1), "Should restore state");
+  TEST_ASSERT_TRUE_MESSAGE(store.get(id2)->isEqualIgnoreDirty(state2), "Should restore unflushed state");
+
+  retained.slots[0].data[4] ^= 0x01;
+  TEST_ASSERT_FALSE_MESSAGE(retained.isValid(), "Corrupted states should not check out");
+}
+
+//================================================================================
+// Packet queue
+//================================================================================
+
+void test_packet_queue() {
+  PacketQueue queue;
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH] = {0};
+
+  TEST_ASSERT_TRUE_MESSAGE(queue.isEmpty(), "Queue should start empty");
+
+  // Push and pop enough packets to wrap around the ring a few times
+  for (size_t i = 0; i < MILIGHT_MAX_QUEUED_PACKETS * 3; i++) {
+    packet[0] = i;
+    queue.push(packet, &FUT092Config, i);
+
+    QueuedPacket& front = queue.front();
+    TEST_ASSERT_EQUAL_INT_MESSAGE(i, front.packet[0], "Should borrow the packet that was pushed");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(i, front.repeatsOverride, "Should keep the repeats override");
+
+    queue.pop();
+  }
+
+  TEST_ASSERT_TRUE_MESSAGE(queue.isEmpty(), "Queue should be empty after popping everything");
+  TEST_ASSERT_EQUAL_INT(MILIGHT_MAX_QUEUED_PACKETS * 3, queue.getEnqueuedPacketCount());
+  TEST_ASSERT_EQUAL_INT(MILIGHT_MAX_QUEUED_PACKETS * 3, queue.getDequeuedPacketCount());
+  TEST_ASSERT_EQUAL_INT(0, queue.getDroppedPacketCount());
+
+  // Overfill.  The oldest packet must survive, the newest slot gets overwritten.
+  for (size_t i = 0; i < MILIGHT_MAX_QUEUED_PACKETS; i++) {
+    packet[0] = i;
+    TEST_ASSERT_TRUE(queue.push(packet, &FUT092Config, 0) == PacketQueue::PushResult::QUEUED);
+  }
+  packet[0] = MILIGHT_MAX_QUEUED_PACKETS;
+  TEST_ASSERT_TRUE_MESSAGE(
+    queue.push(packet, &FUT092Config, 0) == PacketQueue::PushResult::REPLACED,
+    "Should report overwriting the newest packet"
+  );
+
+  TEST_ASSERT_EQUAL_INT(MILIGHT_MAX_QUEUED_PACKETS, queue.size());
+  TEST_ASSERT_EQUAL_INT_MESSAGE(1, queue.getDroppedPacketCount(), "Should count the overwritten packet");
+  TEST_ASSERT_EQUAL_INT_MESSAGE(
+    queue.getEnqueuedPacketCount(),
+    queue.getDequeuedPacketCount() + queue.size(),
+    "Overwriting a packet should not count as enqueued"
+  );
+  TEST_ASSERT_EQUAL_INT_MESSAGE(0, queue.front().packet[0], "Oldest packet should not be overwritten");
+
+  // Packets being sent are never overwritten.  The oldest one which isn't goes instead.
+  BulbId oldestBulb(7, 1, REMOTE_TYPE_RGB_CCT);
+  queue.at(0).bulbId = oldestBulb;
+  queue.checkout(MILIGHT_MAX_QUEUED_PACKETS - 1);
+  packet[0] = 100;
+  TEST_ASSERT_TRUE(queue.push(packet, &FUT092Config, 0) == PacketQueue::PushResult::REPLACED);
+  TEST_ASSERT_EQUAL_INT(2, queue.getDroppedPacketCount());
+  TEST_ASSERT_EQUAL_INT(MILIGHT_MAX_QUEUED_PACKETS, queue.size());
+  TEST_ASSERT_EQUAL_INT_MESSAGE(7, queue.evicted().bulbId.deviceId, "Should report the dropped packet");
+  TEST_ASSERT_EQUAL_INT_MESSAGE(1, queue.front().packet[0], "Should drop the oldest packet");
+  TEST_ASSERT_EQUAL_INT_MESSAGE(
+    MILIGHT_MAX_QUEUED_PACKETS,
+    queue.at(MILIGHT_MAX_QUEUED_PACKETS - 2).packet[0],
+    "Should not overwrite a checked out packet"
+  );
+  TEST_ASSERT_TRUE(queue.at(MILIGHT_MAX_QUEUED_PACKETS - 2).checkedOut);
+  TEST_ASSERT_EQUAL_INT(100, queue.at(MILIGHT_MAX_QUEUED_PACKETS - 1).packet[0]);
+  TEST_ASSERT_EQUAL_INT(queue.getEnqueuedPacketCount(), queue.getDequeuedPacketCount() + queue.size());
+
+  // Nothing to make room with
+  PacketQueue sendingQueue;
+  for (size_t i = 0; i < MILIGHT_MAX_QUEUED_PACKETS; i++) {
+    sendingQueue.push(packet, &FUT092Config, 0);
+    sendingQueue.checkout(i);
+  }
+  TEST_ASSERT_TRUE(sendingQueue.push(packet, &FUT092Config, 0) == PacketQueue::PushResult::DROPPED);
+  TEST_ASSERT_EQUAL_INT(1, sendingQueue.getDroppedPacketCount());
+
+  // Removing from the middle keeps the order of the rest
+  uint8_t second = queue.at(2).packet[0];
+  queue.remove(1);
+  TEST_ASSERT_EQUAL_INT(MILIGHT_MAX_QUEUED_PACKETS - 1, queue.size());
+  TEST_ASSERT_EQUAL_INT(1, queue.at(0).packet[0]);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(second, queue.at(1).packet[0], "Should shift later packets forward");
+}
+
+void test_packet_queue_coalescing() {
+  PacketQueue queue;
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH] = {0};
+  BulbId bulb1(1, 1, REMOTE_TYPE_RGB_CCT);
+  BulbId bulb2(1, 2, REMOTE_TYPE_RGB_CCT);
+  BulbId otherDevice(2, 1, REMOTE_TYPE_RGB_CCT);
+
+  packet[0] = 1;
+  queue.push(packet, &FUT092Config, 0, bulb1, PacketCommandClass::BRIGHTNESS);
+  packet[0] = 2;
+  queue.push(packet, &FUT092Config, 0, otherDevice, PacketCommandClass::BRIGHTNESS);
+  packet[0] = 3;
+  TEST_ASSERT_TRUE(
+    queue.push(packet, &FUT092Config, 0, bulb1, PacketCommandClass::BRIGHTNESS) == PacketQueue::PushResult::MERGED
+  );
+
+  TEST_ASSERT_EQUAL_INT_MESSAGE(2, queue.size(), "Should supersede pending packet for the same bulb and command");
+  TEST_ASSERT_EQUAL_INT(1, queue.getMergedPacketCount());
+  TEST_ASSERT_EQUAL_INT_MESSAGE(2, queue.getEnqueuedPacketCount(), "Merged packets should not count as enqueued");
+  TEST_ASSERT_EQUAL_INT_MESSAGE(3, queue.front().packet[0], "Superseding packet should keep the original position");
+
+  // A status packet for the same bulb is a barrier
+  queue.push(packet, &FUT092Config, 0, bulb1, PacketCommandClass::NONE);
+  queue.push(packet, &FUT092Config, 0, bulb1, PacketCommandClass::BRIGHTNESS);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(4, queue.size(), "Should not reorder across other commands for the same bulb");
+
+  // ...and so is another group on the same device
+  queue.push(packet, &FUT092Config, 0, bulb2, PacketCommandClass::BRIGHTNESS);
+  queue.push(packet, &FUT092Config, 0, bulb1, PacketCommandClass::BRIGHTNESS);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(6, queue.size(), "Should not reorder across other groups on the same device");
+
+  // Status packets are never merged
+  queue.push(packet, &FUT092Config, 0, bulb2, PacketCommandClass::NONE);
+  queue.push(packet, &FUT092Config, 0, bulb2, PacketCommandClass::NONE);
+  TEST_ASSERT_EQUAL_INT(8, queue.size());
+
+  // Packets being sent are never superseded
+  PacketQueue sendingQueue;
+  sendingQueue.push(packet, &FUT092Config, 0, bulb1, PacketCommandClass::HUE);
+  sendingQueue.checkout();
+  sendingQueue.push(packet, &FUT092Config, 0, bulb1, PacketCommandClass::HUE);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(2, sendingQueue.size(), "Should not supersede a checked out packet");
+  TEST_ASSERT_EQUAL_INT(0, sendingQueue.getMergedPacketCount());
+
+  // Hue can skip over saturation for the same bulb...
+  PacketQueue colorQueue;
+  colorQueue.push(packet, &FUT092Config, 0, bulb1, PacketCommandClass::HUE);
+  colorQueue.push(packet, &FUT092Config, 0, bulb1, PacketCommandClass::SATURATION);
+  colorQueue.push(packet, &FUT092Config, 0, bulb1, PacketCommandClass::HUE);
+  TEST_ASSERT_EQUAL_INT(2, colorQueue.size());
+
+  // ...except on FUT089, where saturation shares a command with color temperature
+  BulbId fut089Bulb(1, 1, REMOTE_TYPE_FUT089);
+  colorQueue.push(packet, &FUT089Config, 0, fut089Bulb, PacketCommandClass::HUE);
+  colorQueue.push(packet, &FUT089Config, 0, fut089Bulb, PacketCommandClass::SATURATION);
+  colorQueue.push(packet, &FUT089Config, 0, fut089Bulb, PacketCommandClass::HUE);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(5, colorQueue.size(), "Should not reorder hue and saturation on FUT089");
+  TEST_ASSERT_EQUAL_INT(
+    colorQueue.getEnqueuedPacketCount(),
+    colorQueue.getDequeuedPacketCount() + colorQueue.size()
+  );
+}
+
+//================================================================================
+// Packet sender
+//================================================================================
+
+struct SentFrame {
+  size_t module;
+  const MiLightRadioConfig* radioConfig;
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH];
+};
+
+#define MAX_FAKE_RADIO_MODULES 4
+
+static std::vector<SentFrame> sentFrames;
+// Indexed by module
+static size_t fakeRadioConfigures[MAX_FAKE_RADIO_MODULES];
+static const MiLightRadioConfig* fakeRadioTuned[MAX_FAKE_RADIO_MODULES];
+
+static void resetFakeRadios() {
+  sentFrames.clear();
+
+  for (size_t i = 0; i < MAX_FAKE_RADIO_MODULES; i++) {
+    fakeRadioConfigures[i] = 0;
+    fakeRadioTuned[i] = nullptr;
+  }
+}
+
+// Records what would have gone on air
+class FakeRadio : public MiLightRadio {
+public:
+  FakeRadio(size_t module, const MiLightRadioConfig& radioConfig)
+    : module(module)
+    , radioConfig(radioConfig)
+  { }
+
+  virtual int begin() { return 0; }
+  virtual bool available() { return false; }
+  virtual int read(uint8_t frame[], size_t &frame_length) { frame_length = 0; return 0; }
+  virtual int resend() { return 0; }
+  virtual const MiLightRadioConfig& config() { return radioConfig; }
+
+  virtual int configure() {
+    ++fakeRadioConfigures[module];
+    fakeRadioTuned[module] = &radioConfig;
+    return 0;
+  }
+
+  virtual int write(uint8_t frame[], size_t frame_length) {
+    SentFrame sent;
+    sent.module = module;
+    sent.radioConfig = &radioConfig;
+    memcpy(sent.packet, frame, std::min(frame_length, static_cast<size_t>(MILIGHT_MAX_PACKET_LENGTH)));
+    sentFrames.push_back(sent);
+    return 0;
+  }
+
+private:
+  size_t module;
+  const MiLightRadioConfig& radioConfig;
+};
+
+class FakeRadioFactory : public MiLightRadioFactory {
+public:
+  FakeRadioFactory(
+    size_t module,
+    RadioRole role = RadioRole::BOTH,
+    const std::vector<MiLightRemoteType>& remoteTypes = std::vector<MiLightRemoteType>()
+  ) : module(module) {
+    this->role = role;
+    this->remoteTypes = remoteTypes;
+  }
+
+  virtual std::shared_ptr<MiLightRadio> create(const MiLightRadioConfig& config) {
+    return std::make_shared<FakeRadio>(module, config);
+  }
+
+  virtual bool isIrqActiveLow() const { return false; }
+
+private:
+  size_t module;
+};
+
+static void drainSender(PacketSender& sender) {
+  for (size_t i = 0; i < 1000 && sender.isSending(); i++) {
+    sender.loop();
+  }
+}
+
+static size_t configIndex(const MiLightRemoteConfig& remote) {
+  return &remote.radioConfig - MiLightRadioConfig::ALL_CONFIGS;
+}
+
+// Send a packet through the switchboard and return the module it went out on
+static size_t sendThrough(RadioSwitchboard& switchboard, const MiLightRemoteConfig& remote) {
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH] = {0};
+
+  if (switchboard.switchRadio(&remote) == nullptr || !switchboard.write(packet, remote.packetFormatter->getPacketLength())) {
+    return RadioRouter::NONE;
+  }
+
+  return sentFrames.back().module;
+}
+
+static std::vector<std::shared_ptr<MiLightRadioFactory>> oneFakeRadio() {
+  std::vector<std::shared_ptr<MiLightRadioFactory>> factories;
+  factories.push_back(std::make_shared<FakeRadioFactory>(0));
+  return factories;
+}
+
+// Clears what the fake radios recorded before the switchboard sets them up
+struct FakeRadiosReset {
+  FakeRadiosReset() {
+    resetFakeRadios();
+  }
+};
+
+// A sender and switchboard on fake radios.  Settings are copied, so change
+// them before building the fixture.
+struct SenderFixture : FakeRadiosReset {
+  GroupStateStore stateStore;
+  Settings settings;
+  RadioSwitchboard switchboard;
+  PacketSender sender;
+
+  explicit SenderFixture(
+    const Settings& settings = Settings(),
+    const std::vector<std::shared_ptr<MiLightRadioFactory>>& factories = oneFakeRadio(),
+    PacketSender::PacketSentHandler packetSentHandler = nullptr
+  ) : stateStore(10, 0)
+    , settings(settings)
+    , switchboard(factories, &stateStore, this->settings)
+    , sender(switchboard, this->settings, packetSentHandler)
+  { }
+};
+
+void test_switchboard_dedicated_receiver() {
+  std::vector<std::shared_ptr<MiLightRadioFactory>> factories;
+  factories.push_back(std::make_shared<FakeRadioFactory>(0, RadioRole::RX));
+  factories.push_back(std::make_shared<FakeRadioFactory>(1, RadioRole::TX));
+  SenderFixture fixture(Settings(), factories);
+  RadioSwitchboard& switchboard = fixture.switchboard;
+
+  TEST_ASSERT_TRUE(switchboard.hasDedicatedReceiver());
+  switchboard.switchRadio(configIndex(FUT098Config));
+
+  TEST_ASSERT_EQUAL_INT(1, sendThrough(switchboard, FUT096Config));
+  TEST_ASSERT_EQUAL_INT_MESSAGE(1, sendThrough(switchboard, FUT098Config), "Receiver should never send");
+  TEST_ASSERT_EQUAL_INT(1, sendThrough(switchboard, FUT092Config));
+
+  TEST_ASSERT_EQUAL_INT(1, fakeRadioConfigures[0]);
+  TEST_ASSERT_TRUE_MESSAGE(fakeRadioTuned[0] == &FUT098Config.radioConfig, "Sending shouldn't retune the receiver");
+  TEST_ASSERT_EQUAL_INT(3, fakeRadioConfigures[1]);
+}
+
+void test_switchboard_spreads_transmitters() {
+  std::vector<std::shared_ptr<MiLightRadioFactory>> factories;
+  factories.push_back(std::make_shared<FakeRadioFactory>(0, RadioRole::RX));
+  factories.push_back(std::make_shared<FakeRadioFactory>(
+    1, RadioRole::TX, std::vector<MiLightRemoteType>(1, REMOTE_TYPE_RGB_CCT)
+  ));
+  factories.push_back(std::make_shared<FakeRadioFactory>(2, RadioRole::TX));
+  factories.push_back(std::make_shared<FakeRadioFactory>(3, RadioRole::TX));
+  SenderFixture fixture(Settings(), factories);
+  RadioSwitchboard& switchboard = fixture.switchboard;
+
+  for (size_t i = 0; i < 5; i++) {
+    TEST_ASSERT_EQUAL_INT_MESSAGE(1, sendThrough(switchboard, FUT092Config), "Should use the pinned module");
+    TEST_ASSERT_EQUAL_INT(2, sendThrough(switchboard, FUT096Config));
+    TEST_ASSERT_EQUAL_INT_MESSAGE(3, sendThrough(switchboard, FUT007Config), "Should use every unpinned module");
+  }
+
+  TEST_ASSERT_EQUAL_INT(1, fakeRadioConfigures[1]);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(1, fakeRadioConfigures[2], "Alternating traffic shouldn't retune anything");
+  TEST_ASSERT_EQUAL_INT(1, fakeRadioConfigures[3]);
+  TEST_ASSERT_EQUAL_INT(0, fakeRadioConfigures[0]);
+}
+
+void test_sender_drops_unroutable_packets() {
+  std::vector<std::shared_ptr<MiLightRadioFactory>> factories;
+  factories.push_back(std::make_shared<FakeRadioFactory>(0, RadioRole::RX));
+  factories.push_back(std::make_shared<FakeRadioFactory>(
+    1, RadioRole::TX, std::vector<MiLightRemoteType>(1, REMOTE_TYPE_RGBW)
+  ));
+  size_t handled = 0;
+  SenderFixture fixture(Settings(), factories, [&handled](uint8_t*, const MiLightRemoteConfig&, uint16_t) { ++handled; });
+  PacketSender& sender = fixture.sender;
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH] = {0};
+  BulbId bulbId(1, 1, REMOTE_TYPE_RGB_CCT);
+
+  sender.enqueue(packet, &FUT092Config, 1, bulbId);
+  drainSender(sender);
+
+  TEST_ASSERT_EQUAL_INT(0, sentFrames.size());
+  TEST_ASSERT_EQUAL_INT_MESSAGE(0, handled, "Should not report unsent packets as sent");
+  TEST_ASSERT_EQUAL_INT(1, sender.droppedPackets());
+  TEST_ASSERT_EQUAL_INT(0, sender.queueLength());
+  TEST_ASSERT_FALSE(sender.hasPendingPackets(bulbId));
+}
+
+void test_sender_promotes_transition_packets() {
+  SenderFixture fixture;
+  PacketSender& sender = fixture.sender;
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH] = {0};
+  BulbId bulb1(1, 1, REMOTE_TYPE_RGB_CCT);
+  BulbId otherGroup(1, 2, REMOTE_TYPE_RGB_CCT);
+
+  packet[0] = 1;
+  sender.enqueue(packet, &FUT092Config, 1, bulb1, PacketCommandClass::BRIGHTNESS, PacketPriority::TRANSITION);
+  packet[0] = 2;
+  sender.enqueue(packet, &FUT092Config, 1, otherGroup, PacketCommandClass::BRIGHTNESS, PacketPriority::TRANSITION);
+  packet[0] = 3;
+  sender.enqueue(packet, &FUT092Config, 1, bulb1, PacketCommandClass::NONE);
+
+  TEST_ASSERT_EQUAL_INT_MESSAGE(1, sender.promotedPackets(), "Should move the bulb's transition packet");
+  TEST_ASSERT_EQUAL_INT(2, sender.queueLength(PacketPriority::INTERACTIVE));
+  TEST_ASSERT_EQUAL_INT_MESSAGE(1, sender.queueLength(PacketPriority::TRANSITION), "Should leave other groups alone");
+
+  sentFrames.clear();
+  drainSender(sender);
+
+  TEST_ASSERT_EQUAL_INT(3, sentFrames.size());
+  TEST_ASSERT_EQUAL_INT_MESSAGE(1, sentFrames[0].packet[0], "Transition packet should go out before the newer command");
+  TEST_ASSERT_EQUAL_INT(3, sentFrames[1].packet[0]);
+  TEST_ASSERT_FALSE(sender.hasPendingPackets(bulb1));
+}
+
+void test_sender_background_lane() {
+  SenderFixture fixture;
+  PacketSender& sender = fixture.sender;
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH] = {0};
+  BulbId bulb1(1, 1, REMOTE_TYPE_RGB_CCT);
+  BulbId bulb2(2, 1, REMOTE_TYPE_RGB_CCT);
+  BulbId bulb3(3, 1, REMOTE_TYPE_RGB_CCT);
+
+  packet[0] = 1;
+  sender.enqueue(packet, &FUT092Config, 1, bulb1, PacketCommandClass::BRIGHTNESS, PacketPriority::BACKGROUND);
+  packet[0] = 2;
+  sender.enqueue(packet, &FUT092Config, 1, bulb2, PacketCommandClass::BRIGHTNESS, PacketPriority::BACKGROUND);
+  packet[0] = 3;
+  sender.enqueue(packet, &FUT092Config, 1, bulb2, PacketCommandClass::HUE, PacketPriority::TRANSITION);
+  packet[0] = 4;
+  sender.enqueue(packet, &FUT092Config, 1, bulb3, PacketCommandClass::NONE);
+
+  TEST_ASSERT_EQUAL_INT_MESSAGE(1, sender.promotedPackets(), "Should move the bulb's background packet up to the transition lane");
+  TEST_ASSERT_EQUAL_INT(1, sender.queueLength(PacketPriority::BACKGROUND));
+  TEST_ASSERT_EQUAL_INT(2, sender.queueLength(PacketPriority::TRANSITION));
+
+  sentFrames.clear();
+  drainSender(sender);
+
+  TEST_ASSERT_EQUAL_INT(4, sentFrames.size());
+  TEST_ASSERT_EQUAL_INT_MESSAGE(4, sentFrames[0].packet[0], "Interactive packet should go first");
+  TEST_ASSERT_EQUAL_INT_MESSAGE(2, sentFrames[1].packet[0], "Promoted packet should stay ahead of the newer one");
+  TEST_ASSERT_EQUAL_INT(3, sentFrames[2].packet[0]);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(1, sentFrames[3].packet[0], "Background packet should go last");
+  TEST_ASSERT_EQUAL_INT(1, sender.laneStats(PacketPriority::BACKGROUND).sentPackets);
+}
+
+void test_sender_finishes_partly_sent_packets() {
+  Settings settings;
+  settings.packetRepeatsPerLoop = 1;
+  SenderFixture fixture(settings);
+  PacketSender& sender = fixture.sender;
+  RadioSwitchboard& switchboard = fixture.switchboard;
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH] = {0};
+
+  // Leave the radio set up for rgb_cct
+  sender.enqueue(packet, &FUT092Config, 1, BulbId(1, 1, REMOTE_TYPE_RGB_CCT));
+  drainSender(sender);
+
+  // The older rgbw packet is held back for the rgb_cct one, which gets one repeat out
+  packet[0] = 1;
+  sender.enqueue(packet, &FUT096Config, 3, BulbId(2, 1, REMOTE_TYPE_RGBW));
+  packet[0] = 2;
+  sender.enqueue(packet, &FUT092Config, 3, BulbId(3, 1, REMOTE_TYPE_RGB_CCT));
+
+  sentFrames.clear();
+  sender.loop();
+  TEST_ASSERT_EQUAL_INT(1, sentFrames.size());
+  TEST_ASSERT_EQUAL_INT(2, sentFrames[0].packet[0]);
+
+  // Something else, e.g. listening, reconfigures the radio for rgbw
+  switchboard.switchRadio(&FUT096Config);
+  drainSender(sender);
+
+  TEST_ASSERT_EQUAL_INT(6, sentFrames.size());
+  TEST_ASSERT_EQUAL_INT_MESSAGE(2, sentFrames[1].packet[0], "Partly sent packet should not wait for the older one");
+  TEST_ASSERT_EQUAL_INT(2, sentFrames[2].packet[0]);
+  TEST_ASSERT_EQUAL_INT(1, sentFrames[3].packet[0]);
+  TEST_ASSERT_TRUE(sentFrames[3].radioConfig == &FUT096Config.radioConfig);
+}
+
+void test_sender_holds_batch_until_sealed() {
+  SenderFixture fixture;
+  PacketSender& sender = fixture.sender;
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH] = {0};
+
+  const uint16_t batchId = sender.beginBatch();
+  for (uint16_t i = 1; i <= 3; i++) {
+    sender.enqueue(packet, &FUT092Config, 1, BulbId(i, 1, REMOTE_TYPE_RGB_CCT));
+  }
+
+  sentFrames.clear();
+  sender.loop();
+  TEST_ASSERT_EQUAL_INT_MESSAGE(0, sentFrames.size(), "Should wait for the rest of the batch");
+
+  TEST_ASSERT_EQUAL_INT(0, sender.endBatch());
+  drainSender(sender);
+
+  TEST_ASSERT_EQUAL_INT(3, sentFrames.size());
+  TEST_ASSERT_EQUAL_INT(batchId, sender.lastBatch().id);
+  TEST_ASSERT_EQUAL_INT(3, sender.lastBatch().packets);
+}
+
+void test_sender_batch_seal_timeout() {
+  SenderFixture fixture;
+  PacketSender& sender = fixture.sender;
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH] = {0};
+
+  // The end of the batch never arrives
+  sender.beginBatch();
+  sender.enqueue(packet, &FUT092Config, 1, BulbId(1, 1, REMOTE_TYPE_RGB_CCT));
+
+  sentFrames.clear();
+  sender.loop();
+  TEST_ASSERT_EQUAL_INT(0, sentFrames.size());
+
+  delay(MILIGHT_BATCH_SEAL_TIMEOUT_MS + 10);
+  sender.loop();
+  TEST_ASSERT_EQUAL_INT_MESSAGE(1, sentFrames.size(), "Should give up waiting for the batch");
+
+  sender.endBatch();
+}
+
+void test_sender_spills_large_batch() {
+  size_t handled = 0;
+  SenderFixture fixture(Settings(), oneFakeRadio(), [&handled](uint8_t*, const MiLightRemoteConfig&, uint16_t) { ++handled; });
+  PacketSender& sender = fixture.sender;
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH] = {0};
+  const size_t numPackets = MILIGHT_MAX_QUEUED_PACKETS + MILIGHT_PACKET_INBOX_SIZE + 8;
+
+  sentFrames.clear();
+  sender.beginBatch();
+  for (uint16_t i = 1; i <= numPackets; i++) {
+    sender.enqueue(packet, &FUT092Config, 1, BulbId(i, 1, REMOTE_TYPE_RGB_CCT));
+  }
+
+  TEST_ASSERT_TRUE_MESSAGE(sentFrames.size() > 0, "Should send to make room rather than drop");
+  TEST_ASSERT_EQUAL_INT(0, sender.endBatch());
+  drainSender(sender);
+
+  TEST_ASSERT_EQUAL_INT(numPackets, sentFrames.size());
+  TEST_ASSERT_EQUAL_INT(numPackets, handled);
+  TEST_ASSERT_EQUAL_INT(0, sender.droppedPackets());
+}
+
+void test_sender_batch_overflow() {
+  SenderFixture fixture;
+  PacketSender& sender = fixture.sender;
+  uint8_t packet[MILIGHT_MAX_PACKET_LENGTH] = {0};
+  const size_t overflow = 8;
+
+  // Nothing drains the inbox, as if the radio task were stuck
+  sender.setAsync(true);
+  sender.beginBatch();
+
+  const unsigned long start = millis();
+  for (uint16_t i = 1; i <= MILIGHT_PACKET_INBOX_SIZE + overflow; i++) {
+    sender.enqueue(packet, &FUT092Config, 1, BulbId(i, 1, REMOTE_TYPE_RGB_CCT));
+  }
+  const unsigned long elapsed = millis() - start;
+
+  TEST_ASSERT_TRUE_MESSAGE(elapsed < 2 * MILIGHT_PACKET_INBOX_WAIT_MS, "Should only wait for the inbox once");
+  TEST_ASSERT_EQUAL_INT_MESSAGE(overflow, sender.endBatch(), "Should report dropped batch packets");
+  TEST_ASSERT_EQUAL_INT(overflow, sender.droppedPackets());
+
+  // The batch's end didn't fit either, so the last of it waits for the seal to time out
+  sender.setAsync(false);
+  sentFrames.clear();
+  drainSender(sender);
+  delay(MILIGHT_BATCH_SEAL_TIMEOUT_MS + 10);
+  drainSender(sender);
+  TEST_ASSERT_EQUAL_INT(MILIGHT_PACKET_INBOX_SIZE, sentFrames.size());
+}
+
+//================================================================================
+// Batch planner
+//================================================================================
+
+void test_batch_planner() {
+  std::vector<BulbId> bulbIds;
+  for (uint8_t i = 1; i <= 4; i++) {
+    bulbIds.push_back(BulbId(1, i, REMOTE_TYPE_RGB_CCT));
+  }
+  bulbIds.push_back(BulbId(2, 1, REMOTE_TYPE_RGB_CCT));
+  bulbIds.push_back(BulbId(1, 2, REMOTE_TYPE_RGB_CCT));
+
+  std::vector<BatchTarget> targets = BatchPlanner::plan(bulbIds, true);
+
+  TEST_ASSERT_EQUAL_INT_MESSAGE(2, targets.size(), "Should send a whole device one group 0 command");
+  TEST_ASSERT_EQUAL_INT(1, targets[0].bulbId.deviceId);
+  TEST_ASSERT_EQUAL_INT(0, targets[0].bulbId.groupId);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(4, targets[0].covers, "Should count each group once");
+  TEST_ASSERT_EQUAL_INT(2, targets[1].bulbId.deviceId);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(1, targets[1].bulbId.groupId, "Should leave partly targeted devices alone");
+
+  targets = BatchPlanner::plan(bulbIds, false);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(5, targets.size(), "Should only drop duplicates when not collapsing");
+
+  // Device types without groups are only ever addressed as group 0
+  bulbIds.clear();
+  bulbIds.push_back(BulbId(3, 0, REMOTE_TYPE_RGB));
+  targets = BatchPlanner::plan(bulbIds, true);
+  TEST_ASSERT_EQUAL_INT(1, targets.size());
+  TEST_ASSERT_EQUAL_INT(1, targets[0].covers);
+}
+
 // setup connects serial, runs test cases (upcoming)
 void setup() {
   delay(2000);
@@ -354,13 +1169,34 @@ void setup() {
 
   RUN_TEST(test_init_state);
   RUN_TEST(test_state_updates);
+  RUN_TEST(test_parsed_packet_patch);
+  RUN_TEST(test_benchmark_parsed_packet);
   RUN_TEST(test_cache);
   RUN_TEST(test_persistence);
+  RUN_TEST(test_persistence_full_device_id);
   RUN_TEST(test_store);
   RUN_TEST(test_group_0);
+  RUN_TEST(test_group_0_in_place);
+  RUN_TEST(test_store_batched_flush);
+  RUN_TEST(test_store_retain_restore);
+
+  RUN_TEST(test_packet_queue);
+  RUN_TEST(test_packet_queue_coalescing);
+  RUN_TEST(test_sender_promotes_transition_packets);
+  RUN_TEST(test_sender_background_lane);
+  RUN_TEST(test_sender_finishes_partly_sent_packets);
+  RUN_TEST(test_switchboard_dedicated_receiver);
+  RUN_TEST(test_switchboard_spreads_transmitters);
+  RUN_TEST(test_sender_drops_unroutable_packets);
+  RUN_TEST(test_sender_holds_batch_until_sealed);
+  RUN_TEST(test_sender_batch_seal_timeout);
+  RUN_TEST(test_sender_spills_large_batch);
+  RUN_TEST(test_sender_batch_overflow);
+  RUN_TEST(test_batch_planner);
 
   RUN_TEST(test_fut091_packet_formatter);
   RUN_TEST(test_fut092_packet_formatter);
+  RUN_TEST(test_receive_dispatch);
 
   UNITY_END();
 }
@@ -0,0 +1,75 @@
+#include <unity.h>
+#include <LatencyHistogram.h>
+
+void test_empty() {
+  LatencyHistogram histogram;
+
+  TEST_ASSERT_EQUAL(0, histogram.getCount());
+  TEST_ASSERT_EQUAL(0, histogram.percentile(50));
+  TEST_ASSERT_EQUAL(0, histogram.percentile(99));
+}
+
+void test_buckets_cover_every_value() {
+  // Each bucket starts right after the previous one ends
+  for (size_t i = 1; i < LatencyHistogram::NUM_BUCKETS; i++) {
+    const uint32_t start = LatencyHistogram::upperBound(i - 1) + 1;
+
+    TEST_ASSERT_EQUAL(i, LatencyHistogram::bucketFor(start));
+    TEST_ASSERT_EQUAL(i, LatencyHistogram::bucketFor(LatencyHistogram::upperBound(i)));
+  }
+
+  TEST_ASSERT_EQUAL(LatencyHistogram::NUM_BUCKETS - 1, LatencyHistogram::bucketFor(UINT32_MAX));
+  TEST_ASSERT_EQUAL(UINT32_MAX, LatencyHistogram::upperBound(LatencyHistogram::NUM_BUCKETS - 1));
+}
+
+void test_percentiles() {
+  LatencyHistogram histogram;
+
+  // 1..1000us, one sample each
+  for (uint32_t i = 1; i <= 1000; i++) {
+    histogram.add(i);
+  }
+
+  TEST_ASSERT_EQUAL(1000, histogram.getCount());
+  TEST_ASSERT_EQUAL(1000, histogram.getMax());
+
+  // Within a bucket (25%) of the real value, never under it
+  const uint8_t pcts[] = { 50, 90, 99 };
+  for (size_t i = 0; i < sizeof(pcts); i++) {
+    const uint32_t exact = pcts[i] * 10;
+    const uint32_t p = histogram.percentile(pcts[i]);
+
+    TEST_ASSERT_TRUE(p >= exact);
+    TEST_ASSERT_TRUE(p <= exact + exact / 4);
+  }
+
+  TEST_ASSERT_EQUAL_MESSAGE(1000, histogram.percentile(100), "p100 should be the max");
+}
+
+void test_outlier() {
+  LatencyHistogram histogram;
+
+  for (size_t i = 0; i < 99; i++) {
+    histogram.add(200);
+  }
+  histogram.add(50000);
+
+  TEST_ASSERT_TRUE(histogram.percentile(50) < 256);
+  TEST_ASSERT_TRUE(histogram.percentile(99) < 256);
+  TEST_ASSERT_EQUAL(50000, histogram.percentile(100));
+
+  histogram.reset();
+  TEST_ASSERT_EQUAL(0, histogram.getCount());
+  TEST_ASSERT_EQUAL(0, histogram.getMax());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_empty);
+  RUN_TEST(test_buckets_cover_every_value);
+  RUN_TEST(test_percentiles);
+  RUN_TEST(test_outlier);
+
+  return UNITY_END();
+}
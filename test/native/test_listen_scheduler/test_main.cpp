@@ -0,0 +1,132 @@
+#include <unity.h>
+#include <ListenScheduler.h>
+
+static const size_t NUM_CONFIGS = 5;
+
+// Radio config indexes, as in MiLightRadioConfig::ALL_CONFIGS
+static const size_t RGBW = 0;
+static const size_t CCT = 1;
+static const size_t RGB_CCT = 2;
+static const size_t RGB = 3;
+
+// Listens on whatever the scheduler picks for the given number of rounds,
+// hearing packets only on the active config.  Counts listens per config.
+static void run(ListenScheduler& scheduler, size_t rounds, size_t activeConfig, size_t listens[]) {
+  for (size_t i = 0; i < NUM_CONFIGS; i++) {
+    listens[i] = 0;
+  }
+
+  for (size_t i = 0; i < rounds; i++) {
+    size_t configIx = scheduler.next();
+
+    if (configIx >= NUM_CONFIGS) {
+      TEST_FAIL_MESSAGE("Should pick a config to listen on");
+      return;
+    }
+
+    ++listens[configIx];
+    scheduler.recordListen(configIx, configIx == activeConfig ? 1 : 0);
+  }
+}
+
+void test_idle_configs_share_evenly() {
+  ListenScheduler scheduler(NUM_CONFIGS);
+  size_t listens[NUM_CONFIGS];
+
+  run(scheduler, 100, ListenScheduler::NONE, listens);
+
+  for (size_t i = 0; i < NUM_CONFIGS; i++) {
+    TEST_ASSERT_EQUAL(20, listens[i]);
+  }
+}
+
+void test_active_config_gets_more_listens() {
+  ListenScheduler scheduler(NUM_CONFIGS);
+  size_t listens[NUM_CONFIGS];
+
+  // Let the hit rate settle
+  run(scheduler, 200, RGB_CCT, listens);
+  run(scheduler, 190, RGB_CCT, listens);
+
+  TEST_ASSERT_TRUE_MESSAGE(listens[RGB_CCT] > 140, "Active config should get most listens");
+
+  for (size_t i = 0; i < NUM_CONFIGS; i++) {
+    if (i != RGB_CCT) {
+      TEST_ASSERT_TRUE_MESSAGE(listens[i] >= 5, "Idle configs should still be probed");
+    }
+  }
+
+  ListenScheduler::ConfigStats stats = scheduler.stats(RGB_CCT);
+  TEST_ASSERT_TRUE(stats.hitRate > ListenScheduler::RATE_SCALE * 9 / 10);
+  TEST_ASSERT_EQUAL(stats.listens, stats.hits);
+  TEST_ASSERT_EQUAL(0, scheduler.stats(RGBW).hits);
+}
+
+void test_quiet_config_decays() {
+  ListenScheduler scheduler(NUM_CONFIGS);
+  size_t listens[NUM_CONFIGS];
+
+  run(scheduler, 200, CCT, listens);
+  run(scheduler, 500, ListenScheduler::NONE, listens);
+
+  TEST_ASSERT_TRUE(scheduler.stats(CCT).hitRate < ListenScheduler::RATE_SCALE / 100);
+
+  run(scheduler, 100, ListenScheduler::NONE, listens);
+  TEST_ASSERT_INT_WITHIN(1, 20, listens[CCT]);
+}
+
+void test_hit_rate_reaches_bounds() {
+  ListenScheduler scheduler(NUM_CONFIGS);
+
+  for (size_t i = 0; i < 200; i++) {
+    scheduler.recordListen(CCT, 1);
+  }
+  TEST_ASSERT_EQUAL(ListenScheduler::RATE_SCALE, scheduler.stats(CCT).hitRate);
+
+  for (size_t i = 0; i < 200; i++) {
+    scheduler.recordListen(CCT, 0);
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(0, scheduler.stats(CCT).hitRate, "Should decay all the way to 0");
+}
+
+void test_only_allowed_configs() {
+  ListenScheduler scheduler(NUM_CONFIGS);
+  size_t listens[NUM_CONFIGS];
+
+  scheduler.setAllowedConfigs((1 << RGBW) | (1 << RGB));
+  run(scheduler, 100, ListenScheduler::NONE, listens);
+
+  TEST_ASSERT_EQUAL(50, listens[RGBW]);
+  TEST_ASSERT_EQUAL(50, listens[RGB]);
+  TEST_ASSERT_EQUAL(0, listens[CCT]);
+  TEST_ASSERT_FALSE(scheduler.stats(CCT).allowed);
+  TEST_ASSERT_EQUAL(0, scheduler.stats(CCT).weight);
+
+  scheduler.setAllowedConfigs(0);
+  run(scheduler, 100, ListenScheduler::NONE, listens);
+
+  TEST_ASSERT_EQUAL_MESSAGE(20, listens[CCT], "Empty allow-list allows everything");
+}
+
+void test_nothing_allowed() {
+  ListenScheduler scheduler(2);
+
+  // Only configs the scheduler knows about count
+  scheduler.setAllowedConfigs(1 << 4);
+
+  TEST_ASSERT_EQUAL(ListenScheduler::NONE, scheduler.next());
+  TEST_ASSERT_EQUAL(0, scheduler.totalWeight());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_idle_configs_share_evenly);
+  RUN_TEST(test_active_config_gets_more_listens);
+  RUN_TEST(test_quiet_config_decays);
+  RUN_TEST(test_hit_rate_reaches_bounds);
+  RUN_TEST(test_only_allowed_configs);
+  RUN_TEST(test_nothing_allowed);
+
+  return UNITY_END();
+}
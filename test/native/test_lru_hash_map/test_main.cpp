@@ -0,0 +1,300 @@
+#include <unity.h>
+#include <LruHashMap.h>
+#include <LinkedList.h>
+
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <random>
+
+struct IdentityHash {
+  uint32_t operator()(uint32_t key) const {
+    return key;
+  }
+};
+
+// Every key lands in the same slot
+struct CollidingHash {
+  uint32_t operator()(uint32_t) const {
+    return 7;
+  }
+};
+
+// Same size as the packed GroupState data
+struct State {
+  uint32_t rawData[2];
+};
+
+typedef LruHashMap<uint32_t, int, IdentityHash> IntMap;
+typedef LruHashMap<uint32_t, State, IdentityHash> StateMap;
+
+static volatile uint32_t sink;
+
+void test_get_and_put() {
+  IntMap map(4);
+
+  TEST_ASSERT_NULL(map.get(1));
+
+  map.put(1, 10);
+  map.put(2, 20);
+
+  TEST_ASSERT_EQUAL(2, map.size());
+  TEST_ASSERT_EQUAL(10, *map.get(1));
+  TEST_ASSERT_EQUAL(20, *map.get(2));
+
+  // Replacing doesn't add an entry
+  map.put(1, 11);
+  TEST_ASSERT_EQUAL(2, map.size());
+  TEST_ASSERT_EQUAL(11, *map.get(1));
+}
+
+void test_evicts_least_recently_used() {
+  IntMap map(3);
+
+  map.put(1, 10);
+  map.put(2, 20);
+  map.put(3, 30);
+  TEST_ASSERT_TRUE(map.isFull());
+
+  // 1 is now the most recently used, so 2 goes first
+  map.get(1);
+  map.put(4, 40);
+
+  TEST_ASSERT_NULL(map.get(2));
+  TEST_ASSERT_NOT_NULL(map.get(1));
+  TEST_ASSERT_NOT_NULL(map.get(3));
+  TEST_ASSERT_NOT_NULL(map.get(4));
+  TEST_ASSERT_EQUAL(3, map.size());
+}
+
+void test_peek_keeps_order() {
+  IntMap map(2);
+
+  map.put(1, 10);
+  map.put(2, 20);
+  map.peek(1);
+  map.put(3, 30);
+
+  TEST_ASSERT_NULL(map.peek(1));
+  TEST_ASSERT_EQUAL(2, map.at(map.last()).key);
+}
+
+void test_iterates_most_recent_first() {
+  IntMap map(4);
+
+  map.put(1, 10);
+  map.put(2, 20);
+  map.put(3, 30);
+  map.get(2);
+
+  const uint32_t expected[] = { 2, 3, 1 };
+  size_t n = 0;
+
+  for (IntMap::Index i = map.first(); i != IntMap::NONE; i = map.next(i)) {
+    TEST_ASSERT_EQUAL(expected[n++], map.at(i).key);
+  }
+  TEST_ASSERT_EQUAL(3, n);
+}
+
+void test_remove_frees_node() {
+  IntMap map(2);
+
+  map.put(1, 10);
+  map.put(2, 20);
+
+  TEST_ASSERT_TRUE(map.remove(1));
+  TEST_ASSERT_FALSE(map.remove(1));
+  TEST_ASSERT_EQUAL(1, map.size());
+
+  // Reuses the freed node rather than evicting
+  map.put(3, 30);
+  TEST_ASSERT_EQUAL(20, *map.get(2));
+  TEST_ASSERT_EQUAL(30, *map.get(3));
+}
+
+void test_colliding_hashes() {
+  LruHashMap<uint32_t, int, CollidingHash> map(8);
+
+  for (uint32_t i = 0; i < 8; i++) {
+    map.put(i, i * 10);
+  }
+  TEST_ASSERT_TRUE(map.remove(3));
+
+  for (uint32_t i = 0; i < 8; i++) {
+    if (i == 3) {
+      TEST_ASSERT_NULL(map.get(i));
+    } else {
+      TEST_ASSERT_EQUAL(i * 10, *map.get(i));
+    }
+  }
+}
+
+// Random operations checked against a std::list + std::map LRU
+void test_matches_reference() {
+  const size_t capacity = 50;
+  IntMap map(capacity);
+  std::list<uint32_t> order;
+  std::map<uint32_t, int> values;
+  std::mt19937 random(1234);
+
+  for (int op = 0; op < 100000; op++) {
+    const uint32_t key = random() % 200;
+    const int action = random() % 4;
+
+    if (action == 0) {
+      const bool removed = map.remove(key);
+      TEST_ASSERT_EQUAL(values.count(key) > 0, removed);
+
+      if (removed) {
+        order.remove(key);
+        values.erase(key);
+      }
+    } else if (action == 1) {
+      int* value = map.get(key);
+      TEST_ASSERT_EQUAL(values.count(key) > 0, value != NULL);
+
+      if (value != NULL) {
+        TEST_ASSERT_EQUAL(values[key], *value);
+        order.remove(key);
+        order.push_front(key);
+      }
+    } else {
+      map.put(key, op);
+
+      if (values.count(key) > 0) {
+        order.remove(key);
+      } else if (values.size() == capacity) {
+        values.erase(order.back());
+        order.pop_back();
+      }
+      order.push_front(key);
+      values[key] = op;
+    }
+
+    TEST_ASSERT_EQUAL(values.size(), map.size());
+  }
+
+  IntMap::Index ix = map.first();
+  for (uint32_t key : order) {
+    TEST_ASSERT_EQUAL(key, map.at(ix).key);
+    ix = map.next(ix);
+  }
+  TEST_ASSERT_EQUAL(IntMap::NONE, ix);
+}
+
+// What GroupStateCache used to do: scan a LinkedList for the id, and move
+// the node to the front when found
+class ListCache {
+public:
+  struct Node {
+    uint32_t id;
+    State state;
+  };
+
+  explicit ListCache(size_t maxSize) : maxSize(maxSize) { }
+
+  ~ListCache() {
+    for (ListNode<Node*>* cur = cache.getHead(); cur != NULL; cur = cur->next) {
+      delete cur->data;
+    }
+  }
+
+  State* get(uint32_t id) {
+    for (ListNode<Node*>* cur = cache.getHead(); cur != NULL; cur = cur->next) {
+      if (cur->data->id == id) {
+        cache.spliceToFront(cur);
+        return &cur->data->state;
+      }
+    }
+    return NULL;
+  }
+
+  State* set(uint32_t id, const State& state) {
+    State* cached = get(id);
+
+    if (cached == NULL) {
+      Node* node = cache.size() >= maxSize ? cache.pop() : new Node();
+      node->id = id;
+      cache.unshift(node);
+      cached = &node->state;
+    }
+
+    *cached = state;
+    return cached;
+  }
+
+private:
+  LinkedList<Node*> cache;
+  const size_t maxSize;
+};
+
+// A mix of hits on the working set and misses that load (set) a new bulb, as
+// GroupStateStore::get does
+template <typename Cache, typename GetFn, typename SetFn>
+static double nsPerOp(Cache& cache, size_t entries, size_t ops, GetFn get, SetFn set) {
+  std::mt19937 random(42);
+  State state = { { 1, 2 } };
+
+  for (size_t i = 0; i < entries; i++) {
+    set(cache, i << 8, state);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ops; i++) {
+    const uint32_t id = (random() % (entries + entries / 10)) << 8;
+    State* found = get(cache, id);
+
+    if (found == NULL) {
+      found = set(cache, id, state);
+    }
+    sink += found->rawData[0];
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  return std::chrono::duration<double, std::nano>(elapsed).count() / ops;
+}
+
+void test_benchmark_get_set() {
+  const size_t sizes[] = { 100, 1000, 10000 };
+
+  for (size_t entries : sizes) {
+    ListCache list(entries);
+    StateMap map(entries);
+
+    // Keep the scans to roughly the same total work at every size
+    const double listNs = nsPerOp(
+      list, entries, 20000000 / entries,
+      [](ListCache& c, uint32_t id) { return c.get(id); },
+      [](ListCache& c, uint32_t id, const State& s) { return c.set(id, s); }
+    );
+    const double mapNs = nsPerOp(
+      map, entries, 1000000,
+      [](StateMap& c, uint32_t id) { return c.get(id); },
+      [](StateMap& c, uint32_t id, const State& s) { return c.put(id, s); }
+    );
+
+    char message[160];
+    snprintf(message, sizeof(message), "%zu entries: list %.0f ns/op, hash %.0f ns/op", entries, listNs, mapNs);
+    TEST_MESSAGE(message);
+
+    if (entries >= 1000) {
+      TEST_ASSERT_TRUE_MESSAGE(mapNs < listNs, "Hash lookups should beat scanning the list");
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_get_and_put);
+  RUN_TEST(test_evicts_least_recently_used);
+  RUN_TEST(test_peek_keeps_order);
+  RUN_TEST(test_iterates_most_recent_first);
+  RUN_TEST(test_remove_frees_node);
+  RUN_TEST(test_colliding_hashes);
+  RUN_TEST(test_matches_reference);
+  RUN_TEST(test_benchmark_get_set);
+
+  return UNITY_END();
+}
@@ -0,0 +1,297 @@
+#include <unity.h>
+#include <ParsedPacket.h>
+#include <ArduinoJson.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// GroupState and the formatters can't be built for the native environment:
+// they reach Settings, the file system and WiFi through PacketFormatter.h.
+// The patches below do the same lookups, in the same order, as
+// GroupState::patch(JsonObject) and GroupState::patch(const ParsedPacket&),
+// on a stand-in for the state.  The device benchmark
+// (test_benchmark_parsed_packet) runs the real ones.
+
+static const size_t ITERATIONS = 200000;
+
+static volatile uint32_t sink;
+
+// What a formatter parses out of the packets a remote sends most: on/off,
+// brightness, color temperature, hue and a relative command
+static void parseTyped(size_t ix, ParsedPacket& result) {
+  switch (ix % 5) {
+    case 0: result.setState(true); break;
+    case 1: result.setBrightness(40 + (ix & 0x1F)); break;
+    case 2: result.setColorTemp(153 + (ix & 0xFF)); break;
+    case 3: result.setHue(ix % 360); break;
+    case 4: result.setCommand(PacketCommand::BRIGHTNESS_UP); break;
+  }
+}
+
+// Same packets as formatters used to write them into JSON
+static void parseJson(size_t ix, JsonObject result) {
+  switch (ix % 5) {
+    case 0: result["state"] = "ON"; break;
+    case 1: result["brightness"] = (uint8_t)(40 + (ix & 0x1F)); break;
+    case 2: result["color_temp"] = (uint16_t)(153 + (ix & 0xFF)); break;
+    case 3: result["hue"] = (uint16_t)(ix % 360); break;
+    case 4: result["command"] = "brightness_up"; break;
+  }
+}
+
+// Stand-in for GroupState.  Only the lookups differ between the two paths.
+struct State {
+  bool on;
+  uint8_t brightness;
+  uint16_t hue;
+  uint8_t saturation;
+  uint8_t mode;
+  uint16_t mireds;
+};
+
+static void patchTyped(State& state, const ParsedPacket& packet) {
+  if (packet.has(ParsedPacket::STATE)) {
+    state.on = packet.on;
+  }
+  if (packet.has(ParsedPacket::BRIGHTNESS)) {
+    state.brightness = packet.brightness;
+  }
+  if (packet.has(ParsedPacket::HUE)) {
+    state.hue = packet.hue;
+  }
+  if (packet.has(ParsedPacket::SATURATION)) {
+    state.saturation = packet.saturation;
+  }
+  if (packet.has(ParsedPacket::MODE)) {
+    state.mode = packet.mode;
+  }
+  if (packet.has(ParsedPacket::COLOR_TEMP)) {
+    state.mireds = packet.colorTemp;
+  }
+  if (packet.has(ParsedPacket::COMMAND)) {
+    switch (packet.command) {
+      case PacketCommand::SET_WHITE: state.mode = 0; break;
+      case PacketCommand::NIGHT_MODE: state.mode = 1; break;
+      case PacketCommand::BRIGHTNESS_UP: ++state.brightness; break;
+      case PacketCommand::BRIGHTNESS_DOWN: --state.brightness; break;
+      default: break;
+    }
+  }
+}
+
+// Mirrors GroupState::patch(JsonObject)
+static void patchJson(State& state, JsonObject packet) {
+  if (packet.containsKey("state")) {
+    state.on = packet["state"] == "ON";
+  }
+  if (packet.containsKey("brightness")) {
+    state.brightness = packet["brightness"].as<uint8_t>();
+  }
+  if (packet.containsKey("hue")) {
+    state.hue = packet["hue"].as<uint16_t>();
+  }
+  if (packet.containsKey("saturation")) {
+    state.saturation = packet["saturation"].as<uint8_t>();
+  }
+  if (packet.containsKey("mode")) {
+    state.mode = packet["mode"].as<uint8_t>();
+  }
+  if (packet.containsKey("color_temp")) {
+    state.mireds = packet["color_temp"].as<uint16_t>();
+  }
+  // GroupState copies the command into a String, and compares it against
+  // each command name in turn
+  if (packet.containsKey("command")) {
+    const std::string command = packet["command"].as<const char*>();
+
+    if (command == "set_white") {
+      state.mode = 0;
+    } else if (command == "night_mode") {
+      state.mode = 1;
+    } else if (command == "brightness_up") {
+      ++state.brightness;
+    } else if (command == "brightness_down") {
+      --state.brightness;
+    }
+  }
+}
+
+// Mirrors PacketFormatter::toJson for the fields used here
+static void toJson(const ParsedPacket& packet, JsonObject result) {
+  if (packet.has(ParsedPacket::STATE)) {
+    result["state"] = packet.on ? "ON" : "OFF";
+  }
+  if (packet.has(ParsedPacket::BRIGHTNESS)) {
+    result["brightness"] = packet.brightness;
+  }
+  if (packet.has(ParsedPacket::HUE)) {
+    result["hue"] = packet.hue;
+  }
+  if (packet.has(ParsedPacket::COLOR_TEMP)) {
+    result["color_temp"] = packet.colorTemp;
+  }
+  if (packet.hasCommand(PacketCommand::BRIGHTNESS_UP)) {
+    result["command"] = "brightness_up";
+  }
+}
+
+// Per-packet cost of the old path: parse into JSON, patch state from it, and
+// serialize it if publish is set
+static double jsonNsPerPacket(bool publish) {
+  State state = State();
+  char output[200];
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    StaticJsonDocument<200> buffer;
+    JsonObject result = buffer.to<JsonObject>();
+
+    parseJson(i, result);
+    patchJson(state, result);
+
+    if (publish) {
+      sink += serializeJson(result, output, sizeof(output));
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  sink += state.brightness + state.mireds + state.hue;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / ITERATIONS;
+}
+
+// Same for the typed path.  JSON is only built when publishing.
+static double typedNsPerPacket(bool publish) {
+  State state = State();
+  char output[200];
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    ParsedPacket result;
+
+    parseTyped(i, result);
+    patchTyped(state, result);
+
+    if (publish) {
+      StaticJsonDocument<200> buffer;
+      toJson(result, buffer.to<JsonObject>());
+      sink += serializeJson(buffer, output, sizeof(output));
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  sink += state.brightness + state.mireds + state.hue;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / ITERATIONS;
+}
+
+void test_starts_empty() {
+  ParsedPacket packet;
+
+  TEST_ASSERT_EQUAL(0, packet.fields);
+  TEST_ASSERT_FALSE(packet.has(ParsedPacket::STATE));
+  TEST_ASSERT_FALSE(packet.hasCommand(PacketCommand::NONE));
+}
+
+void test_setters_mark_fields() {
+  ParsedPacket packet;
+
+  packet.setBrightness(42);
+  packet.setColorTemp(370);
+
+  TEST_ASSERT_TRUE(packet.has(ParsedPacket::BRIGHTNESS));
+  TEST_ASSERT_TRUE(packet.has(ParsedPacket::COLOR_TEMP));
+  TEST_ASSERT_FALSE(packet.has(ParsedPacket::HUE));
+  TEST_ASSERT_FALSE(packet.has(ParsedPacket::COMMAND));
+  TEST_ASSERT_EQUAL(42, packet.brightness);
+  TEST_ASSERT_EQUAL(370, packet.colorTemp);
+
+  // OFF is a value like any other
+  packet.setState(false);
+  TEST_ASSERT_TRUE(packet.has(ParsedPacket::STATE));
+  TEST_ASSERT_FALSE(packet.on);
+}
+
+void test_has_command() {
+  ParsedPacket packet;
+
+  packet.setCommand(PacketCommand::NIGHT_MODE);
+
+  TEST_ASSERT_TRUE(packet.hasCommand(PacketCommand::NIGHT_MODE));
+  TEST_ASSERT_FALSE(packet.hasCommand(PacketCommand::SET_WHITE));
+}
+
+void test_typed_patch_matches_json() {
+  State typed = State();
+  State json = State();
+
+  for (size_t i = 0; i < 1000; i++) {
+    ParsedPacket packet;
+    parseTyped(i, packet);
+    patchTyped(typed, packet);
+
+    StaticJsonDocument<200> buffer;
+    JsonObject result = buffer.to<JsonObject>();
+    parseJson(i, result);
+    patchJson(json, result);
+  }
+
+  TEST_ASSERT_EQUAL(json.on, typed.on);
+  TEST_ASSERT_EQUAL(json.brightness, typed.brightness);
+  TEST_ASSERT_EQUAL(json.hue, typed.hue);
+  TEST_ASSERT_EQUAL(json.mireds, typed.mireds);
+}
+
+void test_to_json_matches_json() {
+  for (size_t i = 0; i < 5; i++) {
+    char typedOutput[200];
+    char jsonOutput[200];
+
+    ParsedPacket packet;
+    parseTyped(i, packet);
+    StaticJsonDocument<200> typedBuffer;
+    toJson(packet, typedBuffer.to<JsonObject>());
+    serializeJson(typedBuffer, typedOutput, sizeof(typedOutput));
+
+    StaticJsonDocument<200> jsonBuffer;
+    parseJson(i, jsonBuffer.to<JsonObject>());
+    serializeJson(jsonBuffer, jsonOutput, sizeof(jsonOutput));
+
+    TEST_ASSERT_EQUAL_STRING(jsonOutput, typedOutput);
+  }
+}
+
+void test_benchmark_patch() {
+  double beforeNs = jsonNsPerPacket(false);
+  double afterNs = typedNsPerPacket(false);
+
+  char message[160];
+  snprintf(message, sizeof(message), "Parse and patch per packet: %.0f ns through JSON, %.0f ns typed", beforeNs, afterNs);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_TRUE_MESSAGE(afterNs < beforeNs, "Patching from the typed packet should be cheaper");
+}
+
+void test_benchmark_patch_and_publish() {
+  double beforeNs = jsonNsPerPacket(true);
+  double afterNs = typedNsPerPacket(true);
+
+  char message[160];
+  snprintf(message, sizeof(message), "Parse, patch and serialize per packet: %.0f ns through JSON, %.0f ns typed", beforeNs, afterNs);
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_starts_empty);
+  RUN_TEST(test_setters_mark_fields);
+  RUN_TEST(test_has_command);
+  RUN_TEST(test_typed_patch_matches_json);
+  RUN_TEST(test_to_json_matches_json);
+
+  RUN_TEST(test_benchmark_patch);
+  RUN_TEST(test_benchmark_patch_and_publish);
+
+  return UNITY_END();
+}
@@ -0,0 +1,248 @@
+#include <unity.h>
+#include <PL1167Codec.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+// A length-prefixed rgb_cct packet, as passed to PL1167_nRF24::transmit
+static const uint8_t RGB_CCT_PACKET[] = { 0x09, 0x20, 0x8E, 0xA5, 0x2B, 0x3C, 0x15, 0xC5, 0x8A, 0x9D };
+
+// Same parameters as a command sent with the default settings
+static const size_t REPEATS = 50;
+static const size_t CHANNELS = 3;
+static const size_t ITERATIONS = 2000;
+static const size_t MAX_FRAME_LENGTH = 32;
+
+static volatile uint8_t sink;
+
+// Bit at a time implementations the lookup tables replaced.  Used to check the
+// tables and as the baseline for the benchmarks.
+static uint16_t referenceCrc(const uint8_t* data, size_t length) {
+  uint16_t state = 0;
+  for (size_t i = 0; i < length; i++) {
+    uint8_t byte = data[i];
+    for (int j = 0; j < 8; j++) {
+      if ((byte ^ state) & 0x01) {
+        state = (state >> 1) ^ 0x8408;
+      } else {
+        state = state >> 1;
+      }
+      byte = byte >> 1;
+    }
+  }
+  return state;
+}
+
+static uint8_t referenceReverseBits(uint8_t byte) {
+  uint8_t result = byte;
+  uint8_t i = 7;
+
+  for (byte >>= 1; byte; byte >>= 1) {
+    result <<= 1;
+    result |= byte & 1;
+    --i;
+  }
+
+  return result << i;
+}
+
+static size_t referenceEncode(const uint8_t* data, size_t length, uint8_t* out) {
+  uint16_t crc = referenceCrc(data, length);
+
+  for (size_t i = 0; i < length; i++) {
+    out[i] = referenceReverseBits(data[i]);
+  }
+  out[length] = referenceReverseBits(crc & 0xFF);
+  out[length + 1] = referenceReverseBits(crc >> 8);
+
+  return length + PL1167_FRAME_OVERHEAD;
+}
+
+typedef size_t (*EncodeFn)(const uint8_t* data, size_t length, uint8_t* out);
+
+static size_t wordwiseEncode(const uint8_t* data, size_t length, uint8_t* out) {
+  uint16_t crc = PL1167Codec::crc(data, length);
+
+  PL1167Codec::reverseBytesWordwise(data, out, length);
+  out[length] = PL1167Codec::reverseBits(crc & 0xFF);
+  out[length + 1] = PL1167Codec::reverseBits(crc >> 8);
+
+  return length + PL1167_FRAME_OVERHEAD;
+}
+
+static double nsPerFrame(EncodeFn encode, const uint8_t* packet, size_t length) {
+  uint8_t out[MAX_FRAME_LENGTH];
+  const size_t frames = 200000;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < frames; i++) {
+    encode(packet, length, out);
+    sink = out[i % length];
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  return std::chrono::duration<double, std::nano>(elapsed).count() / frames;
+}
+
+void test_crc() {
+  // CRC-16/KERMIT check value (poly 0x8408, init 0, reflected)
+  const uint8_t check[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+  TEST_ASSERT_EQUAL_HEX16(0x2189, PL1167Codec::crc(check, sizeof(check)));
+  TEST_ASSERT_EQUAL_HEX16(0, PL1167Codec::crc(check, 0));
+
+  uint8_t data[MAX_FRAME_LENGTH];
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = i * 37 + 11;
+  }
+
+  for (size_t length = 0; length <= sizeof(data); length++) {
+    TEST_ASSERT_EQUAL_HEX16(referenceCrc(data, length), PL1167Codec::crc(data, length));
+  }
+}
+
+void test_reverse_bits() {
+  for (int i = 0; i < 256; i++) {
+    uint8_t expected = 0;
+    for (int bit = 0; bit < 8; bit++) {
+      if (i & (1 << bit)) {
+        expected |= 0x80 >> bit;
+      }
+    }
+    TEST_ASSERT_EQUAL_HEX8(expected, PL1167Codec::reverseBits(i));
+    TEST_ASSERT_EQUAL_HEX8(expected, referenceReverseBits(i));
+  }
+
+  // Every length so both the word loop and the tail are covered
+  uint8_t data[MAX_FRAME_LENGTH];
+  uint8_t table[MAX_FRAME_LENGTH];
+  uint8_t wordwise[MAX_FRAME_LENGTH];
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = i * 53 + 7;
+  }
+
+  for (size_t length = 0; length <= sizeof(data); length++) {
+    PL1167Codec::reverseBytes(data, table, length);
+    PL1167Codec::reverseBytesWordwise(data, wordwise, length);
+
+    for (size_t i = 0; i < length; i++) {
+      TEST_ASSERT_EQUAL_HEX8(referenceReverseBits(data[i]), table[i]);
+      TEST_ASSERT_EQUAL_HEX8(referenceReverseBits(data[i]), wordwise[i]);
+    }
+  }
+}
+
+void test_encode() {
+  uint8_t out[sizeof(RGB_CCT_PACKET) + PL1167_FRAME_OVERHEAD];
+  size_t length = PL1167Codec::encode(RGB_CCT_PACKET, sizeof(RGB_CCT_PACKET), out);
+
+  TEST_ASSERT_EQUAL(sizeof(RGB_CCT_PACKET) + PL1167_FRAME_OVERHEAD, length);
+
+  for (size_t i = 0; i < sizeof(RGB_CCT_PACKET); i++) {
+    TEST_ASSERT_EQUAL_HEX8(PL1167Codec::reverseBits(RGB_CCT_PACKET[i]), out[i]);
+  }
+
+  uint16_t crc = PL1167Codec::crc(RGB_CCT_PACKET, sizeof(RGB_CCT_PACKET));
+  TEST_ASSERT_EQUAL_HEX8(PL1167Codec::reverseBits(crc & 0xFF), out[length - 2]);
+  TEST_ASSERT_EQUAL_HEX8(PL1167Codec::reverseBits(crc >> 8), out[length - 1]);
+
+  uint8_t reference[sizeof(out)];
+  referenceEncode(RGB_CCT_PACKET, sizeof(RGB_CCT_PACKET), reference);
+  TEST_ASSERT_EQUAL_MEMORY(reference, out, length);
+}
+
+void test_decode() {
+  uint8_t frame[sizeof(RGB_CCT_PACKET) + PL1167_FRAME_OVERHEAD];
+  size_t length = PL1167Codec::encode(RGB_CCT_PACKET, sizeof(RGB_CCT_PACKET), frame);
+
+  uint8_t decoded[sizeof(frame)];
+  TEST_ASSERT_EQUAL(sizeof(RGB_CCT_PACKET), PL1167Codec::decode(frame, length, decoded));
+  TEST_ASSERT_EQUAL_MEMORY(RGB_CCT_PACKET, decoded, sizeof(RGB_CCT_PACKET));
+
+  // Decoding in place is how the nRF24 receive path uses it
+  TEST_ASSERT_EQUAL(sizeof(RGB_CCT_PACKET), PL1167Codec::decode(frame, length, frame));
+  TEST_ASSERT_EQUAL_MEMORY(RGB_CCT_PACKET, frame, sizeof(RGB_CCT_PACKET));
+
+  PL1167Codec::encode(RGB_CCT_PACKET, sizeof(RGB_CCT_PACKET), frame);
+  frame[3] ^= 0x10;
+  TEST_ASSERT_EQUAL_MESSAGE(-1, PL1167Codec::decode(frame, length, decoded), "Should reject a corrupted frame");
+  TEST_ASSERT_EQUAL(-1, PL1167Codec::decode(frame, 1, decoded));
+}
+
+// ns per frame to encode 7 byte (rgbw, cct, rgb) and 9 byte (rgb_cct, fut089,
+// fut091) packets, plus the length byte the nRF24 path adds
+void test_benchmark_frame_encoding() {
+  uint8_t packet[MAX_FRAME_LENGTH];
+  for (size_t i = 0; i < sizeof(packet); i++) {
+    packet[i] = i * 29 + 3;
+  }
+
+  const size_t lengths[] = { 7 + 1, 9 + 1 };
+  for (size_t length : lengths) {
+    char message[160];
+    snprintf(
+      message,
+      sizeof(message),
+      "%zu byte packet: bitwise %.1f ns/frame, table %.1f ns/frame, table + word reversal %.1f ns/frame",
+      length - 1,
+      nsPerFrame(referenceEncode, packet, length),
+      nsPerFrame(PL1167Codec::encode, packet, length),
+      nsPerFrame(wordwiseEncode, packet, length)
+    );
+    TEST_MESSAGE(message);
+  }
+
+  TEST_ASSERT_TRUE_MESSAGE(
+    nsPerFrame(PL1167Codec::encode, packet, 10) < nsPerFrame(referenceEncode, packet, 10),
+    "Table driven encoding should beat the bitwise version"
+  );
+}
+
+// Compares encoding every repeat on every channel (what transmit() used to do)
+// with encoding once and only copying the frame out for each transmission.
+void test_benchmark_encode_once() {
+  uint8_t out[sizeof(RGB_CCT_PACKET) + PL1167_FRAME_OVERHEAD];
+  uint8_t spiBuffer[sizeof(out)];
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    for (size_t r = 0; r < REPEATS * CHANNELS; r++) {
+      size_t length = PL1167Codec::encode(RGB_CCT_PACKET, sizeof(RGB_CCT_PACKET), out);
+      memcpy(spiBuffer, out, length);
+      sink = spiBuffer[r % length];
+    }
+  }
+  auto perRepeat = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < ITERATIONS; i++) {
+    size_t length = PL1167Codec::encode(RGB_CCT_PACKET, sizeof(RGB_CCT_PACKET), out);
+    for (size_t r = 0; r < REPEATS * CHANNELS; r++) {
+      memcpy(spiBuffer, out, length);
+      sink = spiBuffer[r % length];
+    }
+  }
+  auto once = std::chrono::steady_clock::now() - start;
+
+  double beforeNs = std::chrono::duration<double, std::nano>(perRepeat).count() / ITERATIONS;
+  double afterNs = std::chrono::duration<double, std::nano>(once).count() / ITERATIONS;
+
+  char message[128];
+  snprintf(message, sizeof(message), "Encoding per command: %.0f ns encoding every repeat, %.0f ns encoding once", beforeNs, afterNs);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_TRUE_MESSAGE(afterNs < beforeNs, "Encoding once should be cheaper");
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_crc);
+  RUN_TEST(test_reverse_bits);
+  RUN_TEST(test_encode);
+  RUN_TEST(test_decode);
+  RUN_TEST(test_benchmark_frame_encoding);
+  RUN_TEST(test_benchmark_encode_once);
+
+  return UNITY_END();
+}
@@ -0,0 +1,137 @@
+#include <unity.h>
+#include <RadioRouter.h>
+
+// Radio config indexes, as in MiLightRadioConfig::ALL_CONFIGS
+static const size_t RGBW = 0;
+static const size_t CCT = 1;
+static const size_t RGB_CCT = 2;
+static const size_t RGB = 3;
+
+static RadioModuleSpec module(RadioRole role, uint32_t pinnedConfigs = 0) {
+  RadioModuleSpec spec;
+  spec.role = role;
+  spec.pinnedConfigs = pinnedConfigs;
+  return spec;
+}
+
+// Picks a module to send with and records that it's tuned, like RadioSwitchboard
+static size_t send(RadioRouter& router, size_t configIx) {
+  size_t module = router.transmitterFor(configIx);
+
+  if (module != RadioRouter::NONE) {
+    router.tune(module, configIx);
+  }
+
+  return module;
+}
+
+void test_single_module() {
+  RadioRouter router;
+  router.addModule(module(RadioRole::BOTH));
+
+  TEST_ASSERT_EQUAL(0, router.transmitterFor(RGBW));
+  TEST_ASSERT_EQUAL(0, router.receiver());
+  TEST_ASSERT_FALSE(router.hasDedicatedReceiver());
+
+  TEST_ASSERT_TRUE_MESSAGE(router.tune(0, RGBW), "Should need configuring the first time");
+  TEST_ASSERT_FALSE_MESSAGE(router.tune(0, RGBW), "Should not reconfigure for the config it's tuned to");
+  TEST_ASSERT_TRUE(router.tune(0, CCT));
+  TEST_ASSERT_EQUAL(CCT, router.tunedConfig(0));
+}
+
+void test_dedicated_receiver() {
+  RadioRouter router;
+  router.addModule(module(RadioRole::RX));
+  router.addModule(module(RadioRole::TX));
+
+  TEST_ASSERT_TRUE(router.hasDedicatedReceiver());
+  TEST_ASSERT_EQUAL(0, router.receiver());
+  router.tune(0, RGB);
+
+  TEST_ASSERT_EQUAL_MESSAGE(1, send(router, RGB), "Receiver should never send, even on the config it's tuned to");
+  TEST_ASSERT_EQUAL(1, send(router, RGB_CCT));
+  TEST_ASSERT_EQUAL_MESSAGE(RGB, router.tunedConfig(0), "Sending shouldn't retune the receiver");
+}
+
+void test_pinned_transmitters() {
+  RadioRouter router;
+  router.addModule(module(RadioRole::RX));
+  router.addModule(module(RadioRole::TX, 1 << RGB_CCT));
+  router.addModule(module(RadioRole::TX));
+
+  for (uint8_t i = 0; i < 10; i++) {
+    TEST_ASSERT_EQUAL(1, send(router, RGB_CCT));
+    TEST_ASSERT_EQUAL_MESSAGE(2, send(router, RGBW), "Other traffic shouldn't use the pinned module");
+  }
+
+  TEST_ASSERT_FALSE_MESSAGE(router.tune(1, RGB_CCT), "Pinned module should stay tuned");
+}
+
+void test_unroutable_config() {
+  RadioRouter router;
+  router.addModule(module(RadioRole::RX));
+  router.addModule(module(RadioRole::TX, 1 << RGBW));
+
+  TEST_ASSERT_EQUAL(1, router.transmitterFor(RGBW));
+  TEST_ASSERT_EQUAL_MESSAGE(RadioRouter::NONE, router.transmitterFor(CCT), "Nothing can send configs no module is pinned to");
+
+  RadioRouter empty;
+  TEST_ASSERT_EQUAL(RadioRouter::NONE, empty.transmitterFor(RGBW));
+  TEST_ASSERT_EQUAL(RadioRouter::NONE, empty.receiver());
+  TEST_ASSERT_FALSE(empty.hasDedicatedReceiver());
+}
+
+void test_prefers_tx_only_transmitters() {
+  RadioRouter router;
+  router.addModule(module(RadioRole::BOTH));
+  router.addModule(module(RadioRole::TX));
+
+  TEST_ASSERT_EQUAL_MESSAGE(1, router.transmitterFor(RGBW), "TX only modules are used before shared ones");
+
+  // Even when the shared module happens to be listening on the right config
+  router.tune(0, CCT);
+  TEST_ASSERT_EQUAL(1, router.transmitterFor(CCT));
+  TEST_ASSERT_EQUAL(0, router.receiver());
+
+  // Without TX only modules, one already tuned to the config is best
+  RadioRouter shared;
+  shared.addModule(module(RadioRole::BOTH));
+  shared.addModule(module(RadioRole::BOTH));
+  shared.tune(1, CCT);
+  TEST_ASSERT_EQUAL(1, shared.transmitterFor(CCT));
+  TEST_ASSERT_EQUAL(0, shared.transmitterFor(RGBW));
+}
+
+void test_spreads_over_transmitters() {
+  RadioRouter router;
+  router.addModule(module(RadioRole::RX));
+  router.addModule(module(RadioRole::TX));
+  router.addModule(module(RadioRole::TX));
+
+  TEST_ASSERT_EQUAL(1, send(router, RGBW));
+  TEST_ASSERT_EQUAL_MESSAGE(2, send(router, CCT), "Should use an idle module rather than retune a busy one");
+
+  // Both stay put while traffic alternates
+  for (uint8_t i = 0; i < 5; i++) {
+    TEST_ASSERT_EQUAL(1, send(router, RGBW));
+    TEST_ASSERT_EQUAL(2, send(router, CCT));
+  }
+
+  // A third config takes the module retuned least recently
+  TEST_ASSERT_EQUAL(1, send(router, RGB));
+  TEST_ASSERT_EQUAL(2, send(router, CCT));
+  TEST_ASSERT_EQUAL(2, send(router, RGB_CCT));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_single_module);
+  RUN_TEST(test_dedicated_receiver);
+  RUN_TEST(test_pinned_transmitters);
+  RUN_TEST(test_unroutable_config);
+  RUN_TEST(test_prefers_tx_only_transmitters);
+  RUN_TEST(test_spreads_over_transmitters);
+
+  return UNITY_END();
+}
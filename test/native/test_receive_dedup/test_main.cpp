@@ -0,0 +1,97 @@
+#include <unity.h>
+#include <ReceiveDedup.h>
+
+static const unsigned long WINDOW = 500;
+
+static const uint8_t PRESS_A[] = { 0xB0, 0x12, 0x34, 0x00, 0x01, 0x03, 0x21 };
+// Same button pressed again: only the sequence number differs
+static const uint8_t PRESS_A_AGAIN[] = { 0xB0, 0x12, 0x34, 0x00, 0x01, 0x03, 0x22 };
+static const uint8_t PRESS_B[] = { 0xB0, 0x56, 0x78, 0x00, 0x01, 0x03, 0x21 };
+
+static uint32_t key(const uint8_t* packet, uint8_t remoteType = 0) {
+  return ReceiveDedup::keyFor(remoteType, packet, sizeof(PRESS_A));
+}
+
+void test_repeats_are_dropped() {
+  ReceiveDedup dedup(WINDOW);
+  unsigned long now = 1000;
+
+  TEST_ASSERT_FALSE(dedup.isDuplicate(key(PRESS_A), now));
+  TEST_ASSERT_TRUE(dedup.isDuplicate(key(PRESS_A), now + 10));
+  TEST_ASSERT_TRUE(dedup.isDuplicate(key(PRESS_A), now + 20));
+
+  TEST_ASSERT_EQUAL(3, dedup.getPacketCount());
+  TEST_ASSERT_EQUAL(2, dedup.getDuplicateCount());
+}
+
+void test_interleaved_remotes() {
+  ReceiveDedup dedup(WINDOW);
+  unsigned long now = 1000;
+
+  TEST_ASSERT_FALSE(dedup.isDuplicate(key(PRESS_A), now));
+  TEST_ASSERT_FALSE(dedup.isDuplicate(key(PRESS_B), now + 5));
+  TEST_ASSERT_TRUE(dedup.isDuplicate(key(PRESS_A), now + 10));
+  TEST_ASSERT_TRUE(dedup.isDuplicate(key(PRESS_B), now + 15));
+}
+
+void test_new_press_isnt_a_duplicate() {
+  ReceiveDedup dedup(WINDOW);
+  unsigned long now = 1000;
+
+  TEST_ASSERT_FALSE(dedup.isDuplicate(key(PRESS_A), now));
+  TEST_ASSERT_FALSE(dedup.isDuplicate(key(PRESS_A_AGAIN), now + 10));
+  TEST_ASSERT_FALSE_MESSAGE(
+    dedup.isDuplicate(key(PRESS_A, 1), now + 20),
+    "Same bytes from another remote type are a different packet"
+  );
+}
+
+void test_window_restarts_on_repeat() {
+  ReceiveDedup dedup(WINDOW);
+  unsigned long now = 1000;
+
+  TEST_ASSERT_FALSE(dedup.isDuplicate(key(PRESS_A), now));
+
+  // A burst longer than the window is still one packet
+  for (unsigned long t = now + 100; t < now + 3 * WINDOW; t += 100) {
+    TEST_ASSERT_TRUE(dedup.isDuplicate(key(PRESS_A), t));
+  }
+
+  TEST_ASSERT_FALSE(dedup.isDuplicate(key(PRESS_A), now + 4 * WINDOW));
+}
+
+void test_evicts_oldest() {
+  ReceiveDedup dedup(WINDOW);
+  unsigned long now = 1000;
+
+  for (uint32_t k = 0; k < RECEIVE_DEDUP_MAX_ENTRIES; ++k) {
+    dedup.isDuplicate(k, now + k);
+  }
+
+  // Key 0 is the oldest, so this replaces it
+  TEST_ASSERT_FALSE(dedup.isDuplicate(1000, now + 100));
+
+  TEST_ASSERT_FALSE(dedup.isDuplicate(0, now + 101));
+  TEST_ASSERT_TRUE(dedup.isDuplicate(RECEIVE_DEDUP_MAX_ENTRIES - 1, now + 102));
+}
+
+void test_handles_clock_wrap() {
+  ReceiveDedup dedup(WINDOW);
+  unsigned long now = static_cast<unsigned long>(-100);
+
+  TEST_ASSERT_FALSE(dedup.isDuplicate(key(PRESS_A), now));
+  TEST_ASSERT_TRUE(dedup.isDuplicate(key(PRESS_A), now + 200));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_repeats_are_dropped);
+  RUN_TEST(test_interleaved_remotes);
+  RUN_TEST(test_new_press_isnt_a_duplicate);
+  RUN_TEST(test_window_restarts_on_repeat);
+  RUN_TEST(test_evicts_oldest);
+  RUN_TEST(test_handles_clock_wrap);
+
+  return UNITY_END();
+}
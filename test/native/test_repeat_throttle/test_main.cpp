@@ -0,0 +1,80 @@
+#include <unity.h>
+#include <RepeatThrottle.h>
+
+// Default settings, except sensitivity.  It defaults to 0, which turns
+// throttling off.
+static const size_t MAX_REPEATS = 50;
+static const size_t MIN_REPEATS = 3;
+static const unsigned long THRESHOLD = 200;
+static const size_t MULTIPLIER = 1;
+
+static const uint32_t BULB_A = 0x07011234;
+static const uint32_t BULB_B = 0x07025678;
+
+void test_new_bulb_gets_full_repeats() {
+  RepeatThrottle throttle(MAX_REPEATS, MIN_REPEATS, THRESHOLD, MULTIPLIER);
+
+  TEST_ASSERT_EQUAL(MAX_REPEATS, throttle.repeatsFor(BULB_A));
+  TEST_ASSERT_EQUAL(MAX_REPEATS, throttle.recordSend(BULB_A, 1000));
+  TEST_ASSERT_EQUAL(1, throttle.size());
+}
+
+void test_burst_only_throttles_its_bulb() {
+  RepeatThrottle throttle(MAX_REPEATS, MIN_REPEATS, THRESHOLD, MULTIPLIER);
+  unsigned long now = 1000;
+
+  // Dimming bulb A, a command every 20ms
+  for (size_t i = 0; i < 20; i++) {
+    throttle.recordSend(BULB_A, now);
+    now += 20;
+  }
+
+  TEST_ASSERT_EQUAL_MESSAGE(MIN_REPEATS, throttle.repeatsFor(BULB_A), "Burst should bring bulb A down to the minimum");
+  TEST_ASSERT_EQUAL_MESSAGE(MAX_REPEATS, throttle.repeatsFor(BULB_B), "Bulb B shouldn't be affected");
+  TEST_ASSERT_EQUAL(MAX_REPEATS, throttle.recordSend(BULB_B, now));
+
+  // Bulb A recovers once it's left alone
+  TEST_ASSERT_EQUAL(MAX_REPEATS, throttle.recordSend(BULB_A, now + 1000));
+}
+
+void test_long_gap_doesnt_overflow() {
+  RepeatThrottle throttle(MAX_REPEATS, MIN_REPEATS, THRESHOLD, 1000);
+
+  throttle.recordSend(BULB_A, 0);
+  throttle.recordSend(BULB_A, 10);
+  TEST_ASSERT_EQUAL(MIN_REPEATS, throttle.repeatsFor(BULB_A));
+
+  TEST_ASSERT_EQUAL(MAX_REPEATS, throttle.recordSend(BULB_A, 4000000000UL));
+}
+
+void test_evicts_least_recently_used() {
+  RepeatThrottle throttle(MAX_REPEATS, MIN_REPEATS, THRESHOLD, MULTIPLIER);
+  unsigned long now = 1000;
+
+  for (uint32_t key = 0; key < REPEAT_THROTTLE_MAX_ENTRIES; key++) {
+    throttle.recordSend(key, now);
+    throttle.recordSend(key, now + 1);
+  }
+  TEST_ASSERT_EQUAL(REPEAT_THROTTLE_MAX_ENTRIES, throttle.size());
+
+  // Use key 0 again so key 1 is now the oldest
+  throttle.recordSend(0, now + 2);
+  throttle.recordSend(BULB_A, now + 3);
+
+  TEST_ASSERT_EQUAL(REPEAT_THROTTLE_MAX_ENTRIES, throttle.size());
+  TEST_ASSERT_EQUAL(1, throttle.getEvictionCount());
+  TEST_ASSERT_EQUAL_MESSAGE(MAX_REPEATS, throttle.repeatsFor(1), "Evicted bulb should go back to full repeats");
+  TEST_ASSERT_TRUE(throttle.repeatsFor(0) < MAX_REPEATS);
+  TEST_ASSERT_TRUE(throttle.repeatsFor(2) < MAX_REPEATS);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_new_bulb_gets_full_repeats);
+  RUN_TEST(test_burst_only_throttles_its_bulb);
+  RUN_TEST(test_long_gap_doesnt_overflow);
+  RUN_TEST(test_evicts_least_recently_used);
+
+  return UNITY_END();
+}
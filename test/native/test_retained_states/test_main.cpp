@@ -0,0 +1,165 @@
+#include <unity.h>
+#include <RetainedStates.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+// Retained memory isn't initialized, so start from garbage
+static void fill(RetainedStates& retained, uint8_t value) {
+  memset(&retained, value, sizeof(retained));
+}
+
+static void makeRecord(uint8_t seed, uint8_t* record, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    record[i] = seed * 31 + i;
+  }
+}
+
+void test_garbage_is_invalid() {
+  RetainedStates retained;
+
+  fill(retained, 0x00);
+  TEST_ASSERT_FALSE(retained.isValid());
+
+  fill(retained, 0xFF);
+  TEST_ASSERT_FALSE(retained.isValid());
+
+  fill(retained, 0xA5);
+  TEST_ASSERT_FALSE(retained.isValid());
+}
+
+void test_sealed_records_survive() {
+  RetainedStates retained;
+  uint8_t record[75];
+
+  fill(retained, 0xA5);
+  retained.clear();
+
+  for (uint8_t i = 0; i < 4; i++) {
+    makeRecord(i, record, sizeof(record));
+    TEST_ASSERT_TRUE(retained.add(0x1000 + i, record, sizeof(record), i == 2));
+  }
+  retained.seal();
+
+  // Copying stands in for the restart
+  RetainedStates restored;
+  memcpy(&restored, &retained, sizeof(retained));
+
+  TEST_ASSERT_TRUE(restored.isValid());
+  TEST_ASSERT_EQUAL(4, restored.count);
+
+  for (uint8_t i = 0; i < 4; i++) {
+    makeRecord(i, record, sizeof(record));
+    TEST_ASSERT_EQUAL(0x1000 + i, restored.slots[i].key);
+    TEST_ASSERT_EQUAL(sizeof(record), restored.slots[i].length);
+    TEST_ASSERT_EQUAL(i == 2, restored.slots[i].dirty);
+    TEST_ASSERT_EQUAL_MEMORY(record, restored.slots[i].data, sizeof(record));
+  }
+}
+
+void test_unsealed_is_invalid() {
+  RetainedStates retained;
+  uint8_t record[8] = { 0 };
+
+  fill(retained, 0);
+  retained.clear();
+  retained.seal();
+  TEST_ASSERT_TRUE(retained.isValid());
+
+  // Restarting part way through saving
+  retained.clear();
+  retained.add(1, record, sizeof(record), false);
+  TEST_ASSERT_FALSE(retained.isValid());
+}
+
+void test_corruption_detected() {
+  RetainedStates retained;
+  uint8_t record[16];
+
+  makeRecord(7, record, sizeof(record));
+  retained.clear();
+  retained.add(1, record, sizeof(record), false);
+  retained.add(2, record, sizeof(record), true);
+  retained.seal();
+  TEST_ASSERT_TRUE(retained.isValid());
+
+  retained.slots[1].data[3] ^= 0x10;
+  TEST_ASSERT_FALSE(retained.isValid());
+
+  retained.slots[1].data[3] ^= 0x10;
+  retained.count = 0xFFFF;
+  TEST_ASSERT_FALSE(retained.isValid());
+}
+
+void test_invalidate() {
+  RetainedStates retained;
+  uint8_t record[8] = { 0 };
+
+  retained.clear();
+  retained.add(1, record, sizeof(record), false);
+  retained.seal();
+  retained.invalidate();
+
+  TEST_ASSERT_FALSE(retained.isValid());
+}
+
+void test_limits() {
+  RetainedStates retained;
+  uint8_t record[RETAINED_STATES_MAX_RECORD_LENGTH + 1] = { 0 };
+
+  retained.clear();
+  TEST_ASSERT_FALSE(retained.add(1, record, sizeof(record), false));
+
+  for (size_t i = 0; i < RETAINED_STATES_MAX_DEVICES; i++) {
+    TEST_ASSERT_TRUE(retained.add(i, record, RETAINED_STATES_MAX_RECORD_LENGTH, false));
+  }
+  TEST_ASSERT_FALSE(retained.add(99, record, 8, false));
+  TEST_ASSERT_EQUAL(RETAINED_STATES_MAX_DEVICES, retained.count);
+}
+
+// What a restart costs: sealing a full set of records before it, and
+// checking them after it.  Loading the same devices from flash reads a log
+// record for each one.
+void test_benchmark_seal_and_check() {
+  RetainedStates retained;
+  uint8_t record[75];
+  const size_t iterations = 10000;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    retained.clear();
+    for (size_t j = 0; j < RETAINED_STATES_MAX_DEVICES; j++) {
+      makeRecord(j, record, sizeof(record));
+      retained.add(j, record, sizeof(record), false);
+    }
+    retained.seal();
+    TEST_ASSERT_TRUE(retained.isValid());
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  char message[160];
+  snprintf(
+    message,
+    sizeof(message),
+    "%zu byte block, %d devices sealed and checked in %.1f us",
+    sizeof(RetainedStates),
+    RETAINED_STATES_MAX_DEVICES,
+    std::chrono::duration<double, std::micro>(elapsed).count() / iterations
+  );
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_garbage_is_invalid);
+  RUN_TEST(test_sealed_records_survive);
+  RUN_TEST(test_unsealed_is_invalid);
+  RUN_TEST(test_corruption_detected);
+  RUN_TEST(test_invalidate);
+  RUN_TEST(test_limits);
+  RUN_TEST(test_benchmark_seal_and_check);
+
+  return UNITY_END();
+}
@@ -0,0 +1,112 @@
+#include <unity.h>
+#include <SeqLock.h>
+
+#include <stdint.h>
+#include <thread>
+#include <atomic>
+
+// Odd size, so the last word is partly used
+struct Snapshot {
+  uint32_t version;
+  uint16_t values[13];
+  uint8_t check;
+};
+
+static uint8_t checksum(const Snapshot& snapshot) {
+  uint8_t sum = static_cast<uint8_t>(snapshot.version);
+  for (size_t i = 0; i < 13; i++) {
+    sum += static_cast<uint8_t>(snapshot.values[i]);
+  }
+  return sum;
+}
+
+static Snapshot snapshotFor(uint32_t version) {
+  Snapshot snapshot;
+  snapshot.version = version;
+  for (size_t i = 0; i < 13; i++) {
+    snapshot.values[i] = static_cast<uint16_t>(version * 7 + i);
+  }
+  snapshot.check = checksum(snapshot);
+  return snapshot;
+}
+
+void test_starts_zeroed() {
+  SeqLock<Snapshot> lock;
+  Snapshot snapshot = snapshotFor(5);
+
+  TEST_ASSERT_TRUE(lock.read(snapshot));
+  TEST_ASSERT_EQUAL(0, snapshot.version);
+  TEST_ASSERT_EQUAL(0, snapshot.values[12]);
+  TEST_ASSERT_EQUAL(0, lock.version());
+}
+
+void test_write_then_read() {
+  SeqLock<Snapshot> lock;
+  Snapshot snapshot;
+
+  for (uint32_t i = 1; i <= 3; i++) {
+    lock.write(snapshotFor(i));
+    TEST_ASSERT_TRUE(lock.read(snapshot));
+    TEST_ASSERT_EQUAL(i, snapshot.version);
+    TEST_ASSERT_EQUAL(checksum(snapshot), snapshot.check);
+  }
+
+  TEST_ASSERT_EQUAL(3, lock.version());
+}
+
+// One thread keeps publishing, another keeps reading.  Every successful read
+// should be a whole snapshot, and versions should never go backwards.
+void test_two_threads() {
+  static SeqLock<Snapshot> lock;
+  const uint32_t numWrites = 200000;
+  std::atomic<bool> done(false);
+  uint32_t reads = 0;
+  uint32_t torn = 0;
+  uint32_t backwards = 0;
+  uint32_t lastVersion = 0;
+
+  // So reads before the writer gets going see a whole snapshot too
+  lock.write(snapshotFor(0));
+
+  std::thread writer([&]() {
+    for (uint32_t i = 1; i <= numWrites; i++) {
+      lock.write(snapshotFor(i));
+    }
+    done = true;
+  });
+
+  while (!done || lastVersion < numWrites) {
+    Snapshot snapshot;
+
+    if (!lock.read(snapshot)) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    if (snapshot.check != checksum(snapshot) || snapshot.values[12] != static_cast<uint16_t>(snapshot.version * 7 + 12)) {
+      ++torn;
+    }
+    if (snapshot.version < lastVersion) {
+      ++backwards;
+    }
+    lastVersion = snapshot.version;
+    ++reads;
+  }
+
+  writer.join();
+
+  TEST_ASSERT_TRUE(reads > 0);
+  TEST_ASSERT_EQUAL(0, torn);
+  TEST_ASSERT_EQUAL(0, backwards);
+  TEST_ASSERT_EQUAL(numWrites, lastVersion);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_starts_zeroed);
+  RUN_TEST(test_write_then_read);
+  RUN_TEST(test_two_threads);
+
+  return UNITY_END();
+}
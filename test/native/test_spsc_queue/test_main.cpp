@@ -0,0 +1,218 @@
+#include <unity.h>
+#include <SpscQueue.h>
+#include <LatencyHistogram.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+struct Frame {
+  uint32_t sequence;
+  uint8_t payload[9];
+};
+
+void test_push_pop_in_order() {
+  SpscQueue<int, 4> queue;
+  int value = 0;
+
+  TEST_ASSERT_TRUE(queue.isEmpty());
+  TEST_ASSERT_FALSE(queue.pop(value));
+
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(queue.push(i));
+  }
+  TEST_ASSERT_FALSE_MESSAGE(queue.push(4), "Push should fail when full");
+  TEST_ASSERT_EQUAL(4, queue.size());
+
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(queue.pop(value));
+    TEST_ASSERT_EQUAL(i, value);
+  }
+  TEST_ASSERT_TRUE(queue.isEmpty());
+}
+
+void test_wraps_around() {
+  SpscQueue<int, 4> queue;
+  int value = 0;
+
+  for (int i = 0; i < 100; i++) {
+    TEST_ASSERT_TRUE(queue.push(i));
+    TEST_ASSERT_TRUE(queue.push(i + 1000));
+    TEST_ASSERT_TRUE(queue.pop(value));
+    TEST_ASSERT_EQUAL(i, value);
+    TEST_ASSERT_TRUE(queue.pop(value));
+    TEST_ASSERT_EQUAL(i + 1000, value);
+  }
+}
+
+void test_peek() {
+  SpscQueue<int, 4> queue;
+  int value = 0;
+
+  TEST_ASSERT_TRUE(queue.peek() == nullptr);
+
+  queue.push(1);
+  queue.push(2);
+  TEST_ASSERT_EQUAL(1, *queue.peek());
+  TEST_ASSERT_EQUAL_MESSAGE(2, queue.size(), "Peeking shouldn't remove anything");
+
+  TEST_ASSERT_TRUE(queue.pop(value));
+  TEST_ASSERT_EQUAL(2, *queue.peek());
+
+  TEST_ASSERT_TRUE(queue.pop());
+  TEST_ASSERT_TRUE(queue.peek() == nullptr);
+  TEST_ASSERT_FALSE(queue.pop());
+}
+
+// One thread pushes, another pops.  Everything pushed should come out once,
+// in order and intact.
+void test_two_threads() {
+  static SpscQueue<Frame, 16> queue;
+  const uint32_t numFrames = 200000;
+  uint32_t received = 0;
+  uint32_t corrupted = 0;
+  uint32_t outOfOrder = 0;
+
+  std::thread producer([&]() {
+    for (uint32_t i = 0; i < numFrames; i++) {
+      Frame frame;
+      frame.sequence = i;
+      for (size_t j = 0; j < sizeof(frame.payload); j++) {
+        frame.payload[j] = static_cast<uint8_t>(i + j);
+      }
+
+      while (!queue.push(frame)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  while (received < numFrames) {
+    Frame frame;
+
+    if (!queue.pop(frame)) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    if (frame.sequence != received) {
+      ++outOfOrder;
+    }
+    for (size_t j = 0; j < sizeof(frame.payload); j++) {
+      if (frame.payload[j] != static_cast<uint8_t>(frame.sequence + j)) {
+        ++corrupted;
+        break;
+      }
+    }
+    ++received;
+  }
+
+  producer.join();
+
+  TEST_ASSERT_EQUAL(0, outOfOrder);
+  TEST_ASSERT_EQUAL(0, corrupted);
+  TEST_ASSERT_TRUE(queue.isEmpty());
+}
+
+// Model of the main loop for the latency benchmark.  Each iteration takes one
+// command, then does the rest of its work: usually handling the request,
+// sometimes an MQTT publish, occasionally a state flush to flash.  Sending a
+// command keeps the radio busy for a while, but less than an iteration, so the
+// radio keeps up either way.
+static const size_t NUM_COMMANDS = 400;
+static const uint32_t SEND_MICROS = 1000;
+
+static uint32_t otherWorkMicros(size_t iteration) {
+  if (iteration % 40 == 39) {
+    return 25000;
+  } else if (iteration % 10 == 9) {
+    return 5000;
+  }
+  return 1500;
+}
+
+static std::chrono::steady_clock::time_point now() {
+  return std::chrono::steady_clock::now();
+}
+
+static uint32_t microsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(now() - start).count();
+}
+
+// Busy waits, sleeping isn't precise enough
+static void work(uint32_t micros) {
+  const auto start = now();
+  while (microsSince(start) < micros) { }
+}
+
+static void reportLatency(const char* name, const LatencyHistogram& latency) {
+  char message[160];
+  snprintf(
+    message, sizeof(message),
+    "%s: p50 %u us, p90 %u us, p99 %u us, max %u us",
+    name, latency.percentile(50), latency.percentile(90), latency.percentile(99), latency.getMax()
+  );
+  TEST_MESSAGE(message);
+}
+
+// Command to air latency with the radio in the main loop, against a radio task
+// fed through a queue.  The model only shows how much the rest of the loop
+// holds up sending; /about reports the real figures as command_to_air_us.
+void test_benchmark_command_to_air() {
+  LatencyHistogram inline_;
+  LatencyHistogram tasked;
+
+  for (size_t i = 0; i < NUM_COMMANDS; i++) {
+    const auto queuedAt = now();
+    work(otherWorkMicros(i));
+    work(SEND_MICROS);
+    inline_.add(microsSince(queuedAt));
+  }
+
+  static SpscQueue<std::chrono::steady_clock::time_point, 16> commands;
+  std::atomic<bool> done(false);
+
+  std::thread radio([&]() {
+    std::chrono::steady_clock::time_point queuedAt;
+
+    while (!done || !commands.isEmpty()) {
+      if (!commands.pop(queuedAt)) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      work(SEND_MICROS);
+      tasked.add(microsSince(queuedAt));
+    }
+  });
+
+  for (size_t i = 0; i < NUM_COMMANDS; i++) {
+    while (!commands.push(now())) {
+      std::this_thread::yield();
+    }
+    work(otherWorkMicros(i));
+  }
+
+  done = true;
+  radio.join();
+
+  reportLatency("radio in main loop", inline_);
+  reportLatency("radio task", tasked);
+
+  TEST_ASSERT_EQUAL(NUM_COMMANDS, tasked.getCount());
+  TEST_ASSERT_TRUE_MESSAGE(tasked.percentile(99) < inline_.percentile(99), "Radio task should cut tail latency");
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_push_pop_in_order);
+  RUN_TEST(test_wraps_around);
+  RUN_TEST(test_peek);
+  RUN_TEST(test_two_threads);
+  RUN_TEST(test_benchmark_command_to_air);
+
+  return UNITY_END();
+}
@@ -0,0 +1,315 @@
+#include <unity.h>
+#include <StateLog.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+class MemoryStorage : public StateLogStorage {
+public:
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> rewrite;
+  bool failAppends = false;
+  bool failRewrites = false;
+
+  virtual size_t size() override {
+    return data.size();
+  }
+
+  virtual bool read(size_t offset, uint8_t* buffer, size_t length) override {
+    if (offset + length > data.size()) {
+      return false;
+    }
+    memcpy(buffer, data.data() + offset, length);
+    return true;
+  }
+
+  virtual bool append(const uint8_t* buffer, size_t length) override {
+    if (failAppends) {
+      // Half the record makes it out
+      data.insert(data.end(), buffer, buffer + length / 2);
+      return false;
+    }
+    data.insert(data.end(), buffer, buffer + length);
+    return true;
+  }
+
+  virtual bool beginRewrite() override {
+    rewrite.clear();
+    return true;
+  }
+
+  virtual bool appendRewrite(const uint8_t* buffer, size_t length) override {
+    rewrite.insert(rewrite.end(), buffer, buffer + length);
+    return true;
+  }
+
+  virtual bool commitRewrite() override {
+    if (failRewrites) {
+      rewrite.clear();
+      return false;
+    }
+    data.swap(rewrite);
+    rewrite.clear();
+    return true;
+  }
+};
+
+// Same size as GroupState::dump
+static const size_t STATE_LENGTH = 8;
+
+static void makeState(uint32_t seed, uint8_t* state) {
+  for (size_t i = 0; i < STATE_LENGTH; i++) {
+    state[i] = seed * 31 + i;
+  }
+}
+
+static void assertState(StateLog& log, uint32_t id, uint32_t seed) {
+  uint8_t expected[STATE_LENGTH];
+  uint8_t actual[STATE_LENGTH];
+
+  makeState(seed, expected);
+  TEST_ASSERT_EQUAL(STATE_LENGTH, log.get(id, actual, sizeof(actual)));
+  TEST_ASSERT_EQUAL_MEMORY(expected, actual, STATE_LENGTH);
+}
+
+void test_latest_record_wins() {
+  MemoryStorage storage;
+  StateLog log(storage);
+  uint8_t state[STATE_LENGTH];
+
+  log.begin();
+
+  makeState(1, state);
+  TEST_ASSERT_TRUE(log.set(0x100, state, sizeof(state)));
+  makeState(2, state);
+  TEST_ASSERT_TRUE(log.set(0x200, state, sizeof(state)));
+  makeState(3, state);
+  TEST_ASSERT_TRUE(log.set(0x100, state, sizeof(state)));
+
+  assertState(log, 0x100, 3);
+  assertState(log, 0x200, 2);
+  TEST_ASSERT_EQUAL(0, log.get(0x300, state, sizeof(state)));
+
+  TEST_ASSERT_EQUAL(2, log.getStats().records);
+  TEST_ASSERT_EQUAL(3 * (StateLog::HEADER_LENGTH + STATE_LENGTH), log.getStats().logBytes);
+  TEST_ASSERT_EQUAL(2 * (StateLog::HEADER_LENGTH + STATE_LENGTH), log.getStats().liveBytes);
+}
+
+void test_index_rebuilt_on_begin() {
+  MemoryStorage storage;
+  uint8_t state[STATE_LENGTH];
+
+  {
+    StateLog log(storage);
+    log.begin();
+
+    for (uint32_t i = 0; i < 10; i++) {
+      makeState(i, state);
+      log.set(i, state, sizeof(state));
+    }
+    makeState(42, state);
+    log.set(5, state, sizeof(state));
+    log.clear(7);
+  }
+
+  StateLog log(storage);
+  log.begin();
+
+  TEST_ASSERT_EQUAL(9, log.numIds());
+  assertState(log, 5, 42);
+  assertState(log, 9, 9);
+  TEST_ASSERT_FALSE(log.contains(7));
+  TEST_ASSERT_EQUAL(0, log.getStats().discardedBytes);
+}
+
+void test_torn_record_discarded() {
+  MemoryStorage storage;
+  uint8_t state[STATE_LENGTH];
+
+  {
+    StateLog log(storage);
+    log.begin();
+
+    makeState(1, state);
+    log.set(1, state, sizeof(state));
+    makeState(2, state);
+    log.set(2, state, sizeof(state));
+  }
+
+  // Power cut half way through the second record
+  storage.data.resize(storage.data.size() - 5);
+
+  StateLog log(storage);
+  log.begin();
+
+  TEST_ASSERT_TRUE(log.contains(1));
+  TEST_ASSERT_FALSE(log.contains(2));
+  TEST_ASSERT_EQUAL(StateLog::HEADER_LENGTH + STATE_LENGTH - 5, log.getStats().discardedBytes);
+
+  // Records written after loading must survive the next load
+  makeState(3, state);
+  log.set(3, state, sizeof(state));
+
+  StateLog reloaded(storage);
+  reloaded.begin();
+
+  assertState(reloaded, 1, 1);
+  assertState(reloaded, 3, 3);
+}
+
+void test_failed_append_doesnt_lose_later_records() {
+  MemoryStorage storage;
+  StateLog log(storage);
+  uint8_t state[STATE_LENGTH];
+
+  log.begin();
+
+  makeState(1, state);
+  log.set(1, state, sizeof(state));
+
+  storage.failAppends = true;
+  makeState(2, state);
+  TEST_ASSERT_FALSE(log.set(2, state, sizeof(state)));
+  storage.failAppends = false;
+
+  makeState(3, state);
+  TEST_ASSERT_TRUE(log.set(3, state, sizeof(state)));
+
+  StateLog reloaded(storage);
+  reloaded.begin();
+
+  assertState(reloaded, 1, 1);
+  TEST_ASSERT_FALSE(reloaded.contains(2));
+  assertState(reloaded, 3, 3);
+}
+
+// If the log can't be compacted past a torn record, nothing should be written
+// after it, and reads shouldn't return bytes from the wrong place
+void test_writes_refused_until_compacted() {
+  MemoryStorage storage;
+  StateLog log(storage);
+  uint8_t state[STATE_LENGTH];
+
+  log.begin();
+
+  makeState(1, state);
+  log.set(1, state, sizeof(state));
+
+  storage.failAppends = true;
+  storage.failRewrites = true;
+  makeState(2, state);
+  TEST_ASSERT_FALSE(log.set(2, state, sizeof(state)));
+  storage.failAppends = false;
+
+  const size_t tornSize = storage.data.size();
+  makeState(3, state);
+  TEST_ASSERT_FALSE_MESSAGE(log.set(3, state, sizeof(state)), "Should refuse writes while the log is torn");
+  TEST_ASSERT_FALSE(log.clear(1));
+  TEST_ASSERT_EQUAL(tornSize, storage.data.size());
+  assertState(log, 1, 1);
+
+  storage.failRewrites = false;
+  TEST_ASSERT_TRUE(log.set(3, state, sizeof(state)));
+
+  StateLog reloaded(storage);
+  reloaded.begin();
+
+  TEST_ASSERT_EQUAL(0, reloaded.getStats().discardedBytes);
+  assertState(reloaded, 1, 1);
+  TEST_ASSERT_FALSE(reloaded.contains(2));
+  assertState(reloaded, 3, 3);
+}
+
+void test_compaction() {
+  MemoryStorage storage;
+  StateLog log(storage);
+  uint8_t state[STATE_LENGTH];
+
+  log.begin();
+
+  for (uint32_t round = 0; round < 100; round++) {
+    for (uint32_t id = 0; id < 10; id++) {
+      makeState(round + id, state);
+      log.set(id, state, sizeof(state));
+    }
+    log.compactIfNeeded();
+  }
+
+  const StateLog::Stats& stats = log.getStats();
+  TEST_ASSERT_TRUE(stats.compactions > 0);
+  TEST_ASSERT_TRUE(stats.logBytes < STATE_LOG_COMPACT_MIN_BYTES + StateLog::HEADER_LENGTH + STATE_LENGTH);
+  TEST_ASSERT_EQUAL(storage.data.size(), stats.logBytes);
+
+  StateLog reloaded(storage);
+  reloaded.begin();
+
+  for (uint32_t id = 0; id < 10; id++) {
+    assertState(reloaded, id, 99 + id);
+  }
+}
+
+// Index build for a log with 200 bulbs which have each changed 20 times, and
+// what each change costs.  The per-file layout rewrote a whole file (data
+// page plus metadata) for each change.
+void test_benchmark_index_build() {
+  MemoryStorage storage;
+  uint8_t state[STATE_LENGTH];
+
+  {
+    StateLog log(storage);
+    log.begin();
+
+    for (uint32_t round = 0; round < 20; round++) {
+      for (uint32_t id = 0; id < 200; id++) {
+        makeState(round + id, state);
+        log.set(id << 8, state, sizeof(state));
+      }
+    }
+
+    char message[160];
+    snprintf(
+      message,
+      sizeof(message),
+      "%zu bytes appended per state change, %zu byte log for %zu bulbs",
+      log.getStats().bytesWritten / log.getStats().recordsWritten,
+      log.getStats().logBytes,
+      log.getStats().records
+    );
+    TEST_MESSAGE(message);
+  }
+
+  const size_t iterations = 100;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    StateLog log(storage);
+    log.begin();
+    TEST_ASSERT_EQUAL(200, log.numIds());
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  char message[160];
+  snprintf(
+    message,
+    sizeof(message),
+    "Index build for %zu records: %.0f us",
+    storage.data.size() / (StateLog::HEADER_LENGTH + STATE_LENGTH),
+    std::chrono::duration<double, std::micro>(elapsed).count() / iterations
+  );
+  TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_latest_record_wins);
+  RUN_TEST(test_index_rebuilt_on_begin);
+  RUN_TEST(test_torn_record_discarded);
+  RUN_TEST(test_failed_append_doesnt_lose_later_records);
+  RUN_TEST(test_writes_refused_until_compacted);
+  RUN_TEST(test_compaction);
+  RUN_TEST(test_benchmark_index_build);
+
+  return UNITY_END();
+}